@@ -0,0 +1,181 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Measures common::FindFirstDifference ("dispatched") and each kernel this CPU supports on its
+// own against memcmp, over buffers from 64 bytes to 16 MB: identical (the case that matters:
+// verifying a good copy reads every byte), then with the first difference early (1/16 in), in
+// the middle and at the last byte. memcmp only answers equal/not-equal, so it's the speed to beat, not an equivalent.
+// Throughput counts the bytes up to and including the first difference.
+//
+// Build and run (from Projects/):
+//     c++ -O2 -std=c++14 -I. Benchmarks/ContentCompareBenchmark.cpp Common/ContentCompare.cpp Common/IoUring.cpp Common/PhaseTimer.cpp Common/Progress.cpp Common/ReadQueue.cpp Common/Sha256.cpp -lpthread -o comparebench
+//     ./comparebench
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "Common/ContentCompare.h"
+
+namespace ContentCompareBenchmark_Impl {
+	
+	// Enough bytes per measurement to swamp timer overhead without taking forever on big buffers.
+	static const size_t kBytesPerMeasurement = 1024 * 1024 * 1024;
+	
+	//
+	static const int kColumnWidth = 14;
+	
+	// Where the first difference goes, as a function of the buffer size; kNone for identical.
+	enum class DifferencePosition {
+		kNone,
+		kEarly,
+		kMiddle,
+		kLate
+	};
+	
+	// Every result is added in here, so no call can be dropped as unused.
+	volatile size_t gSink = 0;
+	
+	// Hides where p points from the compiler, so a call with the same buffers can't be hoisted out
+	// of the loop or folded into one.
+	template <class T>
+	T* Launder(T* p) {
+#if defined(__GNUC__)
+		__asm__ volatile("" : "+r"(p) : : "memory");
+#endif
+		return p;
+	}
+	
+	//
+	size_t MemcmpAdapter(const void* data1, const void* data2, size_t size) {
+		return (memcmp(data1, data2, size) == 0) ? size : 0;
+	}
+	
+	//
+	const char* GetPositionName(DifferencePosition position) {
+		switch (position) {
+			case DifferencePosition::kNone: return "identical";
+			case DifferencePosition::kEarly: return "difference early";
+			case DifferencePosition::kMiddle: return "difference in the middle";
+			case DifferencePosition::kLate: return "difference at the end";
+		}
+		return "";
+	}
+	
+	// Offset of the first difference in a buffer of the given size, or size for none.
+	size_t GetDifferenceOffset(DifferencePosition position, size_t size) {
+		switch (position) {
+			case DifferencePosition::kNone: return size;
+			case DifferencePosition::kEarly: return size / 16;
+			case DifferencePosition::kMiddle: return size / 2;
+			case DifferencePosition::kLate: return size - 1;
+		}
+		return size;
+	}
+	
+	// GB/s for function over buffers of the given size whose first difference is at offset
+	// (size if none). expected is what each call has to return.
+	double Measure(common::FindFirstDifferenceFunction function,
+				   const uint8_t* data1,
+				   const uint8_t* data2,
+				   size_t size,
+				   size_t offset,
+				   size_t expected) {
+		size_t bytes = (offset < size) ? (offset + 1) : size;
+		size_t iterations = (kBytesPerMeasurement / bytes) + 1;
+		bool failed = false;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t n = 0; n < iterations; ++n) {
+			size_t result = function(Launder(data1), Launder(data2), size);
+			failed |= (result != expected);
+			gSink = gSink + result;
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (failed) {
+			std::cerr << "ContentCompareBenchmark: unexpected result" << "\n";
+			exit(EXIT_FAILURE);
+		}
+		return ((double)iterations * (double)bytes) / seconds / 1e9;
+	}
+	
+} // namespace ContentCompareBenchmark_Impl
+using namespace ContentCompareBenchmark_Impl;
+
+//
+int main() {
+	static const size_t kMaxSize = 16 * 1024 * 1024;
+	std::vector<uint8_t> buffer1(kMaxSize);
+	for (size_t n = 0; n < kMaxSize; ++n) {
+		buffer1[n] = (uint8_t)(rand() & 0xff);
+	}
+	std::vector<uint8_t> buffer2(buffer1);
+	
+	std::cout << "selected kernel: "
+			  << common::GetContentCompareKernelName(common::GetContentCompareKernel()) << "\n";
+	const common::ContentCompareKernel kernels[] = {
+		common::ContentCompareKernel::kScalar,
+		common::ContentCompareKernel::kSSE42,
+		common::ContentCompareKernel::kAVX2
+	};
+	const DifferencePosition positions[] = {
+		DifferencePosition::kNone,
+		DifferencePosition::kEarly,
+		DifferencePosition::kMiddle,
+		DifferencePosition::kLate
+	};
+	std::cout << std::fixed << std::setprecision(2);
+	for (auto position : positions) {
+		std::cout << "\n" << GetPositionName(position) << " (GB/s)" << "\n";
+		std::cout << std::setw(kColumnWidth) << "size" << std::setw(kColumnWidth) << "memcmp"
+				  << std::setw(kColumnWidth) << "dispatched";
+		for (auto kernel : kernels) {
+			std::cout << std::setw(kColumnWidth) << common::GetContentCompareKernelName(kernel);
+		}
+		std::cout << "\n";
+		
+		for (size_t size = 64; size <= kMaxSize; size *= 4) {
+			size_t offset = GetDifferenceOffset(position, size);
+			if (offset < size) {
+				buffer2[offset] ^= 0xff;
+			}
+			std::cout << std::setw(kColumnWidth) << size;
+			std::cout << std::setw(kColumnWidth)
+					  << Measure(MemcmpAdapter, buffer1.data(), buffer2.data(), size, offset, (offset < size) ? 0 : size);
+			std::cout << std::setw(kColumnWidth)
+					  << Measure(common::FindFirstDifference, buffer1.data(), buffer2.data(), size, offset, offset);
+			for (auto kernel : kernels) {
+				auto function = common::GetFindFirstDifferenceFunction(kernel);
+				if (function == nullptr) {
+					std::cout << std::setw(kColumnWidth) << "-";
+				}
+				else {
+					std::cout << std::setw(kColumnWidth)
+							  << Measure(function, buffer1.data(), buffer2.data(), size, offset, offset);
+				}
+			}
+			std::cout << "\n";
+			if (offset < size) {
+				buffer2[offset] ^= 0xff;
+			}
+		}
+	}
+	return 0;
+}
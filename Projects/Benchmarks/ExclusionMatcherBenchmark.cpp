@@ -0,0 +1,180 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Times exclusion lookups over synthetic relative paths: the std::set of names compare and copy
+// used to check, fnmatch against each rule in turn, and common::ExclusionMatcher, with the
+// default names alone and with a few hundred mixed rules (names, *.ext, prefix*, anchored
+// paths, **/dir/). Nothing touches the disk.
+//
+// Build and run (from Projects/):
+//     c++ -O2 -std=c++14 -I. Benchmarks/ExclusionMatcherBenchmark.cpp Common/ExclusionMatcher.cpp -o exclbench
+//     ./exclbench [paths, default 1000000]
+
+#include <chrono>
+#include <cstdlib>
+#include <fnmatch.h>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include "Common/ExclusionMatcher.h"
+
+namespace ExclusionMatcherBenchmark_Impl {
+	
+	//
+	static const char* kExtensions[] = { "c", "h", "cpp", "o", "txt", "jpg", "log", "tmp", "md", "json" };
+	static const size_t kExtensionCount = sizeof(kExtensions) / sizeof(kExtensions[0]);
+	
+	//
+	struct Rule {
+		std::string mPattern;
+		bool mInclude;
+	};
+	
+	//
+	std::vector<std::string> MakePaths(size_t count) {
+		std::mt19937_64 generator(1);
+		std::vector<std::string> paths;
+		paths.reserve(count);
+		for (size_t n = 0; n < count; ++n) {
+			std::string path("dir" + std::to_string(generator() % 50));
+			size_t depth = generator() % 4;
+			for (size_t level = 0; level < depth; ++level) {
+				static const char* kNames[] = { "src", "build", "gen", "lib", "docs", "cache" };
+				path += "/" + std::string(kNames[generator() % 6]) + std::to_string(generator() % 20);
+			}
+			path += "/file" + std::to_string(generator() % 1000) + "." + kExtensions[generator() % kExtensionCount];
+			paths.push_back(path);
+		}
+		return paths;
+	}
+	
+	//
+	std::vector<Rule> MakeMixedRules() {
+		std::vector<Rule> rules;
+		for (size_t n = 0; n < 200; ++n) {
+			rules.push_back(Rule { "file" + std::to_string(n * 5) + ".txt", false });
+		}
+		for (size_t n = 0; n < 40; ++n) {
+			rules.push_back(Rule { "*." + std::string(kExtensions[n % kExtensionCount]) + std::to_string(n), false });
+		}
+		rules.push_back(Rule { "*.o", false });
+		rules.push_back(Rule { "*.tmp", false });
+		for (size_t n = 0; n < 30; ++n) {
+			rules.push_back(Rule { "cache" + std::to_string(n) + "*", false });
+		}
+		for (size_t n = 0; n < 20; ++n) {
+			rules.push_back(Rule { "/dir" + std::to_string(n) + "/build" + std::to_string(n), false });
+		}
+		for (size_t n = 0; n < 10; ++n) {
+			rules.push_back(Rule { "**/gen" + std::to_string(n) + "/", false });
+		}
+		rules.push_back(Rule { "file1.o", true });
+		return rules;
+	}
+	
+	// Last matching rule wins, as in the matcher. fnmatch has no "**" or directory-only rules,
+	// so this is only a timing baseline.
+	size_t CountNaive(const std::vector<Rule>& rules, const std::vector<std::string>& paths) {
+		size_t count = 0;
+		for (const auto& path : paths) {
+			const char* name = path.c_str() + path.rfind('/') + 1;
+			bool excluded = false;
+			for (const auto& rule : rules) {
+				const char* pattern = rule.mPattern.c_str();
+				bool anchored = (rule.mPattern.find('/') != std::string::npos);
+				if (anchored) {
+					pattern += (*pattern == '/') ? 1 : 0;
+				}
+				if (fnmatch(pattern, anchored ? path.c_str() : name, anchored ? FNM_PATHNAME : 0) == 0) {
+					excluded = !rule.mInclude;
+				}
+			}
+			count += excluded ? 1 : 0;
+		}
+		return count;
+	}
+	
+	//
+	size_t CountSet(const std::set<std::string>& names, const std::vector<std::string>& paths) {
+		size_t count = 0;
+		for (const auto& path : paths) {
+			count += (names.find(path.substr(path.rfind('/') + 1)) != names.end()) ? 1 : 0;
+		}
+		return count;
+	}
+	
+	//
+	size_t CountMatcher(const common::ExclusionMatcher& matcher, const std::vector<std::string>& paths) {
+		size_t count = 0;
+		for (const auto& path : paths) {
+			size_t start = matcher.NeedsPath() ? 0 : (path.rfind('/') + 1);
+			count += matcher.Match(path.data() + start, path.size() - start).IsExcluded(false) ? 1 : 0;
+		}
+		return count;
+	}
+	
+	//
+	template <class Function>
+	void Time(const char* label, size_t pathCount, Function function) {
+		auto start = std::chrono::steady_clock::now();
+		size_t count = function();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << label << (pathCount / seconds / 1e6) << " M lookups/s (" << count << " excluded)" << "\n";
+	}
+	
+} // namespace ExclusionMatcherBenchmark_Impl
+using namespace ExclusionMatcherBenchmark_Impl;
+
+//
+int main(int argc, const char* argv[]) {
+	size_t pathCount = (argc > 1) ? (size_t)atoll(argv[1]) : 1000000;
+	if (pathCount == 0) {
+		std::cout << "usage: exclbench [paths]" << "\n";
+		return EXIT_FAILURE;
+	}
+	std::vector<std::string> paths(MakePaths(pathCount));
+	std::string error;
+	
+	std::set<std::string> names { ".DS_Store", ".ipspot_update", "ehthumbs.db", "ehthumbs_vista.db", "Thumbs.db" };
+	common::ExclusionRules defaults;
+	defaults.AddDefaults();
+	common::ExclusionMatcher defaultMatcher(defaults);
+	std::cout << "default names:" << "\n";
+	Time("  std::set:         ", pathCount, [&]() { return CountSet(names, paths); });
+	Time("  ExclusionMatcher: ", pathCount, [&]() { return CountMatcher(defaultMatcher, paths); });
+	
+	std::vector<Rule> mixed(MakeMixedRules());
+	common::ExclusionRules mixedRules;
+	for (const auto& rule : mixed) {
+		if (!mixedRules.Add(rule.mPattern, rule.mInclude, error)) {
+			std::cout << "exclbench: " << rule.mPattern << ": " << error << "\n";
+			return EXIT_FAILURE;
+		}
+	}
+	auto buildStart = std::chrono::steady_clock::now();
+	common::ExclusionMatcher mixedMatcher(mixedRules);
+	double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+	std::cout << mixed.size() << " mixed rules (" << mixedMatcher.GetStateCount() << " DFA states, built in "
+			  << (buildSeconds * 1000) << " ms):" << "\n";
+	Time("  fnmatch per rule: ", pathCount, [&]() { return CountNaive(mixed, paths); });
+	Time("  ExclusionMatcher: ", pathCount, [&]() { return CountMatcher(mixedMatcher, paths); });
+	return 0;
+}
@@ -0,0 +1,147 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Times reading the metadata compare needs (lstat plus every xattr of each regular file) for a
+// synthetic tree, an item at a time through common::MetadataSnapshotter::ReadItem (the default)
+// versus TakeSnapshot a directory at a time (--snapshots). The tree is <files> 4 KB files, 1000 to a directory, and is left in
+// place so later runs can reuse it. For cold-cache numbers, drop the page cache and run each
+// method on its own, since whichever runs first warms the cache for the other.
+//
+// Build and run (from Projects/):
+//     c++ -O2 -std=c++14 -I. Benchmarks/MetadataSnapshotBenchmark.cpp Common/MetadataSnapshot.cpp Common/IoUring.cpp Common/PhaseTimer.cpp Common/WorkStealingPool.cpp -lpthread -o metabench
+//     ./metabench <scratch directory> [files, default 1000000] [syscalls|snapshots]
+
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "Common/MetadataSnapshot.h"
+
+namespace MetadataSnapshotBenchmark_Impl {
+	
+	//
+	static const size_t kFilesPerDirectory = 1000;
+	static const size_t kFileSize = 4096;
+	
+	//
+	std::string DirectoryPath(const std::string& root, size_t n) {
+		return root + "/dir" + std::to_string(n);
+	}
+	
+	// Creates whatever part of the tree doesn't exist yet.
+	bool MakeTree(const std::string& root, size_t fileCount) {
+		std::vector<char> contents(kFileSize, 'x');
+		mkdir(root.c_str(), 0755);
+		for (size_t n = 0; n < fileCount; ++n) {
+			std::string directory(DirectoryPath(root, n / kFilesPerDirectory));
+			if ((n % kFilesPerDirectory) == 0) {
+				mkdir(directory.c_str(), 0755);
+			}
+			std::string path(directory + "/file" + std::to_string(n % kFilesPerDirectory));
+			struct stat s;
+			if (lstat(path.c_str(), &s) == 0) {
+				continue;
+			}
+			int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (fd < 0) {
+				return false;
+			}
+			bool written = (write(fd, contents.data(), contents.size()) == (ssize_t)contents.size());
+			close(fd);
+			if (!written) {
+				return false;
+			}
+		}
+		return true;
+	}
+	
+	// A separate lstat, listxattr and getxattr per item.
+	size_t ReadOneAtATime(const std::string& root, size_t directoryCount) {
+		size_t count = 0;
+		for (size_t d = 0; d < directoryCount; ++d) {
+			std::string directory(DirectoryPath(root, d));
+			for (size_t n = 0; n < kFilesPerDirectory; ++n) {
+				common::SnapshotEntry entry;
+				if (common::MetadataSnapshotter::ReadItem(directory, "file" + std::to_string(n), entry)) {
+					++count;
+				}
+			}
+		}
+		return count;
+	}
+	
+	//
+	size_t ReadBySnapshot(const std::string& root, size_t directoryCount) {
+		size_t count = 0;
+		for (size_t d = 0; d < directoryCount; ++d) {
+			auto snapshot = common::MetadataSnapshotter::TakeSnapshot(DirectoryPath(root, d));
+			if (snapshot != nullptr) {
+				count += snapshot->GetCount();
+			}
+		}
+		return count;
+	}
+	
+	//
+	template <class Function>
+	double Time(Function function, size_t& outCount) {
+		auto start = std::chrono::steady_clock::now();
+		outCount = function();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	
+} // namespace MetadataSnapshotBenchmark_Impl
+using namespace MetadataSnapshotBenchmark_Impl;
+
+//
+int main(int argc, const char* argv[]) {
+	if (argc < 2) {
+		std::cout << "usage: metabench <scratch directory> [files] [syscalls|snapshots]" << "\n";
+		return EXIT_FAILURE;
+	}
+	std::string root(argv[1]);
+	size_t fileCount = (argc > 2) ? (size_t)atoll(argv[2]) : 1000000;
+	std::string method((argc > 3) ? argv[3] : "");
+	size_t directoryCount = (fileCount + kFilesPerDirectory - 1) / kFilesPerDirectory;
+	if (!MakeTree(root, fileCount)) {
+		std::cout << "metabench: couldn't create the tree under " << root << "\n";
+		return EXIT_FAILURE;
+	}
+	
+	double oneAtATime = 0;
+	if (method != "snapshots") {
+		size_t count = 0;
+		oneAtATime = Time([&]() { return ReadOneAtATime(root, directoryCount); }, count);
+		std::cout << "one at a time: " << count << " items in " << oneAtATime << " s" << "\n";
+	}
+	double snapshot = 0;
+	if (method != "syscalls") {
+		size_t count = 0;
+		snapshot = Time([&]() { return ReadBySnapshot(root, directoryCount); }, count);
+		std::cout << "snapshots:     " << count << " items in " << snapshot << " s" << "\n";
+	}
+	if ((oneAtATime > 0) && (snapshot > 0)) {
+		std::cout << "speedup:       " << (oneAtATime / snapshot) << "x" << "\n";
+	}
+	return 0;
+}
@@ -0,0 +1,108 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Measures notifications per second through common::OutputSink against the old pattern of a
+// mutex around std::cout with std::endl, using the "Match:" lines a 1M-file tree produces.
+//
+// Build and run (from Projects/):
+//     c++ -O2 -std=c++14 -I. Benchmarks/NotificationSinkBenchmark.cpp Common/OutputSink.cpp -lpthread -o sinkbench
+//     ./sinkbench [threads] > /dev/null
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Common/OutputSink.h"
+
+namespace NotificationSinkBenchmark_Impl {
+	
+	//
+	static const size_t kFileCount = 1000 * 1000;
+	static const size_t kFilesPerDirectory = 1000;
+	
+	// Path of file n in a tree of kFileCount files, kFilesPerDirectory to a directory.
+	std::string MakePath(size_t n) {
+		std::ostringstream strm;
+		strm << "/Volumes/Backup/Projects/tree/dir" << (n / kFilesPerDirectory) << "/file" << (n % kFilesPerDirectory) << ".dat";
+		return strm.str();
+	}
+	
+	//
+	template <class Function>
+	double Run(size_t threadCount, Function function) {
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < threadCount; ++t) {
+			threads.push_back(std::thread([t, threadCount, &function]() {
+				for (size_t n = t; n < kFileCount; n += threadCount) {
+					function(MakePath(n));
+				}
+			}));
+		}
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count();
+	}
+	
+	//
+	void Report(const std::string& name, double seconds) {
+		std::cerr << name << ": " << (size_t)(kFileCount / seconds) << " notifications/s ("
+				  << seconds << " s)" << "\n";
+	}
+	
+} // namespace NotificationSinkBenchmark_Impl
+using namespace NotificationSinkBenchmark_Impl;
+
+//
+int main(int argc, const char* argv[]) {
+	size_t threadCount = std::thread::hardware_concurrency();
+	if (argc > 1) {
+		threadCount = (size_t)atoi(argv[1]);
+	}
+	if (threadCount == 0) {
+		threadCount = 1;
+	}
+	std::ios::sync_with_stdio(false);
+	std::cerr << "threads: " << threadCount << ", files: " << kFileCount << "\n";
+	
+	std::mutex mutex;
+	double seconds = Run(threadCount, [&mutex](const std::string& path) {
+		std::lock_guard<std::mutex> guard(mutex);
+		std::cout << "Match: " << path << std::endl;
+	});
+	Report("mutex + std::endl", seconds);
+	
+	{
+		common::OutputSink sink(std::cout);
+		seconds = Run(threadCount, [&sink](const std::string& path) {
+			sink.Write("Match: " + path + "\n");
+		});
+		auto start = std::chrono::steady_clock::now();
+		sink.Flush();
+		std::chrono::duration<double> drain = std::chrono::steady_clock::now() - start;
+		Report("OutputSink", seconds + drain.count());
+	}
+	return 0;
+}
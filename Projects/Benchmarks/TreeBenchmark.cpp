@@ -0,0 +1,842 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Times the compare and copy binaries end to end on a synthetic tree, so a change to either (or
+// to Hermit underneath them) shows up as a number that can be tracked from build to build.
+//
+// The tree under <scratch>/a is generated from the seed alone: file sizes, contents, names,
+// permissions, dates, hard links, symlinks and xattrs all come out the same every time. The
+// profiles are
+//     tiny   many small files, a couple of hundred to a directory, some with xattrs
+//     huge   a few big files
+//     deep   chains of nested directories with a few files at every level
+//     links  files with extra hard links elsewhere in the tree, and symlinks (some dangling)
+//     mixed  all of the above, side by side (the default)
+// <scratch>/b is the same tree with --modify percent of its files changed by the seed: a byte
+// flipped with the date left alone, data appended, a new date, new permissions, a new xattr, or
+// the file deleted, plus some new files.
+//
+// Each run times, as separate processes:
+//     copy      copy a to a fresh <scratch>/c
+//     copy -y   the same with verification
+//     compare   a against c, which match
+//     compare   a against b, which don't
+// The results are written to stdout as JSON: seconds, files/s and MB/s (of the source tree),
+// peak RSS and, where perf can count the raw_syscalls tracepoint, the number of system calls
+// the tool and its threads made. Point <scratch> at tmpfs for numbers that are mostly CPU and at
+// a local disk with --drop-caches (as root) for cold-cache numbers. Linux only.
+//
+// Build and run (from Projects/):
+//     c++ -O2 -std=c++14 -I. Benchmarks/TreeBenchmark.cpp -o treebench
+//     ./treebench <compare binary> <copy binary> <scratch directory> [--profile <name>]
+//         [--seed <n>] [--scale <n>] [--modify <percent>] [--jobs <n>] [--runs <n>] [--drop-caches]
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <ftw.h>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <vector>
+
+namespace TreeBenchmark_Impl {
+
+	//
+	static const size_t kTinyFilesPerDirectory = 200;
+	static const size_t kTinyMaxSize = 4096;
+	static const uint64_t kHugeFileSize = 64 * 1024 * 1024;
+	static const size_t kDeepLevels = 64;
+	static const size_t kDeepFilesPerLevel = 3;
+	static const size_t kBufferSize = 1024 * 1024;
+
+	// Every date in the tree is this plus a small offset, so regenerating it gives the same dates.
+	static const time_t kBaseTime = 1500000000;
+
+	// Fully specified, unlike the std:: distributions, so the same seed gives the same tree with
+	// any standard library.
+	class Random {
+	public:
+		//
+		explicit Random(uint64_t seed) : mState(seed) {
+		}
+
+		// splitmix64
+		uint64_t Next() {
+			uint64_t z = (mState += 0x9E3779B97F4A7C15ull);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			return z ^ (z >> 31);
+		}
+
+		// In [0, bound).
+		uint64_t Below(uint64_t bound) {
+			return (bound == 0) ? 0 : (Next() % bound);
+		}
+
+		//
+		void Fill(char* p, size_t size) {
+			while (size >= 8) {
+				uint64_t value = Next();
+				memcpy(p, &value, 8);
+				p += 8;
+				size -= 8;
+			}
+			if (size > 0) {
+				uint64_t value = Next();
+				memcpy(p, &value, size);
+			}
+		}
+
+	private:
+		//
+		uint64_t mState;
+	};
+
+	//
+	struct TreeCounts {
+		//
+		TreeCounts() :
+		mFiles(0),
+		mDirectories(0),
+		mSymlinks(0),
+		mHardLinks(0),
+		mXAttrs(0),
+		mBytes(0),
+		mModifications(0) {
+		}
+
+		//
+		uint64_t mFiles;
+		uint64_t mDirectories;
+		uint64_t mSymlinks;
+		uint64_t mHardLinks;
+		uint64_t mXAttrs;
+		// Data bytes, counting each hard-linked file once.
+		uint64_t mBytes;
+		uint64_t mModifications;
+	};
+
+	//
+	class TreeGenerator {
+	public:
+		//
+		TreeGenerator(const std::string& rootPath, uint64_t seed, uint64_t scale) :
+		mRootPath(rootPath),
+		mRandom(seed),
+		mScale(scale),
+		mNextTime(0),
+		mBuffer(kBufferSize) {
+		}
+
+		//
+		bool Generate(const std::string& profile) {
+			if (!MakeDirectory(mRootPath)) {
+				return false;
+			}
+			bool all = (profile == "mixed");
+			bool known = all;
+			if (all || (profile == "tiny")) {
+				known = true;
+				if (!MakeTiny(Child(mRootPath, all ? "tiny" : ""))) {
+					return false;
+				}
+			}
+			if (all || (profile == "huge")) {
+				known = true;
+				if (!MakeHuge(Child(mRootPath, all ? "huge" : ""))) {
+					return false;
+				}
+			}
+			if (all || (profile == "deep")) {
+				known = true;
+				if (!MakeDeep(Child(mRootPath, all ? "deep" : ""))) {
+					return false;
+				}
+			}
+			if (all || (profile == "links")) {
+				known = true;
+				if (!MakeLinks(Child(mRootPath, all ? "links" : ""))) {
+					return false;
+				}
+			}
+			if (!known) {
+				errno = EINVAL;
+				return false;
+			}
+			return true;
+		}
+
+		// Changes percent of the files. The choices carry on from where Generate left the random
+		// sequence, so the same seed always makes the same changes.
+		bool Modify(double percent) {
+			uint64_t count = std::max<uint64_t>(1, (uint64_t)(mFilePaths.size() * percent / 100));
+			for (uint64_t n = 0; (n < count) && !mFilePaths.empty(); ++n) {
+				size_t index = (size_t)mRandom.Below(mFilePaths.size());
+				std::string path(mFilePaths[index]);
+				struct stat s;
+				if (lstat(path.c_str(), &s) != 0) {
+					// Already deleted.
+					continue;
+				}
+				bool ok = true;
+				switch (mRandom.Below(6)) {
+					case 0:
+						ok = FlipByte(path, s);
+						break;
+					case 1:
+						ok = Append(path) && SetTime(path, false);
+						break;
+					case 2:
+						ok = SetTime(path, false);
+						break;
+					case 3:
+						ok = (chmod(path.c_str(), ((s.st_mode & 0777) == 0600) ? 0644 : 0600) == 0);
+						break;
+					case 4:
+						ok = SetXAttr(path, "user.bench.modified");
+						break;
+					default:
+						ok = (unlink(path.c_str()) == 0);
+						break;
+				}
+				if (!ok) {
+					return false;
+				}
+				++mCounts.mModifications;
+			}
+			for (uint64_t n = 0; n < (count / 10) + 1; ++n) {
+				std::string directory(mDirectoryPaths[(size_t)mRandom.Below(mDirectoryPaths.size())]);
+				if (!MakeFile(directory + "/added" + std::to_string(n), mRandom.Below(kTinyMaxSize), false)) {
+					return false;
+				}
+				++mCounts.mModifications;
+			}
+			return true;
+		}
+
+		// Last, since creating or deleting anything in a directory changes its date.
+		bool SetDirectoryTimes() {
+			for (auto it = mDirectoryPaths.rbegin(); it != mDirectoryPaths.rend(); ++it) {
+				if (!SetTime(*it, false)) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		//
+		const TreeCounts& GetCounts() const {
+			return mCounts;
+		}
+
+	private:
+		//
+		static std::string Child(const std::string& parentPath, const std::string& name) {
+			return name.empty() ? parentPath : (parentPath + "/" + name);
+		}
+
+		//
+		bool MakeDirectory(const std::string& path) {
+			if ((mkdir(path.c_str(), 0755) != 0) && (errno != EEXIST)) {
+				return false;
+			}
+			mDirectoryPaths.push_back(path);
+			++mCounts.mDirectories;
+			return true;
+		}
+
+		//
+		bool SetTime(const std::string& path, bool symlink) {
+			struct timespec times[2];
+			times[0].tv_sec = kBaseTime + (time_t)mNextTime;
+			times[0].tv_nsec = 0;
+			times[1] = times[0];
+			++mNextTime;
+			return (utimensat(AT_FDCWD, path.c_str(), times, symlink ? AT_SYMLINK_NOFOLLOW : 0) == 0);
+		}
+
+		// tmpfs only takes user xattrs from Linux 6.6 on; elsewhere the tree just goes without.
+		bool SetXAttr(const std::string& path, const std::string& name) {
+			char value[32];
+			mRandom.Fill(value, sizeof(value));
+			if (lsetxattr(path.c_str(), name.c_str(), value, 1 + (size_t)mRandom.Below(sizeof(value)), 0) != 0) {
+				return (errno == ENOTSUP);
+			}
+			++mCounts.mXAttrs;
+			return true;
+		}
+
+		//
+		bool WriteData(int fd, uint64_t size) {
+			uint64_t written = 0;
+			while (written < size) {
+				size_t chunk = (size_t)std::min<uint64_t>(size - written, mBuffer.size());
+				mRandom.Fill(mBuffer.data(), chunk);
+				ssize_t result = write(fd, mBuffer.data(), chunk);
+				if (result < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+				written += (uint64_t)result;
+			}
+			return true;
+		}
+
+		//
+		bool MakeFile(const std::string& path, uint64_t size, bool withXAttrs) {
+			int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, (mRandom.Below(8) == 0) ? 0600 : 0644);
+			if (fd < 0) {
+				return false;
+			}
+			bool written = WriteData(fd, size);
+			if (close(fd) != 0) {
+				written = false;
+			}
+			if (!written) {
+				return false;
+			}
+			if (withXAttrs) {
+				uint64_t count = 1 + mRandom.Below(3);
+				for (uint64_t n = 0; n < count; ++n) {
+					if (!SetXAttr(path, "user.bench." + std::to_string(n))) {
+						return false;
+					}
+				}
+			}
+			if (!SetTime(path, false)) {
+				return false;
+			}
+			mFilePaths.push_back(path);
+			++mCounts.mFiles;
+			mCounts.mBytes += size;
+			return true;
+		}
+
+		//
+		bool MakeTiny(const std::string& path) {
+			if (!MakeDirectory(path)) {
+				return false;
+			}
+			uint64_t fileCount = 20000 * mScale;
+			std::string directory;
+			for (uint64_t n = 0; n < fileCount; ++n) {
+				if ((n % kTinyFilesPerDirectory) == 0) {
+					directory = path + "/d" + std::to_string(n / kTinyFilesPerDirectory);
+					if (!MakeDirectory(directory)) {
+						return false;
+					}
+				}
+				std::string filePath(directory + "/f" + std::to_string(n % kTinyFilesPerDirectory));
+				if (!MakeFile(filePath, mRandom.Below(kTinyMaxSize + 1), (mRandom.Below(4) == 0))) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		//
+		bool MakeHuge(const std::string& path) {
+			if (!MakeDirectory(path)) {
+				return false;
+			}
+			for (uint64_t n = 0; n < 4; ++n) {
+				// Not a whole number of blocks, so the tail gets exercised too.
+				uint64_t size = (kHugeFileSize * mScale) - mRandom.Below(4096);
+				if (!MakeFile(path + "/huge" + std::to_string(n), size, false)) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		//
+		bool MakeDeep(const std::string& path) {
+			if (!MakeDirectory(path)) {
+				return false;
+			}
+			for (uint64_t chain = 0; chain < 8 * mScale; ++chain) {
+				std::string level(path + "/chain" + std::to_string(chain));
+				for (size_t depth = 0; depth < kDeepLevels; ++depth) {
+					if (!MakeDirectory(level)) {
+						return false;
+					}
+					for (size_t n = 0; n < kDeepFilesPerLevel; ++n) {
+						if (!MakeFile(level + "/f" + std::to_string(n), mRandom.Below(kTinyMaxSize + 1), false)) {
+							return false;
+						}
+					}
+					level += "/level" + std::to_string(depth + 1);
+				}
+			}
+			return true;
+		}
+
+		//
+		bool MakeLinks(const std::string& path) {
+			std::string filesPath(path + "/files");
+			std::string linksPath(path + "/hardlinks");
+			std::string symlinksPath(path + "/symlinks");
+			if (!MakeDirectory(path) || !MakeDirectory(filesPath) || !MakeDirectory(linksPath) ||
+				!MakeDirectory(symlinksPath)) {
+				return false;
+			}
+			uint64_t fileCount = 1000 * mScale;
+			for (uint64_t n = 0; n < fileCount; ++n) {
+				std::string name("f" + std::to_string(n));
+				std::string filePath(filesPath + "/" + name);
+				if (!MakeFile(filePath, mRandom.Below(64 * 1024), false)) {
+					return false;
+				}
+				uint64_t linkCount = mRandom.Below(3);
+				for (uint64_t l = 0; l < linkCount; ++l) {
+					std::string linkPath(linksPath + "/" + name + "." + std::to_string(l));
+					if (link(filePath.c_str(), linkPath.c_str()) != 0) {
+						return false;
+					}
+					++mCounts.mHardLinks;
+				}
+				// One in ten points at nothing.
+				std::string target((mRandom.Below(10) == 0) ? ("../files/missing" + std::to_string(n)) : ("../files/" + name));
+				std::string symlinkPath(symlinksPath + "/" + name);
+				if ((symlink(target.c_str(), symlinkPath.c_str()) != 0) || !SetTime(symlinkPath, true)) {
+					return false;
+				}
+				++mCounts.mSymlinks;
+			}
+			return true;
+		}
+
+		// Same size, same date, different data: only reading the file can tell.
+		bool FlipByte(const std::string& path, const struct stat& s) {
+			if (s.st_size == 0) {
+				return Append(path) && SetTime(path, false);
+			}
+			int fd = open(path.c_str(), O_RDWR);
+			if (fd < 0) {
+				return false;
+			}
+			off_t offset = (off_t)mRandom.Below((uint64_t)s.st_size);
+			char byte = 0;
+			bool ok = (pread(fd, &byte, 1, offset) == 1);
+			byte = (char)~byte;
+			ok = ok && (pwrite(fd, &byte, 1, offset) == 1);
+			close(fd);
+			struct timespec times[2] = { s.st_atim, s.st_mtim };
+			return ok && (utimensat(AT_FDCWD, path.c_str(), times, 0) == 0);
+		}
+
+		//
+		bool Append(const std::string& path) {
+			int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+			if (fd < 0) {
+				return false;
+			}
+			bool ok = WriteData(fd, 1 + mRandom.Below(4096));
+			close(fd);
+			return ok;
+		}
+
+		//
+		std::string mRootPath;
+		Random mRandom;
+		uint64_t mScale;
+		uint64_t mNextTime;
+		std::vector<char> mBuffer;
+		std::vector<std::string> mDirectoryPaths;
+		std::vector<std::string> mFilePaths;
+		TreeCounts mCounts;
+	};
+
+	//
+	int RemoveItem(const char* path, const struct stat*, int typeFlag, struct FTW*) {
+		return (typeFlag == FTW_DP) ? rmdir(path) : unlink(path);
+	}
+
+	//
+	bool RemoveTree(const std::string& path) {
+		struct stat s;
+		if (lstat(path.c_str(), &s) != 0) {
+			return (errno == ENOENT);
+		}
+		return (nftw(path.c_str(), RemoveItem, 64, FTW_DEPTH | FTW_PHYS) == 0);
+	}
+
+	//
+	std::string GetFileSystemName(const std::string& path) {
+		struct statfs s;
+		if (statfs(path.c_str(), &s) != 0) {
+			return "unknown";
+		}
+		switch ((unsigned long)s.f_type) {
+			case 0x01021994: return "tmpfs";
+			case 0xEF53: return "ext4";
+			case 0x58465342: return "xfs";
+			case 0x9123683E: return "btrfs";
+			case 0x2FC12FC1: return "zfs";
+			case 0x794C7630: return "overlayfs";
+			case 0x65735546: return "fuse";
+			case 0x6969: return "nfs";
+			default: return "unknown";
+		}
+	}
+
+	// Best effort; needs root.
+	void DropCaches() {
+		sync();
+		std::ofstream dropCaches("/proc/sys/vm/drop_caches");
+		dropCaches << "3" << std::flush;
+	}
+
+	// -1 if tracepoints aren't visible here.
+	long long GetSyscallTracepointId() {
+		const char* paths[] = {
+			"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+			"/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"
+		};
+		for (const char* path : paths) {
+			std::ifstream file(path);
+			long long id = -1;
+			if (file >> id) {
+				return id;
+			}
+		}
+		return -1;
+	}
+
+	// Counts every system call the process and the threads and children it starts make, from
+	// exec on. -1 if perf isn't available (or perf_event_paranoid doesn't allow it).
+	int OpenSyscallCounter(pid_t pid) {
+		long long id = GetSyscallTracepointId();
+		if (id < 0) {
+			return -1;
+		}
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_TRACEPOINT;
+		attr.config = (uint64_t)id;
+		attr.disabled = 1;
+		attr.enable_on_exec = 1;
+		attr.inherit = 1;
+		attr.exclude_hv = 1;
+		return (int)syscall(__NR_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+	}
+
+	//
+	struct RunResult {
+		//
+		RunResult() : mSeconds(0), mPeakRSSKB(0), mSyscalls(-1), mExitStatus(-1) {
+		}
+
+		//
+		double mSeconds;
+		long mPeakRSSKB;
+		long long mSyscalls;
+		int mExitStatus;
+	};
+
+	// Output goes to /dev/null; the point is the time it takes, not what it says.
+	bool Run(const std::vector<std::string>& args, RunResult& outResult) {
+		int gate[2];
+		if (pipe(gate) != 0) {
+			return false;
+		}
+		auto start = std::chrono::steady_clock::now();
+		pid_t pid = fork();
+		if (pid < 0) {
+			close(gate[0]);
+			close(gate[1]);
+			return false;
+		}
+		if (pid == 0) {
+			// Hold off exec until the parent has the counter attached.
+			close(gate[1]);
+			char go = 0;
+			while ((read(gate[0], &go, 1) < 0) && (errno == EINTR)) {
+			}
+			close(gate[0]);
+			int devNull = open("/dev/null", O_WRONLY);
+			if (devNull >= 0) {
+				dup2(devNull, STDOUT_FILENO);
+				dup2(devNull, STDERR_FILENO);
+				close(devNull);
+			}
+			std::vector<char*> argv;
+			for (const std::string& arg : args) {
+				argv.push_back(const_cast<char*>(arg.c_str()));
+			}
+			argv.push_back(nullptr);
+			execv(argv[0], argv.data());
+			_exit(127);
+		}
+		close(gate[0]);
+		int counter = OpenSyscallCounter(pid);
+		char go = 1;
+		while ((write(gate[1], &go, 1) < 0) && (errno == EINTR)) {
+		}
+		close(gate[1]);
+
+		int status = 0;
+		struct rusage usage;
+		pid_t waited;
+		do {
+			waited = wait4(pid, &status, 0, &usage);
+		} while ((waited < 0) && (errno == EINTR));
+		outResult.mSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (waited < 0) {
+			if (counter >= 0) {
+				close(counter);
+			}
+			return false;
+		}
+		// Kilobytes, on Linux.
+		outResult.mPeakRSSKB = usage.ru_maxrss;
+		outResult.mExitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : (128 + WTERMSIG(status));
+		if (counter >= 0) {
+			uint64_t count = 0;
+			if (read(counter, &count, sizeof(count)) == (ssize_t)sizeof(count)) {
+				outResult.mSyscalls = (long long)count;
+			}
+			close(counter);
+		}
+		return (outResult.mExitStatus != 127);
+	}
+
+	//
+	std::string JSONString(const std::string& s) {
+		std::ostringstream strm;
+		strm << '"';
+		for (char c : s) {
+			if ((c == '"') || (c == '\\')) {
+				strm << '\\' << c;
+			}
+			else if ((unsigned char)c < 0x20) {
+				static const char* kHex = "0123456789abcdef";
+				strm << "\\u00" << kHex[(c >> 4) & 0xF] << kHex[c & 0xF];
+			}
+			else {
+				strm << c;
+			}
+		}
+		strm << '"';
+		return strm.str();
+	}
+
+	//
+	struct Case {
+		//
+		std::string mName;
+		std::vector<std::string> mArgs;
+		// The copy destination to clear first, if any.
+		std::string mFreshPath;
+	};
+
+	//
+	bool GetArgValue(int argc, const char* argv[], int& index, std::string& outValue) {
+		if ((index + 1) >= argc) {
+			std::cerr << "treebench: " << argv[index] << " requires a value" << "\n";
+			return false;
+		}
+		outValue = argv[++index];
+		return true;
+	}
+
+} // namespace TreeBenchmark_Impl
+using namespace TreeBenchmark_Impl;
+
+//
+int main(int argc, const char* argv[]) {
+	if (argc < 4) {
+		std::cerr << "usage: treebench <compare binary> <copy binary> <scratch directory> [--profile tiny|huge|deep|links|mixed]" << "\n";
+		std::cerr << "\t[--seed <n>] [--scale <n>] [--modify <percent>] [--jobs <n>] [--runs <n>] [--drop-caches]" << "\n";
+		return EXIT_FAILURE;
+	}
+	std::string comparePath(argv[1]);
+	std::string copyPath(argv[2]);
+	std::string scratchPath(argv[3]);
+	std::string profile("mixed");
+	uint64_t seed = 1;
+	uint64_t scale = 1;
+	double modifyPercent = 1;
+	std::string jobs;
+	int runs = 1;
+	bool dropCaches = false;
+	for (int n = 4; n < argc; ++n) {
+		std::string arg(argv[n]);
+		std::string value;
+		if (arg == "--drop-caches") {
+			dropCaches = true;
+			continue;
+		}
+		if (!GetArgValue(argc, argv, n, value)) {
+			return EXIT_FAILURE;
+		}
+		if (arg == "--profile") {
+			profile = value;
+		}
+		else if (arg == "--seed") {
+			seed = strtoull(value.c_str(), nullptr, 10);
+		}
+		else if (arg == "--scale") {
+			scale = std::max<uint64_t>(1, strtoull(value.c_str(), nullptr, 10));
+		}
+		else if (arg == "--modify") {
+			modifyPercent = atof(value.c_str());
+		}
+		else if (arg == "--jobs") {
+			jobs = value;
+		}
+		else if (arg == "--runs") {
+			runs = std::max(1, atoi(value.c_str()));
+		}
+		else {
+			std::cerr << "treebench: unknown option: " << arg << "\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::string aPath(scratchPath + "/a");
+	std::string bPath(scratchPath + "/b");
+	std::string cPath(scratchPath + "/c");
+	if (((mkdir(scratchPath.c_str(), 0755) != 0) && (errno != EEXIST)) ||
+		!RemoveTree(aPath) || !RemoveTree(bPath) || !RemoveTree(cPath)) {
+		std::cerr << "treebench: couldn't clear the scratch directory " << scratchPath << ": " << strerror(errno) << "\n";
+		return EXIT_FAILURE;
+	}
+
+	std::cerr << "treebench: generating the " << profile << " tree (seed " << seed << ", scale " << scale << ")" << "\n";
+	auto generateStart = std::chrono::steady_clock::now();
+	TreeCounts counts;
+	uint64_t modifications = 0;
+	{
+		// Gone before the runs, so the forked children don't start out with its memory in their
+		// peak RSS.
+		TreeGenerator a(aPath, seed, scale);
+		TreeGenerator b(bPath, seed, scale);
+		if (!a.Generate(profile) || !a.SetDirectoryTimes()) {
+			std::cerr << "treebench: couldn't generate " << aPath << ": " << strerror(errno) << "\n";
+			return EXIT_FAILURE;
+		}
+		if (!b.Generate(profile) || !b.Modify(modifyPercent) || !b.SetDirectoryTimes()) {
+			std::cerr << "treebench: couldn't generate " << bPath << ": " << strerror(errno) << "\n";
+			return EXIT_FAILURE;
+		}
+		counts = a.GetCounts();
+		modifications = b.GetCounts().mModifications;
+	}
+	double generateSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - generateStart).count();
+
+	std::vector<std::string> jobArgs;
+	if (!jobs.empty()) {
+		jobArgs = { "-j", jobs };
+	}
+	std::vector<Case> cases;
+	cases.push_back({ "copy", { copyPath }, cPath });
+	cases.push_back({ "copy -y", { copyPath, "-y" }, cPath });
+	cases.push_back({ "compare (matching)", { comparePath }, "" });
+	cases.push_back({ "compare (modified)", { comparePath }, "" });
+	for (size_t n = 0; n < cases.size(); ++n) {
+		Case& c = cases[n];
+		c.mArgs.insert(c.mArgs.end(), jobArgs.begin(), jobArgs.end());
+		c.mArgs.push_back(aPath);
+		c.mArgs.push_back((n == 3) ? bPath : cPath);
+	}
+
+	std::ostringstream results;
+	bool first = true;
+	for (int run = 1; run <= runs; ++run) {
+		for (const Case& c : cases) {
+			if (!c.mFreshPath.empty() && !RemoveTree(c.mFreshPath)) {
+				std::cerr << "treebench: couldn't remove " << c.mFreshPath << ": " << strerror(errno) << "\n";
+				return EXIT_FAILURE;
+			}
+			if (dropCaches) {
+				DropCaches();
+			}
+			std::cerr << "treebench: run " << run << ": " << c.mName << "\n";
+			RunResult result;
+			if (!Run(c.mArgs, result)) {
+				std::cerr << "treebench: couldn't run " << c.mArgs[0] << "\n";
+				return EXIT_FAILURE;
+			}
+			std::string commandLine;
+			for (const std::string& arg : c.mArgs) {
+				commandLine += (commandLine.empty() ? "" : " ") + arg;
+			}
+			double seconds = std::max(result.mSeconds, 1e-9);
+			results << (first ? "" : ",") << "\n    {"
+					<< "\"name\": " << JSONString(c.mName)
+					<< ", \"command\": " << JSONString(commandLine)
+					<< ", \"run\": " << run
+					<< ", \"exit_status\": " << result.mExitStatus
+					<< ", \"seconds\": " << result.mSeconds
+					<< ", \"files_per_second\": " << (counts.mFiles / seconds)
+					<< ", \"mb_per_second\": " << (counts.mBytes / seconds / (1024 * 1024))
+					<< ", \"peak_rss_kb\": " << result.mPeakRSSKB
+					<< ", \"syscalls\": ";
+			if (result.mSyscalls < 0) {
+				results << "null";
+			}
+			else {
+				results << result.mSyscalls;
+			}
+			results << "}";
+			first = false;
+		}
+	}
+
+	std::cout << "{" << "\n"
+			  << "  \"profile\": " << JSONString(profile) << "," << "\n"
+			  << "  \"seed\": " << seed << "," << "\n"
+			  << "  \"scale\": " << scale << "," << "\n"
+			  << "  \"modify_percent\": " << modifyPercent << "," << "\n"
+			  << "  \"jobs\": " << (jobs.empty() ? "null" : jobs) << "," << "\n"
+			  << "  \"scratch\": " << JSONString(scratchPath) << "," << "\n"
+			  << "  \"filesystem\": " << JSONString(GetFileSystemName(scratchPath)) << "," << "\n"
+			  << "  \"drop_caches\": " << (dropCaches ? "true" : "false") << "," << "\n"
+			  << "  \"generate_seconds\": " << generateSeconds << "," << "\n"
+			  << "  \"tree\": {"
+			  << "\"files\": " << counts.mFiles
+			  << ", \"directories\": " << counts.mDirectories
+			  << ", \"symlinks\": " << counts.mSymlinks
+			  << ", \"hard_links\": " << counts.mHardLinks
+			  << ", \"xattrs\": " << counts.mXAttrs
+			  << ", \"bytes\": " << counts.mBytes
+			  << ", \"modifications\": " << modifications << "}," << "\n"
+			  << "  \"results\": [" << results.str() << "\n"
+			  << "  ]" << "\n"
+			  << "}" << "\n";
+	return 0;
+}
@@ -0,0 +1,315 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <algorithm>
+#include <cstring>
+#include "Checksum.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CHECKSUM_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CHECKSUM_ARM 1
+#include <arm_acle.h>
+#endif
+
+namespace common {
+	namespace Checksum_Impl {
+		
+		// Reflected form of the Castagnoli polynomial 0x1EDC6F41.
+		static const uint32_t kCrc32cPolynomial = 0x82f63b78;
+		
+		//
+		static const uint64_t kPrime1 = 0x9e3779b185ebca87ULL;
+		static const uint64_t kPrime2 = 0xc2b2ae3d27d4eb4fULL;
+		static const uint64_t kPrime3 = 0x165667b19e3779f9ULL;
+		static const uint64_t kPrime4 = 0x85ebca77c2b2ae63ULL;
+		static const uint64_t kPrime5 = 0x27d4eb2f165667c5ULL;
+		
+		//
+		inline uint64_t Load64(const uint8_t* p) {
+			uint64_t value;
+			memcpy(&value, p, sizeof(value));
+			return value;
+		}
+		
+		//
+		inline uint32_t Load32(const uint8_t* p) {
+			uint32_t value;
+			memcpy(&value, p, sizeof(value));
+			return value;
+		}
+		
+		// Slicing-by-8 tables: entry [k][b] is the CRC of byte b followed by k zero bytes.
+		struct Crc32cTables {
+			Crc32cTables() {
+				for (uint32_t n = 0; n < 256; ++n) {
+					uint32_t crc = n;
+					for (int bit = 0; bit < 8; ++bit) {
+						crc = (crc >> 1) ^ ((crc & 1) ? kCrc32cPolynomial : 0);
+					}
+					mTable[0][n] = crc;
+				}
+				for (uint32_t n = 0; n < 256; ++n) {
+					for (int k = 1; k < 8; ++k) {
+						mTable[k][n] = (mTable[k - 1][n] >> 8) ^ mTable[0][mTable[k - 1][n] & 0xff];
+					}
+				}
+			}
+			
+			uint32_t mTable[8][256];
+		};
+		
+		//
+		uint32_t UpdateCrc32cSoftware(uint32_t crc, const uint8_t* p, size_t size) {
+			static const Crc32cTables tables;
+			const uint32_t (*t)[256] = tables.mTable;
+			// Assumes little-endian, as every other on-disk format here does.
+			while (size >= 8) {
+				uint32_t low = Load32(p) ^ crc;
+				uint32_t high = Load32(p + 4);
+				crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+					  t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+				p += 8;
+				size -= 8;
+			}
+			while (size-- > 0) {
+				crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+			}
+			return crc;
+		}
+		
+#if CHECKSUM_X86
+		//
+		__attribute__((target("sse4.2")))
+		uint32_t UpdateCrc32cSSE42(uint32_t crc, const uint8_t* p, size_t size) {
+#if defined(__x86_64__)
+			uint64_t crc64 = crc;
+			while (size >= 8) {
+				crc64 = _mm_crc32_u64(crc64, Load64(p));
+				p += 8;
+				size -= 8;
+			}
+			crc = (uint32_t)crc64;
+#endif
+			while (size >= 4) {
+				crc = _mm_crc32_u32(crc, Load32(p));
+				p += 4;
+				size -= 4;
+			}
+			while (size-- > 0) {
+				crc = _mm_crc32_u8(crc, *p++);
+			}
+			return crc;
+		}
+#endif
+		
+#if CHECKSUM_ARM
+		//
+		uint32_t UpdateCrc32cARM(uint32_t crc, const uint8_t* p, size_t size) {
+			while (size >= 8) {
+				crc = __crc32cd(crc, Load64(p));
+				p += 8;
+				size -= 8;
+			}
+			while (size-- > 0) {
+				crc = __crc32cb(crc, *p++);
+			}
+			return crc;
+		}
+#endif
+		
+		//
+		typedef uint32_t (*UpdateCrc32cFunction)(uint32_t crc, const uint8_t* p, size_t size);
+		
+		//
+		UpdateCrc32cFunction ChooseUpdateCrc32cFunction() {
+#if CHECKSUM_X86
+			if (__builtin_cpu_supports("sse4.2")) {
+				return UpdateCrc32cSSE42;
+			}
+#elif CHECKSUM_ARM
+			return UpdateCrc32cARM;
+#endif
+			return UpdateCrc32cSoftware;
+		}
+		
+		//
+		UpdateCrc32cFunction GetUpdateCrc32cFunction() {
+			static const UpdateCrc32cFunction function = ChooseUpdateCrc32cFunction();
+			return function;
+		}
+		
+		//
+		inline uint64_t RotateLeft(uint64_t value, int bits) {
+			return (value << bits) | (value >> (64 - bits));
+		}
+		
+		//
+		inline uint64_t Round(uint64_t accumulator, uint64_t input) {
+			accumulator += input * kPrime2;
+			accumulator = RotateLeft(accumulator, 31);
+			return accumulator * kPrime1;
+		}
+		
+		//
+		inline uint64_t MergeRound(uint64_t hash, uint64_t accumulator) {
+			hash ^= Round(0, accumulator);
+			return hash * kPrime1 + kPrime4;
+		}
+		
+	} // namespace Checksum_Impl
+	using namespace Checksum_Impl;
+	
+	//
+	Crc32c::Crc32c() : mState(0xffffffff) {
+	}
+	
+	//
+	void Crc32c::Update(const void* data, size_t size) {
+		mState = GetUpdateCrc32cFunction()(mState, (const uint8_t*)data, size);
+	}
+	
+	//
+	uint32_t Crc32c::Finish() const {
+		return ~mState;
+	}
+	
+	//
+	bool Crc32c::IsHardwareAccelerated() {
+		return (GetUpdateCrc32cFunction() != UpdateCrc32cSoftware);
+	}
+	
+	//
+	XXHash64::XXHash64() : mTotalSize(0), mBufferSize(0) {
+		mAccumulators[0] = kPrime1 + kPrime2;
+		mAccumulators[1] = kPrime2;
+		mAccumulators[2] = 0;
+		mAccumulators[3] = 0 - kPrime1;
+	}
+	
+	//
+	void XXHash64::Update(const void* data, size_t size) {
+		const uint8_t* p = (const uint8_t*)data;
+		mTotalSize += size;
+		if (mBufferSize > 0) {
+			size_t count = std::min(size, sizeof(mBuffer) - mBufferSize);
+			memcpy(mBuffer + mBufferSize, p, count);
+			mBufferSize += count;
+			p += count;
+			size -= count;
+			if (mBufferSize < sizeof(mBuffer)) {
+				return;
+			}
+			for (int n = 0; n < 4; ++n) {
+				mAccumulators[n] = Round(mAccumulators[n], Load64(mBuffer + n * 8));
+			}
+			mBufferSize = 0;
+		}
+		uint64_t v1 = mAccumulators[0];
+		uint64_t v2 = mAccumulators[1];
+		uint64_t v3 = mAccumulators[2];
+		uint64_t v4 = mAccumulators[3];
+		while (size >= 32) {
+			v1 = Round(v1, Load64(p));
+			v2 = Round(v2, Load64(p + 8));
+			v3 = Round(v3, Load64(p + 16));
+			v4 = Round(v4, Load64(p + 24));
+			p += 32;
+			size -= 32;
+		}
+		mAccumulators[0] = v1;
+		mAccumulators[1] = v2;
+		mAccumulators[2] = v3;
+		mAccumulators[3] = v4;
+		if (size > 0) {
+			memcpy(mBuffer, p, size);
+			mBufferSize = size;
+		}
+	}
+	
+	//
+	uint64_t XXHash64::Finish() const {
+		uint64_t hash;
+		if (mTotalSize >= 32) {
+			hash = RotateLeft(mAccumulators[0], 1) + RotateLeft(mAccumulators[1], 7) +
+				   RotateLeft(mAccumulators[2], 12) + RotateLeft(mAccumulators[3], 18);
+			for (int n = 0; n < 4; ++n) {
+				hash = MergeRound(hash, mAccumulators[n]);
+			}
+		}
+		else {
+			hash = mAccumulators[2] + kPrime5;
+		}
+		hash += mTotalSize;
+		
+		const uint8_t* p = mBuffer;
+		size_t size = mBufferSize;
+		while (size >= 8) {
+			hash ^= Round(0, Load64(p));
+			hash = RotateLeft(hash, 27) * kPrime1 + kPrime4;
+			p += 8;
+			size -= 8;
+		}
+		if (size >= 4) {
+			hash ^= (uint64_t)Load32(p) * kPrime1;
+			hash = RotateLeft(hash, 23) * kPrime2 + kPrime3;
+			p += 4;
+			size -= 4;
+		}
+		while (size-- > 0) {
+			hash ^= (*p++) * kPrime5;
+			hash = RotateLeft(hash, 11) * kPrime1;
+		}
+		hash ^= hash >> 33;
+		hash *= kPrime2;
+		hash ^= hash >> 29;
+		hash *= kPrime3;
+		hash ^= hash >> 32;
+		return hash;
+	}
+	
+	//
+	const char* GetChecksumAlgorithmName(const ChecksumAlgorithm& algorithm) {
+		return (algorithm == ChecksumAlgorithm::kCRC32C) ? "crc32c" : "xxh64";
+	}
+	
+	//
+	StreamingChecksum::StreamingChecksum(const ChecksumAlgorithm& algorithm) : mAlgorithm(algorithm) {
+	}
+	
+	//
+	void StreamingChecksum::Update(const void* data, size_t size) {
+		if (mAlgorithm == ChecksumAlgorithm::kCRC32C) {
+			mCrc32c.Update(data, size);
+		}
+		else {
+			mXXHash64.Update(data, size);
+		}
+	}
+	
+	//
+	uint64_t StreamingChecksum::Finish() const {
+		if (mAlgorithm == ChecksumAlgorithm::kCRC32C) {
+			return mCrc32c.Finish();
+		}
+		return mXXHash64.Finish();
+	}
+	
+} // namespace common
@@ -0,0 +1,98 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef Checksum_h
+#define Checksum_h
+
+#include <cstddef>
+#include <cstdint>
+
+namespace common {
+	
+	// Castagnoli CRC-32 (iSCSI, ext4, btrfs), using the CPU's CRC instruction where there is one.
+	class Crc32c {
+	public:
+		//
+		Crc32c();
+		
+		//
+		void Update(const void* data, size_t size);
+		
+		//
+		uint32_t Finish() const;
+		
+		//
+		static bool IsHardwareAccelerated();
+		
+	private:
+		//
+		uint32_t mState;
+	};
+	
+	// XXH64, seed 0.
+	class XXHash64 {
+	public:
+		//
+		XXHash64();
+		
+		//
+		void Update(const void* data, size_t size);
+		
+		//
+		uint64_t Finish() const;
+		
+	private:
+		//
+		uint64_t mAccumulators[4];
+		uint64_t mTotalSize;
+		uint8_t mBuffer[32];
+		size_t mBufferSize;
+	};
+	
+	//
+	enum class ChecksumAlgorithm {
+		kCRC32C,
+		kXXH64
+	};
+	
+	//
+	const char* GetChecksumAlgorithmName(const ChecksumAlgorithm& algorithm);
+	
+	// Whichever of the above was asked for, for callers that let the user choose.
+	class StreamingChecksum {
+	public:
+		//
+		explicit StreamingChecksum(const ChecksumAlgorithm& algorithm);
+		
+		//
+		void Update(const void* data, size_t size);
+		
+		// CRC32C values are zero-extended.
+		uint64_t Finish() const;
+		
+	private:
+		//
+		ChecksumAlgorithm mAlgorithm;
+		Crc32c mCrc32c;
+		XXHash64 mXXHash64;
+	};
+	
+} // namespace common
+
+#endif /* Checksum_h */
@@ -0,0 +1,43 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef CompareCompletion_h
+#define CompareCompletion_h
+
+#include "Hermit/File/CompareFiles.h"
+#include "Completion.h"
+
+namespace common {
+	
+	//
+	class CompareCompletion : public hermit::file::CompareFilesCompletion, public Completion<hermit::file::CompareFilesStatus> {
+	public:
+		//
+		CompareCompletion() : Completion(hermit::file::CompareFilesStatus::kUnknown) {
+		}
+		
+		//
+		virtual void Call(const hermit::file::CompareFilesStatus& status) override {
+			Signal(status);
+		}
+	};
+	typedef std::shared_ptr<CompareCompletion> CompareCompletionPtr;
+	
+} // namespace common
+
+#endif /* CompareCompletion_h */
@@ -0,0 +1,113 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef Completion_h
+#define Completion_h
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace common {
+	
+	// Result slot for an asynchronous operation. Hermit completion subclasses mix this in and call
+	// Signal() from their Call() override; the caller then blocks in Wait() instead of polling.
+	template <class T>
+	class Completion {
+	public:
+		//
+		typedef std::function<void(const T&)> Continuation;
+		
+		//
+		explicit Completion(const T& pendingValue) : mResult(pendingValue), mDone(false) {
+		}
+		
+		//
+		virtual ~Completion() {
+		}
+		
+		// Stores the result, wakes any waiters and runs the chained continuations on this thread.
+		// Only the first call has any effect.
+		void Signal(const T& result) {
+			std::vector<Continuation> continuations;
+			{
+				std::lock_guard<std::mutex> guard(mMutex);
+				if (mDone) {
+					return;
+				}
+				mResult = result;
+				mDone = true;
+				continuations.swap(mContinuations);
+			}
+			mCondition.notify_all();
+			for (const auto& continuation : continuations) {
+				continuation(result);
+			}
+		}
+		
+		//
+		T Wait() {
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock, [this] { return mDone; });
+			return mResult;
+		}
+		
+		// Returns false if the timeout expired first.
+		template <class Rep, class Period>
+		bool WaitFor(const std::chrono::duration<Rep, Period>& timeout, T& outResult) {
+			std::unique_lock<std::mutex> lock(mMutex);
+			if (!mCondition.wait_for(lock, timeout, [this] { return mDone; })) {
+				return false;
+			}
+			outResult = mResult;
+			return true;
+		}
+		
+		// Runs continuation with the result once there is one: right away if already signaled,
+		// otherwise on the signaling thread.
+		void Then(const Continuation& continuation) {
+			{
+				std::lock_guard<std::mutex> guard(mMutex);
+				if (!mDone) {
+					mContinuations.push_back(continuation);
+					return;
+				}
+			}
+			continuation(mResult);
+		}
+		
+		//
+		bool IsDone() {
+			std::lock_guard<std::mutex> guard(mMutex);
+			return mDone;
+		}
+		
+	private:
+		//
+		std::mutex mMutex;
+		std::condition_variable mCondition;
+		T mResult;
+		bool mDone;
+		std::vector<Continuation> mContinuations;
+	};
+	
+} // namespace common
+
+#endif /* Completion_h */
@@ -0,0 +1,483 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "ContentCompare.h"
+#include "PhaseTimer.h"
+#include "Progress.h"
+#include "ReadQueue.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CONTENT_COMPARE_X86 1
+#include <immintrin.h>
+#endif
+
+namespace common {
+	namespace ContentCompare_Impl {
+		
+		// Only called once a kernel knows there's a difference in [0, size).
+		inline size_t LocateDifference(const uint8_t* p1, const uint8_t* p2, size_t size) {
+			size_t n = 0;
+			while ((n < size) && (p1[n] == p2[n])) {
+				++n;
+			}
+			return n;
+		}
+		
+		//
+		inline uint64_t Load64(const uint8_t* p) {
+			uint64_t value;
+			memcpy(&value, p, sizeof(value));
+			return value;
+		}
+		
+		// 32 bytes a pass as four 64-bit words.
+		size_t FindFirstDifferenceScalar(const void* data1, const void* data2, size_t size) {
+			const uint8_t* p1 = (const uint8_t*)data1;
+			const uint8_t* p2 = (const uint8_t*)data2;
+			size_t offset = 0;
+			for (; (offset + 32) <= size; offset += 32) {
+				uint64_t diff = (Load64(p1 + offset) ^ Load64(p2 + offset)) |
+								(Load64(p1 + offset + 8) ^ Load64(p2 + offset + 8)) |
+								(Load64(p1 + offset + 16) ^ Load64(p2 + offset + 16)) |
+								(Load64(p1 + offset + 24) ^ Load64(p2 + offset + 24));
+				if (diff != 0) {
+					return offset + LocateDifference(p1 + offset, p2 + offset, 32);
+				}
+			}
+			return offset + LocateDifference(p1 + offset, p2 + offset, size - offset);
+		}
+		
+#if CONTENT_COMPARE_X86
+		// 64 bytes a pass, with a single PTEST deciding whether all four lanes matched.
+		__attribute__((target("sse4.2")))
+		size_t FindFirstDifferenceSSE42(const void* data1, const void* data2, size_t size) {
+			const uint8_t* p1 = (const uint8_t*)data1;
+			const uint8_t* p2 = (const uint8_t*)data2;
+			size_t offset = 0;
+			for (; (offset + 64) <= size; offset += 64) {
+				const __m128i* a = (const __m128i*)(p1 + offset);
+				const __m128i* b = (const __m128i*)(p2 + offset);
+				__m128i x0 = _mm_xor_si128(_mm_loadu_si128(a), _mm_loadu_si128(b));
+				__m128i x1 = _mm_xor_si128(_mm_loadu_si128(a + 1), _mm_loadu_si128(b + 1));
+				__m128i x2 = _mm_xor_si128(_mm_loadu_si128(a + 2), _mm_loadu_si128(b + 2));
+				__m128i x3 = _mm_xor_si128(_mm_loadu_si128(a + 3), _mm_loadu_si128(b + 3));
+				__m128i any = _mm_or_si128(_mm_or_si128(x0, x1), _mm_or_si128(x2, x3));
+				if (!_mm_testz_si128(any, any)) {
+					for (size_t lane = 0; lane < 4; ++lane) {
+						__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(a + lane), _mm_loadu_si128(b + lane));
+						unsigned int mask = ~(unsigned int)_mm_movemask_epi8(eq) & 0xffff;
+						if (mask != 0) {
+							return offset + (lane * 16) + (size_t)__builtin_ctz(mask);
+						}
+					}
+				}
+			}
+			return offset + FindFirstDifferenceScalar(p1 + offset, p2 + offset, size - offset);
+		}
+		
+		// 128 bytes a pass.
+		__attribute__((target("avx2")))
+		size_t FindFirstDifferenceAVX2(const void* data1, const void* data2, size_t size) {
+			const uint8_t* p1 = (const uint8_t*)data1;
+			const uint8_t* p2 = (const uint8_t*)data2;
+			size_t offset = 0;
+			for (; (offset + 128) <= size; offset += 128) {
+				const __m256i* a = (const __m256i*)(p1 + offset);
+				const __m256i* b = (const __m256i*)(p2 + offset);
+				__m256i x0 = _mm256_xor_si256(_mm256_loadu_si256(a), _mm256_loadu_si256(b));
+				__m256i x1 = _mm256_xor_si256(_mm256_loadu_si256(a + 1), _mm256_loadu_si256(b + 1));
+				__m256i x2 = _mm256_xor_si256(_mm256_loadu_si256(a + 2), _mm256_loadu_si256(b + 2));
+				__m256i x3 = _mm256_xor_si256(_mm256_loadu_si256(a + 3), _mm256_loadu_si256(b + 3));
+				__m256i any = _mm256_or_si256(_mm256_or_si256(x0, x1), _mm256_or_si256(x2, x3));
+				if (!_mm256_testz_si256(any, any)) {
+					for (size_t lane = 0; lane < 4; ++lane) {
+						__m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256(a + lane), _mm256_loadu_si256(b + lane));
+						unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(eq);
+						if (mask != 0) {
+							return offset + (lane * 32) + (size_t)__builtin_ctz(mask);
+						}
+					}
+				}
+			}
+			return offset + FindFirstDifferenceScalar(p1 + offset, p2 + offset, size - offset);
+		}
+#endif
+		
+		//
+		bool KernelSupported(const ContentCompareKernel& kernel) {
+#if CONTENT_COMPARE_X86
+			if (kernel == ContentCompareKernel::kAVX2) {
+				return __builtin_cpu_supports("avx2");
+			}
+			if (kernel == ContentCompareKernel::kSSE42) {
+				return __builtin_cpu_supports("sse4.2");
+			}
+#else
+			if (kernel != ContentCompareKernel::kScalar) {
+				return false;
+			}
+#endif
+			return true;
+		}
+		
+		//
+		ContentCompareKernel SelectKernel() {
+			if (KernelSupported(ContentCompareKernel::kAVX2)) {
+				return ContentCompareKernel::kAVX2;
+			}
+			if (KernelSupported(ContentCompareKernel::kSSE42)) {
+				return ContentCompareKernel::kSSE42;
+			}
+			return ContentCompareKernel::kScalar;
+		}
+		
+		// FindFirstDifference hands memcmp this much at a time, so the kernel only ever has to
+		// search one chunk for the byte that differs.
+		static const size_t kEqualityChunkSize = 4 * 1024;
+		
+		//
+		static const size_t kBlockAlignment = 4096;
+		
+		//
+		struct AlignedFree {
+			void operator()(uint8_t* p) const {
+				free(p);
+			}
+		};
+		typedef std::unique_ptr<uint8_t, AlignedFree> AlignedBufferPtr;
+		
+		// A ReadQueue and its buffers (depth per side), kept per thread for as long as the
+		// options stay the same.
+		struct PipelineState {
+			//
+			PipelineState() : mDepth(0), mBlockSize(0) {
+			}
+			
+			//
+			bool Prepare(const ReadPipelineOptions& options) {
+				if ((options.mDepth == mDepth) && (options.mBlockSize == mBlockSize) && (mQueue != nullptr)) {
+					return true;
+				}
+				mQueue = nullptr;
+				mBuffers.clear();
+				mDepth = options.mDepth;
+				mBlockSize = options.mBlockSize;
+				for (size_t n = 0; n < (mDepth * 2); ++n) {
+					void* p = nullptr;
+					if (posix_memalign(&p, kBlockAlignment, mBlockSize) != 0) {
+						mBuffers.clear();
+						return false;
+					}
+					mBuffers.push_back(AlignedBufferPtr((uint8_t*)p));
+				}
+				mQueue = CreateReadQueue(mDepth * 2);
+				return true;
+			}
+			
+			//
+			size_t mDepth;
+			size_t mBlockSize;
+			ReadQueuePtr mQueue;
+			std::vector<AlignedBufferPtr> mBuffers;
+		};
+		
+		// Picks up where a short read left off. Returns the total read, or -1 on error.
+		ssize_t FinishRead(int fd, uint8_t* buffer, size_t size, size_t alreadyRead, uint64_t offset) {
+			size_t total = alreadyRead;
+			while (total < size) {
+				ssize_t bytesRead = pread(fd, buffer + total, size - total, (off_t)(offset + total));
+				if (bytesRead < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return -1;
+				}
+				if (bytesRead == 0) {
+					break;
+				}
+				total += (size_t)bytesRead;
+			}
+			return (ssize_t)total;
+		}
+		
+		//
+		int OpenForSequentialRead(const std::string& pathUTF8) {
+			int fd = open(pathUTF8.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+#if defined(POSIX_FADV_SEQUENTIAL)
+			if (fd >= 0) {
+				posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+			}
+#endif
+			return fd;
+		}
+		
+		// Two files being read through one PipelineState. Block n of side s always lands in
+		// buffer (and uses tag) s * depth + n % depth.
+		class FilePairPipeline {
+		public:
+			//
+			FilePairPipeline(PipelineState& state, const int* fds, const uint64_t* sizes) :
+			mState(state),
+			mInFlight(state.mDepth * 2, false) {
+				for (int side = 0; side < 2; ++side) {
+					mFds[side] = fds[side];
+					mSizes[side] = sizes[side];
+					mBusyNsAtStart[side] = state.mQueue->GetBusyNs(side);
+					mBytesRead[side] = 0;
+				}
+			}
+			
+			// Never leaves a read in flight into buffers the next file pair will use.
+			~FilePairPipeline() {
+				for (size_t tag = 0; tag < mInFlight.size(); ++tag) {
+					if (mInFlight[tag]) {
+						mState.mQueue->Wait(tag);
+					}
+				}
+			}
+			
+			// Bytes of block n on side, going by the size the file had when opened.
+			size_t ExpectedSize(int side, uint64_t n) const {
+				uint64_t offset = n * mState.mBlockSize;
+				if (offset >= mSizes[side]) {
+					return 0;
+				}
+				uint64_t remaining = mSizes[side] - offset;
+				return (remaining < mState.mBlockSize) ? (size_t)remaining : mState.mBlockSize;
+			}
+			
+			//
+			size_t Tag(int side, uint64_t n) const {
+				return ((size_t)side * mState.mDepth) + (size_t)(n % mState.mDepth);
+			}
+			
+			//
+			bool Submit(int side, uint64_t n) {
+				size_t size = ExpectedSize(side, n);
+				if (size == 0) {
+					return true;
+				}
+				size_t tag = Tag(side, n);
+				if (!mState.mQueue->Submit(side, tag, mFds[side], n * mState.mBlockSize, mState.mBuffers[tag].get(), size)) {
+					return false;
+				}
+				mInFlight[tag] = true;
+				return true;
+			}
+			
+			// Waits for block n on side. Returns its size, or -1 on error.
+			ssize_t Complete(int side, uint64_t n) {
+				size_t expected = ExpectedSize(side, n);
+				if (expected == 0) {
+					return 0;
+				}
+				size_t tag = Tag(side, n);
+				ssize_t result = mState.mQueue->Wait(tag);
+				mInFlight[tag] = false;
+				if (result < 0) {
+					return -1;
+				}
+				if ((size_t)result < expected) {
+					result = FinishRead(mFds[side], mState.mBuffers[tag].get(), expected, (size_t)result, n * mState.mBlockSize);
+				}
+				if (result > 0) {
+					mBytesRead[side] += (uint64_t)result;
+				}
+				return result;
+			}
+			
+			//
+			const uint8_t* GetBlock(int side, uint64_t n) const {
+				return mState.mBuffers[Tag(side, n)].get();
+			}
+			
+			//
+			void Report(ReadThroughput* throughput) const {
+				if (throughput == nullptr) {
+					return;
+				}
+				throughput->SetMechanism(mState.mQueue->GetName());
+				for (int side = 0; side < 2; ++side) {
+					throughput->Add(side, mBytesRead[side], mState.mQueue->GetBusyNs(side) - mBusyNsAtStart[side]);
+				}
+			}
+			
+		private:
+			//
+			PipelineState& mState;
+			int mFds[2];
+			uint64_t mSizes[2];
+			uint64_t mBusyNsAtStart[2];
+			uint64_t mBytesRead[2];
+			std::vector<bool> mInFlight;
+		};
+		
+		//
+		FileContentCompareStatus ComparePipelined(PipelineState& state,
+												  const int* fds,
+												  const uint64_t* sizes,
+												  ReadThroughput* throughput,
+												  ProgressCounters* progress,
+												  uint64_t& outOffset,
+												  Sha256* hasher) {
+			FilePairPipeline pipeline(state, fds, sizes);
+			uint64_t largerSize = (sizes[0] > sizes[1]) ? sizes[0] : sizes[1];
+			uint64_t blockCount = (largerSize + state.mBlockSize - 1) / state.mBlockSize;
+			for (uint64_t n = 0; (n < state.mDepth) && (n < blockCount); ++n) {
+				if (!pipeline.Submit(0, n) || !pipeline.Submit(1, n)) {
+					return FileContentCompareStatus::kError;
+				}
+			}
+			
+			FileContentCompareStatus status = FileContentCompareStatus::kMatch;
+			for (uint64_t n = 0; n < blockCount; ++n) {
+				ssize_t size1 = 0;
+				ssize_t size2 = 0;
+				{
+					PhaseScope scope(Phase::kRead);
+					size1 = pipeline.Complete(0, n);
+					size2 = pipeline.Complete(1, n);
+				}
+				if ((size1 < 0) || (size2 < 0)) {
+					status = FileContentCompareStatus::kError;
+					break;
+				}
+				{
+					PhaseScope scope(Phase::kCompare);
+					const uint8_t* block1 = pipeline.GetBlock(0, n);
+					size_t commonSize = (size_t)((size1 < size2) ? size1 : size2);
+					size_t at = FindFirstDifference(block1, pipeline.GetBlock(1, n), commonSize);
+					if ((at != commonSize) || (size1 != size2)) {
+						outOffset = (n * state.mBlockSize) + at;
+						status = FileContentCompareStatus::kDiffer;
+						break;
+					}
+					if (hasher != nullptr) {
+						hasher->Update(block1, (size_t)size1);
+					}
+				}
+				if (progress != nullptr) {
+					progress->AddBytes((uint64_t)size1);
+				}
+				
+				// Both buffers for block n are free again, so they can take block n + depth.
+				uint64_t next = n + state.mDepth;
+				if ((next < blockCount) && (!pipeline.Submit(0, next) || !pipeline.Submit(1, next))) {
+					status = FileContentCompareStatus::kError;
+					break;
+				}
+			}
+			pipeline.Report(throughput);
+			return status;
+		}
+		
+	} // namespace ContentCompare_Impl
+	using namespace ContentCompare_Impl;
+	
+	//
+	size_t FindFirstDifference(const void* data1, const void* data2, size_t size) {
+		static const FindFirstDifferenceFunction function = GetFindFirstDifferenceFunction(SelectKernel());
+		const uint8_t* p1 = (const uint8_t*)data1;
+		const uint8_t* p2 = (const uint8_t*)data2;
+		for (size_t offset = 0; offset < size; offset += kEqualityChunkSize) {
+			size_t chunkSize = std::min(kEqualityChunkSize, size - offset);
+			if (memcmp(p1 + offset, p2 + offset, chunkSize) != 0) {
+				return offset + function(p1 + offset, p2 + offset, chunkSize);
+			}
+		}
+		return size;
+	}
+	
+	//
+	ContentCompareKernel GetContentCompareKernel() {
+		static const ContentCompareKernel kernel = SelectKernel();
+		return kernel;
+	}
+	
+	//
+	FindFirstDifferenceFunction GetFindFirstDifferenceFunction(const ContentCompareKernel& kernel) {
+		if (!KernelSupported(kernel)) {
+			return nullptr;
+		}
+#if CONTENT_COMPARE_X86
+		if (kernel == ContentCompareKernel::kAVX2) {
+			return FindFirstDifferenceAVX2;
+		}
+		if (kernel == ContentCompareKernel::kSSE42) {
+			return FindFirstDifferenceSSE42;
+		}
+#endif
+		return FindFirstDifferenceScalar;
+	}
+	
+	//
+	const char* GetContentCompareKernelName(const ContentCompareKernel& kernel) {
+		if (kernel == ContentCompareKernel::kAVX2) {
+			return "avx2";
+		}
+		if (kernel == ContentCompareKernel::kSSE42) {
+			return "sse4.2";
+		}
+		return "scalar";
+	}
+	
+	//
+	FileContentCompareStatus CompareFileContents(const std::string& path1UTF8,
+												 const std::string& path2UTF8,
+												 const ReadPipelineOptions& options,
+												 ReadThroughput* throughput,
+												 uint64_t& outOffset,
+												 Sha256* hasher) {
+		static thread_local PipelineState state;
+		if ((options.mDepth == 0) || (options.mBlockSize == 0) || !state.Prepare(options)) {
+			return FileContentCompareStatus::kError;
+		}
+		int fds[2];
+		fds[0] = OpenForSequentialRead(path1UTF8);
+		if (fds[0] < 0) {
+			return FileContentCompareStatus::kError;
+		}
+		fds[1] = OpenForSequentialRead(path2UTF8);
+		if (fds[1] < 0) {
+			close(fds[0]);
+			return FileContentCompareStatus::kError;
+		}
+		
+		FileContentCompareStatus status = FileContentCompareStatus::kError;
+		struct stat s1;
+		struct stat s2;
+		if ((fstat(fds[0], &s1) == 0) && (fstat(fds[1], &s2) == 0)) {
+			uint64_t sizes[2] = { (uint64_t)s1.st_size, (uint64_t)s2.st_size };
+			status = ComparePipelined(state, fds, sizes, throughput, options.mProgress, outOffset, hasher);
+		}
+		close(fds[0]);
+		close(fds[1]);
+		return status;
+	}
+	
+} // namespace common
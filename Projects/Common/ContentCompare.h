@@ -0,0 +1,138 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef ContentCompare_h
+#define ContentCompare_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "Sha256.h"
+
+namespace common {
+	
+	//
+	enum class ContentCompareKernel {
+		kScalar,
+		kSSE42,
+		kAVX2
+	};
+	
+	// Returns the offset of the first byte that differs, or size if the buffers match.
+	typedef size_t (*FindFirstDifferenceFunction)(const void* data1, const void* data2, size_t size);
+	
+	// Returns the offset of the first byte that differs, or size if the buffers match. libc's
+	// memcmp, which beats the kernels at telling equal from unequal, checks the buffers a chunk at
+	// a time; the widest kernel this CPU supports then finds the byte within the first chunk that
+	// differs.
+	size_t FindFirstDifference(const void* data1, const void* data2, size_t size);
+	
+	// The kernel FindFirstDifference locates differences with.
+	ContentCompareKernel GetContentCompareKernel();
+	
+	// A specific kernel, or nullptr if this CPU (or this build) doesn't support it.
+	FindFirstDifferenceFunction GetFindFirstDifferenceFunction(const ContentCompareKernel& kernel);
+	
+	//
+	const char* GetContentCompareKernelName(const ContentCompareKernel& kernel);
+	
+	//
+	class ProgressCounters;
+	
+	// How CompareFileContents reads: depth blocks of blockSize bytes in flight per file.
+	struct ReadPipelineOptions {
+		//
+		ReadPipelineOptions() : mDepth(4), mBlockSize(1024 * 1024), mProgress(nullptr) {
+		}
+		
+		//
+		size_t mDepth;
+		size_t mBlockSize;
+		// If set, gets each block's bytes as soon as they've been compared.
+		ProgressCounters* mProgress;
+	};
+	
+	// Bytes read from each side (file 1 or file 2 of each pair) and how long that side had reads
+	// outstanding, summed over every CompareFileContents call that was handed this object.
+	class ReadThroughput {
+	public:
+		//
+		ReadThroughput() : mMechanism("") {
+			for (int side = 0; side < 2; ++side) {
+				mBytes[side] = 0;
+				mBusyNs[side] = 0;
+			}
+		}
+		
+		//
+		void Add(int side, uint64_t bytes, uint64_t busyNs) {
+			mBytes[side] += bytes;
+			mBusyNs[side] += busyNs;
+		}
+		
+		//
+		uint64_t GetBytes(int side) const {
+			return mBytes[side];
+		}
+		
+		// Bytes per microsecond is MB/s.
+		double GetMBPerSecond(int side) const {
+			uint64_t busyNs = mBusyNs[side];
+			return (busyNs == 0) ? 0 : ((double)mBytes[side] * 1000.0 / (double)busyNs);
+		}
+		
+		// Which ReadQueue did the reading.
+		const char* GetMechanism() const {
+			return mMechanism;
+		}
+		
+		//
+		void SetMechanism(const char* mechanism) {
+			mMechanism = mechanism;
+		}
+		
+	private:
+		//
+		std::atomic<uint64_t> mBytes[2];
+		std::atomic<uint64_t> mBusyNs[2];
+		std::atomic<const char*> mMechanism;
+	};
+	
+	//
+	enum class FileContentCompareStatus {
+		kMatch,
+		kDiffer,
+		kError
+	};
+	
+	// Reads both files through a ReadQueue, comparing each block while the next ones are being
+	// read on both sides. On kDiffer, outOffset is the offset of the first byte that differs (or
+	// the size of the shorter file). If hasher is given, the contents of file 1 are fed to it as
+	// they're compared. throughput may be null.
+	FileContentCompareStatus CompareFileContents(const std::string& path1UTF8,
+												 const std::string& path2UTF8,
+												 const ReadPipelineOptions& options,
+												 ReadThroughput* throughput,
+												 uint64_t& outOffset,
+												 Sha256* hasher);
+	
+} // namespace common
+
+#endif /* ContentCompare_h */
@@ -0,0 +1,543 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include "ExclusionMatcher.h"
+
+namespace common {
+	namespace ExclusionMatcher_Impl {
+		
+		// Past this the globs are simulated instead, which is slower but can't blow up.
+		static const size_t kMaxDFAStates = 10000;
+		
+		//
+		static const uint32_t kEmptySlot = UINT32_MAX;
+		
+		// FNV-1a.
+		inline uint64_t HashKey(const char* key, size_t length) {
+			uint64_t hash = 14695981039346656037ULL;
+			for (size_t n = 0; n < length; ++n) {
+				hash = (hash ^ (uint8_t)key[n]) * 1099511628211ULL;
+			}
+			return hash;
+		}
+		
+		//
+		std::vector<bool> AllButSlash() {
+			std::vector<bool> characters(256, true);
+			characters['/'] = false;
+			return characters;
+		}
+		
+	} // namespace ExclusionMatcher_Impl
+	using namespace ExclusionMatcher_Impl;
+	
+	//
+	ExclusionRules::ExclusionRules() {
+	}
+	
+	//
+	bool ExclusionRules::Add(const std::string& pattern, bool include, std::string& outError) {
+		Rule rule;
+		rule.mPattern = pattern;
+		rule.mInclude = include;
+		rule.mDirectoriesOnly = false;
+		std::string text(pattern);
+		while ((text.size() > 1) && (text.back() == '/') && (text[text.size() - 2] != '\\')) {
+			text.pop_back();
+			rule.mDirectoriesOnly = true;
+		}
+		rule.mAnchored = (text.find('/') != std::string::npos);
+		size_t start = text.find_first_not_of('/');
+		if (start == std::string::npos) {
+			outError = "empty pattern: " + pattern;
+			return false;
+		}
+		text.erase(0, start);
+		
+		if (!rule.mAnchored) {
+			// Any number of directories, then the name.
+			rule.mTokens.push_back(Token { TokenType::kDirectories, 0, std::vector<bool>() });
+		}
+		size_t n = 0;
+		while (n < text.size()) {
+			char ch = text[n];
+			bool componentStart = (n == 0) || (text[n - 1] == '/');
+			if (ch == '*') {
+				size_t end = text.find_first_not_of('*', n);
+				size_t run = ((end == std::string::npos) ? text.size() : end) - n;
+				if ((run >= 2) && componentStart && ((n + run) == text.size())) {
+					rule.mTokens.push_back(Token { TokenType::kAnything, 0, std::vector<bool>() });
+					n += run;
+				}
+				else if ((run >= 2) && componentStart && (text[n + run] == '/')) {
+					rule.mTokens.push_back(Token { TokenType::kDirectories, 0, std::vector<bool>() });
+					n += run + 1;
+				}
+				else {
+					rule.mTokens.push_back(Token { TokenType::kName, 0, std::vector<bool>() });
+					n += run;
+				}
+			}
+			else if (ch == '?') {
+				rule.mTokens.push_back(Token { TokenType::kCharacter, 0, AllButSlash() });
+				++n;
+			}
+			else if (ch == '[') {
+				size_t p = n + 1;
+				bool negate = (p < text.size()) && ((text[p] == '!') || (text[p] == '^'));
+				if (negate) {
+					++p;
+				}
+				std::vector<bool> characters(256, false);
+				bool closed = false;
+				bool first = true;
+				while (p < text.size()) {
+					if ((text[p] == ']') && !first) {
+						closed = true;
+						++p;
+						break;
+					}
+					first = false;
+					if ((text[p] == '\\') && ((p + 1) < text.size())) {
+						++p;
+					}
+					uint8_t low = (uint8_t)text[p++];
+					uint8_t high = low;
+					if (((p + 1) < text.size()) && (text[p] == '-') && (text[p + 1] != ']')) {
+						p += ((text[p + 1] == '\\') && ((p + 2) < text.size())) ? 2 : 1;
+						high = (uint8_t)text[p++];
+					}
+					for (unsigned c = low; c <= high; ++c) {
+						characters[c] = true;
+					}
+				}
+				if (!closed) {
+					outError = "unclosed '[' in pattern: " + pattern;
+					return false;
+				}
+				if (negate) {
+					characters.flip();
+				}
+				characters['/'] = false;
+				rule.mTokens.push_back(Token { TokenType::kCharacter, 0, characters });
+				n = p;
+			}
+			else if (ch == '\\') {
+				if ((n + 1) == text.size()) {
+					outError = "pattern ends with a backslash: " + pattern;
+					return false;
+				}
+				rule.mTokens.push_back(Token { TokenType::kLiteral, (uint8_t)text[n + 1], std::vector<bool>() });
+				n += 2;
+			}
+			else {
+				rule.mTokens.push_back(Token { TokenType::kLiteral, (uint8_t)ch, std::vector<bool>() });
+				++n;
+			}
+		}
+		mRules.push_back(std::move(rule));
+		return true;
+	}
+	
+	//
+	void ExclusionRules::Add(const ExclusionRules& rules) {
+		mRules.insert(mRules.end(), rules.mRules.begin(), rules.mRules.end());
+	}
+	
+	//
+	bool ExclusionRules::AddFromFile(const std::string& pathUTF8, std::string& outError) {
+		std::ifstream file(pathUTF8);
+		if (!file) {
+			outError = "couldn't read " + pathUTF8;
+			return false;
+		}
+		std::string line;
+		size_t lineNumber = 0;
+		while (std::getline(file, line)) {
+			++lineNumber;
+			if (!line.empty() && (line.back() == '\r')) {
+				line.pop_back();
+			}
+			// Trailing spaces don't count unless quoted.
+			while (!line.empty() && (line.back() == ' ') && ((line.size() < 2) || (line[line.size() - 2] != '\\'))) {
+				line.pop_back();
+			}
+			if (line.empty() || (line[0] == '#')) {
+				continue;
+			}
+			bool include = (line[0] == '!');
+			std::string error;
+			if (!Add(include ? line.substr(1) : line, include, error)) {
+				outError = pathUTF8 + ":" + std::to_string(lineNumber) + ": " + error;
+				return false;
+			}
+		}
+		return true;
+	}
+	
+	//
+	void ExclusionRules::AddDefaults() {
+		static const char* kNames[] = {
+			".DS_Store",            // Finder view file which gets added/updated when you open a folder
+			".ipspot_update",       // Spotlight photo data file which the OS changes on its own
+			"ehthumbs.db",          // Windows thumbnails file
+			"ehthumbs_vista.db",    // Windows thumbnails file
+			"Thumbs.db"             // Windows thumbnails file
+		};
+		std::string error;
+		for (const char* name : kNames) {
+			Add(name, false, error);
+		}
+	}
+	
+	//
+	ExclusionMatcher::ExclusionMatcher(const ExclusionRules& rules) :
+	mNeedsPath(false),
+	mPrefixes(1),
+	mSuffixes(1),
+	mNFA(1),
+	mClassCount(1),
+	mStateCount(0) {
+		std::map<std::string, Winners> names;
+		std::map<std::string, Winners> paths;
+		for (size_t index = 0; index < rules.mRules.size(); ++index) {
+			const ExclusionRules::Rule& rule = rules.mRules[index];
+			mRuleIncludes.push_back(rule.mInclude);
+			mNeedsPath = mNeedsPath || rule.mAnchored;
+			Winners winners;
+			winners.mDirectory = (int32_t)index;
+			winners.mOther = rule.mDirectoriesOnly ? -1 : (int32_t)index;
+			
+			// Names are preceded by a kDirectories, which the lookups below don't need.
+			auto begin = rule.mTokens.begin() + (rule.mAnchored ? 0 : 1);
+			auto end = rule.mTokens.end();
+			auto literalCount = std::count_if(begin, end, [](const ExclusionRules::Token& token) {
+				return (token.mType == ExclusionRules::TokenType::kLiteral);
+			});
+			std::string literal;
+			for (auto it = begin; it != end; ++it) {
+				if (it->mType == ExclusionRules::TokenType::kLiteral) {
+					literal += (char)it->mLiteral;
+				}
+			}
+			if (literalCount == (end - begin)) {
+				(rule.mAnchored ? paths : names)[literal].Merge(winners);
+			}
+			else if (!rule.mAnchored && (literalCount > 0) && (literalCount == ((end - begin) - 1)) &&
+					 (begin->mType == ExclusionRules::TokenType::kName)) {
+				std::reverse(literal.begin(), literal.end());
+				AddToTrie(mSuffixes, literal, winners);
+			}
+			else if (!rule.mAnchored && (literalCount > 0) && (literalCount == ((end - begin) - 1)) &&
+					 ((end - 1)->mType == ExclusionRules::TokenType::kName)) {
+				AddToTrie(mPrefixes, literal, winners);
+			}
+			else {
+				AddToNFA(rule, winners);
+			}
+		}
+		if (!names.empty()) {
+			BuildTable(mNames, mNameKeys, mNameStarts, names);
+		}
+		if (!paths.empty()) {
+			BuildTable(mPaths, mPathKeys, mPathStarts, paths);
+		}
+		if ((mNFA.size() > 1) && !BuildDFA()) {
+			mTransitions.clear();
+			mAccepting.clear();
+			mStateCount = 0;
+		}
+	}
+	
+	//
+	void ExclusionMatcher::BuildTable(std::vector<Slot>& table,
+									  std::string& keys,
+									  std::bitset<256>& outStarts,
+									  const std::map<std::string, Winners>& entries) {
+		// At most half full.
+		size_t size = 16;
+		while (size < (entries.size() * 2)) {
+			size *= 2;
+		}
+		table.assign(size, Slot { 0, kEmptySlot, 0, Winners() });
+		for (const auto& entry : entries) {
+			uint64_t hash = HashKey(entry.first.data(), entry.first.size());
+			size_t index = (size_t)hash & (size - 1);
+			while (table[index].mOffset != kEmptySlot) {
+				index = (index + 1) & (size - 1);
+			}
+			table[index] = Slot { hash, (uint32_t)keys.size(), (uint32_t)entry.first.size(), entry.second };
+			outStarts.set((uint8_t)entry.first[0]);
+			keys += entry.first;
+		}
+	}
+	
+	//
+	ExclusionMatcher::Winners ExclusionMatcher::LookUp(const std::vector<Slot>& table,
+													   const std::string& keys,
+													   const char* key,
+													   size_t length) const {
+		uint64_t hash = HashKey(key, length);
+		size_t mask = table.size() - 1;
+		for (size_t index = (size_t)hash & mask; table[index].mOffset != kEmptySlot; index = (index + 1) & mask) {
+			const Slot& slot = table[index];
+			if ((slot.mHash == hash) && (slot.mLength == length) && (keys.compare(slot.mOffset, length, key, length) == 0)) {
+				return slot.mWinners;
+			}
+		}
+		return Winners();
+	}
+	
+	//
+	void ExclusionMatcher::AddToTrie(std::vector<TrieNode>& trie, const std::string& key, const Winners& winners) {
+		uint32_t node = 0;
+		for (char ch : key) {
+			auto& children = trie[node].mChildren;
+			auto it = std::lower_bound(children.begin(), children.end(), std::make_pair((uint8_t)ch, (uint32_t)0));
+			if ((it != children.end()) && (it->first == (uint8_t)ch)) {
+				node = it->second;
+				continue;
+			}
+			uint32_t child = (uint32_t)trie.size();
+			children.insert(it, std::make_pair((uint8_t)ch, child));
+			trie.push_back(TrieNode());
+			node = child;
+		}
+		trie[node].mWinners.Merge(winners);
+	}
+	
+	//
+	void ExclusionMatcher::AddToNFA(const ExclusionRules::Rule& rule, const Winners& winners) {
+		auto addState = [this]() {
+			mNFA.push_back(NFAState());
+			return (uint32_t)(mNFA.size() - 1);
+		};
+		uint32_t state = addState();
+		mNFA[0].mEpsilons.push_back(state);
+		for (const auto& token : rule.mTokens) {
+			uint32_t next = addState();
+			switch (token.mType) {
+				case ExclusionRules::TokenType::kLiteral: {
+					std::vector<bool> characters(256, false);
+					characters[token.mLiteral] = true;
+					mNFA[state].mEdges.push_back(std::make_pair(characters, next));
+					break;
+				}
+				case ExclusionRules::TokenType::kCharacter:
+					mNFA[state].mEdges.push_back(std::make_pair(token.mCharacters, next));
+					break;
+				case ExclusionRules::TokenType::kName:
+					mNFA[state].mEpsilons.push_back(next);
+					mNFA[next].mEdges.push_back(std::make_pair(AllButSlash(), next));
+					break;
+				case ExclusionRules::TokenType::kAnything:
+					mNFA[state].mEpsilons.push_back(next);
+					mNFA[next].mEdges.push_back(std::make_pair(std::vector<bool>(256, true), next));
+					break;
+				case ExclusionRules::TokenType::kDirectories: {
+					// Nothing, or anything ending in '/'.
+					uint32_t inside = addState();
+					std::vector<bool> slash(256, false);
+					slash['/'] = true;
+					mNFA[state].mEpsilons.push_back(next);
+					mNFA[state].mEpsilons.push_back(inside);
+					mNFA[inside].mEdges.push_back(std::make_pair(std::vector<bool>(256, true), inside));
+					mNFA[inside].mEdges.push_back(std::make_pair(slash, next));
+					break;
+				}
+			}
+			state = next;
+		}
+		mNFA[state].mWinners.Merge(winners);
+	}
+	
+	//
+	void ExclusionMatcher::CloseOverEpsilons(std::vector<uint32_t>& states) const {
+		std::vector<bool> seen(mNFA.size(), false);
+		for (uint32_t state : states) {
+			seen[state] = true;
+		}
+		for (size_t n = 0; n < states.size(); ++n) {
+			for (uint32_t next : mNFA[states[n]].mEpsilons) {
+				if (!seen[next]) {
+					seen[next] = true;
+					states.push_back(next);
+				}
+			}
+		}
+		std::sort(states.begin(), states.end());
+	}
+	
+	//
+	bool ExclusionMatcher::BuildDFA() {
+		// Split the characters into classes that every edge treats alike.
+		std::fill(mCharacterClasses, mCharacterClasses + 256, 0);
+		mClassCount = 1;
+		for (const auto& state : mNFA) {
+			for (const auto& edge : state.mEdges) {
+				std::map<std::pair<uint8_t, bool>, uint8_t> split;
+				for (int c = 0; c < 256; ++c) {
+					auto key = std::make_pair(mCharacterClasses[c], (bool)edge.first[c]);
+					auto it = split.find(key);
+					if (it == split.end()) {
+						it = split.insert(std::make_pair(key, (uint8_t)split.size())).first;
+					}
+					mCharacterClasses[c] = it->second;
+				}
+				mClassCount = split.size();
+			}
+		}
+		std::vector<uint8_t> representatives(mClassCount);
+		for (int c = 255; c >= 0; --c) {
+			representatives[mCharacterClasses[c]] = (uint8_t)c;
+		}
+		
+		std::map<std::vector<uint32_t>, uint32_t> stateIDs;
+		std::vector<std::vector<uint32_t>> stateSets;
+		auto getState = [&](std::vector<uint32_t>&& states) {
+			auto it = stateIDs.find(states);
+			if (it != stateIDs.end()) {
+				return it->second;
+			}
+			uint32_t id = (uint32_t)stateSets.size();
+			stateIDs.insert(std::make_pair(states, id));
+			Winners winners;
+			for (uint32_t state : states) {
+				winners.Merge(mNFA[state].mWinners);
+			}
+			mAccepting.push_back(winners);
+			stateSets.push_back(std::move(states));
+			return id;
+		};
+		getState(std::vector<uint32_t>());
+		std::vector<uint32_t> start(1, 0);
+		CloseOverEpsilons(start);
+		getState(std::move(start));
+		
+		for (uint32_t id = 1; id < stateSets.size(); ++id) {
+			if (stateSets.size() > kMaxDFAStates) {
+				return false;
+			}
+			mTransitions.resize(stateSets.size() * mClassCount, 0);
+			for (size_t characterClass = 0; characterClass < mClassCount; ++characterClass) {
+				uint8_t c = representatives[characterClass];
+				std::vector<uint32_t> next;
+				for (uint32_t state : stateSets[id]) {
+					for (const auto& edge : mNFA[state].mEdges) {
+						if (edge.first[c] && (std::find(next.begin(), next.end(), edge.second) == next.end())) {
+							next.push_back(edge.second);
+						}
+					}
+				}
+				CloseOverEpsilons(next);
+				uint32_t nextID = getState(std::move(next));
+				mTransitions[(id * mClassCount) + characterClass] = nextID;
+			}
+		}
+		mTransitions.resize(stateSets.size() * mClassCount, 0);
+		mStateCount = stateSets.size();
+		return true;
+	}
+	
+	//
+	ExclusionMatcher::Winners ExclusionMatcher::RunNFA(const char* pathUTF8, size_t length) const {
+		std::vector<uint32_t> states(1, 0);
+		CloseOverEpsilons(states);
+		std::vector<uint32_t> next;
+		for (size_t n = 0; (n < length) && !states.empty(); ++n) {
+			uint8_t c = (uint8_t)pathUTF8[n];
+			next.clear();
+			for (uint32_t state : states) {
+				for (const auto& edge : mNFA[state].mEdges) {
+					if (edge.first[c]) {
+						next.push_back(edge.second);
+					}
+				}
+			}
+			std::sort(next.begin(), next.end());
+			next.erase(std::unique(next.begin(), next.end()), next.end());
+			CloseOverEpsilons(next);
+			states.swap(next);
+		}
+		Winners winners;
+		for (uint32_t state : states) {
+			winners.Merge(mNFA[state].mWinners);
+		}
+		return winners;
+	}
+	
+	//
+	ExclusionMatch ExclusionMatcher::Match(const char* pathUTF8, size_t length) const {
+		const char* name = pathUTF8;
+		for (size_t n = length; n > 0; --n) {
+			if (pathUTF8[n - 1] == '/') {
+				name = pathUTF8 + n;
+				break;
+			}
+		}
+		size_t nameLength = length - (size_t)(name - pathUTF8);
+		
+		Winners winners;
+		if ((nameLength > 0) && mNameStarts.test((uint8_t)name[0])) {
+			winners.Merge(LookUp(mNames, mNameKeys, name, nameLength));
+		}
+		if ((length > 0) && mPathStarts.test((uint8_t)pathUTF8[0])) {
+			winners.Merge(LookUp(mPaths, mPathKeys, pathUTF8, length));
+		}
+		// A node's rules match every name that gets as far as it.
+		auto walk = [&winners](const std::vector<TrieNode>& trie, uint8_t c, uint32_t& node) {
+			const auto& children = trie[node].mChildren;
+			auto it = std::lower_bound(children.begin(), children.end(), std::make_pair(c, (uint32_t)0));
+			if ((it == children.end()) || (it->first != c)) {
+				return false;
+			}
+			node = it->second;
+			winners.Merge(trie[node].mWinners);
+			return true;
+		};
+		if (mPrefixes.size() > 1) {
+			uint32_t node = 0;
+			for (size_t n = 0; (n < nameLength) && walk(mPrefixes, (uint8_t)name[n], node); ++n) {
+			}
+		}
+		if (mSuffixes.size() > 1) {
+			uint32_t node = 0;
+			for (size_t n = nameLength; (n > 0) && walk(mSuffixes, (uint8_t)name[n - 1], node); --n) {
+			}
+		}
+		if (mStateCount > 0) {
+			uint32_t state = 1;
+			for (size_t n = 0; (n < length) && (state != 0); ++n) {
+				state = mTransitions[(state * mClassCount) + mCharacterClasses[(uint8_t)pathUTF8[n]]];
+			}
+			winners.Merge(mAccepting[state]);
+		}
+		else if (mNFA.size() > 1) {
+			winners.Merge(RunNFA(pathUTF8, length));
+		}
+		
+		ExclusionMatch match;
+		match.mExcludedIfDirectory = (winners.mDirectory >= 0) && !mRuleIncludes[(size_t)winners.mDirectory];
+		match.mExcludedOtherwise = (winners.mOther >= 0) && !mRuleIncludes[(size_t)winners.mOther];
+		return match;
+	}
+	
+} // namespace common
@@ -0,0 +1,248 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef ExclusionMatcher_h
+#define ExclusionMatcher_h
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace common {
+	
+	// What the rules say about an item, as far as its path alone can tell: rules ending in '/'
+	// only apply to directories, so the verdict can depend on what the item turns out to be.
+	struct ExclusionMatch {
+		//
+		ExclusionMatch() : mExcludedIfDirectory(false), mExcludedOtherwise(false) {
+		}
+		
+		//
+		bool IsExcluded(bool isDirectory) const {
+			return isDirectory ? mExcludedIfDirectory : mExcludedOtherwise;
+		}
+		
+		// True if the caller has to find out whether the item is a directory.
+		bool DependsOnType() const {
+			return (mExcludedIfDirectory != mExcludedOtherwise);
+		}
+		
+		//
+		bool mExcludedIfDirectory;
+		bool mExcludedOtherwise;
+	};
+	
+	// Exclusion rules in the style of .gitignore, matched against paths relative to the root of
+	// the tree being walked:
+	//     "Thumbs.db", "*.tmp"   a name, at any depth; "*", "?" and "[a-z]" don't match '/'
+	//     "/build", "docs/*.pdf" a '/' other than at the end anchors the pattern to the root
+	//     "src/**/test"          "**" matches any number of directories
+	//     "node_modules/"        a trailing '/' matches directories only
+	// The last rule an item matches decides, so an include can make an exception to an earlier
+	// exclude. As with git, nothing under an excluded directory can be included again, since the
+	// walk never goes in there.
+	class ExclusionRules {
+	public:
+		//
+		ExclusionRules();
+		
+		// False, with a message, if the pattern doesn't parse (an unclosed '[', say).
+		bool Add(const std::string& pattern, bool include, std::string& outError);
+		
+		// Appends rules after the ones already here.
+		void Add(const ExclusionRules& rules);
+		
+		// A .gitignore-style file: a pattern per line, '#' starts a comment line, a leading '!'
+		// makes the rule an include, and a backslash quotes the character after it.
+		bool AddFromFile(const std::string& pathUTF8, std::string& outError);
+		
+		// Items that come and go on their own, which no comparison should trip over.
+		void AddDefaults();
+		
+		//
+		bool IsEmpty() const {
+			return mRules.empty();
+		}
+		
+	private:
+		//
+		friend class ExclusionMatcher;
+		
+		//
+		enum class TokenType {
+			kLiteral,
+			// '?' and [...]: one character in mCharacters.
+			kCharacter,
+			// '*': any run of characters other than '/'.
+			kName,
+			// "**" at the end: anything at all.
+			kAnything,
+			// "**/": zero or more whole directories.
+			kDirectories
+		};
+		
+		//
+		struct Token {
+			TokenType mType;
+			uint8_t mLiteral;
+			// 256 flags, for kCharacter.
+			std::vector<bool> mCharacters;
+		};
+		
+		//
+		struct Rule {
+			std::string mPattern;
+			bool mInclude;
+			bool mDirectoriesOnly;
+			// Matched against the whole relative path rather than just the name.
+			bool mAnchored;
+			std::vector<Token> mTokens;
+		};
+		
+		//
+		std::vector<Rule> mRules;
+	};
+	
+	// ExclusionRules compiled for matching. Plain names go in a hash table, "prefix*" and
+	// "*suffix" names in a pair of tries, and every other pattern into a single DFA over the
+	// relative path, so an item costs a pass over its name and a pass over its path however many
+	// rules there are. Never changes once built, so threads can share one.
+	class ExclusionMatcher {
+	public:
+		//
+		explicit ExclusionMatcher(const ExclusionRules& rules);
+		
+		// pathUTF8 is relative to the root, "a/b/name", or can be just the name if !NeedsPath().
+		ExclusionMatch Match(const char* pathUTF8, size_t length) const;
+		
+		//
+		ExclusionMatch Match(const std::string& pathUTF8) const {
+			return Match(pathUTF8.data(), pathUTF8.size());
+		}
+		
+		// False if no rule looks further than the item's name.
+		bool NeedsPath() const {
+			return mNeedsPath;
+		}
+		
+		//
+		bool IsEmpty() const {
+			return mRuleIncludes.empty();
+		}
+		
+		// DFA states, for the curious; 0 if the globs were too tangled to build one and get
+		// simulated instead.
+		size_t GetStateCount() const {
+			return mStateCount;
+		}
+		
+	private:
+		// The last rule matched, on the assumption the item is a directory and that it isn't.
+		struct Winners {
+			//
+			Winners() : mDirectory(-1), mOther(-1) {
+			}
+			
+			//
+			void Merge(const Winners& winners) {
+				mDirectory = (winners.mDirectory > mDirectory) ? winners.mDirectory : mDirectory;
+				mOther = (winners.mOther > mOther) ? winners.mOther : mOther;
+			}
+			
+			//
+			int32_t mDirectory;
+			int32_t mOther;
+		};
+		
+		// Open addressing; keys live in mKeys.
+		struct Slot {
+			uint64_t mHash;
+			uint32_t mOffset;
+			uint32_t mLength;
+			Winners mWinners;
+		};
+		
+		//
+		struct TrieNode {
+			Winners mWinners;
+			// Sorted by character.
+			std::vector<std::pair<uint8_t, uint32_t>> mChildren;
+		};
+		
+		//
+		struct NFAState {
+			// Characters (256 flags) and the state they lead to.
+			std::vector<std::pair<std::vector<bool>, uint32_t>> mEdges;
+			std::vector<uint32_t> mEpsilons;
+			Winners mWinners;
+		};
+		
+		// outStarts gets the first character of each key, which rules out most misses without
+		// hashing.
+		void BuildTable(std::vector<Slot>& table,
+						std::string& keys,
+						std::bitset<256>& outStarts,
+						const std::map<std::string, Winners>& entries);
+		
+		//
+		Winners LookUp(const std::vector<Slot>& table, const std::string& keys, const char* key, size_t length) const;
+		
+		//
+		void AddToTrie(std::vector<TrieNode>& trie, const std::string& key, const Winners& winners);
+		
+		//
+		void AddToNFA(const ExclusionRules::Rule& rule, const Winners& winners);
+		
+		//
+		void CloseOverEpsilons(std::vector<uint32_t>& states) const;
+		
+		// False if the DFA would have more than a sane number of states.
+		bool BuildDFA();
+		
+		//
+		Winners RunNFA(const char* pathUTF8, size_t length) const;
+		
+		//
+		std::vector<bool> mRuleIncludes;
+		bool mNeedsPath;
+		std::vector<Slot> mNames;
+		std::string mNameKeys;
+		std::bitset<256> mNameStarts;
+		std::vector<Slot> mPaths;
+		std::string mPathKeys;
+		std::bitset<256> mPathStarts;
+		std::vector<TrieNode> mPrefixes;
+		std::vector<TrieNode> mSuffixes;
+		std::vector<NFAState> mNFA;
+		// Equivalence classes of characters: ones no pattern tells apart share a column.
+		uint8_t mCharacterClasses[256];
+		size_t mClassCount;
+		// mStateCount x mClassCount; state 0 is dead, state 1 the start.
+		std::vector<uint32_t> mTransitions;
+		std::vector<Winners> mAccepting;
+		size_t mStateCount;
+	};
+	typedef std::shared_ptr<const ExclusionMatcher> ExclusionMatcherPtr;
+	
+} // namespace common
+
+#endif /* ExclusionMatcher_h */
@@ -0,0 +1,105 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "HardLinkIndex.h"
+
+namespace common {
+	namespace HardLinkIndex_Impl {
+		
+		//
+		static const size_t kInitialSlotCount = 1024;
+		
+		// Inode numbers are mostly sequential, so they need mixing before they're masked.
+		inline uint64_t Mix(uint64_t value) {
+			value ^= value >> 33;
+			value *= 0xff51afd7ed558ccdULL;
+			value ^= value >> 33;
+			value *= 0xc4ceb9fe1a85ec53ULL;
+			value ^= value >> 33;
+			return value;
+		}
+		
+		//
+		inline uint64_t HashKey(const HardLinkIndex::Key& key) {
+			return Mix(key.mInode1 ^ Mix(key.mInode2 ^ Mix(key.mDevice1 ^ (key.mDevice2 << 32))));
+		}
+		
+		//
+		inline bool operator==(const HardLinkIndex::Key& lhs, const HardLinkIndex::Key& rhs) {
+			return (lhs.mInode1 == rhs.mInode1) && (lhs.mInode2 == rhs.mInode2) &&
+				   (lhs.mDevice1 == rhs.mDevice1) && (lhs.mDevice2 == rhs.mDevice2);
+		}
+		
+	} // namespace HardLinkIndex_Impl
+	using namespace HardLinkIndex_Impl;
+	
+	//
+	HardLinkIndex::HardLinkIndex() : mCount(0), mSkippedFileCount(0), mSkippedByteCount(0) {
+	}
+	
+	//
+	bool HardLinkIndex::Find(const Key& key, bool& outMatch, uint64_t& outOffset) {
+		std::lock_guard<std::mutex> guard(mMutex);
+		if (mSlots.empty()) {
+			return false;
+		}
+		const Slot& slot = mSlots[FindSlot(key)];
+		if (slot.mResult == 0) {
+			return false;
+		}
+		outMatch = (slot.mResult == 1);
+		outOffset = outMatch ? 0 : (slot.mResult - 2);
+		return true;
+	}
+	
+	//
+	void HardLinkIndex::Add(const Key& key, bool match, uint64_t offset) {
+		std::lock_guard<std::mutex> guard(mMutex);
+		if ((mCount + 1) * 2 > mSlots.size()) {
+			Grow();
+		}
+		Slot& slot = mSlots[FindSlot(key)];
+		if (slot.mResult == 0) {
+			slot.mKey = key;
+			slot.mResult = match ? 1 : (offset + 2);
+			++mCount;
+		}
+	}
+	
+	//
+	size_t HardLinkIndex::FindSlot(const Key& key) const {
+		size_t mask = mSlots.size() - 1;
+		size_t index = (size_t)HashKey(key) & mask;
+		while ((mSlots[index].mResult != 0) && !(mSlots[index].mKey == key)) {
+			index = (index + 1) & mask;
+		}
+		return index;
+	}
+	
+	//
+	void HardLinkIndex::Grow() {
+		std::vector<Slot> slots(mSlots.empty() ? kInitialSlotCount : (mSlots.size() * 2), Slot { Key { 0, 0, 0, 0 }, 0 });
+		slots.swap(mSlots);
+		for (const auto& slot : slots) {
+			if (slot.mResult != 0) {
+				mSlots[FindSlot(slot.mKey)] = slot;
+			}
+		}
+	}
+	
+} // namespace common
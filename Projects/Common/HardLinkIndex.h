@@ -0,0 +1,95 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HardLinkIndex_h
+#define HardLinkIndex_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace common {
+	
+	// Content comparison results for pairs of files with more than one link, keyed by both
+	// sides' (device, inode), so contents reached through many paths are read once. Backup trees
+	// built from hard links into earlier snapshots see the same pairs over and over. A flat
+	// open-addressing table (linear probing, doubled at half full) of 40-byte slots under one
+	// lock, which costs nothing next to the reads it saves.
+	class HardLinkIndex {
+	public:
+		//
+		struct Key {
+			uint64_t mDevice1;
+			uint64_t mInode1;
+			uint64_t mDevice2;
+			uint64_t mInode2;
+		};
+		
+		//
+		HardLinkIndex();
+		
+		// False if the pair hasn't been recorded. outOffset is the first difference if !outMatch.
+		bool Find(const Key& key, bool& outMatch, uint64_t& outOffset);
+		
+		// The first result recorded for a pair stands.
+		void Add(const Key& key, bool match, uint64_t offset);
+		
+		// A pair of size bytes settled by Find instead of being read.
+		void AddSkipped(uint64_t size) {
+			++mSkippedFileCount;
+			mSkippedByteCount += size;
+		}
+		
+		//
+		uint64_t GetSkippedFileCount() const {
+			return mSkippedFileCount;
+		}
+		
+		//
+		uint64_t GetSkippedByteCount() const {
+			return mSkippedByteCount;
+		}
+		
+	private:
+		//
+		struct Slot {
+			Key mKey;
+			// 0 for an empty slot, 1 for a match, otherwise 2 plus the offset of the first
+			// difference.
+			uint64_t mResult;
+		};
+		
+		// The slot holding key, or the empty slot where it would go.
+		size_t FindSlot(const Key& key) const;
+		
+		//
+		void Grow();
+		
+		//
+		std::mutex mMutex;
+		std::vector<Slot> mSlots;
+		size_t mCount;
+		std::atomic<uint64_t> mSkippedFileCount;
+		std::atomic<uint64_t> mSkippedByteCount;
+	};
+	
+} // namespace common
+
+#endif /* HardLinkIndex_h */
@@ -0,0 +1,143 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "IoUring.h"
+
+#if COMMON_HAVE_IO_URING
+
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace common {
+	
+	//
+	IoUring::IoUring() :
+	mRingFd(-1),
+	mSQRing(nullptr),
+	mSQRingSize(0),
+	mCQRing(nullptr),
+	mCQRingSize(0),
+	mSQEs(nullptr),
+	mSQEsSize(0),
+	mSQEntries(0),
+	mPendingTail(0) {
+	}
+	
+	//
+	IoUring::~IoUring() {
+		if (mSQEs != nullptr) {
+			munmap(mSQEs, mSQEsSize);
+		}
+		if ((mCQRing != nullptr) && (mCQRing != mSQRing)) {
+			munmap(mCQRing, mCQRingSize);
+		}
+		if (mSQRing != nullptr) {
+			munmap(mSQRing, mSQRingSize);
+		}
+		if (mRingFd >= 0) {
+			close(mRingFd);
+		}
+	}
+	
+	//
+	bool IoUring::Init(unsigned entries) {
+		struct io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		mRingFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+		if (mRingFd < 0) {
+			return false;
+		}
+		
+		mSQRingSize = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+		mCQRingSize = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+		bool singleMap = ((params.features & IORING_FEAT_SINGLE_MMAP) != 0);
+		if (singleMap && (mCQRingSize > mSQRingSize)) {
+			mSQRingSize = mCQRingSize;
+		}
+		mSQRing = (uint8_t*)Map(mSQRingSize, IORING_OFF_SQ_RING);
+		if (mSQRing == nullptr) {
+			return false;
+		}
+		mCQRing = singleMap ? mSQRing : (uint8_t*)Map(mCQRingSize, IORING_OFF_CQ_RING);
+		if (mCQRing == nullptr) {
+			return false;
+		}
+		mSQEsSize = params.sq_entries * sizeof(struct io_uring_sqe);
+		mSQEs = (struct io_uring_sqe*)Map(mSQEsSize, IORING_OFF_SQES);
+		if (mSQEs == nullptr) {
+			return false;
+		}
+		
+		mSQEntries = params.sq_entries;
+		mSQHead = (std::atomic<unsigned>*)(mSQRing + params.sq_off.head);
+		mSQTail = (std::atomic<unsigned>*)(mSQRing + params.sq_off.tail);
+		mSQMask = *(unsigned*)(mSQRing + params.sq_off.ring_mask);
+		mSQArray = (unsigned*)(mSQRing + params.sq_off.array);
+		mPendingTail = mSQTail->load(std::memory_order_relaxed);
+		mCQHead = (std::atomic<unsigned>*)(mCQRing + params.cq_off.head);
+		mCQTail = (std::atomic<unsigned>*)(mCQRing + params.cq_off.tail);
+		mCQMask = *(unsigned*)(mCQRing + params.cq_off.ring_mask);
+		mCQEs = (struct io_uring_cqe*)(mCQRing + params.cq_off.cqes);
+		return true;
+	}
+	
+	//
+	struct io_uring_sqe* IoUring::GetSQE() {
+		unsigned head = mSQHead->load(std::memory_order_acquire);
+		if ((mPendingTail - head) >= mSQEntries) {
+			return nullptr;
+		}
+		unsigned index = mPendingTail & mSQMask;
+		struct io_uring_sqe* sqe = &mSQEs[index];
+		memset(sqe, 0, sizeof(*sqe));
+		mSQArray[index] = index;
+		++mPendingTail;
+		return sqe;
+	}
+	
+	//
+	int IoUring::Submit(unsigned minComplete) {
+		unsigned tail = mSQTail->load(std::memory_order_relaxed);
+		unsigned toSubmit = mPendingTail - tail;
+		// The release store publishes the filled-in entries to the kernel.
+		mSQTail->store(mPendingTail, std::memory_order_release);
+		unsigned flags = (minComplete > 0) ? IORING_ENTER_GETEVENTS : 0;
+		while (true) {
+			int result = (int)syscall(__NR_io_uring_enter, mRingFd, toSubmit, minComplete, flags, nullptr, 0);
+			if (result >= 0) {
+				return result;
+			}
+			if (errno != EINTR) {
+				return -errno;
+			}
+		}
+	}
+	
+	//
+	void* IoUring::Map(size_t size, off_t offset) {
+		void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, offset);
+		return (p == MAP_FAILED) ? nullptr : p;
+	}
+	
+} // namespace common
+
+#endif /* COMMON_HAVE_IO_URING */
@@ -0,0 +1,106 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef IoUring_h
+#define IoUring_h
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define COMMON_HAVE_IO_URING 1
+#endif
+#endif
+
+#if COMMON_HAVE_IO_URING
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <sys/types.h>
+
+namespace common {
+	
+	// Minimal io_uring driven straight through its syscalls and shared rings, so there's no
+	// liburing dependency. Owned and used by one thread at a time.
+	class IoUring {
+	public:
+		//
+		IoUring();
+		
+		//
+		~IoUring();
+		
+		// False if the kernel doesn't support io_uring or won't let us use it.
+		bool Init(unsigned entries);
+		
+		// A zeroed submission entry to fill in, or nullptr if every entry is already queued.
+		struct io_uring_sqe* GetSQE();
+		
+		// Hands the kernel every entry filled in since the last call, and with minComplete also
+		// waits for that many completions. Returns the count submitted, or -errno.
+		int Submit(unsigned minComplete);
+		
+		// Calls function(userData, result) for each completion that's ready. Returns how many.
+		template <class Function>
+		unsigned Reap(Function function) {
+			unsigned head = mCQHead->load(std::memory_order_relaxed);
+			unsigned tail = mCQTail->load(std::memory_order_acquire);
+			unsigned count = tail - head;
+			for (; head != tail; ++head) {
+				const struct io_uring_cqe& cqe = mCQEs[head & mCQMask];
+				function(cqe.user_data, cqe.res);
+			}
+			mCQHead->store(head, std::memory_order_release);
+			return count;
+		}
+		
+		//
+		unsigned GetEntryCount() const {
+			return mSQEntries;
+		}
+		
+	private:
+		//
+		void* Map(size_t size, off_t offset);
+		
+		//
+		int mRingFd;
+		uint8_t* mSQRing;
+		size_t mSQRingSize;
+		uint8_t* mCQRing;
+		size_t mCQRingSize;
+		struct io_uring_sqe* mSQEs;
+		size_t mSQEsSize;
+		unsigned mSQEntries;
+		std::atomic<unsigned>* mSQHead;
+		std::atomic<unsigned>* mSQTail;
+		unsigned mSQMask;
+		unsigned* mSQArray;
+		unsigned mPendingTail;
+		std::atomic<unsigned>* mCQHead;
+		std::atomic<unsigned>* mCQTail;
+		unsigned mCQMask;
+		struct io_uring_cqe* mCQEs;
+	};
+	
+} // namespace common
+
+#endif /* COMMON_HAVE_IO_URING */
+
+#endif /* IoUring_h */
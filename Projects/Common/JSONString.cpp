@@ -0,0 +1,128 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cstdint>
+#include "JSONString.h"
+
+namespace common {
+	namespace JSONString_Impl {
+		
+		//
+		static const char* kHexDigits = "0123456789abcdef";
+		
+		//
+		inline bool IsContinuation(uint8_t byte) {
+			return ((byte & 0xc0) == 0x80);
+		}
+		
+		// Length of the well-formed UTF-8 sequence starting at p (RFC 3629: no overlong forms,
+		// surrogates or code points past U+10FFFF), or 0 if there isn't one.
+		size_t GetSequenceLength(const uint8_t* p, const uint8_t* end) {
+			uint8_t lead = p[0];
+			size_t length = 0;
+			uint8_t secondMin = 0x80;
+			uint8_t secondMax = 0xbf;
+			if (lead < 0x80) {
+				return 1;
+			}
+			else if ((lead >= 0xc2) && (lead <= 0xdf)) {
+				length = 2;
+			}
+			else if ((lead >= 0xe0) && (lead <= 0xef)) {
+				length = 3;
+				if (lead == 0xe0) {
+					secondMin = 0xa0;
+				}
+				else if (lead == 0xed) {
+					secondMax = 0x9f;
+				}
+			}
+			else if ((lead >= 0xf0) && (lead <= 0xf4)) {
+				length = 4;
+				if (lead == 0xf0) {
+					secondMin = 0x90;
+				}
+				else if (lead == 0xf4) {
+					secondMax = 0x8f;
+				}
+			}
+			else {
+				return 0;
+			}
+			if ((size_t)(end - p) < length) {
+				return 0;
+			}
+			if ((p[1] < secondMin) || (p[1] > secondMax)) {
+				return 0;
+			}
+			for (size_t n = 2; n < length; ++n) {
+				if (!IsContinuation(p[n])) {
+					return 0;
+				}
+			}
+			return length;
+		}
+		
+		//
+		void AppendEscapedByte(std::string& json, const char* prefix, uint8_t byte) {
+			json += prefix;
+			json += kHexDigits[byte >> 4];
+			json += kHexDigits[byte & 0x0f];
+		}
+		
+	} // namespace JSONString_Impl
+	using namespace JSONString_Impl;
+	
+	//
+	void AppendJSONString(std::string& json, const std::string& value) {
+		json += '"';
+		const uint8_t* p = (const uint8_t*)value.data();
+		const uint8_t* end = p + value.size();
+		while (p < end) {
+			uint8_t byte = *p;
+			size_t length = GetSequenceLength(p, end);
+			if (length == 0) {
+				AppendEscapedByte(json, "\\udc", byte);
+				++p;
+				continue;
+			}
+			if (length > 1) {
+				json.append((const char*)p, length);
+				p += length;
+				continue;
+			}
+			switch (byte) {
+				case '"': json += "\\\""; break;
+				case '\\': json += "\\\\"; break;
+				case '\n': json += "\\n"; break;
+				case '\r': json += "\\r"; break;
+				case '\t': json += "\\t"; break;
+				default:
+					if (byte < 0x20) {
+						AppendEscapedByte(json, "\\u00", byte);
+					}
+					else {
+						json += (char)byte;
+					}
+			}
+			++p;
+		}
+		json += '"';
+	}
+	
+} // namespace common
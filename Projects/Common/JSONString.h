@@ -0,0 +1,35 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef JSONString_h
+#define JSONString_h
+
+#include <string>
+
+namespace common {
+	
+	// Appends value to json as a quoted JSON string. Paths are bytes and needn't be valid UTF-8, so
+	// each byte that isn't part of a well-formed UTF-8 sequence is written as \udcXX, XX being the
+	// byte in hex: the lone low surrogate U+DC80 + byte, as in Python's "surrogateescape". Valid
+	// text never produces these, so a reader can recover the original bytes exactly (in Python,
+	// os.fsencode(value)).
+	void AppendJSONString(std::string& json, const std::string& value);
+	
+} // namespace common
+
+#endif /* JSONString_h */
@@ -0,0 +1,434 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/xattr.h>
+#include <thread>
+#include <unistd.h>
+#include "Completion.h"
+#include "IoUring.h"
+#include "PhaseTimer.h"
+#include "StatUtilities.h"
+#include "WorkStealingPool.h"
+#include "MetadataSnapshot.h"
+
+#if COMMON_HAVE_IO_URING && defined(STATX_BASIC_STATS)
+#define METADATA_SNAPSHOT_STATX 1
+#include <sys/sysmacros.h>
+#endif
+
+namespace common {
+	namespace MetadataSnapshot_Impl {
+		
+		//
+		static const size_t kMaxCachedSnapshots = 1024;
+		
+		// Directories smaller than this are read on the calling thread; handing them to the pool
+		// costs more than it saves.
+		static const size_t kParallelThreshold = 64;
+		static const size_t kEntriesPerTask = 64;
+		
+		//
+		static const unsigned kRingEntries = 256;
+		
+		//
+		ssize_t ListXAttrs(const std::string& pathUTF8, char* buffer, size_t size) {
+#if defined(__APPLE__)
+			return listxattr(pathUTF8.c_str(), buffer, size, XATTR_NOFOLLOW);
+#else
+			return llistxattr(pathUTF8.c_str(), buffer, size);
+#endif
+		}
+		
+		//
+		ssize_t GetXAttr(const std::string& pathUTF8, const char* name, void* buffer, size_t size) {
+#if defined(__APPLE__)
+			return getxattr(pathUTF8.c_str(), name, buffer, size, 0, XATTR_NOFOLLOW);
+#else
+			return lgetxattr(pathUTF8.c_str(), name, buffer, size);
+#endif
+		}
+		
+		//
+		void FillFromStat(DirectorySnapshot& snapshot, size_t index, const struct stat& s) {
+			snapshot.mModes[index] = (uint32_t)s.st_mode;
+			snapshot.mUserIDs[index] = (uint32_t)s.st_uid;
+			snapshot.mGroupIDs[index] = (uint32_t)s.st_gid;
+			snapshot.mDevices[index] = (uint64_t)s.st_dev;
+			snapshot.mInodes[index] = (uint64_t)s.st_ino;
+			snapshot.mLinkCounts[index] = (uint32_t)s.st_nlink;
+			snapshot.mSizes[index] = (uint64_t)s.st_size;
+			snapshot.mModificationTimes[index] = GetModificationTimeNs(s);
+			snapshot.mChangeTimes[index] = GetChangeTimeNs(s);
+#if defined(__APPLE__)
+			snapshot.mFlags[index] = (uint32_t)s.st_flags;
+			snapshot.mBirthTimes[index] = ((int64_t)s.st_birthtimespec.tv_sec * 1000000000) + s.st_birthtimespec.tv_nsec;
+#endif
+			snapshot.mValid[index] |= DirectorySnapshot::kStatValid;
+		}
+		
+		//
+		void FillFromStat(SnapshotEntry& entry, const struct stat& s) {
+			entry.mMode = (uint32_t)s.st_mode;
+			entry.mUserID = (uint32_t)s.st_uid;
+			entry.mGroupID = (uint32_t)s.st_gid;
+			entry.mDevice = (uint64_t)s.st_dev;
+			entry.mInode = (uint64_t)s.st_ino;
+			entry.mLinkCount = (uint32_t)s.st_nlink;
+			entry.mSize = (uint64_t)s.st_size;
+			entry.mModificationTime = GetModificationTimeNs(s);
+			entry.mChangeTime = GetChangeTimeNs(s);
+#if defined(__APPLE__)
+			entry.mFlags = (uint32_t)s.st_flags;
+			entry.mBirthTime = ((int64_t)s.st_birthtimespec.tv_sec * 1000000000) + s.st_birthtimespec.tv_nsec;
+#endif
+			entry.mValid |= DirectorySnapshot::kStatValid;
+		}
+		
+		//
+		void StatEntries(int directoryFd, DirectorySnapshot& snapshot, size_t begin, size_t end) {
+			for (size_t n = begin; n < end; ++n) {
+				struct stat s;
+				if (fstatat(directoryFd, snapshot.mNames[n].c_str(), &s, AT_SYMLINK_NOFOLLOW) == 0) {
+					FillFromStat(snapshot, n, s);
+				}
+			}
+		}
+		
+		//
+		void ReadEntryXAttrs(const std::string& directoryUTF8, DirectorySnapshot& snapshot, size_t begin, size_t end) {
+			for (size_t n = begin; n < end; ++n) {
+				if (((snapshot.mValid[n] & DirectorySnapshot::kStatValid) != 0) && S_ISREG(snapshot.mModes[n]) &&
+					ReadXAttrs(directoryUTF8 + "/" + snapshot.mNames[n], snapshot.mXAttrs[n])) {
+					snapshot.mValid[n] |= DirectorySnapshot::kXAttrsValid;
+				}
+			}
+		}
+		
+		// Shared by every snapshotter. The work is mostly waiting on the file system, so it's
+		// worth having more threads than cores.
+		WorkStealingPool& GetPool() {
+			static WorkStealingPool pool(std::max<size_t>(8, std::thread::hardware_concurrency()));
+			return pool;
+		}
+		
+		// Runs function(begin, end) over [0, count), split across the pool if count is large
+		// enough to be worth it, and returns once every range is done.
+		template <class Function>
+		void ForEachRange(size_t count, Function function) {
+			if (count < kParallelThreshold) {
+				function(0, count);
+				return;
+			}
+			size_t taskCount = (count + kEntriesPerTask - 1) / kEntriesPerTask;
+			auto remaining = std::make_shared<std::atomic<size_t>>(taskCount);
+			auto done = std::make_shared<Completion<bool>>(false);
+			for (size_t begin = 0; begin < count; begin += kEntriesPerTask) {
+				size_t end = std::min(begin + kEntriesPerTask, count);
+				GetPool().Submit([begin, end, remaining, done, &function]() {
+					function(begin, end);
+					if (--(*remaining) == 0) {
+						done->Signal(true);
+					}
+				});
+			}
+			done->Wait();
+		}
+		
+#if METADATA_SNAPSHOT_STATX
+		//
+		void FillFromStatx(DirectorySnapshot& snapshot, size_t index, const struct statx& s) {
+			snapshot.mModes[index] = s.stx_mode;
+			snapshot.mUserIDs[index] = s.stx_uid;
+			snapshot.mGroupIDs[index] = s.stx_gid;
+			snapshot.mDevices[index] = (uint64_t)makedev(s.stx_dev_major, s.stx_dev_minor);
+			snapshot.mInodes[index] = s.stx_ino;
+			snapshot.mLinkCounts[index] = s.stx_nlink;
+			snapshot.mSizes[index] = s.stx_size;
+			snapshot.mModificationTimes[index] = ((int64_t)s.stx_mtime.tv_sec * 1000000000) + s.stx_mtime.tv_nsec;
+			snapshot.mChangeTimes[index] = ((int64_t)s.stx_ctime.tv_sec * 1000000000) + s.stx_ctime.tv_nsec;
+			if ((s.stx_mask & STATX_BTIME) != 0) {
+				snapshot.mBirthTimes[index] = ((int64_t)s.stx_btime.tv_sec * 1000000000) + s.stx_btime.tv_nsec;
+			}
+			snapshot.mValid[index] |= DirectorySnapshot::kStatValid;
+		}
+		
+		// A ring per thread, created on first use.
+		struct StatxRing {
+			//
+			StatxRing() : mUsable(false) {
+				mUsable = mRing.Init(kRingEntries);
+			}
+			
+			//
+			IoUring mRing;
+			bool mUsable;
+		};
+		
+		// Stats every entry with IORING_OP_STATX, keeping up to kRingEntries in flight. Entries
+		// that fail are left for fstatat. False if io_uring can't be used for this at all.
+		bool StatEntriesWithIoUring(int directoryFd, DirectorySnapshot& snapshot) {
+			static thread_local StatxRing statxRing;
+			if (!statxRing.mUsable) {
+				return false;
+			}
+			IoUring& ring = statxRing.mRing;
+			size_t count = snapshot.GetCount();
+			std::vector<struct statx> results(count);
+			size_t next = 0;
+			size_t inFlight = 0;
+			size_t unsupportedCount = 0;
+			while ((next < count) || (inFlight > 0)) {
+				while ((next < count) && (inFlight < kRingEntries)) {
+					struct io_uring_sqe* sqe = ring.GetSQE();
+					if (sqe == nullptr) {
+						break;
+					}
+					sqe->opcode = IORING_OP_STATX;
+					sqe->fd = directoryFd;
+					sqe->addr = (uint64_t)(uintptr_t)snapshot.mNames[next].c_str();
+					sqe->len = STATX_BASIC_STATS | STATX_BTIME;
+					sqe->off = (uint64_t)(uintptr_t)&results[next];
+					sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+					sqe->user_data = next;
+					++next;
+					++inFlight;
+				}
+				if (ring.Submit(1) < 0) {
+					// Anything still in flight could land in results after it's gone.
+					statxRing.mUsable = false;
+					return false;
+				}
+				inFlight -= ring.Reap([&](uint64_t userData, int result) {
+					if (result == 0) {
+						FillFromStatx(snapshot, (size_t)userData, results[(size_t)userData]);
+					}
+					else if (result == -EINVAL) {
+						++unsupportedCount;
+					}
+				});
+			}
+			if ((count > 0) && (unsupportedCount == count)) {
+				// Kernel predates IORING_OP_STATX.
+				statxRing.mUsable = false;
+			}
+			return true;
+		}
+#endif
+		
+	} // namespace MetadataSnapshot_Impl
+	using namespace MetadataSnapshot_Impl;
+	
+	//
+	bool ReadXAttrs(const std::string& pathUTF8, std::string& outXAttrs) {
+		ssize_t listSize = ListXAttrs(pathUTF8, nullptr, 0);
+		if (listSize <= 0) {
+			return (listSize == 0);
+		}
+		std::vector<char> nameList((size_t)listSize);
+		listSize = ListXAttrs(pathUTF8, nameList.data(), nameList.size());
+		if (listSize < 0) {
+			return false;
+		}
+		std::vector<std::string> names;
+		for (const char* name = nameList.data(); name < (nameList.data() + listSize); name += strlen(name) + 1) {
+			names.push_back(name);
+		}
+		std::sort(names.begin(), names.end());
+		
+		for (const auto& name : names) {
+			ssize_t valueSize = GetXAttr(pathUTF8, name.c_str(), nullptr, 0);
+			if (valueSize < 0) {
+				return false;
+			}
+			std::string value((size_t)valueSize, 0);
+			if ((valueSize > 0) && (GetXAttr(pathUTF8, name.c_str(), &value[0], value.size()) != valueSize)) {
+				return false;
+			}
+			uint32_t size = (uint32_t)valueSize;
+			outXAttrs.append(name.c_str(), name.size() + 1);
+			outXAttrs.append((const char*)&size, sizeof(size));
+			outXAttrs += value;
+		}
+		return true;
+	}
+	
+	//
+	bool DirectorySnapshot::Find(const std::string& name, size_t& outIndex) const {
+		auto it = std::lower_bound(mNames.begin(), mNames.end(), name);
+		if ((it == mNames.end()) || (*it != name)) {
+			return false;
+		}
+		outIndex = (size_t)(it - mNames.begin());
+		return true;
+	}
+	
+	//
+	void SnapshotEntry::Assign(const DirectorySnapshot& snapshot, size_t index) {
+		mValid = snapshot.mValid[index];
+		mMode = snapshot.mModes[index];
+		mUserID = snapshot.mUserIDs[index];
+		mGroupID = snapshot.mGroupIDs[index];
+		mFlags = snapshot.mFlags[index];
+		mDevice = snapshot.mDevices[index];
+		mInode = snapshot.mInodes[index];
+		mLinkCount = snapshot.mLinkCounts[index];
+		mSize = snapshot.mSizes[index];
+		mModificationTime = snapshot.mModificationTimes[index];
+		mChangeTime = snapshot.mChangeTimes[index];
+		mBirthTime = snapshot.mBirthTimes[index];
+		mXAttrs = snapshot.mXAttrs[index];
+	}
+	
+	//
+	MetadataSnapshotter::MetadataSnapshotter() {
+	}
+	
+	//
+	bool MetadataSnapshotter::Lookup(const std::string& directoryUTF8, const std::string& name, SnapshotEntry& outEntry) {
+		DirectorySnapshotPtr snapshot;
+		size_t index = 0;
+		{
+			std::lock_guard<std::mutex> guard(mMutex);
+			auto it = mSnapshots.find(directoryUTF8);
+			if (it != mSnapshots.end()) {
+				snapshot = it->second.mSnapshot;
+				if (snapshot->Find(name, index)) {
+					outEntry.Assign(*snapshot, index);
+					if (++it->second.mLookupCount >= snapshot->GetCount()) {
+						mAges.erase(it->second.mAge);
+						mSnapshots.erase(it);
+					}
+					return true;
+				}
+				return false;
+			}
+		}
+		
+		snapshot = TakeSnapshot(directoryUTF8);
+		if ((snapshot == nullptr) || !snapshot->Find(name, index)) {
+			return false;
+		}
+		outEntry.Assign(*snapshot, index);
+		if (snapshot->GetCount() > 1) {
+			std::lock_guard<std::mutex> guard(mMutex);
+			if (mSnapshots.find(directoryUTF8) == mSnapshots.end()) {
+				CachedSnapshot cached;
+				cached.mSnapshot = snapshot;
+				cached.mLookupCount = 1;
+				cached.mAge = mAges.insert(mAges.end(), directoryUTF8);
+				mSnapshots.insert(SnapshotMap::value_type(directoryUTF8, cached));
+				if (mSnapshots.size() > kMaxCachedSnapshots) {
+					mSnapshots.erase(mAges.front());
+					mAges.pop_front();
+				}
+			}
+		}
+		return true;
+	}
+	
+	//
+	DirectorySnapshotPtr MetadataSnapshotter::TakeSnapshot(const std::string& directoryUTF8) {
+		auto snapshot = std::make_shared<DirectorySnapshot>();
+		int directoryFd = -1;
+		{
+			PhaseScope scope(Phase::kTraverse);
+			directoryFd = open(directoryUTF8.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (directoryFd < 0) {
+				return nullptr;
+			}
+			// fdopendir takes over the descriptor, so read the names through a duplicate.
+			int listFd = dup(directoryFd);
+			DIR* dir = (listFd >= 0) ? fdopendir(listFd) : nullptr;
+			if (dir == nullptr) {
+				if (listFd >= 0) {
+					close(listFd);
+				}
+				close(directoryFd);
+				return nullptr;
+			}
+			while (struct dirent* entry = readdir(dir)) {
+				if ((strcmp(entry->d_name, ".") != 0) && (strcmp(entry->d_name, "..") != 0)) {
+					snapshot->mNames.push_back(entry->d_name);
+				}
+			}
+			closedir(dir);
+			std::sort(snapshot->mNames.begin(), snapshot->mNames.end());
+		}
+		PhaseScope scope(Phase::kStat);
+		
+		size_t count = snapshot->GetCount();
+		snapshot->mValid.resize(count, 0);
+		snapshot->mModes.resize(count, 0);
+		snapshot->mUserIDs.resize(count, 0);
+		snapshot->mGroupIDs.resize(count, 0);
+		snapshot->mFlags.resize(count, 0);
+		snapshot->mDevices.resize(count, 0);
+		snapshot->mInodes.resize(count, 0);
+		snapshot->mLinkCounts.resize(count, 0);
+		snapshot->mSizes.resize(count, 0);
+		snapshot->mModificationTimes.resize(count, 0);
+		snapshot->mChangeTimes.resize(count, 0);
+		snapshot->mBirthTimes.resize(count, 0);
+		snapshot->mXAttrs.resize(count);
+		
+		bool statted = false;
+#if METADATA_SNAPSHOT_STATX
+		statted = StatEntriesWithIoUring(directoryFd, *snapshot);
+#endif
+		DirectorySnapshot& s = *snapshot;
+		ForEachRange(count, [&](size_t begin, size_t end) {
+			if (!statted) {
+				StatEntries(directoryFd, s, begin, end);
+			}
+			else {
+				// Retry just the entries io_uring couldn't do.
+				for (size_t n = begin; n < end; ++n) {
+					if ((s.mValid[n] & DirectorySnapshot::kStatValid) == 0) {
+						StatEntries(directoryFd, s, n, n + 1);
+					}
+				}
+			}
+			ReadEntryXAttrs(directoryUTF8, s, begin, end);
+		});
+		close(directoryFd);
+		return snapshot;
+	}
+	
+	//
+	bool MetadataSnapshotter::ReadItem(const std::string& directoryUTF8, const std::string& name, SnapshotEntry& outEntry) {
+		PhaseScope scope(Phase::kStat);
+		std::string pathUTF8(directoryUTF8 + "/" + name);
+		struct stat s;
+		if (lstat(pathUTF8.c_str(), &s) != 0) {
+			return false;
+		}
+		outEntry = SnapshotEntry();
+		FillFromStat(outEntry, s);
+		if (S_ISREG(s.st_mode) && ReadXAttrs(pathUTF8, outEntry.mXAttrs)) {
+			outEntry.mValid |= DirectorySnapshot::kXAttrsValid;
+		}
+		return true;
+	}
+	
+} // namespace common
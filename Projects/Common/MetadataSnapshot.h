@@ -0,0 +1,229 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef MetadataSnapshot_h
+#define MetadataSnapshot_h
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace common {
+	
+	// The metadata of every entry in one directory, sorted by name and laid out as one array
+	// per field so a pass over a single field stays in cache.
+	class DirectorySnapshot {
+	public:
+		//
+		enum : uint8_t {
+			kStatValid = 1,
+			kXAttrsValid = 2
+		};
+		
+		// False if there's no entry called name.
+		bool Find(const std::string& name, size_t& outIndex) const;
+		
+		//
+		size_t GetCount() const {
+			return mNames.size();
+		}
+		
+		//
+		std::vector<std::string> mNames;
+		std::vector<uint8_t> mValid;
+		std::vector<uint32_t> mModes;
+		std::vector<uint32_t> mUserIDs;
+		std::vector<uint32_t> mGroupIDs;
+		// BSD file flags; always 0 where there are none.
+		std::vector<uint32_t> mFlags;
+		std::vector<uint64_t> mDevices;
+		std::vector<uint64_t> mInodes;
+		std::vector<uint32_t> mLinkCounts;
+		std::vector<uint64_t> mSizes;
+		std::vector<int64_t> mModificationTimes;
+		std::vector<int64_t> mChangeTimes;
+		// 0 where the file system doesn't keep one.
+		std::vector<int64_t> mBirthTimes;
+		// Regular files only: every extended attribute, sorted by name and serialized, so two
+		// files have the same xattrs exactly when these compare equal.
+		std::vector<std::string> mXAttrs;
+	};
+	typedef std::shared_ptr<const DirectorySnapshot> DirectorySnapshotPtr;
+	
+	// The metadata of one item, copied out of a DirectorySnapshot or read on its own. Times are in
+	// nanoseconds.
+	struct SnapshotEntry {
+		//
+		SnapshotEntry() :
+		mValid(0),
+		mMode(0),
+		mUserID(0),
+		mGroupID(0),
+		mFlags(0),
+		mDevice(0),
+		mInode(0),
+		mLinkCount(0),
+		mSize(0),
+		mModificationTime(0),
+		mChangeTime(0),
+		mBirthTime(0) {
+		}
+		
+		// Copies entry index of snapshot.
+		void Assign(const DirectorySnapshot& snapshot, size_t index);
+		
+		//
+		bool HasStat() const {
+			return ((mValid & DirectorySnapshot::kStatValid) != 0);
+		}
+		
+		//
+		bool HasXAttrs() const {
+			return ((mValid & DirectorySnapshot::kXAttrsValid) != 0);
+		}
+		
+		//
+		bool IsRegularFile() const {
+			return HasStat() && S_ISREG(mMode);
+		}
+		
+		//
+		uint32_t GetMode() const {
+			return mMode;
+		}
+		
+		//
+		uint32_t GetUserID() const {
+			return mUserID;
+		}
+		
+		//
+		uint32_t GetGroupID() const {
+			return mGroupID;
+		}
+		
+		//
+		uint32_t GetFlags() const {
+			return mFlags;
+		}
+		
+		//
+		uint64_t GetDevice() const {
+			return mDevice;
+		}
+		
+		//
+		uint64_t GetInode() const {
+			return mInode;
+		}
+		
+		//
+		uint32_t GetLinkCount() const {
+			return mLinkCount;
+		}
+		
+		//
+		uint64_t GetSize() const {
+			return mSize;
+		}
+		
+		//
+		int64_t GetModificationTime() const {
+			return mModificationTime;
+		}
+		
+		//
+		int64_t GetChangeTime() const {
+			return mChangeTime;
+		}
+		
+		//
+		int64_t GetBirthTime() const {
+			return mBirthTime;
+		}
+		
+		//
+		const std::string& GetXAttrs() const {
+			return mXAttrs;
+		}
+		
+		//
+		uint8_t mValid;
+		uint32_t mMode;
+		uint32_t mUserID;
+		uint32_t mGroupID;
+		uint32_t mFlags;
+		uint64_t mDevice;
+		uint64_t mInode;
+		uint32_t mLinkCount;
+		uint64_t mSize;
+		int64_t mModificationTime;
+		int64_t mChangeTime;
+		int64_t mBirthTime;
+		std::string mXAttrs;
+	};
+	
+	// Every extended attribute of the item, without following a symbolic link (ACLs and, on macOS,
+	// Finder info and resource forks among them) as name, NUL, 32-bit length, value, in name order.
+	// False if any of it couldn't be read.
+	bool ReadXAttrs(const std::string& pathUTF8, std::string& outXAttrs);
+	
+	// Reads whole directories at once, batching the per-entry stat calls (statx through io_uring
+	// on Linux, a thread pool elsewhere) and the xattr reads (thread pool) across the directory.
+	// CompareFiles asks about a directory's items one at a time, so recent snapshots are kept
+	// until each of their entries has been looked up.
+	class MetadataSnapshotter {
+	public:
+		//
+		MetadataSnapshotter();
+		
+		// False if the directory can't be read or has no entry called name.
+		bool Lookup(const std::string& directoryUTF8, const std::string& name, SnapshotEntry& outEntry);
+		
+		// A fresh snapshot of the directory, or nullptr if it can't be read.
+		static DirectorySnapshotPtr TakeSnapshot(const std::string& directoryUTF8);
+		
+		// Just the one item, with an lstat and its own xattr reads. False if it can't be statted.
+		static bool ReadItem(const std::string& directoryUTF8, const std::string& name, SnapshotEntry& outEntry);
+		
+	private:
+		//
+		struct CachedSnapshot {
+			DirectorySnapshotPtr mSnapshot;
+			size_t mLookupCount;
+			std::list<std::string>::iterator mAge;
+		};
+		typedef std::map<std::string, CachedSnapshot> SnapshotMap;
+		
+		//
+		std::mutex mMutex;
+		SnapshotMap mSnapshots;
+		// Oldest first, for evicting snapshots whose directories were never fully visited.
+		std::list<std::string> mAges;
+	};
+	typedef std::shared_ptr<MetadataSnapshotter> MetadataSnapshotterPtr;
+	
+} // namespace common
+
+#endif /* MetadataSnapshot_h */
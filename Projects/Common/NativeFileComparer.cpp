@@ -0,0 +1,235 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "Hermit/File/GetFilePathUTF8String.h"
+#include "ContentCompare.h"
+#include "NativeFileComparer.h"
+#include "Progress.h"
+
+namespace common {
+	namespace NativeFileComparer_Impl {
+		
+		// Only pairs where either side has other links can turn up again under another path.
+		bool IsLinked(const SnapshotEntry& entry1, const SnapshotEntry& entry2) {
+			return (entry1.GetLinkCount() > 1) || (entry2.GetLinkCount() > 1);
+		}
+		
+		//
+		HardLinkIndex::Key MakeHardLinkKey(const SnapshotEntry& entry1, const SnapshotEntry& entry2) {
+			return HardLinkIndex::Key { entry1.GetDevice(), entry1.GetInode(), entry2.GetDevice(), entry2.GetInode() };
+		}
+		
+		//
+		std::string StripTrailingSlash(const std::string& pathUTF8) {
+			if ((pathUTF8.size() > 1) && (pathUTF8.back() == '/')) {
+				return pathUTF8.substr(0, pathUTF8.size() - 1);
+			}
+			return pathUTF8;
+		}
+		
+	} // namespace NativeFileComparer_Impl
+	using namespace NativeFileComparer_Impl;
+	
+	//
+	const char* kNativeCompareNotification = "common.NativeCompare";
+	
+	//
+	NativeFileComparer::NativeFileComparer(const std::string& root1UTF8,
+										   const std::string& root2UTF8,
+										   bool ignoreDates,
+										   bool useSnapshots,
+										   const ReadPipelineOptions& readOptions) :
+	mRoot1UTF8(StripTrailingSlash(root1UTF8)),
+	mRoot2UTF8(StripTrailingSlash(root2UTF8)),
+	mIgnoreDates(ignoreDates),
+	mUseSnapshots(useSnapshots),
+	mReadOptions(readOptions) {
+	}
+	
+	//
+	bool NativeFileComparer::GetItemPaths(const hermit::HermitPtr& h_,
+										  const hermit::file::FilePathPtr& parent,
+										  const std::string& itemName,
+										  std::string& outPath1UTF8,
+										  std::string& outPath2UTF8) const {
+		std::string parentUTF8;
+		hermit::file::GetFilePathUTF8String(h_, parent, parentUTF8);
+		if (parentUTF8.compare(0, mRoot1UTF8.size(), mRoot1UTF8) != 0) {
+			return false;
+		}
+		std::string relativePathUTF8(parentUTF8, mRoot1UTF8.size());
+		if (!relativePathUTF8.empty() && (relativePathUTF8[0] != '/')) {
+			return false;
+		}
+		relativePathUTF8 += "/" + itemName;
+		outPath1UTF8 = mRoot1UTF8 + relativePathUTF8;
+		outPath2UTF8 = mRoot2UTF8 + relativePathUTF8;
+		return true;
+	}
+	
+	//
+	bool NativeFileComparer::GetItemMetadata(const hermit::HermitPtr& h_,
+											 const hermit::file::FilePathPtr& parent,
+											 const std::string& itemName,
+											 std::string& outPath1UTF8,
+											 std::string& outPath2UTF8,
+											 SnapshotEntry& outEntry1,
+											 SnapshotEntry& outEntry2) {
+		if (!GetItemPaths(h_, parent, itemName, outPath1UTF8, outPath2UTF8)) {
+			return false;
+		}
+		return LookupItem(outPath1UTF8, itemName, outEntry1) && LookupItem(outPath2UTF8, itemName, outEntry2);
+	}
+	
+	//
+	bool NativeFileComparer::IsExcluded(const hermit::HermitPtr& h_,
+										const hermit::file::FilePathPtr& parent,
+										const std::string& itemName,
+										const ExclusionMatcher& exclusions) {
+		if (exclusions.IsEmpty()) {
+			return false;
+		}
+		std::string path1UTF8;
+		std::string path2UTF8;
+		ExclusionMatch match;
+		if (exclusions.NeedsPath()) {
+			if (!GetItemPaths(h_, parent, itemName, path1UTF8, path2UTF8)) {
+				return false;
+			}
+			size_t rootLength = mRoot1UTF8.size() + 1;
+			match = exclusions.Match(path1UTF8.data() + rootLength, path1UTF8.size() - rootLength);
+		}
+		else {
+			match = exclusions.Match(itemName);
+		}
+		if (!match.DependsOnType()) {
+			return match.IsExcluded(false);
+		}
+		
+		if (path1UTF8.empty() && !GetItemPaths(h_, parent, itemName, path1UTF8, path2UTF8)) {
+			return false;
+		}
+		// From whichever side has it.
+		SnapshotEntry entry;
+		bool found = LookupItem(path1UTF8, itemName, entry) || LookupItem(path2UTF8, itemName, entry);
+		return match.IsExcluded(found && entry.HasStat() && S_ISDIR(entry.GetMode()));
+	}
+	
+	//
+	bool NativeFileComparer::CompareLinkedPair(const hermit::HermitPtr& h_,
+											   const std::string& path1UTF8,
+											   const std::string& path2UTF8,
+											   const SnapshotEntry& entry1,
+											   const SnapshotEntry& entry2) {
+		if (!entry1.IsRegularFile() || !entry2.IsRegularFile() || !IsLinked(entry1, entry2) ||
+			!MetadataMatches(entry1, entry2)) {
+			return false;
+		}
+		NativeCompareParams params(path1UTF8, path2UTF8);
+		if (!mHardLinks.Find(MakeHardLinkKey(entry1, entry2), params.mMatch, params.mOffset)) {
+			return false;
+		}
+		mHardLinks.AddSkipped(entry1.GetSize());
+		if (mReadOptions.mProgress != nullptr) {
+			mReadOptions.mProgress->AddBytes(entry1.GetSize());
+		}
+		NOTIFY(h_, kNativeCompareNotification, &params);
+		return true;
+	}
+	
+	//
+	bool NativeFileComparer::Compare(const hermit::HermitPtr& h_,
+									 const std::string& path1UTF8,
+									 const std::string& path2UTF8,
+									 const SnapshotEntry& entry1,
+									 const SnapshotEntry& entry2,
+									 bool calculateDigest) {
+		if (!entry1.IsRegularFile() || !entry2.IsRegularFile() || !MetadataMatches(entry1, entry2)) {
+			return false;
+		}
+		
+		Sha256 hasher;
+		uint64_t offset = 0;
+		auto status = CompareFileContents(path1UTF8,
+										  path2UTF8,
+										  mReadOptions,
+										  &mThroughput,
+										  offset,
+										  calculateDigest ? &hasher : nullptr);
+		if (status == FileContentCompareStatus::kError) {
+			// CompareFiles will run into the same problem and report it properly.
+			return false;
+		}
+		
+		NativeCompareParams params(path1UTF8, path2UTF8);
+		Sha256Digest digest;
+		if (status == FileContentCompareStatus::kMatch) {
+			params.mMatch = true;
+			if (calculateDigest) {
+				digest = hasher.Finish();
+				params.mDigest = &digest;
+			}
+		}
+		else {
+			params.mOffset = offset;
+		}
+		if (IsLinked(entry1, entry2)) {
+			mHardLinks.Add(MakeHardLinkKey(entry1, entry2), params.mMatch, params.mOffset);
+		}
+		NOTIFY(h_, kNativeCompareNotification, &params);
+		return true;
+	}
+	
+	// Everything CompareFiles checks on a regular file besides its contents. Any mismatch, or
+	// anything we couldn't read, sends the pair back to CompareFiles so the difference is
+	// reported in its usual form.
+	bool NativeFileComparer::MetadataMatches(const SnapshotEntry& entry1, const SnapshotEntry& entry2) const {
+		if ((entry1.GetSize() != entry2.GetSize()) ||
+			(entry1.GetMode() != entry2.GetMode()) ||
+			(entry1.GetUserID() != entry2.GetUserID()) ||
+			(entry1.GetGroupID() != entry2.GetGroupID()) ||
+			(entry1.GetFlags() != entry2.GetFlags())) {
+			return false;
+		}
+		if (!mIgnoreDates) {
+			if (entry1.GetModificationTime() != entry2.GetModificationTime()) {
+				return false;
+			}
+#if defined(__APPLE__)
+			if (entry1.GetBirthTime() != entry2.GetBirthTime()) {
+				return false;
+			}
+#endif
+		}
+		return entry1.HasXAttrs() && entry2.HasXAttrs() && (entry1.GetXAttrs() == entry2.GetXAttrs());
+	}
+	
+	// pathUTF8 ends in "/" + itemName.
+	bool NativeFileComparer::LookupItem(const std::string& pathUTF8, const std::string& itemName, SnapshotEntry& outEntry) {
+		std::string directoryUTF8(pathUTF8, 0, pathUTF8.size() - itemName.size() - 1);
+		if (directoryUTF8.empty()) {
+			directoryUTF8 = "/";
+		}
+		if (mUseSnapshots) {
+			return mSnapshotter.Lookup(directoryUTF8, itemName, outEntry);
+		}
+		return MetadataSnapshotter::ReadItem(directoryUTF8, itemName, outEntry);
+	}
+	
+} // namespace common
@@ -0,0 +1,151 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef NativeFileComparer_h
+#define NativeFileComparer_h
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "Hermit/File/FilePath.h"
+#include "Hermit/Foundation/Hermit.h"
+#include "ContentCompare.h"
+#include "ExclusionMatcher.h"
+#include "HardLinkIndex.h"
+#include "MetadataSnapshot.h"
+#include "Sha256.h"
+
+namespace common {
+	
+	// Sent (with NativeCompareParams) for each pair of files NativeFileComparer settles, in place
+	// of the notifications CompareFiles would have sent.
+	extern const char* kNativeCompareNotification;
+	
+	//
+	struct NativeCompareParams {
+		//
+		NativeCompareParams(const std::string& path1UTF8, const std::string& path2UTF8) :
+		mPath1UTF8(path1UTF8),
+		mPath2UTF8(path2UTF8),
+		mMatch(false),
+		mOffset(0),
+		mDigest(nullptr) {
+		}
+		
+		//
+		std::string mPath1UTF8;
+		std::string mPath2UTF8;
+		bool mMatch;
+		// Offset to the first difference, if the contents differ.
+		uint64_t mOffset;
+		// Digest of the contents, if they match and one was asked for.
+		const Sha256Digest* mDigest;
+	};
+	
+	// Compares regular files itself instead of leaving them to CompareFiles, reading both in
+	// large blocks through FindFirstDifference. Metadata comes from an lstat and xattr reads per
+	// item or, with useSnapshots, from per-directory snapshots (which haven't yet been measured
+	// faster on local disks). Only pairs whose metadata it can fully
+	// account for are settled here; anything else is left for CompareFiles to report on.
+	class NativeFileComparer {
+	public:
+		//
+		NativeFileComparer(const std::string& root1UTF8,
+						   const std::string& root2UTF8,
+						   bool ignoreDates,
+						   bool useSnapshots,
+						   const ReadPipelineOptions& readOptions);
+		
+		// Maps an item under root 1 to its full path and the path of its counterpart under root 2.
+		bool GetItemPaths(const hermit::HermitPtr& h_,
+						  const hermit::file::FilePathPtr& parent,
+						  const std::string& itemName,
+						  std::string& outPath1UTF8,
+						  std::string& outPath2UTF8) const;
+		
+		// GetItemPaths plus the item's metadata on both sides. False if either side is missing
+		// or unreadable.
+		bool GetItemMetadata(const hermit::HermitPtr& h_,
+							 const hermit::file::FilePathPtr& parent,
+							 const std::string& itemName,
+							 std::string& outPath1UTF8,
+							 std::string& outPath2UTF8,
+							 SnapshotEntry& outEntry1,
+							 SnapshotEntry& outEntry2);
+		
+		// True if exclusions exclude the item, going by its path relative to root 1. Looks the item
+		// up only if the verdict turns on whether it's a directory.
+		bool IsExcluded(const hermit::HermitPtr& h_,
+						const hermit::file::FilePathPtr& parent,
+						const std::string& itemName,
+						const ExclusionMatcher& exclusions);
+		
+		// Like Compare, but only settles a pair with other links whose inodes were already compared
+		// through another path, without reading anything. Callers that do work before reading
+		// (the digest cache) try this first.
+		bool CompareLinkedPair(const hermit::HermitPtr& h_,
+							   const std::string& path1UTF8,
+							   const std::string& path2UTF8,
+							   const SnapshotEntry& entry1,
+							   const SnapshotEntry& entry2);
+		
+		// True if the pair was settled and reported through h_, in which case the caller should
+		// have CompareFiles skip it. The results for files with other links are remembered for
+		// CompareLinkedPair.
+		bool Compare(const hermit::HermitPtr& h_,
+					 const std::string& path1UTF8,
+					 const std::string& path2UTF8,
+					 const SnapshotEntry& entry1,
+					 const SnapshotEntry& entry2,
+					 bool calculateDigest);
+		
+		// Everything CompareFiles checks on a regular file besides its contents: size, mode,
+		// owners, flags, extended attributes and (unless dates are ignored) dates. False if any of
+		// it couldn't be read.
+		bool MetadataMatches(const SnapshotEntry& entry1, const SnapshotEntry& entry2) const;
+		
+		// Root 1 is side 0, root 2 is side 1.
+		const ReadThroughput& GetThroughput() const {
+			return mThroughput;
+		}
+		
+		// Pairs CompareLinkedPair settled, and their bytes (on each side) that weren't read.
+		const HardLinkIndex& GetHardLinks() const {
+			return mHardLinks;
+		}
+		
+	private:
+		//
+		bool LookupItem(const std::string& pathUTF8, const std::string& itemName, SnapshotEntry& outEntry);
+		
+		//
+		std::string mRoot1UTF8;
+		std::string mRoot2UTF8;
+		bool mIgnoreDates;
+		bool mUseSnapshots;
+		ReadPipelineOptions mReadOptions;
+		ReadThroughput mThroughput;
+		MetadataSnapshotter mSnapshotter;
+		HardLinkIndex mHardLinks;
+	};
+	typedef std::shared_ptr<NativeFileComparer> NativeFileComparerPtr;
+	
+} // namespace common
+
+#endif /* NativeFileComparer_h */
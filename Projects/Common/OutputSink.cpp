@@ -0,0 +1,174 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "OutputSink.h"
+
+namespace common {
+	
+	//
+	OutputSink::OutputSink(std::ostream& stream,
+						   size_t capacity,
+						   size_t flushSize,
+						   std::chrono::milliseconds flushInterval) :
+	mStream(stream),
+	mMask(0),
+	mFlushSize(flushSize),
+	mFlushInterval(flushInterval),
+	mEnqueuePosition(0),
+	mDequeuePosition(0),
+	mEnqueuedCount(0),
+	mWrittenCount(0),
+	mFlushTarget(0),
+	mWriterIdle(false),
+	mShutdown(false) {
+		// Round up to a power of two so positions can be masked instead of divided.
+		size_t slotCount = 2;
+		while (slotCount < capacity) {
+			slotCount *= 2;
+		}
+		mMask = slotCount - 1;
+		mSlots.reset(new Slot[slotCount]);
+		for (size_t n = 0; n < slotCount; ++n) {
+			mSlots[n].mSequence.store(n, std::memory_order_relaxed);
+		}
+		mBuffer.reserve(mFlushSize + 4096);
+		mWriter = std::thread(&OutputSink::Run, this);
+	}
+	
+	//
+	OutputSink::~OutputSink() {
+		{
+			std::lock_guard<std::mutex> guard(mMutex);
+			mShutdown = true;
+		}
+		mWorkAvailable.notify_one();
+		mWriter.join();
+	}
+	
+	//
+	void OutputSink::Write(std::string&& text) {
+		size_t position = mEnqueuePosition.load(std::memory_order_relaxed);
+		while (true) {
+			Slot& slot = mSlots[position & mMask];
+			size_t sequence = slot.mSequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+			if (difference == 0) {
+				if (mEnqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					slot.mText = std::move(text);
+					slot.mSequence.store(position + 1, std::memory_order_release);
+					break;
+				}
+			}
+			else if (difference < 0) {
+				// Full; give the writer a chance to catch up.
+				mWorkAvailable.notify_one();
+				std::this_thread::yield();
+				position = mEnqueuePosition.load(std::memory_order_relaxed);
+			}
+			else {
+				position = mEnqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+		++mEnqueuedCount;
+		if (mWriterIdle.load(std::memory_order_acquire)) {
+			std::lock_guard<std::mutex> guard(mMutex);
+			mWorkAvailable.notify_one();
+		}
+	}
+	
+	//
+	bool OutputSink::TryDequeue(std::string& outText) {
+		Slot& slot = mSlots[mDequeuePosition & mMask];
+		size_t sequence = slot.mSequence.load(std::memory_order_acquire);
+		if (sequence != mDequeuePosition + 1) {
+			return false;
+		}
+		outText.swap(slot.mText);
+		slot.mText.clear();
+		slot.mSequence.store(mDequeuePosition + mMask + 1, std::memory_order_release);
+		++mDequeuePosition;
+		return true;
+	}
+	
+	//
+	void OutputSink::FlushBuffer() {
+		if (!mBuffer.empty()) {
+			mStream.write(mBuffer.data(), (std::streamsize)mBuffer.size());
+			mBuffer.clear();
+		}
+		mStream.flush();
+	}
+	
+	//
+	void OutputSink::Run() {
+		auto lastFlush = std::chrono::steady_clock::now();
+		std::string text;
+		uint64_t dequeuedCount = 0;
+		while (true) {
+			bool gotText = false;
+			while ((mBuffer.size() < mFlushSize) && TryDequeue(text)) {
+				gotText = true;
+				++dequeuedCount;
+				mBuffer += text;
+			}
+			
+			auto now = std::chrono::steady_clock::now();
+			bool flushRequested = (mFlushTarget > mWrittenCount) && (dequeuedCount >= mFlushTarget);
+			if ((mBuffer.size() >= mFlushSize) ||
+				flushRequested ||
+				(!mBuffer.empty() && ((now - lastFlush) >= mFlushInterval))) {
+				FlushBuffer();
+				lastFlush = now;
+				std::lock_guard<std::mutex> guard(mMutex);
+				mWrittenCount = dequeuedCount;
+				mFlushed.notify_all();
+			}
+			if (gotText) {
+				continue;
+			}
+			
+			std::unique_lock<std::mutex> lock(mMutex);
+			if (mShutdown && (dequeuedCount == mEnqueuedCount)) {
+				break;
+			}
+			mWriterIdle.store(true, std::memory_order_release);
+			// The timeout covers the window between a producer's enqueue and its idle check, and
+			// bounds how long buffered text can sit unflushed.
+			mWorkAvailable.wait_for(lock, mFlushInterval, [this, dequeuedCount] {
+				return mShutdown || (mEnqueuedCount != dequeuedCount) || (mFlushTarget > mWrittenCount);
+			});
+			mWriterIdle.store(false, std::memory_order_release);
+		}
+		FlushBuffer();
+		std::lock_guard<std::mutex> guard(mMutex);
+		mWrittenCount = dequeuedCount;
+		mFlushed.notify_all();
+	}
+	
+	//
+	void OutputSink::Flush() {
+		uint64_t target = mEnqueuedCount;
+		std::unique_lock<std::mutex> lock(mMutex);
+		if (mFlushTarget < target) {
+			mFlushTarget = target;
+		}
+		mWorkAvailable.notify_one();
+		mFlushed.wait(lock, [this, target] { return (mWrittenCount >= target); });
+	}
+	
+} // namespace common
@@ -0,0 +1,100 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef OutputSink_h
+#define OutputSink_h
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace common {
+	
+	// Collects text from any number of threads and writes it to one stream from a single writer
+	// thread. Producers hand lines over through a bounded lock-free ring (Vyukov's MPSC/MPMC queue)
+	// and never touch the stream; the writer batches them into a large buffer and flushes when it
+	// fills up or when flushInterval has passed.
+	class OutputSink {
+	public:
+		//
+		OutputSink(std::ostream& stream,
+				   size_t capacity = 64 * 1024,
+				   size_t flushSize = 1024 * 1024,
+				   std::chrono::milliseconds flushInterval = std::chrono::milliseconds(100));
+		
+		// Writes out anything still queued.
+		~OutputSink();
+		
+		// Queues text for output. Blocks (yielding) only if the ring is full.
+		void Write(std::string&& text);
+		
+		// Blocks until everything queued so far has reached the stream and the stream is flushed.
+		void Flush();
+		
+		//
+		uint64_t GetWriteCount() const {
+			return mEnqueuedCount;
+		}
+		
+	private:
+		//
+		struct Slot {
+			std::atomic<size_t> mSequence;
+			std::string mText;
+		};
+		
+		//
+		bool TryDequeue(std::string& outText);
+		
+		//
+		void Run();
+		
+		//
+		void FlushBuffer();
+		
+		//
+		std::ostream& mStream;
+		std::unique_ptr<Slot[]> mSlots;
+		size_t mMask;
+		size_t mFlushSize;
+		std::chrono::milliseconds mFlushInterval;
+		alignas(64) std::atomic<size_t> mEnqueuePosition;
+		alignas(64) size_t mDequeuePosition;
+		std::atomic<uint64_t> mEnqueuedCount;
+		std::atomic<uint64_t> mWrittenCount;
+		std::atomic<uint64_t> mFlushTarget;
+		std::atomic<bool> mWriterIdle;
+		bool mShutdown;
+		std::string mBuffer;
+		std::mutex mMutex;
+		std::condition_variable mWorkAvailable;
+		std::condition_variable mFlushed;
+		std::thread mWriter;
+	};
+	typedef std::shared_ptr<OutputSink> OutputSinkPtr;
+	
+} // namespace common
+
+#endif /* OutputSink_h */
@@ -0,0 +1,260 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#include "PhaseTimer.h"
+
+namespace common {
+	namespace PhaseTimer_Impl {
+		
+		//
+		static const size_t kPhaseCount = (size_t)Phase::kCount;
+		
+		// Latencies go into log-linear buckets, 8 per power of two, so percentiles are good to
+		// within 12.5%.
+		static const int kSubBucketBits = 3;
+		static const uint64_t kSubBucketCount = 1 << kSubBucketBits;
+		static const size_t kBucketCount = (64 - kSubBucketBits + 1) * kSubBucketCount;
+		
+		//
+		size_t GetBucket(uint64_t ns) {
+			if (ns < kSubBucketCount) {
+				return (size_t)ns;
+			}
+			int exponent = 63 - __builtin_clzll(ns);
+			uint64_t subBucket = (ns >> (exponent - kSubBucketBits)) & (kSubBucketCount - 1);
+			return (size_t)(((uint64_t)(exponent - kSubBucketBits + 1) * kSubBucketCount) + subBucket);
+		}
+		
+		//
+		uint64_t GetBucketMidpoint(size_t bucket) {
+			if (bucket < kSubBucketCount) {
+				return bucket;
+			}
+			int exponent = (int)(bucket / kSubBucketCount) + kSubBucketBits - 1;
+			uint64_t low = (kSubBucketCount + (bucket % kSubBucketCount)) << (exponent - kSubBucketBits);
+			uint64_t width = 1ULL << (exponent - kSubBucketBits);
+			return low + (width / 2);
+		}
+		
+		// Written only by the thread it belongs to, and read by Report, so a relaxed load and store
+		// does instead of an atomic add.
+		inline void Add(std::atomic<uint64_t>& counter, uint64_t value) {
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+		
+		//
+		struct ThreadTimes {
+			//
+			ThreadTimes() {
+				for (size_t phase = 0; phase < kPhaseCount; ++phase) {
+					mCounts[phase] = 0;
+					mTotalNs[phase] = 0;
+					mSelfNs[phase] = 0;
+					mMaxNs[phase] = 0;
+					for (auto& bucket : mBuckets[phase]) {
+						bucket = 0;
+					}
+				}
+			}
+			
+			//
+			std::atomic<uint64_t> mCounts[kPhaseCount];
+			std::atomic<uint64_t> mTotalNs[kPhaseCount];
+			std::atomic<uint64_t> mSelfNs[kPhaseCount];
+			std::atomic<uint64_t> mMaxNs[kPhaseCount];
+			std::atomic<uint64_t> mBuckets[kPhaseCount][kBucketCount];
+		};
+		
+		// Every thread that ever timed anything. Threads' times outlive them, for the report at
+		// the end.
+		struct Registry {
+			std::mutex mMutex;
+			std::vector<std::unique_ptr<ThreadTimes>> mThreads;
+		};
+		
+		// Never destroyed, so a worker thread finishing up during exit can't find it gone.
+		Registry& GetRegistry() {
+			static Registry* registry = new Registry;
+			return *registry;
+		}
+		
+		//
+		std::atomic<bool> sEnabled(false);
+		thread_local ThreadTimes* tThreadTimes = nullptr;
+		thread_local PhaseScope* tInnermostScope = nullptr;
+		
+		//
+		ThreadTimes& GetThreadTimes() {
+			if (tThreadTimes == nullptr) {
+				Registry& registry = GetRegistry();
+				std::lock_guard<std::mutex> guard(registry.mMutex);
+				registry.mThreads.emplace_back(new ThreadTimes);
+				tThreadTimes = registry.mThreads.back().get();
+			}
+			return *tThreadTimes;
+		}
+		
+		//
+		uint64_t GetPercentile(const std::vector<uint64_t>& buckets, uint64_t count, double fraction) {
+			uint64_t rank = (uint64_t)(fraction * (double)count);
+			uint64_t seen = 0;
+			for (size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+				seen += buckets[bucket];
+				if (seen > rank) {
+					return GetBucketMidpoint(bucket);
+				}
+			}
+			return 0;
+		}
+		
+	} // namespace PhaseTimer_Impl
+	using namespace PhaseTimer_Impl;
+	
+	//
+	const char* GetPhaseName(const Phase& phase) {
+		switch (phase) {
+			case Phase::kTraverse: return "traverse";
+			case Phase::kStat: return "stat";
+			case Phase::kRead: return "read";
+			case Phase::kCompare: return "compare";
+			case Phase::kWrite: return "write";
+			case Phase::kVerify: return "verify";
+			default: return "unknown";
+		}
+	}
+	
+	//
+	void PhaseTimes::Enable() {
+		sEnabled = true;
+	}
+	
+	//
+	bool PhaseTimes::IsEnabled() {
+		return sEnabled.load(std::memory_order_relaxed);
+	}
+	
+	//
+	void PhaseTimes::Record(const Phase& phase, uint64_t totalNs, uint64_t selfNs) {
+		ThreadTimes& times = GetThreadTimes();
+		size_t index = (size_t)phase;
+		Add(times.mCounts[index], 1);
+		Add(times.mTotalNs[index], totalNs);
+		Add(times.mSelfNs[index], selfNs);
+		if (totalNs > times.mMaxNs[index].load(std::memory_order_relaxed)) {
+			times.mMaxNs[index].store(totalNs, std::memory_order_relaxed);
+		}
+		Add(times.mBuckets[index][GetBucket(totalNs)], 1);
+	}
+	
+	//
+	void PhaseTimes::Report(std::ostream& strm) {
+		uint64_t counts[kPhaseCount] = {};
+		uint64_t totalNs[kPhaseCount] = {};
+		uint64_t selfNs[kPhaseCount] = {};
+		uint64_t maxNs[kPhaseCount] = {};
+		std::vector<std::vector<uint64_t>> buckets(kPhaseCount, std::vector<uint64_t>(kBucketCount, 0));
+		{
+			Registry& registry = GetRegistry();
+			std::lock_guard<std::mutex> guard(registry.mMutex);
+			for (const auto& times : registry.mThreads) {
+				for (size_t phase = 0; phase < kPhaseCount; ++phase) {
+					counts[phase] += times->mCounts[phase].load(std::memory_order_relaxed);
+					totalNs[phase] += times->mTotalNs[phase].load(std::memory_order_relaxed);
+					selfNs[phase] += times->mSelfNs[phase].load(std::memory_order_relaxed);
+					maxNs[phase] = std::max(maxNs[phase], times->mMaxNs[phase].load(std::memory_order_relaxed));
+					for (size_t bucket = 0; bucket < kBucketCount; ++bucket) {
+						buckets[phase][bucket] += times->mBuckets[phase][bucket].load(std::memory_order_relaxed);
+					}
+				}
+			}
+		}
+		uint64_t allSelfNs = 0;
+		for (size_t phase = 0; phase < kPhaseCount; ++phase) {
+			allSelfNs += selfNs[phase];
+		}
+		
+		// Totals are summed over threads, so with several at work they can add up to more than the
+		// elapsed time. Latencies are per scope, in microseconds. The table is built apart from
+		// strm, whose formatting is the caller's.
+		std::ostringstream table;
+		table << "Phase times (self excludes nested phases; latencies in microseconds):\n";
+		table << std::left << std::setw(10) << "phase" << std::right
+			  << std::setw(12) << "count"
+			  << std::setw(12) << "total s"
+			  << std::setw(12) << "self s"
+			  << std::setw(8) << "self %"
+			  << std::setw(11) << "p50"
+			  << std::setw(11) << "p90"
+			  << std::setw(11) << "p99"
+			  << std::setw(11) << "max" << "\n";
+		table << std::fixed;
+		for (size_t phase = 0; phase < kPhaseCount; ++phase) {
+			if (counts[phase] == 0) {
+				continue;
+			}
+			double selfPercent = (allSelfNs > 0) ? (100.0 * (double)selfNs[phase] / (double)allSelfNs) : 0;
+			table << std::left << std::setw(10) << GetPhaseName((Phase)phase) << std::right
+				  << std::setw(12) << counts[phase]
+				  << std::setprecision(3)
+				  << std::setw(12) << (double)totalNs[phase] / 1e9
+				  << std::setw(12) << (double)selfNs[phase] / 1e9
+				  << std::setprecision(1)
+				  << std::setw(8) << selfPercent
+				  << std::setw(11) << (double)GetPercentile(buckets[phase], counts[phase], 0.50) / 1e3
+				  << std::setw(11) << (double)GetPercentile(buckets[phase], counts[phase], 0.90) / 1e3
+				  << std::setw(11) << (double)GetPercentile(buckets[phase], counts[phase], 0.99) / 1e3
+				  << std::setw(11) << (double)maxNs[phase] / 1e3 << "\n";
+		}
+		strm << table.str();
+	}
+	
+	//
+	PhaseScope::PhaseScope(const Phase& phase) :
+	mPhase(phase),
+	mActive(PhaseTimes::IsEnabled()),
+	mNestedNs(0),
+	mEnclosing(nullptr) {
+		if (mActive) {
+			mEnclosing = tInnermostScope;
+			tInnermostScope = this;
+			mStart = std::chrono::steady_clock::now();
+		}
+	}
+	
+	//
+	PhaseScope::~PhaseScope() {
+		if (!mActive) {
+			return;
+		}
+		auto elapsed = std::chrono::steady_clock::now() - mStart;
+		uint64_t totalNs = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+		tInnermostScope = mEnclosing;
+		if (mEnclosing != nullptr) {
+			mEnclosing->mNestedNs += totalNs;
+		}
+		PhaseTimes::Record(mPhase, totalNs, totalNs - std::min(mNestedNs, totalNs));
+	}
+	
+} // namespace common
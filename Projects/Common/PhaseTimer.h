@@ -0,0 +1,129 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef PhaseTimer_h
+#define PhaseTimer_h
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace common {
+	
+	// Where a run's time goes.
+	enum class Phase {
+		// Listing directories.
+		kTraverse,
+		// Reading item metadata.
+		kStat,
+		// Reading file data.
+		kRead,
+		// Comparing data already read.
+		kCompare,
+		// Writing (or copying inside the kernel) file data.
+		kWrite,
+		// Checking what was written.
+		kVerify,
+		kCount
+	};
+	
+	//
+	const char* GetPhaseName(const Phase& phase);
+	
+	// Count, total and self time, and a latency histogram per phase, kept per thread so timing a
+	// scope costs two clock reads and a few uncontended stores. Off until enabled, in which case a
+	// PhaseScope costs one branch.
+	class PhaseTimes {
+	public:
+		//
+		static void Enable();
+		
+		//
+		static bool IsEnabled();
+		
+		// A table of every phase that was entered: count, total, self, p50/p90/p99 and max.
+		static void Report(std::ostream& strm);
+		
+		// Called by PhaseScope.
+		static void Record(const Phase& phase, uint64_t totalNs, uint64_t selfNs);
+	};
+	
+	// Times the enclosing scope as phase. Scopes nest on a thread: a nested scope's time is taken
+	// out of the enclosing one's self time, so self times add up to the time actually spent.
+	class PhaseScope {
+	public:
+		//
+		explicit PhaseScope(const Phase& phase);
+		
+		//
+		~PhaseScope();
+		
+		PhaseScope(const PhaseScope&) = delete;
+		PhaseScope& operator=(const PhaseScope&) = delete;
+		
+	private:
+		//
+		Phase mPhase;
+		bool mActive;
+		std::chrono::steady_clock::time_point mStart;
+		uint64_t mNestedNs;
+		PhaseScope* mEnclosing;
+	};
+	
+	// Like hermit::utility::OperationTimer, but on the steady clock and to the nanosecond. Calls
+	// Reporter::Report(tag, seconds) with seconds as a double when it goes out of scope.
+	template <class Reporter>
+	class ScopedTimer {
+	public:
+		//
+		ScopedTimer(Reporter& reporter, const std::string& tag) :
+		mReporter(reporter),
+		mTag(tag),
+		mStart(std::chrono::steady_clock::now()),
+		mSuppressed(false) {
+		}
+		
+		//
+		~ScopedTimer() {
+			if (!mSuppressed) {
+				mReporter.Report(mTag, std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count());
+			}
+		}
+		
+		//
+		void SuppressOutput() {
+			mSuppressed = true;
+		}
+		
+		ScopedTimer(const ScopedTimer&) = delete;
+		ScopedTimer& operator=(const ScopedTimer&) = delete;
+		
+	private:
+		//
+		Reporter& mReporter;
+		std::string mTag;
+		std::chrono::steady_clock::time_point mStart;
+		bool mSuppressed;
+	};
+	
+} // namespace common
+
+#endif /* PhaseTimer_h */
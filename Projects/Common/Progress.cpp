@@ -0,0 +1,268 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <fts.h>
+#include <iomanip>
+#include <sstream>
+#include <sys/stat.h>
+#include <vector>
+#include "Progress.h"
+
+namespace common {
+	namespace Progress_Impl {
+		
+		// Redraws on a terminal, and new lines in a log.
+		static const std::chrono::milliseconds kRedrawInterval(250);
+		static const std::chrono::milliseconds kLogInterval(5000);
+		
+		// Weight of the latest interval in the smoothed rates.
+		static const double kRateSmoothing = 0.3;
+		
+		//
+		std::atomic<size_t> sNextSlot(0);
+		thread_local size_t tSlot = sNextSlot++;
+		
+		//
+		inline double ToMB(uint64_t bytes) {
+			return (double)bytes / (1024 * 1024);
+		}
+		
+		//
+		std::string FormatDuration(double seconds) {
+			uint64_t total = (uint64_t)(seconds + 0.5);
+			std::ostringstream strm;
+			strm << (total / 3600) << ":" << std::setfill('0') << std::setw(2) << ((total / 60) % 60)
+				 << ":" << std::setw(2) << (total % 60);
+			return strm.str();
+		}
+		
+	} // namespace Progress_Impl
+	using namespace Progress_Impl;
+	
+	//
+	ProgressCounters::ProgressCounters() {
+		for (auto& slot : mSlots) {
+			slot.mEntries = 0;
+			slot.mFiles = 0;
+			slot.mBytes = 0;
+		}
+	}
+	
+	//
+	ProgressCounters::Slot& ProgressCounters::GetSlot() {
+		return mSlots[tSlot % kSlotCount];
+	}
+	
+	//
+	void ProgressCounters::AddEntries(uint64_t count) {
+		GetSlot().mEntries.fetch_add(count, std::memory_order_relaxed);
+	}
+	
+	//
+	void ProgressCounters::AddFiles(uint64_t count) {
+		GetSlot().mFiles.fetch_add(count, std::memory_order_relaxed);
+	}
+	
+	//
+	void ProgressCounters::AddBytes(uint64_t bytes) {
+		GetSlot().mBytes.fetch_add(bytes, std::memory_order_relaxed);
+	}
+	
+	//
+	ProgressCounters::Totals ProgressCounters::Read() const {
+		Totals totals = { 0, 0, 0 };
+		for (const auto& slot : mSlots) {
+			totals.mEntries += slot.mEntries.load(std::memory_order_relaxed);
+			totals.mFiles += slot.mFiles.load(std::memory_order_relaxed);
+			totals.mBytes += slot.mBytes.load(std::memory_order_relaxed);
+		}
+		return totals;
+	}
+	
+	//
+	ProgressReporter::ProgressReporter(const ProgressCounters& counters,
+									   std::ostream& output,
+									   bool redrawInPlace,
+									   const std::string& estimateRootUTF8,
+									   bool etaByBytes) :
+	mCounters(counters),
+	mOutput(output),
+	mRedrawInPlace(redrawInPlace),
+	mEtaByBytes(etaByBytes),
+	mStartTime(std::chrono::steady_clock::now()),
+	mStopping(false),
+	mStopEstimate(false),
+	mHaveEstimate(false),
+	mLastLineLength(0) {
+		if (!estimateRootUTF8.empty()) {
+			mEstimateThread = std::thread(&ProgressReporter::RunEstimate, this, estimateRootUTF8);
+		}
+		mStatusThread = std::thread(&ProgressReporter::RunStatus, this);
+	}
+	
+	//
+	ProgressReporter::~ProgressReporter() {
+		Stop();
+	}
+	
+	//
+	void ProgressReporter::Stop() {
+		{
+			std::lock_guard<std::mutex> guard(mMutex);
+			if (mStopping) {
+				return;
+			}
+			mStopping = true;
+		}
+		mCondition.notify_all();
+		mStatusThread.join();
+		mStopEstimate = true;
+		if (mEstimateThread.joinable()) {
+			mEstimateThread.join();
+		}
+		
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - mStartTime).count();
+		ProgressCounters::Totals totals = mCounters.Read();
+		if (seconds <= 0) {
+			seconds = 1;
+		}
+		WriteStatus(totals, totals.mEntries / seconds, totals.mFiles / seconds, totals.mBytes / seconds, true);
+	}
+	
+	//
+	void ProgressReporter::RunEstimate(const std::string& rootUTF8) {
+		std::vector<char> root(rootUTF8.begin(), rootUTF8.end());
+		root.push_back(0);
+		char* paths[] = { root.data(), nullptr };
+		FTS* fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, nullptr);
+		if (fts == nullptr) {
+			return;
+		}
+		ProgressEstimate estimate;
+		while (FTSENT* entry = fts_read(fts)) {
+			if (mStopEstimate) {
+				fts_close(fts);
+				return;
+			}
+			if (entry->fts_info == FTS_DP) {
+				// Directories come back a second time on the way out.
+				continue;
+			}
+			++estimate.mEntries;
+			if ((entry->fts_info == FTS_F) && (entry->fts_statp != nullptr)) {
+				estimate.mBytes += (uint64_t)entry->fts_statp->st_size;
+			}
+		}
+		fts_close(fts);
+		
+		std::lock_guard<std::mutex> guard(mMutex);
+		mEstimate = estimate;
+		mHaveEstimate = true;
+	}
+	
+	//
+	void ProgressReporter::RunStatus() {
+		std::chrono::milliseconds interval(mRedrawInPlace ? kRedrawInterval : kLogInterval);
+		ProgressCounters::Totals last = { 0, 0, 0 };
+		auto lastTime = mStartTime;
+		double entryRate = 0;
+		double fileRate = 0;
+		double byteRate = 0;
+		bool first = true;
+		std::unique_lock<std::mutex> lock(mMutex);
+		while (!mCondition.wait_for(lock, interval, [this]() { return mStopping; })) {
+			auto now = std::chrono::steady_clock::now();
+			double seconds = std::chrono::duration<double>(now - lastTime).count();
+			ProgressCounters::Totals totals = mCounters.Read();
+			if (seconds > 0) {
+				double weight = first ? 1 : kRateSmoothing;
+				entryRate += weight * (((totals.mEntries - last.mEntries) / seconds) - entryRate);
+				fileRate += weight * (((totals.mFiles - last.mFiles) / seconds) - fileRate);
+				byteRate += weight * (((totals.mBytes - last.mBytes) / seconds) - byteRate);
+				first = false;
+			}
+			last = totals;
+			lastTime = now;
+			WriteStatus(totals, entryRate, fileRate, byteRate, false);
+		}
+	}
+	
+	//
+	void ProgressReporter::WriteStatus(const ProgressCounters::Totals& totals,
+									   double entryRate,
+									   double fileRate,
+									   double byteRate,
+									   bool final) {
+		ProgressEstimate estimate;
+		bool haveEstimate = mHaveEstimate;
+		if (haveEstimate) {
+			// Only written before mHaveEstimate is set.
+			estimate = mEstimate;
+		}
+		
+		std::ostringstream line;
+		line << std::fixed << std::setprecision(1);
+		line << totals.mEntries;
+		if (haveEstimate && !final) {
+			line << "/" << estimate.mEntries;
+		}
+		line << " entries, " << totals.mFiles << " files, " << ToMB(totals.mBytes);
+		if (haveEstimate && mEtaByBytes && !final) {
+			line << "/" << ToMB(estimate.mBytes);
+		}
+		line << " MB, " << ToMB((uint64_t)byteRate) << " MB/s, " << fileRate << " files/s";
+		if (final) {
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - mStartTime).count();
+			line << ", done in " << FormatDuration(seconds);
+		}
+		else if (haveEstimate) {
+			// Whatever grew since the pre-scan can't be allowed for.
+			double remaining = -1;
+			if (mEtaByBytes && (estimate.mBytes > 0) && (byteRate > 0)) {
+				remaining = (double)(estimate.mBytes - std::min(estimate.mBytes, totals.mBytes)) / byteRate;
+			}
+			else if (!mEtaByBytes && (entryRate > 0)) {
+				remaining = (double)(estimate.mEntries - std::min(estimate.mEntries, totals.mEntries)) / entryRate;
+			}
+			line << ", ETA " << ((remaining >= 0) ? FormatDuration(remaining) : std::string("--"));
+		}
+		else {
+			line << ", ETA --";
+		}
+		
+		std::string text(line.str());
+		if (mRedrawInPlace) {
+			// Spaces cover whatever's left of a longer previous line.
+			size_t length = text.size();
+			if (length < mLastLineLength) {
+				text.append(mLastLineLength - length, ' ');
+			}
+			mLastLineLength = length;
+			mOutput << "\r" << text;
+			if (final) {
+				mOutput << "\n";
+			}
+		}
+		else {
+			mOutput << text << "\n";
+		}
+		mOutput.flush();
+	}
+	
+} // namespace common
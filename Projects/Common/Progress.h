@@ -0,0 +1,146 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef Progress_h
+#define Progress_h
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+namespace common {
+	
+	// Running totals bumped from any thread. Each thread counts into its own cache line, so the
+	// hot path is an uncontended add; Read sums the lines.
+	class ProgressCounters {
+	public:
+		//
+		struct Totals {
+			uint64_t mEntries;
+			uint64_t mFiles;
+			uint64_t mBytes;
+		};
+		
+		//
+		ProgressCounters();
+		
+		// Items looked at.
+		void AddEntries(uint64_t count);
+		
+		// Items finished with.
+		void AddFiles(uint64_t count);
+		
+		// File data compared or copied.
+		void AddBytes(uint64_t bytes);
+		
+		//
+		Totals Read() const;
+		
+	private:
+		//
+		struct Slot {
+			std::atomic<uint64_t> mEntries;
+			std::atomic<uint64_t> mFiles;
+			std::atomic<uint64_t> mBytes;
+			char mPadding[64 - (3 * sizeof(std::atomic<uint64_t>))];
+		};
+		
+		// Threads past kSlotCount share slots, which is still correct, just slower.
+		static const size_t kSlotCount = 64;
+		
+		//
+		Slot& GetSlot();
+		
+		//
+		Slot mSlots[kSlotCount];
+	};
+	
+	// What a pre-scan found: the total to measure progress against.
+	struct ProgressEstimate {
+		//
+		ProgressEstimate() :
+		mEntries(0),
+		mBytes(0) {
+		}
+		
+		//
+		uint64_t mEntries;
+		// Regular files' data.
+		uint64_t mBytes;
+	};
+	
+	// Keeps a one-line status refreshed from a set of ProgressCounters: entries, files and bytes
+	// so far, current MB/s and files/s, and an ETA once a pre-scan of estimateRootUTF8 (run
+	// alongside the real work) has said how much there is. On a terminal the line is redrawn in
+	// place a few times a second; otherwise a line is written every few seconds.
+	class ProgressReporter {
+	public:
+		//
+		ProgressReporter(const ProgressCounters& counters,
+						 std::ostream& output,
+						 bool redrawInPlace,
+						 const std::string& estimateRootUTF8,
+						 bool etaByBytes);
+		
+		// Stop must have been called.
+		~ProgressReporter();
+		
+		// Writes a last status line and ends it.
+		void Stop();
+		
+	private:
+		//
+		void RunEstimate(const std::string& rootUTF8);
+		
+		//
+		void RunStatus();
+		
+		// Rates are per second.
+		void WriteStatus(const ProgressCounters::Totals& totals,
+						 double entryRate,
+						 double fileRate,
+						 double byteRate,
+						 bool final);
+		
+		//
+		const ProgressCounters& mCounters;
+		std::ostream& mOutput;
+		bool mRedrawInPlace;
+		bool mEtaByBytes;
+		std::chrono::steady_clock::time_point mStartTime;
+		std::mutex mMutex;
+		std::condition_variable mCondition;
+		bool mStopping;
+		std::atomic<bool> mStopEstimate;
+		std::atomic<bool> mHaveEstimate;
+		ProgressEstimate mEstimate;
+		size_t mLastLineLength;
+		std::thread mEstimateThread;
+		std::thread mStatusThread;
+	};
+	
+} // namespace common
+
+#endif /* Progress_h */
@@ -0,0 +1,297 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "IoUring.h"
+#include "ReadQueue.h"
+
+#if COMMON_HAVE_IO_URING
+#include <sys/uio.h>
+#endif
+
+namespace common {
+	namespace ReadQueue_Impl {
+		
+		//
+		inline uint64_t NowNs() {
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+		
+		// Accumulates the time a side has one or more reads outstanding.
+		class BusyClock {
+		public:
+			//
+			BusyClock() : mInFlight(0), mSince(0), mBusyNs(0) {
+			}
+			
+			//
+			void OnSubmit() {
+				if (mInFlight++ == 0) {
+					mSince = NowNs();
+				}
+			}
+			
+			//
+			void OnComplete() {
+				if (--mInFlight == 0) {
+					mBusyNs += NowNs() - mSince;
+				}
+			}
+			
+			//
+			uint64_t GetBusyNs() const {
+				return mBusyNs;
+			}
+			
+		private:
+			//
+			size_t mInFlight;
+			uint64_t mSince;
+			uint64_t mBusyNs;
+		};
+		
+#if COMMON_HAVE_IO_URING
+		// READV rather than READ so this works back to the first kernels that had io_uring.
+		class IoUringReadQueue : public ReadQueue {
+		public:
+			//
+			explicit IoUringReadQueue(size_t capacity) : mCapacity(capacity), mSlots(capacity) {
+			}
+			
+			//
+			bool Init() {
+				return mRing.Init((unsigned)mCapacity);
+			}
+			
+			//
+			virtual size_t GetCapacity() const override {
+				return mCapacity;
+			}
+			
+			//
+			virtual bool Submit(int side, size_t tag, int fd, uint64_t offset, void* buffer, size_t size) override {
+				struct io_uring_sqe* sqe = mRing.GetSQE();
+				if (sqe == nullptr) {
+					return false;
+				}
+				Slot& slot = mSlots[tag];
+				slot.mVector.iov_base = buffer;
+				slot.mVector.iov_len = size;
+				slot.mSide = side;
+				slot.mDone = false;
+				sqe->opcode = IORING_OP_READV;
+				sqe->fd = fd;
+				sqe->off = offset;
+				sqe->addr = (uint64_t)(uintptr_t)&slot.mVector;
+				sqe->len = 1;
+				sqe->user_data = tag;
+				if (mRing.Submit(0) < 0) {
+					return false;
+				}
+				mBusy[side].OnSubmit();
+				return true;
+			}
+			
+			//
+			virtual ssize_t Wait(size_t tag) override {
+				Slot& slot = mSlots[tag];
+				while (!slot.mDone) {
+					auto onComplete = [this](uint64_t userData, int result) {
+						Slot& completed = mSlots[(size_t)userData];
+						completed.mResult = result;
+						completed.mDone = true;
+						mBusy[completed.mSide].OnComplete();
+					};
+					if (mRing.Reap(onComplete) == 0) {
+						int result = mRing.Submit(1);
+						if (result < 0) {
+							return result;
+						}
+					}
+				}
+				return slot.mResult;
+			}
+			
+			//
+			virtual uint64_t GetBusyNs(int side) const override {
+				return mBusy[side].GetBusyNs();
+			}
+			
+			//
+			virtual const char* GetName() const override {
+				return "io_uring";
+			}
+			
+		private:
+			//
+			struct Slot {
+				struct iovec mVector;
+				int mSide;
+				bool mDone;
+				ssize_t mResult;
+			};
+			
+			//
+			size_t mCapacity;
+			IoUring mRing;
+			std::vector<Slot> mSlots;
+			BusyClock mBusy[2];
+		};
+#endif
+		
+		// One thread per side issuing preads in submission order, so a slow device on one side
+		// doesn't hold up reads on the other.
+		class ThreadReadQueue : public ReadQueue {
+		public:
+			//
+			explicit ThreadReadQueue(size_t capacity) : mCapacity(capacity), mSlots(capacity), mShutdown(false) {
+				for (int side = 0; side < 2; ++side) {
+					mBusyNs[side] = 0;
+					mThreads[side] = std::thread(&ThreadReadQueue::Run, this, side);
+				}
+			}
+			
+			//
+			virtual ~ThreadReadQueue() {
+				{
+					std::lock_guard<std::mutex> guard(mMutex);
+					mShutdown = true;
+				}
+				mRequestAvailable.notify_all();
+				for (int side = 0; side < 2; ++side) {
+					mThreads[side].join();
+				}
+			}
+			
+			//
+			virtual size_t GetCapacity() const override {
+				return mCapacity;
+			}
+			
+			//
+			virtual bool Submit(int side, size_t tag, int fd, uint64_t offset, void* buffer, size_t size) override {
+				{
+					std::lock_guard<std::mutex> guard(mMutex);
+					Slot& slot = mSlots[tag];
+					slot.mFd = fd;
+					slot.mOffset = offset;
+					slot.mBuffer = buffer;
+					slot.mSize = size;
+					slot.mDone = false;
+					mRequests[side].push_back(tag);
+				}
+				mRequestAvailable.notify_all();
+				return true;
+			}
+			
+			//
+			virtual ssize_t Wait(size_t tag) override {
+				std::unique_lock<std::mutex> lock(mMutex);
+				mRequestDone.wait(lock, [&]() { return mSlots[tag].mDone; });
+				return mSlots[tag].mResult;
+			}
+			
+			//
+			virtual uint64_t GetBusyNs(int side) const override {
+				return mBusyNs[side];
+			}
+			
+			//
+			virtual const char* GetName() const override {
+				return "pread threads";
+			}
+			
+		private:
+			//
+			struct Slot {
+				int mFd;
+				uint64_t mOffset;
+				void* mBuffer;
+				size_t mSize;
+				bool mDone;
+				ssize_t mResult;
+			};
+			
+			//
+			void Run(int side) {
+				std::unique_lock<std::mutex> lock(mMutex);
+				while (true) {
+					mRequestAvailable.wait(lock, [&]() { return mShutdown || !mRequests[side].empty(); });
+					if (mShutdown) {
+						return;
+					}
+					size_t tag = mRequests[side].front();
+					mRequests[side].pop_front();
+					Slot request = mSlots[tag];
+					lock.unlock();
+					
+					uint64_t start = NowNs();
+					ssize_t result = 0;
+					do {
+						result = pread(request.mFd, request.mBuffer, request.mSize, (off_t)request.mOffset);
+					} while ((result < 0) && (errno == EINTR));
+					if (result < 0) {
+						result = -errno;
+					}
+					mBusyNs[side] += NowNs() - start;
+					
+					lock.lock();
+					mSlots[tag].mResult = result;
+					mSlots[tag].mDone = true;
+					mRequestDone.notify_all();
+				}
+			}
+			
+			//
+			size_t mCapacity;
+			std::vector<Slot> mSlots;
+			std::deque<size_t> mRequests[2];
+			bool mShutdown;
+			std::mutex mMutex;
+			std::condition_variable mRequestAvailable;
+			std::condition_variable mRequestDone;
+			std::atomic<uint64_t> mBusyNs[2];
+			std::thread mThreads[2];
+		};
+		
+	} // namespace ReadQueue_Impl
+	using namespace ReadQueue_Impl;
+	
+	//
+	ReadQueuePtr CreateReadQueue(size_t capacity) {
+#if COMMON_HAVE_IO_URING
+		auto queue = std::make_shared<IoUringReadQueue>(capacity);
+		if (queue->Init()) {
+			return queue;
+		}
+#endif
+		return std::make_shared<ThreadReadQueue>(capacity);
+	}
+	
+} // namespace common
@@ -0,0 +1,62 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef ReadQueue_h
+#define ReadQueue_h
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sys/types.h>
+
+namespace common {
+	
+	// Asynchronous positional reads against two sides (the two trees being compared, typically
+	// on different devices) so both can have reads in flight at once. Each read is identified
+	// by a tag below GetCapacity(); a tag may be reused once its read has been waited for.
+	class ReadQueue {
+	public:
+		//
+		virtual ~ReadQueue() {
+		}
+		
+		//
+		virtual size_t GetCapacity() const = 0;
+		
+		// False if the read couldn't be queued, in which case there's nothing to wait for.
+		virtual bool Submit(int side, size_t tag, int fd, uint64_t offset, void* buffer, size_t size) = 0;
+		
+		// Blocks until the read for tag is done. Returns bytes read, or -errno.
+		virtual ssize_t Wait(size_t tag) = 0;
+		
+		// Total time side has had at least one read in flight on this queue, in nanoseconds.
+		virtual uint64_t GetBusyNs(int side) const = 0;
+		
+		//
+		virtual const char* GetName() const = 0;
+	};
+	typedef std::shared_ptr<ReadQueue> ReadQueuePtr;
+	
+	// An io_uring queue where the kernel supports it (and allows it), otherwise one backed by a
+	// pread thread per side.
+	ReadQueuePtr CreateReadQueue(size_t capacity);
+	
+} // namespace common
+
+#endif /* ReadQueue_h */
@@ -0,0 +1,207 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include "Sha256.h"
+
+namespace common {
+	namespace Sha256_Impl {
+		
+		//
+		static const uint32_t kRoundConstants[64] = {
+			0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+			0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+			0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+			0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+			0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+			0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+			0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+			0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+		};
+		
+		//
+		static const size_t kFileReadSize = 1024 * 1024;
+		
+		//
+		inline uint32_t RotateRight(uint32_t value, int bits) {
+			return (value >> bits) | (value << (32 - bits));
+		}
+		
+	} // namespace Sha256_Impl
+	using namespace Sha256_Impl;
+	
+	//
+	bool operator==(const Sha256Digest& lhs, const Sha256Digest& rhs) {
+		return (memcmp(lhs.mBytes, rhs.mBytes, kSha256DigestSize) == 0);
+	}
+	
+	//
+	Sha256::Sha256() : mTotalSize(0), mBufferSize(0) {
+		mState[0] = 0x6a09e667;
+		mState[1] = 0xbb67ae85;
+		mState[2] = 0x3c6ef372;
+		mState[3] = 0xa54ff53a;
+		mState[4] = 0x510e527f;
+		mState[5] = 0x9b05688c;
+		mState[6] = 0x1f83d9ab;
+		mState[7] = 0x5be0cd19;
+	}
+	
+	//
+	void Sha256::ProcessBlock(const uint8_t* block) {
+		uint32_t w[64];
+		for (int n = 0; n < 16; ++n) {
+			w[n] = ((uint32_t)block[n * 4] << 24) |
+				   ((uint32_t)block[n * 4 + 1] << 16) |
+				   ((uint32_t)block[n * 4 + 2] << 8) |
+				   (uint32_t)block[n * 4 + 3];
+		}
+		for (int n = 16; n < 64; ++n) {
+			uint32_t s0 = RotateRight(w[n - 15], 7) ^ RotateRight(w[n - 15], 18) ^ (w[n - 15] >> 3);
+			uint32_t s1 = RotateRight(w[n - 2], 17) ^ RotateRight(w[n - 2], 19) ^ (w[n - 2] >> 10);
+			w[n] = w[n - 16] + s0 + w[n - 7] + s1;
+		}
+		
+		uint32_t a = mState[0];
+		uint32_t b = mState[1];
+		uint32_t c = mState[2];
+		uint32_t d = mState[3];
+		uint32_t e = mState[4];
+		uint32_t f = mState[5];
+		uint32_t g = mState[6];
+		uint32_t h = mState[7];
+		for (int n = 0; n < 64; ++n) {
+			uint32_t s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+			uint32_t ch = (e & f) ^ (~e & g);
+			uint32_t t1 = h + s1 + ch + kRoundConstants[n] + w[n];
+			uint32_t s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+			uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+			uint32_t t2 = s0 + maj;
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		mState[0] += a;
+		mState[1] += b;
+		mState[2] += c;
+		mState[3] += d;
+		mState[4] += e;
+		mState[5] += f;
+		mState[6] += g;
+		mState[7] += h;
+	}
+	
+	//
+	void Sha256::Update(const void* data, size_t size) {
+		const uint8_t* p = (const uint8_t*)data;
+		mTotalSize += size;
+		if (mBufferSize > 0) {
+			size_t count = std::min(size, sizeof(mBuffer) - mBufferSize);
+			memcpy(mBuffer + mBufferSize, p, count);
+			mBufferSize += count;
+			p += count;
+			size -= count;
+			if (mBufferSize < sizeof(mBuffer)) {
+				return;
+			}
+			ProcessBlock(mBuffer);
+			mBufferSize = 0;
+		}
+		while (size >= sizeof(mBuffer)) {
+			ProcessBlock(p);
+			p += sizeof(mBuffer);
+			size -= sizeof(mBuffer);
+		}
+		if (size > 0) {
+			memcpy(mBuffer, p, size);
+			mBufferSize = size;
+		}
+	}
+	
+	//
+	Sha256Digest Sha256::Finish() {
+		uint64_t bitCount = mTotalSize * 8;
+		uint8_t padding[72] = { 0x80 };
+		size_t paddingSize = (mBufferSize < 56) ? (56 - mBufferSize) : (120 - mBufferSize);
+		for (int n = 0; n < 8; ++n) {
+			padding[paddingSize + n] = (uint8_t)(bitCount >> (56 - n * 8));
+		}
+		Update(padding, paddingSize + 8);
+		
+		Sha256Digest digest;
+		for (int n = 0; n < 8; ++n) {
+			digest.mBytes[n * 4] = (uint8_t)(mState[n] >> 24);
+			digest.mBytes[n * 4 + 1] = (uint8_t)(mState[n] >> 16);
+			digest.mBytes[n * 4 + 2] = (uint8_t)(mState[n] >> 8);
+			digest.mBytes[n * 4 + 3] = (uint8_t)mState[n];
+		}
+		return digest;
+	}
+	
+	//
+	std::string Sha256DigestToString(const Sha256Digest& digest) {
+		static const char* kHexDigits = "0123456789abcdef";
+		std::string result;
+		for (size_t n = 0; n < kSha256DigestSize; ++n) {
+			result += kHexDigits[digest.mBytes[n] >> 4];
+			result += kHexDigits[digest.mBytes[n] & 0x0f];
+		}
+		return result;
+	}
+	
+	//
+	bool CalculateFileSha256(const std::string& pathUTF8, Sha256Digest& outDigest) {
+		int fd = open(pathUTF8.c_str(), O_RDONLY | O_NOFOLLOW);
+		if (fd < 0) {
+			return false;
+		}
+		Sha256 sha;
+		std::vector<uint8_t> buffer(kFileReadSize);
+		bool success = true;
+		while (true) {
+			ssize_t bytesRead = read(fd, buffer.data(), buffer.size());
+			if (bytesRead < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				success = false;
+				break;
+			}
+			if (bytesRead == 0) {
+				break;
+			}
+			sha.Update(buffer.data(), (size_t)bytesRead);
+		}
+		close(fd);
+		if (success) {
+			outDigest = sha.Finish();
+		}
+		return success;
+	}
+	
+} // namespace common
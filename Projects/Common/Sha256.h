@@ -0,0 +1,75 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef Sha256_h
+#define Sha256_h
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace common {
+	
+	//
+	static const size_t kSha256DigestSize = 32;
+	
+	//
+	struct Sha256Digest {
+		uint8_t mBytes[kSha256DigestSize];
+	};
+	
+	//
+	bool operator==(const Sha256Digest& lhs, const Sha256Digest& rhs);
+	
+	//
+	inline bool operator!=(const Sha256Digest& lhs, const Sha256Digest& rhs) {
+		return !(lhs == rhs);
+	}
+	
+	//
+	class Sha256 {
+	public:
+		//
+		Sha256();
+		
+		//
+		void Update(const void* data, size_t size);
+		
+		//
+		Sha256Digest Finish();
+		
+	private:
+		//
+		void ProcessBlock(const uint8_t* block);
+		
+		//
+		uint32_t mState[8];
+		uint64_t mTotalSize;
+		uint8_t mBuffer[64];
+		size_t mBufferSize;
+	};
+	
+	// Hex string form of the digest, lowercase.
+	std::string Sha256DigestToString(const Sha256Digest& digest);
+	
+	// Streams the file at pathUTF8 through SHA-256. Returns false if the file couldn't be read.
+	bool CalculateFileSha256(const std::string& pathUTF8, Sha256Digest& outDigest);
+	
+} // namespace common
+
+#endif /* Sha256_h */
@@ -0,0 +1,47 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef StatUtilities_h
+#define StatUtilities_h
+
+#include <cstdint>
+#include <sys/stat.h>
+
+namespace common {
+	
+	//
+	inline int64_t GetModificationTimeNs(const struct stat& s) {
+#if defined(__APPLE__)
+		return (int64_t)s.st_mtimespec.tv_sec * 1000000000 + s.st_mtimespec.tv_nsec;
+#else
+		return (int64_t)s.st_mtim.tv_sec * 1000000000 + s.st_mtim.tv_nsec;
+#endif
+	}
+	
+	// Status change time: bumped by the kernel on any content, ownership, permission or xattr change.
+	inline int64_t GetChangeTimeNs(const struct stat& s) {
+#if defined(__APPLE__)
+		return (int64_t)s.st_ctimespec.tv_sec * 1000000000 + s.st_ctimespec.tv_nsec;
+#else
+		return (int64_t)s.st_ctim.tv_sec * 1000000000 + s.st_ctim.tv_nsec;
+#endif
+	}
+	
+} // namespace common
+
+#endif /* StatUtilities_h */
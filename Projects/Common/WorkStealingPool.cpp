@@ -0,0 +1,143 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "WorkStealingPool.h"
+
+namespace common {
+	namespace WorkStealingPool_Impl {
+		
+		//
+		thread_local const WorkStealingPool* tCurrentPool = nullptr;
+		thread_local size_t tCurrentWorker = 0;
+		
+	} // namespace WorkStealingPool_Impl
+	using namespace WorkStealingPool_Impl;
+	
+	//
+	WorkStealingPool::WorkStealingPool(size_t workerCount) :
+	mQueuedCount(0),
+	mNextWorker(0),
+	mOutstandingCount(0),
+	mShutdown(false) {
+		if (workerCount == 0) {
+			workerCount = 1;
+		}
+		for (size_t n = 0; n < workerCount; ++n) {
+			mWorkers.push_back(WorkerPtr(new Worker()));
+		}
+		for (size_t n = 0; n < workerCount; ++n) {
+			mThreads.push_back(std::thread(&WorkStealingPool::Run, this, n));
+		}
+	}
+	
+	//
+	WorkStealingPool::~WorkStealingPool() {
+		{
+			std::lock_guard<std::mutex> guard(mMutex);
+			mShutdown = true;
+		}
+		mWorkAvailable.notify_all();
+		for (auto& thread : mThreads) {
+			thread.join();
+		}
+	}
+	
+	//
+	void WorkStealingPool::Submit(const Task& task) {
+		size_t index = 0;
+		if (tCurrentPool == this) {
+			index = tCurrentWorker;
+		}
+		else {
+			index = mNextWorker++ % mWorkers.size();
+		}
+		{
+			std::lock_guard<std::mutex> guard(mMutex);
+			++mOutstandingCount;
+		}
+		{
+			std::lock_guard<std::mutex> guard(mWorkers[index]->mMutex);
+			mWorkers[index]->mTasks.push_back(task);
+			++mQueuedCount;
+		}
+		// Taking mMutex before notifying closes the gap between an idle worker checking
+		// mQueuedCount and starting to wait.
+		{
+			std::lock_guard<std::mutex> guard(mMutex);
+		}
+		mWorkAvailable.notify_one();
+	}
+	
+	//
+	void WorkStealingPool::Wait() {
+		std::unique_lock<std::mutex> lock(mMutex);
+		mAllDone.wait(lock, [this] { return (mOutstandingCount == 0); });
+	}
+	
+	//
+	bool WorkStealingPool::TakeTask(size_t index, Task& outTask) {
+		{
+			Worker& own = *mWorkers[index];
+			std::lock_guard<std::mutex> guard(own.mMutex);
+			if (!own.mTasks.empty()) {
+				outTask = std::move(own.mTasks.back());
+				own.mTasks.pop_back();
+				--mQueuedCount;
+				return true;
+			}
+		}
+		for (size_t n = 1; n < mWorkers.size(); ++n) {
+			Worker& victim = *mWorkers[(index + n) % mWorkers.size()];
+			std::lock_guard<std::mutex> guard(victim.mMutex);
+			if (!victim.mTasks.empty()) {
+				outTask = std::move(victim.mTasks.front());
+				victim.mTasks.pop_front();
+				--mQueuedCount;
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	//
+	void WorkStealingPool::Run(size_t index) {
+		tCurrentPool = this;
+		tCurrentWorker = index;
+		while (true) {
+			Task task;
+			if (TakeTask(index, task)) {
+				task();
+				// Release whatever the task captured before reporting it done, so the last
+				// reference to the pool's owner is never dropped on one of its own threads.
+				task = nullptr;
+				std::lock_guard<std::mutex> guard(mMutex);
+				if (--mOutstandingCount == 0) {
+					mAllDone.notify_all();
+				}
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWorkAvailable.wait(lock, [this] { return mShutdown || (mQueuedCount > 0); });
+			if (mShutdown && (mQueuedCount == 0)) {
+				break;
+			}
+		}
+		tCurrentPool = nullptr;
+	}
+	
+} // namespace common
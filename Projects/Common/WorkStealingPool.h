@@ -0,0 +1,91 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef WorkStealingPool_h
+#define WorkStealingPool_h
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace common {
+	
+	//
+	typedef std::function<void()> Task;
+	
+	// Fixed set of worker threads, each owning a deque of tasks. A worker pops from the back of
+	// its own deque and, when that runs dry, steals from the front of the others. Tasks submitted
+	// from inside a worker go onto that worker's deque so related work tends to stay together.
+	class WorkStealingPool {
+	public:
+		//
+		explicit WorkStealingPool(size_t workerCount);
+		
+		//
+		~WorkStealingPool();
+		
+		//
+		void Submit(const Task& task);
+		
+		// Blocks until every submitted task, including tasks submitted by other tasks, has run.
+		void Wait();
+		
+		//
+		size_t QueuedTaskCount() const {
+			return mQueuedCount;
+		}
+		
+		//
+		size_t WorkerCount() const {
+			return mWorkers.size();
+		}
+		
+	private:
+		//
+		struct Worker {
+			std::mutex mMutex;
+			std::deque<Task> mTasks;
+		};
+		typedef std::unique_ptr<Worker> WorkerPtr;
+		
+		//
+		void Run(size_t index);
+		
+		//
+		bool TakeTask(size_t index, Task& outTask);
+		
+		//
+		std::vector<WorkerPtr> mWorkers;
+		std::vector<std::thread> mThreads;
+		std::atomic<size_t> mQueuedCount;
+		std::atomic<size_t> mNextWorker;
+		size_t mOutstandingCount;
+		bool mShutdown;
+		std::mutex mMutex;
+		std::condition_variable mWorkAvailable;
+		std::condition_variable mAllDone;
+	};
+	
+} // namespace common
+
+#endif /* WorkStealingPool_h */
@@ -0,0 +1,102 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Checks copy_Impl::CopyJournal: records survive a reopen, are only found under the path and
+// stamp they were written for, and a journal in the old format is refused. Exits non-zero on any
+// failure.
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include "copy/copy/CopyJournal.h"
+
+namespace CopyJournalTest_Impl {
+	
+	//
+	int gFailureCount = 0;
+	
+	//
+	void Expect(const char* name, bool value) {
+		if (!value) {
+			std::cout << "FAILED: " << name << "\n";
+			++gFailureCount;
+		}
+	}
+	
+} // namespace CopyJournalTest_Impl
+using namespace CopyJournalTest_Impl;
+
+//
+int main() {
+	char directory[] = "/tmp/copyjournaltest.XXXXXX";
+	if (mkdtemp(directory) == nullptr) {
+		std::cout << "FAILED: can't create a temporary directory" << "\n";
+		return EXIT_FAILURE;
+	}
+	std::string journalPath(std::string(directory) + "/journal");
+	std::string sourceRoot(std::string(directory) + "/source");
+	std::string destRoot(std::string(directory) + "/dest");
+	copy_Impl::FileStamp stamp(1000, 1234567890);
+	copy_Impl::FileStamp bigStamp(1ULL << 32, 1234567890);
+	
+	Expect("different paths, different keys", !(copy_Impl::CopyJournal::MakeKey("/a") == copy_Impl::CopyJournal::MakeKey("/b")));
+	Expect("same path, same key", copy_Impl::CopyJournal::MakeKey("/dir/a") == copy_Impl::CopyJournal::MakeKey("/dir/a"));
+	{
+		copy_Impl::CopyJournal journal(journalPath);
+		std::string error;
+		Expect("create", journal.Open(sourceRoot, destRoot, error));
+		journal.RecordFileDone(copy_Impl::CopyJournal::MakeKey("/dir/a"), stamp);
+		journal.RecordRangeDone(copy_Impl::CopyJournal::MakeKey("/big"), bigStamp, 0, 1 << 20);
+		Expect("commit", journal.Commit());
+	}
+	{
+		copy_Impl::CopyJournal journal(journalPath);
+		std::string error;
+		Expect("reopen", journal.Open(sourceRoot, destRoot, error));
+		Expect("replayed count", journal.GetReplayedRecordCount() == 2);
+		Expect("file done", journal.IsFileDone(copy_Impl::CopyJournal::MakeKey("/dir/a"), stamp));
+		Expect("other path", !journal.IsFileDone(copy_Impl::CopyJournal::MakeKey("/dir/b"), stamp));
+		Expect("changed file", !journal.IsFileDone(copy_Impl::CopyJournal::MakeKey("/dir/a"), copy_Impl::FileStamp(1001, 1234567890)));
+		copy_Impl::ByteRangeVector ranges;
+		journal.GetDoneRanges(copy_Impl::CopyJournal::MakeKey("/big"), bigStamp, ranges);
+		Expect("range done", (ranges.size() == 1) && (ranges[0] == copy_Impl::ByteRange(0, 1 << 20)));
+		ranges.clear();
+		journal.GetDoneRanges(copy_Impl::CopyJournal::MakeKey("/dir/a"), stamp, ranges);
+		Expect("no ranges", ranges.empty());
+	}
+	{
+		// Its 64-bit keys can't be told apart from a collision, so it isn't replayed.
+		std::string oldJournalPath(std::string(directory) + "/old");
+		std::ofstream(oldJournalPath) << "CPYJRNL1";
+		copy_Impl::CopyJournal journal(oldJournalPath);
+		std::string error;
+		Expect("old format refused", !journal.Open(sourceRoot, destRoot, error) && (error.find("older version") != std::string::npos));
+		unlink(oldJournalPath.c_str());
+	}
+	unlink(journalPath.c_str());
+	rmdir(directory);
+	
+	if (gFailureCount > 0) {
+		std::cout << gFailureCount << " failed" << "\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "all passed" << "\n";
+	return 0;
+}
@@ -0,0 +1,113 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Checks compare_Impl::FolderDifferences: folders above a difference are found up to, but not
+// including, the roots; ones already reported are left out; and the rest come deepest first.
+// Exits non-zero on any failure.
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "compare/compare/FolderDifferences.h"
+
+namespace FolderDifferencesTest_Impl {
+	
+	//
+	int gFailureCount = 0;
+	
+	//
+	void Expect(const char* name,
+				compare_Impl::FolderDifferences& differences,
+				const std::vector<compare_Impl::FolderDifferences::FolderPair>& expected) {
+		std::vector<compare_Impl::FolderDifferences::FolderPair> folders;
+		differences.GetUnreportedFolders(folders);
+		if (folders != expected) {
+			std::cout << "FAILED: " << name << ": got";
+			for (const auto& folder : folders) {
+				std::cout << " " << folder.first << "|" << folder.second;
+			}
+			std::cout << "\n";
+			++gFailureCount;
+		}
+	}
+	
+} // namespace FolderDifferencesTest_Impl
+using namespace FolderDifferencesTest_Impl;
+
+//
+int main() {
+	{
+		compare_Impl::FolderDifferences differences("/a", "/b/");
+		differences.AddDifference("/a/x/y/file", "/b/x/y/file");
+		Expect("ancestors below the root", differences, { { "/a/x/y", "/b/x/y" }, { "/a/x", "/b/x" } });
+	}
+	{
+		// -j1: CompareFiles reports every folder itself, so there's nothing to add.
+		compare_Impl::FolderDifferences differences("/a", "/b");
+		differences.AddDifference("/a/x/file", "/b/x/file");
+		differences.AddReportedFolder("/a/x");
+		differences.AddDifference("/a/x", "/b/x");
+		Expect("already reported", differences, {});
+	}
+	{
+		// -j: the split-off /a/x/y reported itself, but /a/x was compared by another call.
+		compare_Impl::FolderDifferences differences("/a", "/b");
+		differences.AddDifference("/a/x/y/file", "/b/x/y/file");
+		differences.AddReportedFolder("/a/x/y");
+		differences.AddDifference("/a/x/y", "/b/x/y");
+		Expect("split parent", differences, { { "/a/x", "/b/x" } });
+	}
+	{
+		// The Preprocessor found /a/x/file differs and CompareFiles skipped it, so /a/x looked
+		// the same to CompareFiles, while /a/x/y had a difference of its own.
+		compare_Impl::FolderDifferences differences("/a", "/b");
+		differences.AddDifference("/a/x/y/z", "/b/x/y/z");
+		differences.AddReportedFolder("/a/x/y");
+		differences.AddDifference("/a/x/y", "/b/x/y");
+		differences.AddReportedFolder("/a/x");
+		differences.AddDifference("/a/x", "/b/x");
+		differences.AddDifference("/a/x/file", "/b/x/file");
+		differences.AddDifference("/a/w/file", "/b/w/file");
+		Expect("skipped by the Preprocessor", differences, { { "/a/w", "/b/w" } });
+	}
+	{
+		compare_Impl::FolderDifferences differences("/a", "/b");
+		differences.AddDifference("", "/b/x/only2");
+		differences.AddDifference("/a/file", "/b/file");
+		differences.AddDifference("/other/x/file", "/b/x/file");
+		differences.AddDifference("/ab/x/file", "/b/x/file");
+		Expect("path 2 only, top level, and outside the root", differences, { { "/a/x", "/b/x" } });
+	}
+	{
+		compare_Impl::FolderDifferences differences("/a", "/b");
+		differences.AddDifference("/a/p/file", "/b/p/file");
+		differences.AddDifference("/a/p-q/r/file", "/b/p-q/r/file");
+		differences.AddDifference("/a/p/s/file", "/b/p/s/file");
+		Expect("deepest first",
+			   differences,
+			   { { "/a/p/s", "/b/p/s" }, { "/a/p-q/r", "/b/p-q/r" }, { "/a/p-q", "/b/p-q" }, { "/a/p", "/b/p" } });
+	}
+	
+	if (gFailureCount > 0) {
+		std::cout << gFailureCount << " failed" << "\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "all passed" << "\n";
+	return 0;
+}
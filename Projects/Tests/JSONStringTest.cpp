@@ -0,0 +1,67 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Checks common::AppendJSONString: JSON escapes, well-formed UTF-8 passed through, and each byte
+// of a path that isn't UTF-8 written as \udcXX. Exits non-zero on any failure.
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "Common/JSONString.h"
+
+namespace JSONStringTest_Impl {
+	
+	//
+	int gFailureCount = 0;
+	
+	//
+	void Expect(const char* name, const std::string& value, const std::string& expected) {
+		std::string json;
+		common::AppendJSONString(json, value);
+		if (json != expected) {
+			std::cout << "FAILED: " << name << ": got " << json << ", expected " << expected << "\n";
+			++gFailureCount;
+		}
+	}
+	
+} // namespace JSONStringTest_Impl
+using namespace JSONStringTest_Impl;
+
+//
+int main() {
+	Expect("plain", "dir/file.txt", "\"dir/file.txt\"");
+	Expect("escapes", "a\"b\\c\nd\te\x01", "\"a\\\"b\\\\c\\nd\\te\\u0001\"");
+	Expect("two-byte UTF-8", "caf\xc3\xa9", "\"caf\xc3\xa9\"");
+	Expect("four-byte UTF-8", "\xf0\x9f\x93\x81", "\"\xf0\x9f\x93\x81\"");
+	// A file named in Latin-1: 0xe9 starts a three-byte sequence that never comes.
+	Expect("Latin-1 name", "caf\xe9.txt", "\"caf\\udce9.txt\"");
+	Expect("truncated sequence", "a\xe2\x82", "\"a\\udce2\\udc82\"");
+	Expect("stray continuation byte", "\x80x", "\"\\udc80x\"");
+	Expect("overlong encoding", "\xc0\xaf", "\"\\udcc0\\udcaf\"");
+	Expect("encoded surrogate", "\xed\xa0\x80", "\"\\udced\\udca0\\udc80\"");
+	Expect("past U+10FFFF", "\xf4\x90\x80\x80", "\"\\udcf4\\udc90\\udc80\\udc80\"");
+	Expect("invalid then valid", "\xff\xc3\xa9", "\"\\udcff\xc3\xa9\"");
+	
+	if (gFailureCount > 0) {
+		std::cout << gFailureCount << " failed" << "\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "all passed" << "\n";
+	return 0;
+}
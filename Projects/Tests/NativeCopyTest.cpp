@@ -0,0 +1,123 @@
+//
+//    Utilities
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Checks that NativeCopier replaces a destination file that has other hard links in place, so
+// the other links see the new contents, while two destination paths sharing a file that the
+// source has as separate files each get their own. Exits non-zero on any failure.
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "copy/copy/NativeCopy.h"
+
+namespace NativeCopyTest_Impl {
+	
+	//
+	int gFailureCount = 0;
+	
+	//
+	void Expect(const char* name, bool value) {
+		if (!value) {
+			std::cout << "FAILED: " << name << "\n";
+			++gFailureCount;
+		}
+	}
+	
+	//
+	void WriteFile(const std::string& pathUTF8, const std::string& contents) {
+		std::ofstream(pathUTF8) << contents;
+	}
+	
+	//
+	std::string ReadFile(const std::string& pathUTF8) {
+		std::ifstream strm(pathUTF8);
+		std::ostringstream contents;
+		contents << strm.rdbuf();
+		return contents.str();
+	}
+	
+	//
+	bool SameFile(const std::string& path1UTF8, const std::string& path2UTF8) {
+		struct stat s1;
+		struct stat s2;
+		return (lstat(path1UTF8.c_str(), &s1) == 0) &&
+			   (lstat(path2UTF8.c_str(), &s2) == 0) &&
+			   (s1.st_dev == s2.st_dev) &&
+			   (s1.st_ino == s2.st_ino);
+	}
+	
+} // namespace NativeCopyTest_Impl
+using namespace NativeCopyTest_Impl;
+
+//
+int main() {
+	char directory[] = "/tmp/nativecopytest.XXXXXX";
+	if (mkdtemp(directory) == nullptr) {
+		std::cout << "FAILED: can't create a temporary directory" << "\n";
+		return EXIT_FAILURE;
+	}
+	std::string source(std::string(directory) + "/source");
+	std::string dest(std::string(directory) + "/dest");
+	std::string outside(std::string(directory) + "/outside");
+	mkdir(source.c_str(), S_IRWXU);
+	mkdir(dest.c_str(), S_IRWXU);
+	
+	WriteFile(source + "/a", "new contents");
+	WriteFile(dest + "/a", "old");
+	link((dest + "/a").c_str(), outside.c_str());
+	// Linked in an earlier copy, but separate files in the source now.
+	WriteFile(source + "/b", "bee");
+	WriteFile(source + "/c", "sea");
+	WriteFile(dest + "/b", "old");
+	link((dest + "/b").c_str(), (dest + "/c").c_str());
+	
+	copy_Impl::SyncPlan plan(source, dest);
+	plan.AddChanged(source + "/a");
+	plan.AddChanged(source + "/b");
+	plan.AddChanged(source + "/c");
+	std::ostringstream output;
+	copy_Impl::NativeCopier copier(copy_Impl::CopyOptions(), output);
+	Expect("sync", copier.SyncTree(plan, false));
+	
+	Expect("replaced", ReadFile(dest + "/a") == "new contents");
+	Expect("still linked", SameFile(dest + "/a", outside));
+	Expect("other link updated", ReadFile(outside) == "new contents");
+	Expect("first of a split link", ReadFile(dest + "/b") == "bee");
+	Expect("second of a split link", ReadFile(dest + "/c") == "sea");
+	Expect("split", !SameFile(dest + "/b", dest + "/c"));
+	if (gFailureCount > 0) {
+		std::cout << output.str();
+	}
+	
+	const char* paths[] = { "/source/a", "/source/b", "/source/c", "/dest/a", "/dest/b", "/dest/c", "/outside", "/source", "/dest" };
+	for (const char* path : paths) {
+		remove((std::string(directory) + path).c_str());
+	}
+	rmdir(directory);
+	
+	if (gFailureCount > 0) {
+		std::cout << gFailureCount << " failed" << "\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "all passed" << "\n";
+	return 0;
+}
@@ -0,0 +1,55 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef CompareNotification_h
+#define CompareNotification_h
+
+#include <string>
+
+namespace compare_Impl {
+	
+	// Sent instead of kFilesMatchNotification for a pair of files that's treated as matching
+	// without CompareFiles reading it. Its param is an AssumedMatchParams.
+	extern const char* kFilesAssumedMatchNotification;
+	
+	//
+	enum class AssumedMatchReason {
+		// Same size, modification date, permissions and owners (-q).
+		kQuickCheck,
+		// Neither file has changed since they were last found to match (--cache).
+		kDigestCache
+	};
+	
+	//
+	struct AssumedMatchParams {
+		//
+		AssumedMatchParams(const AssumedMatchReason& reason, const std::string& path1UTF8, const std::string& path2UTF8) :
+		mReason(reason),
+		mPath1UTF8(path1UTF8),
+		mPath2UTF8(path2UTF8) {
+		}
+		
+		//
+		AssumedMatchReason mReason;
+		std::string mPath1UTF8;
+		std::string mPath2UTF8;
+	};
+	
+} // namespace compare_Impl
+
+#endif /* CompareNotification_h */
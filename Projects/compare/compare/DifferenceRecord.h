@@ -0,0 +1,63 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef DifferenceRecord_h
+#define DifferenceRecord_h
+
+#include <cstdint>
+#include <string>
+#include "Hermit/File/FileNotification.h"
+
+namespace compare_Impl {
+	
+	// mInt1 of a kFileContentsDiffer found by comparing digests, which can't say where.
+	static const uint64_t kUnknownDifferenceOffset = UINT64_MAX;
+	
+	// Everything compare reports about one difference or error, with the paths already converted
+	// to UTF-8 so it no longer holds on to any FilePath objects.
+	struct DifferenceRecord {
+		//
+		DifferenceRecord() : mType(hermit::file::kFolderContentsDiffer), mInt1(0), mInt2(0) {
+		}
+		
+		//
+		DifferenceRecord(const hermit::file::FileNotificationParams& params,
+						 const std::string& path1UTF8,
+						 const std::string& path2UTF8) :
+		mType(params.mType),
+		mPath1UTF8(path1UTF8),
+		mPath2UTF8(path2UTF8),
+		mString1(params.mString1),
+		mString2(params.mString2),
+		mInt1(params.mInt1),
+		mInt2(params.mInt2) {
+		}
+		
+		//
+		hermit::file::FileNotificationType mType;
+		std::string mPath1UTF8;
+		std::string mPath2UTF8;
+		std::string mString1;
+		std::string mString2;
+		uint64_t mInt1;
+		uint64_t mInt2;
+	};
+	
+} // namespace compare_Impl
+
+#endif /* DifferenceRecord_h */
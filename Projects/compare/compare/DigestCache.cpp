@@ -0,0 +1,340 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unordered_set>
+#include "Common/StatUtilities.h"
+#include "DigestCache.h"
+
+namespace compare_Impl {
+	namespace DigestCache_Impl {
+		
+		//
+		static const char kMagic[8] = { 'C', 'M', 'P', 'D', 'G', 'S', 'T', '1' };
+		static const uint32_t kVersion = 1;
+		
+		//
+		struct Header {
+			char mMagic[8];
+			uint32_t mVersion;
+			uint32_t mOptionFlags;
+			uint64_t mRecordCount;
+		};
+		
+		//
+		uint64_t HashKey(const DigestCacheKey& key) {
+			// FNV-1a over the key fields.
+			uint64_t hash = 14695981039346656037ULL;
+			const uint64_t fields[] = {
+				key.mDevice, key.mInode, key.mSize, (uint64_t)key.mModificationTime, (uint64_t)key.mChangeTime
+			};
+			for (uint64_t field : fields) {
+				for (int n = 0; n < 8; ++n) {
+					hash ^= (field >> (n * 8)) & 0xff;
+					hash *= 1099511628211ULL;
+				}
+			}
+			return hash;
+		}
+		
+		//
+		struct DeviceInode {
+			uint64_t mDevice;
+			uint64_t mInode;
+			
+			bool operator==(const DeviceInode& other) const {
+				return (mDevice == other.mDevice) && (mInode == other.mInode);
+			}
+		};
+		
+		//
+		struct DeviceInodeHash {
+			size_t operator()(const DeviceInode& value) const {
+				return (size_t)(value.mInode * 31 + value.mDevice);
+			}
+		};
+		
+		//
+		bool StatRegularFile(const std::string& pathUTF8, DigestCacheKey& outKey) {
+			struct stat s;
+			if ((lstat(pathUTF8.c_str(), &s) != 0) || !S_ISREG(s.st_mode)) {
+				return false;
+			}
+			outKey = MakeDigestCacheKey(s);
+			return true;
+		}
+		
+	} // namespace DigestCache_Impl
+	using namespace DigestCache_Impl;
+	
+	//
+	DigestCacheKey MakeDigestCacheKey(const struct stat& s) {
+		DigestCacheKey key;
+		key.mDevice = (uint64_t)s.st_dev;
+		key.mInode = (uint64_t)s.st_ino;
+		key.mSize = (uint64_t)s.st_size;
+		key.mModificationTime = common::GetModificationTimeNs(s);
+		key.mChangeTime = common::GetChangeTimeNs(s);
+		return key;
+	}
+	
+	//
+	DigestCacheKey MakeDigestCacheKey(const common::SnapshotEntry& entry) {
+		DigestCacheKey key;
+		key.mDevice = entry.GetDevice();
+		key.mInode = entry.GetInode();
+		key.mSize = entry.GetSize();
+		key.mModificationTime = entry.GetModificationTime();
+		key.mChangeTime = entry.GetChangeTime();
+		return key;
+	}
+	
+	//
+	bool operator<(const DigestCacheKey& lhs, const DigestCacheKey& rhs) {
+		if (lhs.mDevice != rhs.mDevice) {
+			return lhs.mDevice < rhs.mDevice;
+		}
+		if (lhs.mInode != rhs.mInode) {
+			return lhs.mInode < rhs.mInode;
+		}
+		if (lhs.mSize != rhs.mSize) {
+			return lhs.mSize < rhs.mSize;
+		}
+		if (lhs.mModificationTime != rhs.mModificationTime) {
+			return lhs.mModificationTime < rhs.mModificationTime;
+		}
+		return lhs.mChangeTime < rhs.mChangeTime;
+	}
+	
+	//
+	bool operator==(const DigestCacheKey& lhs, const DigestCacheKey& rhs) {
+		return (lhs.mDevice == rhs.mDevice) &&
+			   (lhs.mInode == rhs.mInode) &&
+			   (lhs.mSize == rhs.mSize) &&
+			   (lhs.mModificationTime == rhs.mModificationTime) &&
+			   (lhs.mChangeTime == rhs.mChangeTime);
+	}
+	
+	//
+	DigestCache::DigestCache(const std::string& pathUTF8, uint32_t optionFlags) :
+	mPathUTF8(pathUTF8),
+	mOptionFlags(optionFlags),
+	mMappedData(nullptr),
+	mMappedSize(0),
+	mRecords(nullptr),
+	mRecordCount(0),
+	mHitCount(0),
+	mMissCount(0) {
+	}
+	
+	//
+	DigestCache::~DigestCache() {
+		Unmap();
+	}
+	
+	//
+	void DigestCache::Unmap() {
+		if (mMappedData != nullptr) {
+			munmap(mMappedData, mMappedSize);
+			mMappedData = nullptr;
+		}
+		mMappedSize = 0;
+		mRecords = nullptr;
+		mRecordCount = 0;
+	}
+	
+	//
+	void DigestCache::Load() {
+		Unmap();
+		int fd = open(mPathUTF8.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return;
+		}
+		struct stat s;
+		if ((fstat(fd, &s) != 0) || ((size_t)s.st_size < sizeof(Header))) {
+			close(fd);
+			return;
+		}
+		void* data = mmap(nullptr, (size_t)s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED) {
+			return;
+		}
+		mMappedData = data;
+		mMappedSize = (size_t)s.st_size;
+		
+		const Header* header = (const Header*)data;
+		if ((memcmp(header->mMagic, kMagic, sizeof(kMagic)) != 0) ||
+			(header->mVersion != kVersion) ||
+			(header->mOptionFlags != mOptionFlags) ||
+			(header->mRecordCount > (mMappedSize - sizeof(Header)) / sizeof(DigestCacheRecord))) {
+			// Written by another version, or with comparison options that would make its matches
+			// meaningless for this run.
+			Unmap();
+			return;
+		}
+		mRecords = (const DigestCacheRecord*)((const char*)data + sizeof(Header));
+		mRecordCount = header->mRecordCount;
+	}
+	
+	//
+	const DigestCacheRecord* DigestCache::Find(const DigestCacheKey& key) const {
+		const DigestCacheRecord* end = mRecords + mRecordCount;
+		auto it = std::lower_bound(mRecords, end, key, [](const DigestCacheRecord& record, const DigestCacheKey& key) {
+			return record.mKey < key;
+		});
+		if ((it == end) || !(it->mKey == key)) {
+			return nullptr;
+		}
+		return it;
+	}
+	
+	//
+	bool DigestCache::Lookup(const DigestCacheKey& key1, const DigestCacheKey& key2) {
+		const DigestCacheRecord* record1 = Find(key1);
+		const DigestCacheRecord* record2 = (record1 != nullptr) ? Find(key2) : nullptr;
+		if ((record1 != nullptr) &&
+			(record2 != nullptr) &&
+			(record1->mPeerKeyHash == HashKey(key2)) &&
+			(record2->mPeerKeyHash == HashKey(key1)) &&
+			(record1->mDigest == record2->mDigest)) {
+			++mHitCount;
+			return true;
+		}
+		++mMissCount;
+		return false;
+	}
+	
+	//
+	void DigestCache::AddPending(const std::string& path1UTF8,
+								 const std::string& path2UTF8,
+								 const DigestCacheKey& key1,
+								 const DigestCacheKey& key2) {
+		PendingPair pair;
+		pair.mPath2UTF8 = path2UTF8;
+		pair.mKey1 = key1;
+		pair.mKey2 = key2;
+		std::lock_guard<std::mutex> guard(mMutex);
+		mPending[path1UTF8] = pair;
+	}
+	
+	//
+	void DigestCache::OnFilesMatch(const std::string& path1UTF8, const common::Sha256Digest* knownDigest) {
+		PendingPair pair;
+		{
+			std::lock_guard<std::mutex> guard(mMutex);
+			auto it = mPending.find(path1UTF8);
+			if (it == mPending.end()) {
+				return;
+			}
+			pair = it->second;
+			mPending.erase(it);
+		}
+		
+		// Both files have already been read and found identical, so one digest serves for both.
+		// Only record it if neither file changed while we were looking at it.
+		common::Sha256Digest digest;
+		if (knownDigest != nullptr) {
+			digest = *knownDigest;
+		}
+		else if (!common::CalculateFileSha256(path1UTF8, digest)) {
+			return;
+		}
+		DigestCacheKey key1;
+		DigestCacheKey key2;
+		if (!StatRegularFile(path1UTF8, key1) || !(key1 == pair.mKey1) ||
+			!StatRegularFile(pair.mPath2UTF8, key2) || !(key2 == pair.mKey2)) {
+			return;
+		}
+		
+		DigestCacheRecord record1;
+		record1.mKey = key1;
+		record1.mPeerKeyHash = HashKey(key2);
+		record1.mDigest = digest;
+		DigestCacheRecord record2;
+		record2.mKey = key2;
+		record2.mPeerKeyHash = HashKey(key1);
+		record2.mDigest = digest;
+		
+		std::lock_guard<std::mutex> guard(mMutex);
+		mNewRecords.push_back(record1);
+		mNewRecords.push_back(record2);
+	}
+	
+	//
+	void DigestCache::OnFilesDiffer(const std::string& path1UTF8) {
+		std::lock_guard<std::mutex> guard(mMutex);
+		mPending.erase(path1UTF8);
+	}
+	
+	//
+	bool DigestCache::Save() {
+		std::lock_guard<std::mutex> guard(mMutex);
+		
+		// Records from this run replace any older record for the same file; older records for files
+		// we didn't visit this time are carried forward.
+		DigestCacheRecordVector records(mNewRecords);
+		std::unordered_set<DeviceInode, DeviceInodeHash> seen;
+		for (const auto& record : records) {
+			seen.insert(DeviceInode { record.mKey.mDevice, record.mKey.mInode });
+		}
+		for (uint64_t n = 0; n < mRecordCount; ++n) {
+			const DigestCacheRecord& record = mRecords[n];
+			if (seen.insert(DeviceInode { record.mKey.mDevice, record.mKey.mInode }).second) {
+				records.push_back(record);
+			}
+		}
+		std::sort(records.begin(), records.end(), [](const DigestCacheRecord& lhs, const DigestCacheRecord& rhs) {
+			return lhs.mKey < rhs.mKey;
+		});
+		records.erase(std::unique(records.begin(), records.end(), [](const DigestCacheRecord& lhs, const DigestCacheRecord& rhs) {
+			return lhs.mKey == rhs.mKey;
+		}), records.end());
+		
+		std::string tempPathUTF8 = mPathUTF8 + ".tmp";
+		FILE* file = fopen(tempPathUTF8.c_str(), "wb");
+		if (file == nullptr) {
+			return false;
+		}
+		Header header;
+		memcpy(header.mMagic, kMagic, sizeof(kMagic));
+		header.mVersion = kVersion;
+		header.mOptionFlags = mOptionFlags;
+		header.mRecordCount = records.size();
+		bool success = (fwrite(&header, sizeof(header), 1, file) == 1);
+		if (success && !records.empty()) {
+			success = (fwrite(records.data(), sizeof(DigestCacheRecord), records.size(), file) == records.size());
+		}
+		if (fclose(file) != 0) {
+			success = false;
+		}
+		if (!success) {
+			unlink(tempPathUTF8.c_str());
+			return false;
+		}
+		
+		Unmap();
+		return (rename(tempPathUTF8.c_str(), mPathUTF8.c_str()) == 0);
+	}
+	
+} // namespace compare_Impl
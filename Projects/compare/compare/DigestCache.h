@@ -0,0 +1,140 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef DigestCache_h
+#define DigestCache_h
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+#include "Common/MetadataSnapshot.h"
+#include "Common/Sha256.h"
+
+namespace compare_Impl {
+	
+	// Identifies one version of one file. Any change to the file's contents or metadata changes
+	// at least one of these (ctime is bumped by chmod, chown and xattr changes too).
+	struct DigestCacheKey {
+		uint64_t mDevice;
+		uint64_t mInode;
+		uint64_t mSize;
+		int64_t mModificationTime;
+		int64_t mChangeTime;
+	};
+	
+	//
+	DigestCacheKey MakeDigestCacheKey(const struct stat& s);
+	
+	//
+	DigestCacheKey MakeDigestCacheKey(const common::SnapshotEntry& entry);
+	
+	//
+	bool operator<(const DigestCacheKey& lhs, const DigestCacheKey& rhs);
+	
+	//
+	bool operator==(const DigestCacheKey& lhs, const DigestCacheKey& rhs);
+	
+	// One on-disk record. The index file is a small header followed by these, sorted by key, so
+	// it can be mapped and binary searched in place.
+	struct DigestCacheRecord {
+		DigestCacheKey mKey;
+		// Hash of the key of the file this one was last verified against.
+		uint64_t mPeerKeyHash;
+		common::Sha256Digest mDigest;
+	};
+	
+	// Remembers the content digests of file pairs that were found to match, so a later run
+	// can skip reading any pair where neither file has changed since.
+	class DigestCache {
+	public:
+		//
+		DigestCache(const std::string& pathUTF8, uint32_t optionFlags);
+		
+		//
+		~DigestCache();
+		
+		// Maps the existing index, if there is one. A missing, stale or unreadable index just
+		// means every lookup misses.
+		void Load();
+		
+		// Writes the index back out, replacing the old one.
+		bool Save();
+		
+		// True if both files are unchanged since they were last recorded as a matching pair.
+		bool Lookup(const DigestCacheKey& key1, const DigestCacheKey& key2);
+		
+		// Remembers a pair that missed so its result can be recorded when CompareFiles reports it.
+		void AddPending(const std::string& path1UTF8, const std::string& path2UTF8,
+						const DigestCacheKey& key1, const DigestCacheKey& key2);
+		
+		// digest is the contents' digest if the caller already has it; otherwise file 1 is read
+		// to get it.
+		void OnFilesMatch(const std::string& path1UTF8, const common::Sha256Digest* digest);
+		
+		//
+		void OnFilesDiffer(const std::string& path1UTF8);
+		
+		//
+		uint64_t GetHitCount() const {
+			return mHitCount;
+		}
+		
+		//
+		uint64_t GetMissCount() const {
+			return mMissCount;
+		}
+		
+	private:
+		//
+		struct PendingPair {
+			std::string mPath2UTF8;
+			DigestCacheKey mKey1;
+			DigestCacheKey mKey2;
+		};
+		typedef std::map<std::string, PendingPair> PendingPairMap;
+		typedef std::vector<DigestCacheRecord> DigestCacheRecordVector;
+		
+		//
+		const DigestCacheRecord* Find(const DigestCacheKey& key) const;
+		
+		//
+		void Unmap();
+		
+		//
+		std::string mPathUTF8;
+		uint32_t mOptionFlags;
+		void* mMappedData;
+		size_t mMappedSize;
+		const DigestCacheRecord* mRecords;
+		uint64_t mRecordCount;
+		std::mutex mMutex;
+		PendingPairMap mPending;
+		DigestCacheRecordVector mNewRecords;
+		std::atomic<uint64_t> mHitCount;
+		std::atomic<uint64_t> mMissCount;
+	};
+	typedef std::shared_ptr<DigestCache> DigestCachePtr;
+	
+} // namespace compare_Impl
+
+#endif /* DigestCache_h */
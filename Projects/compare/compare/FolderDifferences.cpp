@@ -0,0 +1,100 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "FolderDifferences.h"
+
+namespace compare_Impl {
+	namespace FolderDifferences_Impl {
+		
+		//
+		std::string StripTrailingSlash(const std::string& pathUTF8) {
+			std::string result(pathUTF8);
+			while (!result.empty() && (result.back() == '/')) {
+				result.pop_back();
+			}
+			return result;
+		}
+		
+	} // namespace FolderDifferences_Impl
+	using namespace FolderDifferences_Impl;
+	
+	//
+	FolderDifferences::FolderDifferences(const std::string& root1UTF8, const std::string& root2UTF8) :
+	mRoot1UTF8(StripTrailingSlash(root1UTF8)),
+	mRoot2UTF8(StripTrailingSlash(root2UTF8)) {
+	}
+	
+	//
+	void FolderDifferences::AddDifference(const std::string& path1UTF8, const std::string& path2UTF8) {
+		std::string relativePath;
+		if (!path1UTF8.empty()) {
+			if (!GetRelativePath(path1UTF8, mRoot1UTF8, relativePath)) {
+				return;
+			}
+		}
+		else if (!GetRelativePath(path2UTF8, mRoot2UTF8, relativePath)) {
+			return;
+		}
+		
+		std::lock_guard<std::mutex> guard(mMutex);
+		size_t slash = relativePath.rfind('/');
+		while ((slash != std::string::npos) && (slash > 0)) {
+			// Once a folder is in the set so is everything above it.
+			if (!mDifferingFolders.insert(relativePath.substr(0, slash)).second) {
+				break;
+			}
+			slash = relativePath.rfind('/', slash - 1);
+		}
+	}
+	
+	//
+	void FolderDifferences::AddReportedFolder(const std::string& path1UTF8) {
+		std::string relativePath;
+		if (GetRelativePath(path1UTF8, mRoot1UTF8, relativePath)) {
+			std::lock_guard<std::mutex> guard(mMutex);
+			mReportedFolders.insert(relativePath);
+		}
+	}
+	
+	//
+	void FolderDifferences::GetUnreportedFolders(std::vector<FolderPair>& outFolders) {
+		std::lock_guard<std::mutex> guard(mMutex);
+		// A folder's descendants all sort after it, so in reverse they come first.
+		for (auto it = mDifferingFolders.rbegin(); it != mDifferingFolders.rend(); ++it) {
+			if (mReportedFolders.find(*it) == mReportedFolders.end()) {
+				outFolders.push_back(FolderPair(mRoot1UTF8 + *it, mRoot2UTF8 + *it));
+			}
+		}
+	}
+	
+	//
+	bool FolderDifferences::GetRelativePath(const std::string& pathUTF8,
+											const std::string& rootUTF8,
+											std::string& outRelativePath) const {
+		if ((pathUTF8.size() < rootUTF8.size()) || (pathUTF8.compare(0, rootUTF8.size(), rootUTF8) != 0)) {
+			return false;
+		}
+		std::string relativePath(StripTrailingSlash(pathUTF8.substr(rootUTF8.size())));
+		if (!relativePath.empty() && (relativePath[0] != '/')) {
+			return false;
+		}
+		outRelativePath = relativePath;
+		return true;
+	}
+	
+} // namespace compare_Impl
@@ -0,0 +1,70 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef FolderDifferences_h
+#define FolderDifferences_h
+
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace compare_Impl {
+	
+	// Works out which folders should be reported as kFolderContentsDiffer from the differences
+	// found inside them. CompareFiles does this for the folders it walks itself, but not for a
+	// folder whose subdirectories were split off into their own CompareFiles calls (-j), nor for
+	// one whose only difference is a file the Preprocessor settled and told it to skip. The
+	// folders it never reported are filled in at the end. The roots themselves are left out, as in
+	// manifest comparisons.
+	class FolderDifferences {
+	public:
+		//
+		typedef std::pair<std::string, std::string> FolderPair;
+		
+		//
+		FolderDifferences(const std::string& root1UTF8, const std::string& root2UTF8);
+		
+		// A difference at path1UTF8 (or, if that's empty, at path2UTF8), which makes every folder
+		// above it, up to the roots, differ as well.
+		void AddDifference(const std::string& path1UTF8, const std::string& path2UTF8);
+		
+		// A kFolderContentsDiffer that has already been reported.
+		void AddReportedFolder(const std::string& path1UTF8);
+		
+		// The folders that differ but haven't been reported, as (path1, path2), each one before
+		// the folders above it.
+		void GetUnreportedFolders(std::vector<FolderPair>& outFolders);
+		
+	private:
+		// The part of pathUTF8 below rootUTF8, starting with '/', or false if it isn't below it.
+		bool GetRelativePath(const std::string& pathUTF8, const std::string& rootUTF8, std::string& outRelativePath) const;
+		
+		//
+		std::string mRoot1UTF8;
+		std::string mRoot2UTF8;
+		std::mutex mMutex;
+		// Relative paths, so the two sides share them.
+		std::set<std::string> mDifferingFolders;
+		std::set<std::string> mReportedFolders;
+	};
+	
+} // namespace compare_Impl
+
+#endif /* FolderDifferences_h */
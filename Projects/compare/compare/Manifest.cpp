@@ -0,0 +1,851 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Common/Checksum.h"
+#include "Common/Progress.h"
+#include "Manifest.h"
+
+namespace compare_Impl {
+	namespace Manifest_Impl {
+		
+		//
+		static const char kMagic[8] = { 'C', 'M', 'P', 'M', 'A', 'N', '0', '1' };
+		static const uint32_t kVersion = 1;
+		
+		// Header flags.
+		static const uint32_t kHasDigests = 1;
+		
+		//
+		struct Header {
+			char mMagic[8];
+			uint32_t mVersion;
+			uint32_t mFlags;
+			uint64_t mEntryCount;
+			uint32_t mRootLength;
+			uint32_t mReserved;
+		};
+		
+		//
+		static const char kIndexMagic[8] = { 'C', 'M', 'P', 'D', 'I', 'X', '0', '1' };
+		static const uint32_t kIndexVersion = 1;
+		static const char* kIndexSuffix = ".dirs";
+		
+		// Ties the index to the manifest it was written with.
+		struct IndexHeader {
+			char mMagic[8];
+			uint32_t mVersion;
+			uint32_t mFlags;
+			uint64_t mManifestSize;
+			uint64_t mManifestEntryCount;
+			uint64_t mRecordCount;
+		};
+		
+		// How far reading gets ahead of the pages it has already let go of.
+		static const size_t kReleaseInterval = 64 * 1024 * 1024;
+		
+		//
+		void AppendVarint(std::string& buffer, uint64_t value) {
+			while (value >= 0x80) {
+				buffer += (char)((value & 0x7f) | 0x80);
+				value >>= 7;
+			}
+			buffer += (char)value;
+		}
+		
+		//
+		inline uint64_t ZigZag(int64_t value) {
+			return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+		}
+		
+		//
+		inline int64_t UnZigZag(uint64_t value) {
+			return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+		}
+		
+		//
+		bool ReadVarint(const uint8_t*& p, const uint8_t* end, uint64_t& outValue) {
+			uint64_t value = 0;
+			for (int shift = 0; (shift < 64) && (p < end); shift += 7) {
+				uint8_t byte = *p++;
+				value |= (uint64_t)(byte & 0x7f) << shift;
+				if ((byte & 0x80) == 0) {
+					outValue = value;
+					return true;
+				}
+			}
+			return false;
+		}
+		
+		//
+		bool ReadVarint32(const uint8_t*& p, const uint8_t* end, uint32_t& outValue) {
+			uint64_t value = 0;
+			if (!ReadVarint(p, end, value) || (value > UINT32_MAX)) {
+				return false;
+			}
+			outValue = (uint32_t)value;
+			return true;
+		}
+		
+		//
+		ManifestItemType GetItemType(uint32_t mode) {
+			if (S_ISREG(mode)) {
+				return ManifestItemType::kFile;
+			}
+			if (S_ISDIR(mode)) {
+				return ManifestItemType::kDirectory;
+			}
+			if (S_ISLNK(mode)) {
+				return ManifestItemType::kSymbolicLink;
+			}
+			return ManifestItemType::kOther;
+		}
+		
+		//
+		bool ReadLinkTarget(const std::string& pathUTF8, std::string& outTarget) {
+			std::vector<char> buffer(256);
+			while (true) {
+				ssize_t length = readlink(pathUTF8.c_str(), buffer.data(), buffer.size());
+				if (length < 0) {
+					return false;
+				}
+				if ((size_t)length < buffer.size()) {
+					outTarget.assign(buffer.data(), (size_t)length);
+					return true;
+				}
+				buffer.resize(buffer.size() * 2);
+			}
+		}
+		
+		// The part of an item that goes into its directory's digests. Names rather than paths, so
+		// equal subtrees hash the same wherever they are.
+		void AppendDigestInput(std::string& buffer, const ManifestEntry& entry) {
+			size_t slash = entry.mPath.rfind('/');
+			size_t nameStart = (slash == std::string::npos) ? 0 : (slash + 1);
+			AppendVarint(buffer, entry.mPath.size() - nameStart);
+			buffer.append(entry.mPath, nameStart, std::string::npos);
+			buffer += (char)entry.mType;
+			AppendVarint(buffer, entry.mMode);
+			AppendVarint(buffer, entry.mUserID);
+			AppendVarint(buffer, entry.mGroupID);
+			AppendVarint(buffer, entry.mFlags);
+			for (int n = 0; n < 8; ++n) {
+				buffer += (char)((entry.mXAttrsHash >> (n * 8)) & 0xff);
+			}
+			if (entry.mType == ManifestItemType::kFile) {
+				AppendVarint(buffer, entry.mSize);
+				if (entry.mHasDigest) {
+					buffer.append((const char*)entry.mDigest.mBytes, sizeof(entry.mDigest.mBytes));
+				}
+			}
+			else if (entry.mType == ManifestItemType::kSymbolicLink) {
+				AppendVarint(buffer, entry.mLinkTarget.size());
+				buffer += entry.mLinkTarget;
+			}
+		}
+		
+	} // namespace Manifest_Impl
+	using namespace Manifest_Impl;
+	
+	//
+	struct DirectoryIndexRecord {
+		// The directory's own entry, and the first entry after its subtree.
+		uint64_t mEntryOffset;
+		uint64_t mEndOffset;
+		uint64_t mEntryCount;
+		uint64_t mDirectoryCount;
+		uint64_t mFileCount;
+		uint64_t mByteCount;
+		uint8_t mDigest[common::kSha256DigestSize];
+		uint8_t mDatelessDigest[common::kSha256DigestSize];
+	};
+	
+	//
+	int CompareManifestPaths(const std::string& path1, const std::string& path2) {
+		size_t length = std::min(path1.size(), path2.size());
+		for (size_t n = 0; n < length; ++n) {
+			if (path1[n] != path2[n]) {
+				// The separator sorts before anything that can be in a name.
+				unsigned char ch1 = (path1[n] == '/') ? 0 : (unsigned char)path1[n];
+				unsigned char ch2 = (path2[n] == '/') ? 0 : (unsigned char)path2[n];
+				return (ch1 < ch2) ? -1 : 1;
+			}
+		}
+		if (path1.size() == path2.size()) {
+			return 0;
+		}
+		return (path1.size() < path2.size()) ? -1 : 1;
+	}
+	
+	//
+	bool IsManifestPathWithin(const std::string& path, const std::string& directoryPath) {
+		if (directoryPath.empty()) {
+			return !path.empty();
+		}
+		return (path.size() > directoryPath.size()) &&
+			   (path[directoryPath.size()] == '/') &&
+			   (path.compare(0, directoryPath.size(), directoryPath) == 0);
+	}
+	
+	//
+	TreeManifestSource::TreeManifestSource(const std::string& rootUTF8,
+										   const common::ExclusionMatcherPtr& exclusions,
+										   const ManifestErrorFunction& onError,
+										   common::ProgressCounters* progress) :
+	mRootUTF8(rootUTF8),
+	mExclusions(exclusions),
+	mOnError(onError),
+	mProgress(progress),
+	mDescend(true) {
+		while ((mRootUTF8.size() > 1) && (mRootUTF8.back() == '/')) {
+			mRootUTF8.pop_back();
+		}
+	}
+	
+	//
+	std::string TreeManifestSource::GetFullPath(const std::string& path) const {
+		return GetManifestItemPath(*this, path);
+	}
+	
+	//
+	bool TreeManifestSource::Next(ManifestEntry& outEntry) {
+		while (true) {
+			if (mDescend) {
+				mDescend = false;
+				std::string directoryUTF8(GetFullPath(mDescendPath));
+				auto snapshot = common::MetadataSnapshotter::TakeSnapshot(directoryUTF8);
+				if (snapshot == nullptr) {
+					mOnError(directoryUTF8, errno);
+				}
+				else {
+					mLevels.push_back(Level { mDescendPath, snapshot, 0 });
+				}
+			}
+			if (mLevels.empty()) {
+				return false;
+			}
+			Level& level = mLevels.back();
+			if (level.mIndex == level.mSnapshot->GetCount()) {
+				mLevels.pop_back();
+				continue;
+			}
+			size_t index = level.mIndex++;
+			const common::DirectorySnapshot& snapshot = *level.mSnapshot;
+			const std::string& name = snapshot.mNames[index];
+			outEntry.mPath = level.mPath.empty() ? name : (level.mPath + "/" + name);
+			if ((mExclusions != nullptr) &&
+				mExclusions->Match(mExclusions->NeedsPath() ? outEntry.mPath : name).IsExcluded(S_ISDIR(snapshot.mModes[index]))) {
+				continue;
+			}
+			if ((snapshot.mValid[index] & common::DirectorySnapshot::kStatValid) == 0) {
+				mOnError(GetFullPath(outEntry.mPath), EIO);
+				continue;
+			}
+			uint32_t mode = snapshot.mModes[index];
+			outEntry.mType = GetItemType(mode);
+			outEntry.mMode = mode & 07777;
+			outEntry.mUserID = snapshot.mUserIDs[index];
+			outEntry.mGroupID = snapshot.mGroupIDs[index];
+			outEntry.mFlags = snapshot.mFlags[index];
+			outEntry.mSize = (outEntry.mType == ManifestItemType::kFile) ? snapshot.mSizes[index] : 0;
+			outEntry.mModificationTime = snapshot.mModificationTimes[index];
+			outEntry.mBirthTime = snapshot.mBirthTimes[index];
+			outEntry.mXAttrsHash = 0;
+			const std::string& xattrs = snapshot.mXAttrs[index];
+			if (!xattrs.empty()) {
+				common::XXHash64 hash;
+				hash.Update(xattrs.data(), xattrs.size());
+				outEntry.mXAttrsHash = hash.Finish();
+			}
+			outEntry.mLinkTarget.clear();
+			outEntry.mHasDigest = false;
+			if ((outEntry.mType == ManifestItemType::kSymbolicLink) &&
+				!ReadLinkTarget(GetFullPath(outEntry.mPath), outEntry.mLinkTarget)) {
+				mOnError(GetFullPath(outEntry.mPath), errno);
+				continue;
+			}
+			if (outEntry.mType == ManifestItemType::kDirectory) {
+				mDescend = true;
+				mDescendPath = outEntry.mPath;
+			}
+			return true;
+		}
+	}
+	
+	//
+	bool TreeManifestSource::GetDigest(const ManifestEntry& entry, common::Sha256Digest& outDigest) {
+		if (!common::CalculateFileSha256(GetFullPath(entry.mPath), outDigest)) {
+			return false;
+		}
+		if (mProgress != nullptr) {
+			mProgress->AddBytes(entry.mSize);
+		}
+		return true;
+	}
+	
+	//
+	ManifestWriter::ManifestWriter(const std::string& manifestPathUTF8, const std::string& rootUTF8, bool withDigests) :
+	mManifestPathUTF8(manifestPathUTF8),
+	mTempPathUTF8(manifestPathUTF8 + ".tmp"),
+	mRootUTF8(rootUTF8),
+	mWithDigests(withDigests),
+	mFile(nullptr),
+	mEntryCount(0),
+	mOffset(0),
+	mIndexTempPathUTF8(GetDirectoryIndexPath(manifestPathUTF8) + ".tmp"),
+	mIndexFD(-1),
+	mIndexFailed(false),
+	mIndexRecordCount(0) {
+	}
+	
+	//
+	ManifestWriter::~ManifestWriter() {
+		if (mFile != nullptr) {
+			fclose(mFile);
+			unlink(mTempPathUTF8.c_str());
+		}
+		if (mIndexFD >= 0) {
+			close(mIndexFD);
+			unlink(mIndexTempPathUTF8.c_str());
+		}
+	}
+	
+	//
+	bool ManifestWriter::Open() {
+		mFile = fopen(mTempPathUTF8.c_str(), "wb");
+		if (mFile == nullptr) {
+			return false;
+		}
+		setvbuf(mFile, nullptr, _IOFBF, 1024 * 1024);
+		// The index is a nicety; the manifest goes ahead without one.
+		mIndexFD = open(mIndexTempPathUTF8.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		mIndexFailed = (mIndexFD < 0);
+		// Filled in for real by Finish.
+		Header header;
+		memset(&header, 0, sizeof(header));
+		mOffset = sizeof(header) + mRootUTF8.size();
+		return (fwrite(&header, sizeof(header), 1, mFile) == 1) &&
+			   (fwrite(mRootUTF8.data(), 1, mRootUTF8.size(), mFile) == mRootUTF8.size());
+	}
+	
+	//
+	void ManifestWriter::AddToParent(const ManifestEntry& entry, const SubtreeDigest* subtree) {
+		if (mOpenDirectories.empty()) {
+			return;
+		}
+		OpenDirectory& parent = mOpenDirectories.back();
+		mBuffer.clear();
+		AppendDigestInput(mBuffer, entry);
+		parent.mHash.Update(mBuffer.data(), mBuffer.size());
+		parent.mDatelessHash.Update(mBuffer.data(), mBuffer.size());
+		int64_t times[2] = { entry.mModificationTime, entry.mBirthTime };
+		parent.mHash.Update(times, sizeof(times));
+		
+		SubtreeDigest& counts = parent.mSubtree;
+		++counts.mEntryCount;
+		if (subtree != nullptr) {
+			parent.mHash.Update(subtree->mDigest.mBytes, sizeof(subtree->mDigest.mBytes));
+			parent.mDatelessHash.Update(subtree->mDatelessDigest.mBytes, sizeof(subtree->mDatelessDigest.mBytes));
+			counts.mEntryCount += subtree->mEntryCount;
+			counts.mDirectoryCount += subtree->mDirectoryCount + 1;
+			counts.mFileCount += subtree->mFileCount;
+			counts.mByteCount += subtree->mByteCount;
+		}
+		else if (entry.mType == ManifestItemType::kFile) {
+			++counts.mFileCount;
+			counts.mByteCount += entry.mSize;
+		}
+	}
+	
+	//
+	void ManifestWriter::CloseDirectories(const std::string& path) {
+		while (!mOpenDirectories.empty() &&
+			   (path.empty() || !IsManifestPathWithin(path, mOpenDirectories.back().mEntry.mPath))) {
+			OpenDirectory directory(std::move(mOpenDirectories.back()));
+			mOpenDirectories.pop_back();
+			directory.mSubtree.mDigest = directory.mHash.Finish();
+			directory.mSubtree.mDatelessDigest = directory.mDatelessHash.Finish();
+			if (!mIndexFailed) {
+				DirectoryIndexRecord record;
+				record.mEntryOffset = directory.mOffset;
+				record.mEndOffset = mOffset;
+				record.mEntryCount = directory.mSubtree.mEntryCount;
+				record.mDirectoryCount = directory.mSubtree.mDirectoryCount;
+				record.mFileCount = directory.mSubtree.mFileCount;
+				record.mByteCount = directory.mSubtree.mByteCount;
+				memcpy(record.mDigest, directory.mSubtree.mDigest.mBytes, sizeof(record.mDigest));
+				memcpy(record.mDatelessDigest, directory.mSubtree.mDatelessDigest.mBytes, sizeof(record.mDatelessDigest));
+				// Records close in post-order but are kept in manifest order, which is what each
+				// directory's slot is.
+				off_t position = (off_t)(sizeof(IndexHeader) + directory.mSlot * sizeof(record));
+				if (pwrite(mIndexFD, &record, sizeof(record), position) != (ssize_t)sizeof(record)) {
+					mIndexFailed = true;
+				}
+			}
+			AddToParent(directory.mEntry, &directory.mSubtree);
+		}
+	}
+	
+	//
+	bool ManifestWriter::Add(const ManifestEntry& entry) {
+		CloseDirectories(entry.mPath);
+		if (entry.mType == ManifestItemType::kDirectory) {
+			mOpenDirectories.push_back(OpenDirectory());
+			OpenDirectory& directory = mOpenDirectories.back();
+			directory.mEntry = entry;
+			directory.mSlot = mIndexRecordCount++;
+			directory.mOffset = mOffset;
+		}
+		else {
+			AddToParent(entry, nullptr);
+		}
+		
+		size_t shared = 0;
+		size_t maxShared = std::min(mPreviousPath.size(), entry.mPath.size());
+		while ((shared < maxShared) && (mPreviousPath[shared] == entry.mPath[shared])) {
+			++shared;
+		}
+		mBuffer.clear();
+		AppendVarint(mBuffer, shared);
+		AppendVarint(mBuffer, entry.mPath.size() - shared);
+		mBuffer.append(entry.mPath, shared, std::string::npos);
+		mBuffer += (char)entry.mType;
+		AppendVarint(mBuffer, entry.mMode);
+		AppendVarint(mBuffer, entry.mUserID);
+		AppendVarint(mBuffer, entry.mGroupID);
+		AppendVarint(mBuffer, entry.mFlags);
+		AppendVarint(mBuffer, ZigZag(entry.mModificationTime));
+		AppendVarint(mBuffer, ZigZag(entry.mBirthTime));
+		for (int n = 0; n < 8; ++n) {
+			mBuffer += (char)((entry.mXAttrsHash >> (n * 8)) & 0xff);
+		}
+		if (entry.mType == ManifestItemType::kFile) {
+			AppendVarint(mBuffer, entry.mSize);
+			if (mWithDigests) {
+				mBuffer.append((const char*)entry.mDigest.mBytes, sizeof(entry.mDigest.mBytes));
+			}
+		}
+		else if (entry.mType == ManifestItemType::kSymbolicLink) {
+			AppendVarint(mBuffer, entry.mLinkTarget.size());
+			mBuffer += entry.mLinkTarget;
+		}
+		if (fwrite(mBuffer.data(), 1, mBuffer.size(), mFile) != mBuffer.size()) {
+			return false;
+		}
+		mPreviousPath = entry.mPath;
+		mOffset += mBuffer.size();
+		++mEntryCount;
+		return true;
+	}
+	
+	//
+	bool ManifestWriter::Finish() {
+		Header header;
+		memcpy(header.mMagic, kMagic, sizeof(kMagic));
+		header.mVersion = kVersion;
+		header.mFlags = mWithDigests ? kHasDigests : 0;
+		header.mEntryCount = mEntryCount;
+		header.mRootLength = (uint32_t)mRootUTF8.size();
+		header.mReserved = 0;
+		bool success = (fseek(mFile, 0, SEEK_SET) == 0) && (fwrite(&header, sizeof(header), 1, mFile) == 1);
+		if (fclose(mFile) != 0) {
+			success = false;
+		}
+		mFile = nullptr;
+		
+		CloseDirectories(std::string());
+		if (!mIndexFailed) {
+			IndexHeader indexHeader;
+			memcpy(indexHeader.mMagic, kIndexMagic, sizeof(kIndexMagic));
+			indexHeader.mVersion = kIndexVersion;
+			indexHeader.mFlags = header.mFlags;
+			indexHeader.mManifestSize = mOffset;
+			indexHeader.mManifestEntryCount = mEntryCount;
+			indexHeader.mRecordCount = mIndexRecordCount;
+			mIndexFailed = (pwrite(mIndexFD, &indexHeader, sizeof(indexHeader), 0) != (ssize_t)sizeof(indexHeader));
+		}
+		if ((mIndexFD >= 0) && (close(mIndexFD) != 0)) {
+			mIndexFailed = true;
+		}
+		mIndexFD = -1;
+		std::string indexPathUTF8(GetDirectoryIndexPath(mManifestPathUTF8));
+		// An index left over from an earlier manifest would be turned down for not matching, but
+		// there's no point leaving it around.
+		unlink(indexPathUTF8.c_str());
+		
+		if (!success || (rename(mTempPathUTF8.c_str(), mManifestPathUTF8.c_str()) != 0)) {
+			unlink(mTempPathUTF8.c_str());
+			unlink(mIndexTempPathUTF8.c_str());
+			return false;
+		}
+		if (mIndexFailed || (rename(mIndexTempPathUTF8.c_str(), indexPathUTF8.c_str()) != 0)) {
+			unlink(mIndexTempPathUTF8.c_str());
+		}
+		return true;
+	}
+	
+	//
+	ManifestReader::ManifestReader() :
+	mMappedData(nullptr),
+	mMappedSize(0),
+	mPosition(nullptr),
+	mEnd(nullptr),
+	mReleased(nullptr),
+	mHasDigests(false),
+	mEntryCount(0),
+	mEntriesRead(0),
+	mSkipping(false),
+	mCorrupt(false),
+	mEntryOffset(0),
+	mIndexData(nullptr),
+	mIndexSize(0),
+	mIndexRecords(nullptr),
+	mIndexRecordCount(0),
+	mIndexCursor(0) {
+	}
+	
+	//
+	ManifestReader::~ManifestReader() {
+		if (mMappedData != nullptr) {
+			munmap(mMappedData, mMappedSize);
+		}
+		if (mIndexData != nullptr) {
+			munmap(mIndexData, mIndexSize);
+		}
+	}
+	
+	//
+	bool ManifestReader::Open(const std::string& manifestPathUTF8) {
+		int fd = open(manifestPathUTF8.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat s;
+		if ((fstat(fd, &s) != 0) || ((size_t)s.st_size < sizeof(Header))) {
+			close(fd);
+			return false;
+		}
+		void* data = mmap(nullptr, (size_t)s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED) {
+			return false;
+		}
+		mMappedData = data;
+		mMappedSize = (size_t)s.st_size;
+		
+		const Header* header = (const Header*)data;
+		if ((memcmp(header->mMagic, kMagic, sizeof(kMagic)) != 0) ||
+			(header->mVersion != kVersion) ||
+			(header->mRootLength > (mMappedSize - sizeof(Header)))) {
+			return false;
+		}
+		madvise(data, mMappedSize, MADV_SEQUENTIAL);
+		const uint8_t* base = (const uint8_t*)data;
+		mRootUTF8.assign((const char*)base + sizeof(Header), header->mRootLength);
+		mHasDigests = ((header->mFlags & kHasDigests) != 0);
+		mEntryCount = header->mEntryCount;
+		mPosition = base + sizeof(Header) + header->mRootLength;
+		mEnd = base + mMappedSize;
+		mReleased = base;
+		OpenDirectoryIndex(GetDirectoryIndexPath(manifestPathUTF8));
+		return true;
+	}
+	
+	//
+	void ManifestReader::OpenDirectoryIndex(const std::string& indexPathUTF8) {
+		int fd = open(indexPathUTF8.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return;
+		}
+		struct stat s;
+		if ((fstat(fd, &s) != 0) || ((size_t)s.st_size < sizeof(IndexHeader))) {
+			close(fd);
+			return;
+		}
+		void* data = mmap(nullptr, (size_t)s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED) {
+			return;
+		}
+		mIndexData = data;
+		mIndexSize = (size_t)s.st_size;
+		
+		const IndexHeader* header = (const IndexHeader*)data;
+		const Header* manifestHeader = (const Header*)mMappedData;
+		if ((memcmp(header->mMagic, kIndexMagic, sizeof(kIndexMagic)) != 0) ||
+			(header->mVersion != kIndexVersion) ||
+			(header->mFlags != manifestHeader->mFlags) ||
+			(header->mManifestSize != mMappedSize) ||
+			(header->mManifestEntryCount != mEntryCount) ||
+			(header->mRecordCount != ((mIndexSize - sizeof(IndexHeader)) / sizeof(DirectoryIndexRecord)))) {
+			return;
+		}
+		mIndexRecords = (const DirectoryIndexRecord*)((const uint8_t*)data + sizeof(IndexHeader));
+		mIndexRecordCount = header->mRecordCount;
+	}
+	
+	//
+	const DirectoryIndexRecord* ManifestReader::FindIndexRecord(uint64_t entryOffset) {
+		while ((mIndexCursor < mIndexRecordCount) && (mIndexRecords[mIndexCursor].mEntryOffset < entryOffset)) {
+			++mIndexCursor;
+		}
+		if ((mIndexCursor == mIndexRecordCount) || (mIndexRecords[mIndexCursor].mEntryOffset != entryOffset)) {
+			return nullptr;
+		}
+		const DirectoryIndexRecord* record = &mIndexRecords[mIndexCursor];
+		// Don't trust it to jump anywhere but forward within the manifest.
+		if ((record->mEndOffset <= record->mEntryOffset) ||
+			(record->mEndOffset > mMappedSize) ||
+			(record->mEntryCount > (mEntryCount - mEntriesRead))) {
+			return nullptr;
+		}
+		return record;
+	}
+	
+	//
+	bool ManifestReader::Decode(ManifestEntry& outEntry) {
+		const uint8_t* p = mPosition;
+		uint64_t shared = 0;
+		uint64_t suffixLength = 0;
+		if (!ReadVarint(p, mEnd, shared) || (shared > mPreviousPath.size()) ||
+			!ReadVarint(p, mEnd, suffixLength) || (suffixLength > (uint64_t)(mEnd - p))) {
+			return false;
+		}
+		outEntry.mPath.assign(mPreviousPath, 0, (size_t)shared);
+		outEntry.mPath.append((const char*)p, (size_t)suffixLength);
+		p += suffixLength;
+		if (p == mEnd) {
+			return false;
+		}
+		outEntry.mType = (ManifestItemType)*p++;
+		uint64_t modificationTime = 0;
+		uint64_t birthTime = 0;
+		if (!ReadVarint32(p, mEnd, outEntry.mMode) ||
+			!ReadVarint32(p, mEnd, outEntry.mUserID) ||
+			!ReadVarint32(p, mEnd, outEntry.mGroupID) ||
+			!ReadVarint32(p, mEnd, outEntry.mFlags) ||
+			!ReadVarint(p, mEnd, modificationTime) ||
+			!ReadVarint(p, mEnd, birthTime) ||
+			((mEnd - p) < 8)) {
+			return false;
+		}
+		outEntry.mModificationTime = UnZigZag(modificationTime);
+		outEntry.mBirthTime = UnZigZag(birthTime);
+		outEntry.mXAttrsHash = 0;
+		for (int n = 0; n < 8; ++n) {
+			outEntry.mXAttrsHash |= (uint64_t)p[n] << (n * 8);
+		}
+		p += 8;
+		outEntry.mSize = 0;
+		outEntry.mLinkTarget.clear();
+		outEntry.mHasDigest = false;
+		if (outEntry.mType == ManifestItemType::kFile) {
+			if (!ReadVarint(p, mEnd, outEntry.mSize)) {
+				return false;
+			}
+			if (mHasDigests) {
+				if ((size_t)(mEnd - p) < sizeof(outEntry.mDigest.mBytes)) {
+					return false;
+				}
+				memcpy(outEntry.mDigest.mBytes, p, sizeof(outEntry.mDigest.mBytes));
+				p += sizeof(outEntry.mDigest.mBytes);
+				outEntry.mHasDigest = true;
+			}
+		}
+		else if (outEntry.mType == ManifestItemType::kSymbolicLink) {
+			uint64_t targetLength = 0;
+			if (!ReadVarint(p, mEnd, targetLength) || (targetLength > (uint64_t)(mEnd - p))) {
+				return false;
+			}
+			outEntry.mLinkTarget.assign((const char*)p, (size_t)targetLength);
+			p += targetLength;
+		}
+		mPosition = p;
+		mPreviousPath = outEntry.mPath;
+		return true;
+	}
+	
+	//
+	void ManifestReader::ReleaseBehind() {
+		if ((size_t)(mPosition - mReleased) < kReleaseInterval) {
+			return;
+		}
+		// Only whole pages behind the entry being read.
+		size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+		const uint8_t* base = (const uint8_t*)mMappedData;
+		const uint8_t* end = base + ((size_t)(mPosition - base) / pageSize) * pageSize;
+		madvise((void*)mReleased, (size_t)(end - mReleased), MADV_DONTNEED);
+		mReleased = end;
+	}
+	
+	//
+	bool ManifestReader::Next(ManifestEntry& outEntry) {
+		while (mEntriesRead < mEntryCount) {
+			mEntryOffset = (uint64_t)(mPosition - (const uint8_t*)mMappedData);
+			if (!Decode(outEntry)) {
+				mCorrupt = true;
+				return false;
+			}
+			++mEntriesRead;
+			ReleaseBehind();
+			if (mSkipping && IsManifestPathWithin(outEntry.mPath, mSkipPath)) {
+				continue;
+			}
+			mSkipping = false;
+			if ((mExclusions != nullptr) && IsExcluded(outEntry)) {
+				if (outEntry.mType == ManifestItemType::kDirectory) {
+					SkipChildren();
+				}
+				continue;
+			}
+			return true;
+		}
+		return false;
+	}
+	
+	//
+	bool ManifestReader::IsExcluded(const ManifestEntry& entry) const {
+		bool isDirectory = (entry.mType == ManifestItemType::kDirectory);
+		if (mExclusions->NeedsPath()) {
+			return mExclusions->Match(entry.mPath).IsExcluded(isDirectory);
+		}
+		size_t slash = entry.mPath.rfind('/');
+		size_t nameStart = (slash == std::string::npos) ? 0 : (slash + 1);
+		return mExclusions->Match(entry.mPath.data() + nameStart, entry.mPath.size() - nameStart).IsExcluded(isDirectory);
+	}
+	
+	//
+	void ManifestReader::SkipChildren() {
+		const DirectoryIndexRecord* record = (mIndexRecords != nullptr) ? FindIndexRecord(mEntryOffset) : nullptr;
+		if (record != nullptr) {
+			// Everything after the subtree shares no more of its path with the subtree's last
+			// entry than with the directory, which stays the previous path.
+			mPosition = (const uint8_t*)mMappedData + record->mEndOffset;
+			mEntriesRead += record->mEntryCount;
+			return;
+		}
+		mSkipping = true;
+		mSkipPath = mPreviousPath;
+	}
+	
+	//
+	bool ManifestReader::GetDigest(const ManifestEntry& entry, common::Sha256Digest& outDigest) {
+		if (!entry.mHasDigest) {
+			return false;
+		}
+		outDigest = entry.mDigest;
+		return true;
+	}
+	
+	//
+	bool ManifestReader::GetSubtreeDigest(const ManifestEntry& directory, SubtreeDigest& outDigest) {
+		if ((mIndexRecords == nullptr) || (directory.mPath != mPreviousPath)) {
+			return false;
+		}
+		const DirectoryIndexRecord* record = FindIndexRecord(mEntryOffset);
+		if (record == nullptr) {
+			return false;
+		}
+		memcpy(outDigest.mDigest.mBytes, record->mDigest, sizeof(record->mDigest));
+		memcpy(outDigest.mDatelessDigest.mBytes, record->mDatelessDigest, sizeof(record->mDatelessDigest));
+		outDigest.mCoversContents = mHasDigests;
+		outDigest.mEntryCount = record->mEntryCount;
+		outDigest.mDirectoryCount = record->mDirectoryCount;
+		outDigest.mFileCount = record->mFileCount;
+		outDigest.mByteCount = record->mByteCount;
+		return true;
+	}
+	
+	//
+	std::string GetDirectoryIndexPath(const std::string& manifestPathUTF8) {
+		return manifestPathUTF8 + kIndexSuffix;
+	}
+	
+	//
+	std::string GetManifestItemPath(const ManifestSource& source, const std::string& path) {
+		const std::string& root = source.GetRootPath();
+		if (path.empty()) {
+			return root;
+		}
+		if (root.empty() || (root.back() == '/')) {
+			return root + path;
+		}
+		return root + "/" + path;
+	}
+	
+	//
+	bool IsManifestFile(const std::string& pathUTF8) {
+		int fd = open(pathUTF8.c_str(), O_RDONLY | O_NOFOLLOW);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat s;
+		char magic[sizeof(kMagic)];
+		bool isManifest = (fstat(fd, &s) == 0) &&
+						  S_ISREG(s.st_mode) &&
+						  (pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic)) &&
+						  (memcmp(magic, kMagic, sizeof(kMagic)) == 0);
+		close(fd);
+		return isManifest;
+	}
+	
+	//
+	bool WriteTreeManifest(const std::string& rootUTF8,
+						   const std::string& manifestPathUTF8,
+						   bool withDigests,
+						   const common::ExclusionMatcherPtr& exclusions,
+						   const ManifestErrorFunction& onError,
+						   common::ProgressCounters* progress,
+						   uint64_t& outEntryCount) {
+		TreeManifestSource source(rootUTF8, exclusions, onError, progress);
+		ManifestWriter writer(manifestPathUTF8, source.GetRootPath(), withDigests);
+		if (!writer.Open()) {
+			return false;
+		}
+		ManifestEntry entry;
+		while (source.Next(entry)) {
+			if (progress != nullptr) {
+				progress->AddEntries(1);
+			}
+			if (entry.mType == ManifestItemType::kFile) {
+				if (withDigests) {
+					if (!source.GetDigest(entry, entry.mDigest)) {
+						onError(GetManifestItemPath(source, entry.mPath), errno);
+						continue;
+					}
+					entry.mHasDigest = true;
+				}
+				if (progress != nullptr) {
+					progress->AddFiles(1);
+				}
+			}
+			if (!writer.Add(entry)) {
+				return false;
+			}
+		}
+		outEntryCount = writer.GetEntryCount();
+		return writer.Finish();
+	}
+	
+} // namespace compare_Impl
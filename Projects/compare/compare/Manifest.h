@@ -0,0 +1,397 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef Manifest_h
+#define Manifest_h
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Common/ExclusionMatcher.h"
+#include "Common/MetadataSnapshot.h"
+#include "Common/Sha256.h"
+
+namespace common {
+	class ProgressCounters;
+}
+
+namespace compare_Impl {
+	
+	//
+	enum class ManifestItemType : uint8_t {
+		kFile = 1,
+		kDirectory = 2,
+		kSymbolicLink = 3,
+		kOther = 4
+	};
+	
+	// One item of a tree, as recorded in a manifest or read from disk. Paths are relative to the
+	// tree's root, separated by '/'.
+	struct ManifestEntry {
+		//
+		ManifestEntry() :
+		mType(ManifestItemType::kOther),
+		mMode(0),
+		mUserID(0),
+		mGroupID(0),
+		mFlags(0),
+		mSize(0),
+		mModificationTime(0),
+		mBirthTime(0),
+		mXAttrsHash(0),
+		mHasDigest(false) {
+		}
+		
+		//
+		std::string mPath;
+		ManifestItemType mType;
+		// Permission bits only; the type is in mType.
+		uint32_t mMode;
+		uint32_t mUserID;
+		uint32_t mGroupID;
+		uint32_t mFlags;
+		// Regular files only.
+		uint64_t mSize;
+		// Nanoseconds. mBirthTime is 0 where the file system doesn't keep one.
+		int64_t mModificationTime;
+		int64_t mBirthTime;
+		// XXH64 of the serialized xattrs (see common::ReadXAttrs), or 0 if there are none.
+		uint64_t mXAttrsHash;
+		// Symbolic links only.
+		std::string mLinkTarget;
+		// Regular files only, when the manifest was written with content digests.
+		bool mHasDigest;
+		common::Sha256Digest mDigest;
+	};
+	
+	// What a manifest's directory index records about everything under one directory.
+	struct SubtreeDigest {
+		//
+		SubtreeDigest() :
+		mCoversContents(false),
+		mEntryCount(0),
+		mDirectoryCount(0),
+		mFileCount(0),
+		mByteCount(0) {
+		}
+		
+		// SHA-256 over each child's name, metadata and content digest, and for a child directory
+		// its own SubtreeDigest: a Merkle tree, so equal digests mean equal subtrees.
+		common::Sha256Digest mDigest;
+		// The same without modification and creation dates, for comparisons that ignore them.
+		common::Sha256Digest mDatelessDigest;
+		// False if the manifest has no content digests, so the digests cover metadata only.
+		bool mCoversContents;
+		// Everything under the directory, at any depth.
+		uint64_t mEntryCount;
+		uint64_t mDirectoryCount;
+		// Regular files and their total size.
+		uint64_t mFileCount;
+		uint64_t mByteCount;
+	};
+	
+	// The order items come out of a manifest or a tree walk in: by path, one component at a time,
+	// so everything under a directory immediately follows it. Negative, zero or positive.
+	int CompareManifestPaths(const std::string& path1, const std::string& path2);
+	
+	// True if path is somewhere under directoryPath.
+	bool IsManifestPathWithin(const std::string& path, const std::string& directoryPath);
+	
+	// One directory's record in a manifest's directory index (see ManifestWriter).
+	struct DirectoryIndexRecord;
+	
+	// Where a comparison gets one side's items from, in CompareManifestPaths order.
+	class ManifestSource {
+	public:
+		//
+		virtual ~ManifestSource() {
+		}
+		
+		// The root the paths are relative to, for reporting.
+		virtual const std::string& GetRootPath() const = 0;
+		
+		// False at the end.
+		virtual bool Next(ManifestEntry& outEntry) = 0;
+		
+		// Leaves out everything under the directory Next just returned.
+		virtual void SkipChildren() = 0;
+		
+		// The contents' digest, if the source has it or can get it.
+		virtual bool GetDigest(const ManifestEntry& entry, common::Sha256Digest& outDigest) = 0;
+		
+		// Whether GetDigest can ever succeed.
+		virtual bool HasDigests() const = 0;
+		
+		// The digest of everything under the directory Next just returned. False if the source
+		// doesn't have one.
+		virtual bool GetSubtreeDigest(const ManifestEntry& directory, SubtreeDigest& outDigest) = 0;
+	};
+	typedef std::shared_ptr<ManifestSource> ManifestSourcePtr;
+	
+	// Unreadable items, by full path, with errno.
+	typedef std::function<void(const std::string& pathUTF8, int error)> ManifestErrorFunction;
+	
+	// Walks a live tree a directory at a time (see common::MetadataSnapshotter::TakeSnapshot),
+	// depth first, reading file contents only when asked for a digest (which progress counts).
+	// Memory use is one snapshot per level of the directory currently being walked.
+	class TreeManifestSource : public ManifestSource {
+	public:
+		//
+		TreeManifestSource(const std::string& rootUTF8,
+						   const common::ExclusionMatcherPtr& exclusions,
+						   const ManifestErrorFunction& onError,
+						   common::ProgressCounters* progress);
+		
+		//
+		virtual const std::string& GetRootPath() const override {
+			return mRootUTF8;
+		}
+		
+		//
+		virtual bool Next(ManifestEntry& outEntry) override;
+		
+		//
+		virtual void SkipChildren() override {
+			mDescend = false;
+		}
+		
+		//
+		virtual bool GetDigest(const ManifestEntry& entry, common::Sha256Digest& outDigest) override;
+		
+		//
+		virtual bool HasDigests() const override {
+			return true;
+		}
+		
+		// A live tree would have to be read in full to get one.
+		virtual bool GetSubtreeDigest(const ManifestEntry& /*directory*/, SubtreeDigest& /*outDigest*/) override {
+			return false;
+		}
+		
+	private:
+		//
+		struct Level {
+			std::string mPath;
+			common::DirectorySnapshotPtr mSnapshot;
+			size_t mIndex;
+		};
+		
+		//
+		std::string GetFullPath(const std::string& path) const;
+		
+		//
+		std::string mRootUTF8;
+		common::ExclusionMatcherPtr mExclusions;
+		ManifestErrorFunction mOnError;
+		common::ProgressCounters* mProgress;
+		std::vector<Level> mLevels;
+		// The directory Next returned last, until the following Next walks into it.
+		bool mDescend;
+		std::string mDescendPath;
+	};
+	
+	// A manifest file: "CMPMAN01", a header, the root path, then the entries in
+	// CompareManifestPaths order. Each entry's path is stored as the length of the prefix it shares
+	// with the previous entry's and the rest; numbers are LEB128 varints (times zigzagged).
+	//
+	// Next to it goes a directory index (GetDirectoryIndexPath): one fixed-size record per
+	// directory, in manifest order, with the directory's SubtreeDigest and where its subtree starts
+	// and ends in the manifest. The digests are built bottom-up as each directory's last child goes
+	// by, so writing one costs memory for the directories currently open and nothing more. A
+	// manifest without its index still reads; comparisons just can't skip subtrees.
+	class ManifestWriter {
+	public:
+		//
+		ManifestWriter(const std::string& manifestPathUTF8, const std::string& rootUTF8, bool withDigests);
+		
+		//
+		~ManifestWriter();
+		
+		// Written to a temporary file next to the manifest.
+		bool Open();
+		
+		// Entries have to arrive in CompareManifestPaths order.
+		bool Add(const ManifestEntry& entry);
+		
+		// Completes the header and moves the manifest and its index into place.
+		bool Finish();
+		
+		//
+		uint64_t GetEntryCount() const {
+			return mEntryCount;
+		}
+		
+	private:
+		//
+		struct OpenDirectory {
+			ManifestEntry mEntry;
+			uint64_t mSlot;
+			uint64_t mOffset;
+			common::Sha256 mHash;
+			common::Sha256 mDatelessHash;
+			SubtreeDigest mSubtree;
+		};
+		
+		// Finishes the directories that path isn't in (all of them for an empty path).
+		void CloseDirectories(const std::string& path);
+		
+		// Adds an item to the digests and counts of the directory it's in.
+		void AddToParent(const ManifestEntry& entry, const SubtreeDigest* subtree);
+		
+		//
+		std::string mManifestPathUTF8;
+		std::string mTempPathUTF8;
+		std::string mRootUTF8;
+		bool mWithDigests;
+		FILE* mFile;
+		uint64_t mEntryCount;
+		std::string mPreviousPath;
+		std::string mBuffer;
+		// Where the next entry goes in the manifest.
+		uint64_t mOffset;
+		std::string mIndexTempPathUTF8;
+		int mIndexFD;
+		bool mIndexFailed;
+		uint64_t mIndexRecordCount;
+		std::vector<OpenDirectory> mOpenDirectories;
+	};
+	
+	// Streams a manifest's entries out of a read-only mapping, dropping the pages behind the read
+	// position as it goes, so reading one costs the same memory at any size.
+	class ManifestReader : public ManifestSource {
+	public:
+		//
+		ManifestReader();
+		
+		//
+		~ManifestReader();
+		
+		// False if the file isn't a manifest this version can read. Its directory index is used if
+		// it's there and belongs to it.
+		bool Open(const std::string& manifestPathUTF8);
+		
+		//
+		virtual const std::string& GetRootPath() const override {
+			return mRootUTF8;
+		}
+		
+		//
+		virtual bool Next(ManifestEntry& outEntry) override;
+		
+		//
+		virtual void SkipChildren() override;
+		
+		//
+		virtual bool GetDigest(const ManifestEntry& entry, common::Sha256Digest& outDigest) override;
+		
+		//
+		virtual bool HasDigests() const override {
+			return mHasDigests;
+		}
+		
+		//
+		virtual bool GetSubtreeDigest(const ManifestEntry& directory, SubtreeDigest& outDigest) override;
+		
+		//
+		bool HasDirectoryIndex() const {
+			return (mIndexRecords != nullptr);
+		}
+		
+		//
+		uint64_t GetEntryCount() const {
+			return mEntryCount;
+		}
+		
+		// Leaves out what exclusions exclude (and everything in an excluded directory), whatever
+		// the manifest was written with.
+		void SetExclusions(const common::ExclusionMatcherPtr& exclusions) {
+			mExclusions = exclusions;
+		}
+		
+		// False if Next stopped early because the data didn't decode.
+		bool IsIntact() const {
+			return !mCorrupt;
+		}
+		
+	private:
+		//
+		bool Decode(ManifestEntry& outEntry);
+		
+		//
+		void ReleaseBehind();
+		
+		//
+		bool IsExcluded(const ManifestEntry& entry) const;
+		
+		//
+		void OpenDirectoryIndex(const std::string& indexPathUTF8);
+		
+		// The index record of the directory at entryOffset in the manifest, or null.
+		const DirectoryIndexRecord* FindIndexRecord(uint64_t entryOffset);
+		
+		//
+		void* mMappedData;
+		size_t mMappedSize;
+		const uint8_t* mPosition;
+		const uint8_t* mEnd;
+		const uint8_t* mReleased;
+		std::string mRootUTF8;
+		bool mHasDigests;
+		uint64_t mEntryCount;
+		uint64_t mEntriesRead;
+		std::string mPreviousPath;
+		bool mSkipping;
+		std::string mSkipPath;
+		bool mCorrupt;
+		// Where the entry Next returned last starts.
+		uint64_t mEntryOffset;
+		common::ExclusionMatcherPtr mExclusions;
+		void* mIndexData;
+		size_t mIndexSize;
+		const DirectoryIndexRecord* mIndexRecords;
+		uint64_t mIndexRecordCount;
+		// Records are looked up in manifest order, so the search only ever moves forward.
+		uint64_t mIndexCursor;
+	};
+	typedef std::shared_ptr<ManifestReader> ManifestReaderPtr;
+	
+	// The directory index that goes with the manifest at manifestPathUTF8.
+	std::string GetDirectoryIndexPath(const std::string& manifestPathUTF8);
+	
+	// Full path of an item of a source.
+	std::string GetManifestItemPath(const ManifestSource& source, const std::string& path);
+	
+	// True if the item at pathUTF8 is a manifest file (by its magic number).
+	bool IsManifestFile(const std::string& pathUTF8);
+	
+	// Walks the tree at rootUTF8 into a new manifest. Unreadable items are passed to onError and
+	// left out.
+	bool WriteTreeManifest(const std::string& rootUTF8,
+						   const std::string& manifestPathUTF8,
+						   bool withDigests,
+						   const common::ExclusionMatcherPtr& exclusions,
+						   const ManifestErrorFunction& onError,
+						   common::ProgressCounters* progress,
+						   uint64_t& outEntryCount);
+	
+} // namespace compare_Impl
+
+#endif /* Manifest_h */
@@ -0,0 +1,289 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+#include "ManifestCompare.h"
+
+namespace compare_Impl {
+	namespace ManifestCompare_Impl {
+		
+		//
+		struct OpenDirectory {
+			std::string mPath;
+			bool mDiffers;
+		};
+		
+		//
+		std::string FormatTime(int64_t timeNs) {
+			time_t seconds = (time_t)(timeNs / 1000000000);
+			int64_t nanoseconds = timeNs % 1000000000;
+			if (nanoseconds < 0) {
+				--seconds;
+				nanoseconds += 1000000000;
+			}
+			struct tm parts;
+			char text[64];
+			if ((gmtime_r(&seconds, &parts) == nullptr) || (strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &parts) == 0)) {
+				return std::to_string(timeNs);
+			}
+			char fraction[16];
+			snprintf(fraction, sizeof(fraction), ".%09lld", (long long)nanoseconds);
+			return std::string(text) + fraction + " UTC";
+		}
+		
+		//
+		class Merger {
+		public:
+			//
+			Merger(ManifestSource& source1,
+				   ManifestSource& source2,
+				   const ManifestCompareOptions& options,
+				   ManifestCompareSink& sink) :
+			mSource1(source1),
+			mSource2(source2),
+			mOptions(options),
+			mSink(sink) {
+			}
+			
+			//
+			void Run() {
+				ManifestEntry entry1;
+				ManifestEntry entry2;
+				bool has1 = mSource1.Next(entry1);
+				bool has2 = mSource2.Next(entry2);
+				while (has1 || has2) {
+					int order = !has1 ? 1 : (!has2 ? -1 : CompareManifestPaths(entry1.mPath, entry2.mPath));
+					CloseDirectories((order <= 0) ? entry1.mPath : entry2.mPath);
+					if (order < 0) {
+						Report(MakeRecord(hermit::file::kItemInPath1Only, entry1.mPath));
+						if (entry1.mType == ManifestItemType::kDirectory) {
+							mSource1.SkipChildren();
+						}
+						has1 = mSource1.Next(entry1);
+					}
+					else if (order > 0) {
+						Report(MakeRecord(hermit::file::kItemInPath2Only, entry2.mPath));
+						if (entry2.mType == ManifestItemType::kDirectory) {
+							mSource2.SkipChildren();
+						}
+						has2 = mSource2.Next(entry2);
+					}
+					else {
+						CompareItems(entry1, entry2);
+						has1 = mSource1.Next(entry1);
+						has2 = mSource2.Next(entry2);
+					}
+				}
+				CloseDirectories(std::string());
+			}
+			
+		private:
+			//
+			DifferenceRecord MakeRecord(const hermit::file::FileNotificationType& type, const std::string& path) {
+				DifferenceRecord record;
+				record.mType = type;
+				record.mPath1UTF8 = GetManifestItemPath(mSource1, path);
+				record.mPath2UTF8 = GetManifestItemPath(mSource2, path);
+				return record;
+			}
+			
+			//
+			void Report(const DifferenceRecord& record) {
+				mSink.OnDifference(record);
+				if (!mOpenDirectories.empty()) {
+					mOpenDirectories.back().mDiffers = true;
+				}
+			}
+			
+			// Finishes each open directory that path isn't in (all of them for an empty path).
+			void CloseDirectories(const std::string& path) {
+				while (!mOpenDirectories.empty() &&
+					   (path.empty() || !IsManifestPathWithin(path, mOpenDirectories.back().mPath))) {
+					OpenDirectory directory(std::move(mOpenDirectories.back()));
+					mOpenDirectories.pop_back();
+					if (directory.mDiffers) {
+						Report(MakeRecord(hermit::file::kFolderContentsDiffer, directory.mPath));
+					}
+				}
+			}
+			
+			//
+			void CompareItems(const ManifestEntry& entry1, const ManifestEntry& entry2) {
+				mSink.OnItem(entry1);
+				if (entry1.mType != entry2.mType) {
+					Report(MakeRecord(hermit::file::kFileTypesDiffer, entry1.mPath));
+					// Whatever's under the directory side isn't compared to anything.
+					if (entry1.mType == ManifestItemType::kDirectory) {
+						mSource1.SkipChildren();
+					}
+					if (entry2.mType == ManifestItemType::kDirectory) {
+						mSource2.SkipChildren();
+					}
+					return;
+				}
+				
+				bool differs = false;
+				auto report = [&](DifferenceRecord&& record) {
+					Report(record);
+					differs = true;
+				};
+				if (entry1.mMode != entry2.mMode) {
+					DifferenceRecord record(MakeRecord(hermit::file::kPermissionsDiffer, entry1.mPath));
+					record.mInt1 = entry1.mMode;
+					record.mInt2 = entry2.mMode;
+					report(std::move(record));
+				}
+				if (entry1.mUserID != entry2.mUserID) {
+					DifferenceRecord record(MakeRecord(hermit::file::kUserOwnersDiffer, entry1.mPath));
+					record.mString1 = std::to_string(entry1.mUserID);
+					record.mString2 = std::to_string(entry2.mUserID);
+					report(std::move(record));
+				}
+				if (entry1.mGroupID != entry2.mGroupID) {
+					DifferenceRecord record(MakeRecord(hermit::file::kGroupOwnersDiffer, entry1.mPath));
+					record.mString1 = std::to_string(entry1.mGroupID);
+					record.mString2 = std::to_string(entry2.mGroupID);
+					report(std::move(record));
+				}
+				if (entry1.mFlags != entry2.mFlags) {
+					DifferenceRecord record(MakeRecord(hermit::file::kBSDFlagsDiffer, entry1.mPath));
+					record.mInt1 = entry1.mFlags;
+					record.mInt2 = entry2.mFlags;
+					report(std::move(record));
+				}
+				bool sameDates = (entry1.mModificationTime == entry2.mModificationTime);
+				if (!mOptions.mIgnoreDates) {
+					if (!sameDates) {
+						DifferenceRecord record(MakeRecord(hermit::file::kModificationDatesDiffer, entry1.mPath));
+						record.mString1 = FormatTime(entry1.mModificationTime);
+						record.mString2 = FormatTime(entry2.mModificationTime);
+						report(std::move(record));
+					}
+					// Only where both file systems keep one.
+					if ((entry1.mBirthTime != 0) && (entry2.mBirthTime != 0) && (entry1.mBirthTime != entry2.mBirthTime)) {
+						DifferenceRecord record(MakeRecord(hermit::file::kCreationDatesDiffer, entry1.mPath));
+						record.mString1 = FormatTime(entry1.mBirthTime);
+						record.mString2 = FormatTime(entry2.mBirthTime);
+						report(std::move(record));
+					}
+				}
+				if (entry1.mXAttrsHash != entry2.mXAttrsHash) {
+					report(MakeRecord(hermit::file::kXAttrValuesDiffer, entry1.mPath));
+				}
+				
+				bool assumed = false;
+				if (entry1.mType == ManifestItemType::kSymbolicLink) {
+					if (entry1.mLinkTarget != entry2.mLinkTarget) {
+						DifferenceRecord record(MakeRecord(hermit::file::kLinkTargetsDiffer, entry1.mPath));
+						record.mString1 = entry1.mLinkTarget;
+						record.mString2 = entry2.mLinkTarget;
+						report(std::move(record));
+					}
+				}
+				else if (entry1.mType == ManifestItemType::kFile) {
+					if (entry1.mSize != entry2.mSize) {
+						DifferenceRecord record(MakeRecord(hermit::file::kFileSizesDiffer, entry1.mPath));
+						record.mInt1 = entry1.mSize;
+						record.mInt2 = entry2.mSize;
+						report(std::move(record));
+					}
+					else if ((mOptions.mQuickCheck && sameDates) || !mSource1.HasDigests() || !mSource2.HasDigests()) {
+						assumed = true;
+					}
+					else {
+						common::Sha256Digest digest1;
+						common::Sha256Digest digest2;
+						if (!mSource1.GetDigest(entry1, digest1)) {
+							mSink.OnError(MakeRecord(hermit::file::kFileContentsDiffer, entry1.mPath));
+							return;
+						}
+						if (!mSource2.GetDigest(entry2, digest2)) {
+							DifferenceRecord record(MakeRecord(hermit::file::kFileContentsDiffer, entry1.mPath));
+							// The error is with the second file.
+							record.mPath1UTF8 = record.mPath2UTF8;
+							mSink.OnError(record);
+							return;
+						}
+						if (digest1 != digest2) {
+							DifferenceRecord record(MakeRecord(hermit::file::kFileContentsDiffer, entry1.mPath));
+							record.mInt1 = kUnknownDifferenceOffset;
+							report(std::move(record));
+						}
+					}
+				}
+				else if (entry1.mType == ManifestItemType::kDirectory) {
+					if (!SkipMatchingSubtree(entry1, entry2)) {
+						mOpenDirectories.push_back(OpenDirectory { entry1.mPath, false });
+					}
+					return;
+				}
+				if (!differs) {
+					mSink.OnMatch(GetManifestItemPath(mSource1, entry1.mPath), GetManifestItemPath(mSource2, entry2.mPath), assumed);
+				}
+			}
+			
+			// True if the directories' contents are known to match without looking at them.
+			bool SkipMatchingSubtree(const ManifestEntry& entry1, const ManifestEntry& entry2) {
+				SubtreeDigest subtree1;
+				SubtreeDigest subtree2;
+				if (!mOptions.mSkipMatchingSubtrees ||
+					!mSource1.GetSubtreeDigest(entry1, subtree1) ||
+					!mSource2.GetSubtreeDigest(entry2, subtree2) ||
+					// The digests only compare if they were made from the same things.
+					(subtree1.mCoversContents != subtree2.mCoversContents)) {
+					return false;
+				}
+				bool match = mOptions.mIgnoreDates ? (subtree1.mDatelessDigest == subtree2.mDatelessDigest) :
+													 (subtree1.mDigest == subtree2.mDigest);
+				if (!match) {
+					return false;
+				}
+				mSource1.SkipChildren();
+				mSource2.SkipChildren();
+				mSink.OnMatchingSubtree(GetManifestItemPath(mSource1, entry1.mPath),
+										GetManifestItemPath(mSource2, entry2.mPath),
+										subtree1,
+										!subtree1.mCoversContents);
+				return true;
+			}
+			
+			//
+			ManifestSource& mSource1;
+			ManifestSource& mSource2;
+			ManifestCompareOptions mOptions;
+			ManifestCompareSink& mSink;
+			// The directories on both sides that the merge is currently inside, outermost first.
+			std::vector<OpenDirectory> mOpenDirectories;
+		};
+		
+	} // namespace ManifestCompare_Impl
+	using namespace ManifestCompare_Impl;
+	
+	//
+	void CompareManifests(ManifestSource& source1,
+						  ManifestSource& source2,
+						  const ManifestCompareOptions& options,
+						  ManifestCompareSink& sink) {
+		Merger merger(source1, source2, options, sink);
+		merger.Run();
+	}
+	
+} // namespace compare_Impl
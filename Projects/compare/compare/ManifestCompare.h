@@ -0,0 +1,85 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef ManifestCompare_h
+#define ManifestCompare_h
+
+#include <string>
+#include "DifferenceRecord.h"
+#include "Manifest.h"
+
+namespace compare_Impl {
+	
+	//
+	struct ManifestCompareOptions {
+		//
+		ManifestCompareOptions() : mIgnoreDates(false), mQuickCheck(false), mSkipMatchingSubtrees(true) {
+		}
+		
+		//
+		bool mIgnoreDates;
+		// Files with the same size and modification date are assumed to match without looking at
+		// their digests.
+		bool mQuickCheck;
+		// Directories whose SubtreeDigests match on both sides aren't descended into, so their
+		// items get no OnItem or OnMatch of their own.
+		bool mSkipMatchingSubtrees;
+	};
+	
+	// Where CompareManifests reports what it finds. Paths are full paths, each side's root joined
+	// to the item's relative path.
+	class ManifestCompareSink {
+	public:
+		//
+		virtual ~ManifestCompareSink() {
+		}
+		
+		// Each item found on both sides, before its result.
+		virtual void OnItem(const ManifestEntry& entry1) = 0;
+		
+		// assumed if the contents weren't compared (quick check, or a side without digests).
+		virtual void OnMatch(const std::string& path1UTF8, const std::string& path2UTF8, bool assumed) = 0;
+		
+		// Everything under a directory found on both sides matched by its SubtreeDigest. assumed as
+		// for OnMatch, for the files in it.
+		virtual void OnMatchingSubtree(const std::string& path1UTF8,
+									   const std::string& path2UTF8,
+									   const SubtreeDigest& subtree,
+									   bool assumed) = 0;
+		
+		//
+		virtual void OnDifference(const DifferenceRecord& record) = 0;
+		
+		//
+		virtual void OnError(const DifferenceRecord& record) = 0;
+	};
+	
+	// Merges the two sides' items in path order, the way CompareFiles would walk two trees: items
+	// on one side only are reported without descending into them, and every directory with a
+	// difference somewhere under it gets a kFolderContentsDiffer. Files of the same size are
+	// compared by digest, so contents are read only from a live tree, and only from that side.
+	// Between two manifests with directory indexes, only the directories whose SubtreeDigests
+	// differ are descended into, so the work follows what changed rather than the size of the tree.
+	void CompareManifests(ManifestSource& source1,
+						  ManifestSource& source2,
+						  const ManifestCompareOptions& options,
+						  ManifestCompareSink& sink);
+	
+} // namespace compare_Impl
+
+#endif /* ManifestCompare_h */
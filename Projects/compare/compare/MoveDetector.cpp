@@ -0,0 +1,362 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <map>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Common/Checksum.h"
+#include "MoveDetector.h"
+
+namespace compare_Impl {
+	namespace MoveDetector_Impl {
+		
+		// How much of each end of a file the partial step reads.
+		static const size_t kPartialSize = 64 * 1024;
+		
+		//
+		bool ReadFully(int fd, uint8_t* buffer, size_t size, uint64_t offset) {
+			while (size > 0) {
+				ssize_t count = pread(fd, buffer, size, (off_t)offset);
+				if (count < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+				if (count == 0) {
+					return false;
+				}
+				buffer += count;
+				size -= (size_t)count;
+				offset += (uint64_t)count;
+			}
+			return true;
+		}
+		
+		//
+		std::string GetLeaf(const std::string& pathUTF8) {
+			return pathUTF8.substr(pathUTF8.rfind('/') + 1);
+		}
+		
+		// 0 for an item only in tree 1, 1 for tree 2.
+		int GetSide(const DifferenceRecord& record) {
+			return (record.mType == hermit::file::kItemInPath1Only) ? 0 : 1;
+		}
+		
+		// The path of the record's item on the side it's on.
+		const std::string& GetItemPath(const DifferenceRecord& record, int side) {
+			return (side == 0) ? record.mPath1UTF8 : record.mPath2UTF8;
+		}
+		
+	} // namespace MoveDetector_Impl
+	using namespace MoveDetector_Impl;
+	
+	//
+	MoveDetector::MoveDetector(const std::string& root1UTF8,
+							   const std::string& root2UTF8,
+							   const common::ExclusionMatcherPtr& exclusions) :
+	mRootUTF8 { root1UTF8, root2UTF8 },
+	mExclusions(exclusions),
+	mRecords(true),
+	mCandidateCount(0),
+	mPartialHashCount(0),
+	mFullHashCount(0),
+	mBytesRead(0) {
+		for (auto& rootUTF8 : mRootUTF8) {
+			while ((rootUTF8.size() > 1) && (rootUTF8.back() == '/')) {
+				rootUTF8.pop_back();
+			}
+		}
+	}
+	
+	//
+	bool MoveDetector::Add(const DifferenceRecord& record) {
+		if ((record.mType != hermit::file::kItemInPath1Only) && (record.mType != hermit::file::kItemInPath2Only)) {
+			return false;
+		}
+		// Without a spill file to keep it in, it's reported now as if moves weren't looked for.
+		if (mRecords.HasFailed()) {
+			return false;
+		}
+		mRecords.Append(record);
+		return true;
+	}
+	
+	//
+	bool MoveDetector::Finish(std::vector<Move>& outMoves, const RecapSpill::RecordFunction& remaining) {
+		bool success = mRecords.ForEach([this](const DifferenceRecord& record) {
+			int side = GetSide(record);
+			AddCandidates(side, GetItemPath(record, side));
+		});
+		mCandidateCount = mCandidates.size();
+		
+		std::map<uint64_t, Group> bySize;
+		for (size_t n = 0; n < mCandidates.size(); ++n) {
+			bySize[mCandidates[n].mSize].push_back(n);
+		}
+		std::vector<Group> groups;
+		for (auto& entry : bySize) {
+			if (HasBothSides(entry.second)) {
+				groups.push_back(std::move(entry.second));
+			}
+		}
+		groups = Refine(groups, [this](Candidate& candidate, std::string& outKey) {
+			return ReadPartialKey(candidate, outKey);
+		});
+		groups = Refine(groups, [this](Candidate& candidate, std::string& outKey) {
+			return ReadFullKey(candidate, outKey);
+		});
+		for (const auto& group : groups) {
+			PairUp(group, outMoves);
+		}
+		std::sort(outMoves.begin(), outMoves.end(), [](const Move& lhs, const Move& rhs) {
+			return (lhs.mPath1UTF8 < rhs.mPath1UTF8);
+		});
+		mCandidates.clear();
+		
+		success = mRecords.ForEach([this, &remaining](const DifferenceRecord& record) {
+			int side = GetSide(record);
+			ReportRemaining(record, side, GetItemPath(record, side), remaining);
+		}) && success;
+		for (auto& movedPaths : mMovedPaths) {
+			movedPaths.clear();
+		}
+		return success;
+	}
+	
+	//
+	bool MoveDetector::HasBothSides(const Group& group) const {
+		bool found[2] = { false, false };
+		for (size_t index : group) {
+			found[mCandidates[index].mSide] = true;
+		}
+		return found[0] && found[1];
+	}
+	
+	//
+	void MoveDetector::AddCandidates(int side, const std::string& pathUTF8) {
+		struct stat s;
+		if (lstat(pathUTF8.c_str(), &s) != 0) {
+			return;
+		}
+		if (!S_ISDIR(s.st_mode)) {
+			if (S_ISREG(s.st_mode) && (s.st_size > 0)) {
+				mCandidates.push_back(Candidate { side, pathUTF8, (uint64_t)s.st_size, false, common::Sha256Digest() });
+			}
+			return;
+		}
+		std::vector<std::string> names;
+		ListDirectory(side, pathUTF8, names);
+		for (const auto& name : names) {
+			AddCandidates(side, pathUTF8 + "/" + name);
+		}
+	}
+	
+	//
+	bool MoveDetector::ListDirectory(int side, const std::string& pathUTF8, std::vector<std::string>& outNames) const {
+		DIR* dir = opendir(pathUTF8.c_str());
+		if (dir == nullptr) {
+			return false;
+		}
+		while (struct dirent* entry = readdir(dir)) {
+			if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0)) {
+				continue;
+			}
+			std::string childUTF8(pathUTF8 + "/" + entry->d_name);
+			struct stat childStat;
+			bool isDirectory = (lstat(childUTF8.c_str(), &childStat) == 0) && S_ISDIR(childStat.st_mode);
+			if (!IsExcluded(side, childUTF8, isDirectory)) {
+				outNames.push_back(entry->d_name);
+			}
+		}
+		closedir(dir);
+		std::sort(outNames.begin(), outNames.end());
+		return true;
+	}
+	
+	//
+	bool MoveDetector::HasMoved(int side, const std::string& pathUTF8) const {
+		const std::set<std::string>& movedPaths = mMovedPaths[side];
+		if (movedPaths.find(pathUTF8) != movedPaths.end()) {
+			return true;
+		}
+		std::string prefix(pathUTF8 + "/");
+		auto it = movedPaths.lower_bound(prefix);
+		return (it != movedPaths.end()) && (it->compare(0, prefix.size(), prefix) == 0);
+	}
+	
+	//
+	void MoveDetector::ReportRemaining(const DifferenceRecord& record,
+									   int side,
+									   const std::string& pathUTF8,
+									   const RecapSpill::RecordFunction& remaining) const {
+		if (!HasMoved(side, pathUTF8)) {
+			const std::string& recordPathUTF8 = GetItemPath(record, side);
+			if (pathUTF8.size() == recordPathUTF8.size()) {
+				remaining(record);
+				return;
+			}
+			// The same difference, for an item inside the record's directory.
+			std::string suffix(pathUTF8, recordPathUTF8.size());
+			DifferenceRecord itemRecord(record);
+			itemRecord.mPath1UTF8 += suffix;
+			itemRecord.mPath2UTF8 += suffix;
+			remaining(itemRecord);
+			return;
+		}
+		// Something at or under it moved, so if it isn't a directory it's gone.
+		std::vector<std::string> names;
+		if (!ListDirectory(side, pathUTF8, names)) {
+			return;
+		}
+		for (const auto& name : names) {
+			ReportRemaining(record, side, pathUTF8 + "/" + name, remaining);
+		}
+	}
+	
+	//
+	bool MoveDetector::IsExcluded(int side, const std::string& pathUTF8, bool isDirectory) const {
+		if ((mExclusions == nullptr) || mExclusions->IsEmpty()) {
+			return false;
+		}
+		size_t start = mExclusions->NeedsPath() ? (mRootUTF8[side].size() + 1) : (pathUTF8.rfind('/') + 1);
+		return mExclusions->Match(pathUTF8.data() + start, pathUTF8.size() - start).IsExcluded(isDirectory);
+	}
+	
+	//
+	template <class KeyFunction>
+	std::vector<MoveDetector::Group> MoveDetector::Refine(const std::vector<Group>& groups, KeyFunction keyFunction) {
+		std::vector<Group> refined;
+		for (const auto& group : groups) {
+			std::map<std::string, Group> byKey;
+			for (size_t index : group) {
+				std::string key;
+				if (keyFunction(mCandidates[index], key)) {
+					byKey[key].push_back(index);
+				}
+			}
+			for (auto& entry : byKey) {
+				if (HasBothSides(entry.second)) {
+					refined.push_back(std::move(entry.second));
+				}
+			}
+		}
+		return refined;
+	}
+	
+	//
+	bool MoveDetector::ReadPartialKey(Candidate& candidate, std::string& outKey) {
+		int fd = open(candidate.mPathUTF8.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return false;
+		}
+		// Files of up to two blocks are read whole, which settles them here.
+		bool whole = (candidate.mSize <= (2 * kPartialSize));
+		size_t headSize = whole ? (size_t)candidate.mSize : kPartialSize;
+		std::vector<uint8_t> buffer(whole ? headSize : (2 * kPartialSize));
+		bool success = ReadFully(fd, buffer.data(), headSize, 0) &&
+					   (whole || ReadFully(fd, buffer.data() + kPartialSize, kPartialSize, candidate.mSize - kPartialSize));
+		close(fd);
+		if (!success) {
+			return false;
+		}
+		++mPartialHashCount;
+		mBytesRead += buffer.size();
+		if (whole) {
+			common::Sha256 hasher;
+			hasher.Update(buffer.data(), buffer.size());
+			candidate.mDigest = hasher.Finish();
+			candidate.mHasDigest = true;
+			outKey.assign((const char*)candidate.mDigest.mBytes, sizeof(candidate.mDigest.mBytes));
+			return true;
+		}
+		common::XXHash64 hash;
+		hash.Update(buffer.data(), buffer.size());
+		uint64_t value = hash.Finish();
+		outKey.assign((const char*)&value, sizeof(value));
+		return true;
+	}
+	
+	//
+	bool MoveDetector::ReadFullKey(Candidate& candidate, std::string& outKey) {
+		if (!candidate.mHasDigest) {
+			if (!common::CalculateFileSha256(candidate.mPathUTF8, candidate.mDigest)) {
+				return false;
+			}
+			candidate.mHasDigest = true;
+			++mFullHashCount;
+			mBytesRead += candidate.mSize;
+		}
+		outKey.assign((const char*)candidate.mDigest.mBytes, sizeof(candidate.mDigest.mBytes));
+		return true;
+	}
+	
+	//
+	void MoveDetector::PairUp(const Group& group, std::vector<Move>& outMoves) {
+		std::vector<size_t> sides[2];
+		for (size_t index : group) {
+			sides[mCandidates[index].mSide].push_back(index);
+		}
+		for (auto& side : sides) {
+			std::sort(side.begin(), side.end(), [this](size_t lhs, size_t rhs) {
+				return (mCandidates[lhs].mPathUTF8 < mCandidates[rhs].mPathUTF8);
+			});
+		}
+		auto pair = [&](size_t index1, size_t index2) {
+			const Candidate& candidate1 = mCandidates[index1];
+			const Candidate& candidate2 = mCandidates[index2];
+			outMoves.push_back(Move { candidate1.mPathUTF8, candidate2.mPathUTF8, candidate1.mSize });
+			mMovedPaths[0].insert(candidate1.mPathUTF8);
+			mMovedPaths[1].insert(candidate2.mPathUTF8);
+		};
+		
+		std::multimap<std::string, size_t> byLeaf2;
+		for (size_t n = 0; n < sides[1].size(); ++n) {
+			byLeaf2.insert(std::make_pair(GetLeaf(mCandidates[sides[1][n]].mPathUTF8), n));
+		}
+		std::vector<bool> paired2(sides[1].size(), false);
+		std::vector<size_t> unpaired1;
+		for (size_t index1 : sides[0]) {
+			auto it = byLeaf2.find(GetLeaf(mCandidates[index1].mPathUTF8));
+			if (it == byLeaf2.end()) {
+				unpaired1.push_back(index1);
+				continue;
+			}
+			pair(index1, sides[1][it->second]);
+			paired2[it->second] = true;
+			byLeaf2.erase(it);
+		}
+		size_t next2 = 0;
+		for (size_t index1 : unpaired1) {
+			while ((next2 < paired2.size()) && paired2[next2]) {
+				++next2;
+			}
+			if (next2 == paired2.size()) {
+				break;
+			}
+			pair(index1, sides[1][next2]);
+			paired2[next2] = true;
+		}
+	}
+	
+} // namespace compare_Impl
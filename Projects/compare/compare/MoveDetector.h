@@ -0,0 +1,149 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef MoveDetector_h
+#define MoveDetector_h
+
+#include <atomic>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+#include "Common/ExclusionMatcher.h"
+#include "Common/Sha256.h"
+#include "DifferenceRecord.h"
+#include "RecapSpill.h"
+
+namespace compare_Impl {
+	
+	// --detect-moves: holds back the "only in" differences of a tree comparison (in a
+	// RecapSpill, so not in memory), then pairs files only in tree 1 with files only in tree 2
+	// that have the same contents. Directories that are only on one side are searched too.
+	// Candidates are narrowed down in three steps so that most are never read: by size, then by
+	// a hash of the first and last 64 KB, and only then by a SHA-256 of the whole file. Empty
+	// files are left alone since they'd all pair up.
+	class MoveDetector {
+	public:
+		//
+		struct Move {
+			std::string mPath1UTF8;
+			std::string mPath2UTF8;
+			uint64_t mSize;
+		};
+		
+		//
+		MoveDetector(const std::string& root1UTF8,
+					 const std::string& root2UTF8,
+					 const common::ExclusionMatcherPtr& exclusions);
+		
+		// True if the record is an "only in" difference, which is kept until Finish instead of
+		// being reported now. Safe to call from any thread.
+		bool Add(const DifferenceRecord& record);
+		
+		// The moves found, and through remaining the "only in" differences that still stand, in
+		// the order they were added. A file that moved is left out. So is a directory whose
+		// contents all moved. A directory only some of whose contents moved is replaced by
+		// differences for what's left in it: its items that didn't move, and its
+		// subdirectories, whole, that have nothing in them that moved. False if held records
+		// couldn't be read back, in which case some differences are missing.
+		bool Finish(std::vector<Move>& outMoves, const RecapSpill::RecordFunction& remaining);
+		
+		// Files only on one side, with directories searched.
+		uint64_t GetCandidateCount() const {
+			return mCandidateCount;
+		}
+		
+		//
+		uint64_t GetPartialHashCount() const {
+			return mPartialHashCount;
+		}
+		
+		//
+		uint64_t GetFullHashCount() const {
+			return mFullHashCount;
+		}
+		
+		//
+		uint64_t GetBytesRead() const {
+			return mBytesRead;
+		}
+		
+	private:
+		//
+		struct Candidate {
+			int mSide;
+			std::string mPathUTF8;
+			uint64_t mSize;
+			// Set in the partial step if that read the whole file.
+			bool mHasDigest;
+			common::Sha256Digest mDigest;
+		};
+		
+		// A group of candidates that could still be the same file, from both sides.
+		typedef std::vector<size_t> Group;
+		
+		//
+		bool HasBothSides(const Group& group) const;
+		
+		//
+		void AddCandidates(int side, const std::string& pathUTF8);
+		
+		// Names in the directory, sorted, less any excluded. False if it can't be read.
+		bool ListDirectory(int side, const std::string& pathUTF8, std::vector<std::string>& outNames) const;
+		
+		// True if anything at or under pathUTF8 moved.
+		bool HasMoved(int side, const std::string& pathUTF8) const;
+		
+		// What's left of record's item at pathUTF8 after the moves, reported through remaining.
+		void ReportRemaining(const DifferenceRecord& record,
+							 int side,
+							 const std::string& pathUTF8,
+							 const RecapSpill::RecordFunction& remaining) const;
+		
+		//
+		bool IsExcluded(int side, const std::string& pathUTF8, bool isDirectory) const;
+		
+		//
+		template <class KeyFunction>
+		std::vector<Group> Refine(const std::vector<Group>& groups, KeyFunction keyFunction);
+		
+		// Key for the partial step: the hash of the first and last 64 KB.
+		bool ReadPartialKey(Candidate& candidate, std::string& outKey);
+		
+		// Key for the last step: the SHA-256 of the whole file.
+		bool ReadFullKey(Candidate& candidate, std::string& outKey);
+		
+		// Pairs same-named files first, then the rest in path order.
+		void PairUp(const Group& group, std::vector<Move>& outMoves);
+		
+		//
+		std::string mRootUTF8[2];
+		common::ExclusionMatcherPtr mExclusions;
+		RecapSpill mRecords;
+		std::vector<Candidate> mCandidates;
+		// Per side, the paths of the files that moved.
+		std::set<std::string> mMovedPaths[2];
+		uint64_t mCandidateCount;
+		std::atomic<uint64_t> mPartialHashCount;
+		std::atomic<uint64_t> mFullHashCount;
+		std::atomic<uint64_t> mBytesRead;
+	};
+	
+} // namespace compare_Impl
+
+#endif /* MoveDetector_h */
@@ -0,0 +1,351 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <iomanip>
+#include <sstream>
+#include "Common/JSONString.h"
+#include "OutputFormat.h"
+
+namespace compare_Impl {
+	namespace OutputFormat_Impl {
+		
+		//
+		static const char kBinaryMagic[8] = { 'C', 'M', 'P', 'B', 'I', 'N', '0', '1' };
+		
+		//
+		class TextFormatter : public RecordFormatter {
+		public:
+			//
+			virtual std::string Match(const std::string& path1UTF8) override {
+				return "Match: " + path1UTF8 + "\n";
+			}
+			
+			//
+			virtual std::string AssumedMatch(const AssumedMatchParams& params) override {
+				if (params.mReason == AssumedMatchReason::kDigestCache) {
+					return "Match: " + params.mPath1UTF8 + "\n";
+				}
+				return "Assumed Match: " + params.mPath1UTF8 + "\n";
+			}
+			
+			//
+			virtual std::string Skipped(const std::string& path1UTF8) override {
+				return "Skipped: " + path1UTF8 + "\n";
+			}
+			
+			//
+			virtual std::string Difference(const DifferenceRecord& record) override {
+				std::ostringstream strm;
+				OutputDifference(record, strm);
+				return strm.str();
+			}
+			
+			//
+			virtual std::string Error(const DifferenceRecord& record) override {
+				return "ERROR: " + record.mPath1UTF8 + "\n";
+			}
+			
+			//
+			virtual std::string Moved(const std::string& path1UTF8, const std::string& path2UTF8, uint64_t /*size*/) override {
+				std::ostringstream strm;
+				OutputMove(path1UTF8, path2UTF8, strm);
+				return strm.str();
+			}
+			
+			//
+			virtual std::string Summary(const RunSummary& /*summary*/) override {
+				return std::string();
+			}
+		};
+		
+		//
+		class NDJSONFormatter : public RecordFormatter {
+		public:
+			//
+			virtual std::string Match(const std::string& path1UTF8) override {
+				std::string json("{\"kind\":\"match\",\"path1\":");
+				common::AppendJSONString(json, path1UTF8);
+				json += "}\n";
+				return json;
+			}
+			
+			//
+			virtual std::string AssumedMatch(const AssumedMatchParams& params) override {
+				std::string json("{\"kind\":\"assumed_match\",\"reason\":");
+				json += (params.mReason == AssumedMatchReason::kDigestCache) ? "\"digest_cache\"" : "\"quick_check\"";
+				json += ",\"path1\":";
+				common::AppendJSONString(json, params.mPath1UTF8);
+				json += ",\"path2\":";
+				common::AppendJSONString(json, params.mPath2UTF8);
+				json += "}\n";
+				return json;
+			}
+			
+			//
+			virtual std::string Skipped(const std::string& path1UTF8) override {
+				std::string json("{\"kind\":\"skipped\",\"path1\":");
+				common::AppendJSONString(json, path1UTF8);
+				json += "}\n";
+				return json;
+			}
+			
+			//
+			virtual std::string Difference(const DifferenceRecord& record) override {
+				return FormatRecord("difference", record);
+			}
+			
+			//
+			virtual std::string Error(const DifferenceRecord& record) override {
+				return FormatRecord("error", record);
+			}
+			
+			//
+			virtual std::string Moved(const std::string& path1UTF8, const std::string& path2UTF8, uint64_t size) override {
+				std::string json("{\"kind\":\"moved\",\"path1\":");
+				common::AppendJSONString(json, path1UTF8);
+				json += ",\"path2\":";
+				common::AppendJSONString(json, path2UTF8);
+				json += ",\"size\":" + std::to_string(size);
+				json += "}\n";
+				return json;
+			}
+			
+			//
+			virtual std::string Summary(const RunSummary& summary) override {
+				std::ostringstream strm;
+				strm << "{\"kind\":\"summary\""
+					 << ",\"files\":" << summary.mFiles
+					 << ",\"bytes\":" << summary.mBytes
+					 << ",\"directories\":" << summary.mDirectories
+					 << ",\"differences\":" << summary.mDifferences
+					 << ",\"errors\":" << summary.mErrors
+					 << ",\"elapsed_seconds\":" << std::fixed << std::setprecision(6) << summary.mElapsedSeconds
+					 << "}\n";
+				return strm.str();
+			}
+			
+		private:
+			//
+			std::string FormatRecord(const char* kind, const DifferenceRecord& record) {
+				std::string json("{\"kind\":\"");
+				json += kind;
+				json += "\",\"type\":" + std::to_string((int)record.mType);
+				json += ",\"path1\":";
+				common::AppendJSONString(json, record.mPath1UTF8);
+				json += ",\"path2\":";
+				common::AppendJSONString(json, record.mPath2UTF8);
+				json += ",\"string1\":";
+				common::AppendJSONString(json, record.mString1);
+				json += ",\"string2\":";
+				common::AppendJSONString(json, record.mString2);
+				json += ",\"int1\":" + std::to_string(record.mInt1);
+				json += ",\"int2\":" + std::to_string(record.mInt2);
+				json += "}\n";
+				return json;
+			}
+		};
+		
+		//
+		class BinaryRecordWriter {
+		public:
+			//
+			BinaryRecordWriter(const RecordKind& kind) {
+				mData.append(4, 0);
+				mData += (char)kind;
+			}
+			
+			//
+			void AppendUInt32(uint32_t value) {
+				for (int n = 0; n < 4; ++n) {
+					mData += (char)((value >> (n * 8)) & 0xff);
+				}
+			}
+			
+			//
+			void AppendUInt64(uint64_t value) {
+				for (int n = 0; n < 8; ++n) {
+					mData += (char)((value >> (n * 8)) & 0xff);
+				}
+			}
+			
+			//
+			void AppendString(const std::string& value) {
+				AppendUInt32((uint32_t)value.size());
+				mData += value;
+			}
+			
+			// Fills in the length prefix and hands back the finished record.
+			std::string Finish() {
+				uint32_t size = (uint32_t)(mData.size() - 4);
+				for (int n = 0; n < 4; ++n) {
+					mData[n] = (char)((size >> (n * 8)) & 0xff);
+				}
+				return std::move(mData);
+			}
+			
+		private:
+			//
+			std::string mData;
+		};
+		
+		//
+		class BinaryFormatter : public RecordFormatter {
+		public:
+			//
+			virtual std::string Header() override {
+				return std::string(kBinaryMagic, sizeof(kBinaryMagic));
+			}
+			
+			//
+			virtual std::string Match(const std::string& path1UTF8) override {
+				BinaryRecordWriter writer(RecordKind::kMatch);
+				writer.AppendString(path1UTF8);
+				return writer.Finish();
+			}
+			
+			//
+			virtual std::string AssumedMatch(const AssumedMatchParams& params) override {
+				BinaryRecordWriter writer(RecordKind::kAssumedMatch);
+				writer.AppendUInt32((uint32_t)params.mReason);
+				writer.AppendString(params.mPath1UTF8);
+				writer.AppendString(params.mPath2UTF8);
+				return writer.Finish();
+			}
+			
+			//
+			virtual std::string Skipped(const std::string& path1UTF8) override {
+				BinaryRecordWriter writer(RecordKind::kSkipped);
+				writer.AppendString(path1UTF8);
+				return writer.Finish();
+			}
+			
+			//
+			virtual std::string Difference(const DifferenceRecord& record) override {
+				return FormatRecord(RecordKind::kDifference, record);
+			}
+			
+			//
+			virtual std::string Error(const DifferenceRecord& record) override {
+				return FormatRecord(RecordKind::kError, record);
+			}
+			
+			//
+			virtual std::string Moved(const std::string& path1UTF8, const std::string& path2UTF8, uint64_t size) override {
+				BinaryRecordWriter writer(RecordKind::kMoved);
+				writer.AppendString(path1UTF8);
+				writer.AppendString(path2UTF8);
+				writer.AppendUInt64(size);
+				return writer.Finish();
+			}
+			
+			//
+			virtual std::string Summary(const RunSummary& summary) override {
+				BinaryRecordWriter writer(RecordKind::kSummary);
+				writer.AppendUInt64(summary.mFiles);
+				writer.AppendUInt64(summary.mBytes);
+				writer.AppendUInt64(summary.mDirectories);
+				writer.AppendUInt64(summary.mDifferences);
+				writer.AppendUInt64(summary.mErrors);
+				writer.AppendUInt64((uint64_t)(summary.mElapsedSeconds * 1000000000.0));
+				return writer.Finish();
+			}
+			
+		private:
+			//
+			std::string FormatRecord(const RecordKind& kind, const DifferenceRecord& record) {
+				BinaryRecordWriter writer(kind);
+				writer.AppendUInt32((uint32_t)record.mType);
+				writer.AppendString(record.mPath1UTF8);
+				writer.AppendString(record.mPath2UTF8);
+				writer.AppendString(record.mString1);
+				writer.AppendString(record.mString2);
+				writer.AppendUInt64(record.mInt1);
+				writer.AppendUInt64(record.mInt2);
+				return writer.Finish();
+			}
+		};
+		
+	} // namespace OutputFormat_Impl
+	using namespace OutputFormat_Impl;
+	
+	//
+	void OutputDifference(const DifferenceRecord& record, std::ostream& strm) {
+		const std::string& path1UTF8 = record.mPath1UTF8;
+		const std::string& path2UTF8 = record.mPath2UTF8;
+		if (record.mType == hermit::file::kItemInPath1Only) {
+			strm << "Only In 1: " << path1UTF8 << "\n";
+		}
+		else if (record.mType == hermit::file::kItemInPath2Only) {
+			strm << "Only In 2: " << path2UTF8 << "\n";
+		}
+		// kFolderContentsDiffer just means there was a difference somewhere under this directory.
+		// In practice it's a bit noisy to show these all the time.
+		else if (record.mType != hermit::file::kFolderContentsDiffer) {
+			strm << "Different: " << path1UTF8 << " (" << record.mType << ")" << "\n";
+		}
+		if (record.mType == hermit::file::kCreationDatesDiffer) {
+			strm << "\t" << "Date 1: " << record.mString1 << "\n";
+			strm << "\t" << "Date 2: " << record.mString2 << "\n";
+		}
+		else if (record.mType == hermit::file::kModificationDatesDiffer) {
+			strm << "\t" << "Date 1: " << record.mString1 << "\n";
+			strm << "\t" << "Date 2: " << record.mString2 << "\n";
+		}
+		else if (record.mType == hermit::file::kLinkTargetsDiffer) {
+			strm << "\t" << "Target 1: " << record.mString1 << "\n";
+			strm << "\t" << "Target 2: " << record.mString2 << "\n";
+		}
+		else if (record.mType == hermit::file::kUserOwnersDiffer) {
+			strm << "\t" << "User Owner 1: " << record.mString1 << "\n";
+			strm << "\t" << "User Owner 2: " << record.mString2 << "\n";
+		}
+		else if (record.mType == hermit::file::kGroupOwnersDiffer) {
+			strm << "\t" << "Group Owner 1: " << record.mString1 << "\n";
+			strm << "\t" << "Group Owner 2: " << record.mString2 << "\n";
+		}
+		else if (record.mType == hermit::file::kBSDFlagsDiffer) {
+			strm << "\t" << "File 1 flags: 0x" << std::setfill('0') << std::setw(8) << std::hex << record.mInt1 << "\n";
+			strm << "\t" << "File 2 flags: 0x" << std::setfill('0') << std::setw(8) << std::hex << record.mInt2 << "\n";
+		}
+		else if (record.mType == hermit::file::kXAttrPresenceMismatch) {
+			if (!record.mString1.empty()) {
+				strm << "\t" << "Only in 1: " << record.mString1 << "\n";
+			}
+			else {
+				strm << "\t" << "Only in 2: " << record.mString2 << "\n";
+			}
+		}
+	}
+	
+	//
+	void OutputMove(const std::string& path1UTF8, const std::string& path2UTF8, std::ostream& strm) {
+		strm << "Moved: " << path1UTF8 << " -> " << path2UTF8 << "\n";
+	}
+	
+	//
+	RecordFormatterPtr CreateRecordFormatter(const OutputFormat& format) {
+		if (format == OutputFormat::kNDJSON) {
+			return std::make_shared<NDJSONFormatter>();
+		}
+		if (format == OutputFormat::kBinary) {
+			return std::make_shared<BinaryFormatter>();
+		}
+		return std::make_shared<TextFormatter>();
+	}
+	
+} // namespace compare_Impl
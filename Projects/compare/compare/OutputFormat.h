@@ -0,0 +1,114 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef OutputFormat_h
+#define OutputFormat_h
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include "CompareNotification.h"
+#include "DifferenceRecord.h"
+
+namespace compare_Impl {
+	
+	//
+	enum class OutputFormat {
+		kText,
+		// One JSON object per line. Bytes of a path that aren't valid UTF-8 come out as \udcXX
+		// escapes (see common::AppendJSONString).
+		kNDJSON,
+		// "CMPBIN01" followed by records, each a uint32 length then that many bytes: a uint8 record
+		// kind and the kind's fields. Integers are little-endian; strings are a uint32 length
+		// followed by the bytes as they are (UTF-8, unless a path isn't).
+		kBinary
+	};
+	
+	//
+	enum class RecordKind : uint8_t {
+		kMatch = 1,
+		kAssumedMatch = 2,
+		kSkipped = 3,
+		kDifference = 4,
+		kError = 5,
+		kSummary = 6,
+		kMoved = 7
+	};
+	
+	//
+	struct RunSummary {
+		//
+		RunSummary() : mFiles(0), mBytes(0), mDirectories(0), mDifferences(0), mErrors(0), mElapsedSeconds(0) {
+		}
+		
+		//
+		uint64_t mFiles;
+		uint64_t mBytes;
+		uint64_t mDirectories;
+		uint64_t mDifferences;
+		uint64_t mErrors;
+		double mElapsedSeconds;
+	};
+	
+	// Turns compare's results into output text (or bytes) for one of the OutputFormats.
+	class RecordFormatter {
+	public:
+		//
+		virtual ~RecordFormatter() {
+		}
+		
+		// Emitted once before anything else.
+		virtual std::string Header() {
+			return std::string();
+		}
+		
+		//
+		virtual std::string Match(const std::string& path1UTF8) = 0;
+		
+		//
+		virtual std::string AssumedMatch(const AssumedMatchParams& params) = 0;
+		
+		//
+		virtual std::string Skipped(const std::string& path1UTF8) = 0;
+		
+		//
+		virtual std::string Difference(const DifferenceRecord& record) = 0;
+		
+		//
+		virtual std::string Error(const DifferenceRecord& record) = 0;
+		
+		// A file only in 1 with the same contents as one only in 2 (--detect-moves).
+		virtual std::string Moved(const std::string& path1UTF8, const std::string& path2UTF8, uint64_t size) = 0;
+		
+		// Empty for formats without a summary record.
+		virtual std::string Summary(const RunSummary& summary) = 0;
+	};
+	typedef std::shared_ptr<RecordFormatter> RecordFormatterPtr;
+	
+	//
+	RecordFormatterPtr CreateRecordFormatter(const OutputFormat& format);
+	
+	// The human readable form of a difference, as printed by the text format and the recap.
+	void OutputDifference(const DifferenceRecord& record, std::ostream& strm);
+	
+	// The same for a move.
+	void OutputMove(const std::string& path1UTF8, const std::string& path2UTF8, std::ostream& strm);
+	
+} // namespace compare_Impl
+
+#endif /* OutputFormat_h */
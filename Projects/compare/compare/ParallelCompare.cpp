@@ -0,0 +1,309 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <dirent.h>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include "Hermit/File/AppendToFilePath.h"
+#include "Hermit/File/FileNotification.h"
+#include "Hermit/File/GetFilePathUTF8String.h"
+#include "Common/CompareCompletion.h"
+#include "Common/WorkStealingPool.h"
+#include "ParallelCompare.h"
+
+namespace compare_Impl {
+	namespace ParallelCompare_Impl {
+		
+		// Keeps splitting directories until this many tasks per worker are waiting to run.
+		static const size_t kQueuedTasksPerWorker = 2;
+		
+		//
+		typedef std::set<std::string> StringSet;
+		
+		//
+		bool IsDirectory(const std::string& pathUTF8) {
+			struct stat s;
+			return (lstat(pathUTF8.c_str(), &s) == 0) && S_ISDIR(s.st_mode);
+		}
+		
+		// Names of the subdirectories of path1UTF8 that are also directories under path2UTF8.
+		void GetCommonSubdirectories(const std::string& path1UTF8, const std::string& path2UTF8, StringSet& outNames) {
+			DIR* dir = opendir(path1UTF8.c_str());
+			if (dir == nullptr) {
+				return;
+			}
+			while (struct dirent* entry = readdir(dir)) {
+				std::string name(entry->d_name);
+				if ((name == ".") || (name == "..")) {
+					continue;
+				}
+#ifdef DT_DIR
+				if ((entry->d_type != DT_DIR) && (entry->d_type != DT_UNKNOWN)) {
+					continue;
+				}
+#endif
+				if (IsDirectory(path1UTF8 + "/" + name) && IsDirectory(path2UTF8 + "/" + name)) {
+					outNames.insert(name);
+				}
+			}
+			closedir(dir);
+		}
+		
+		//
+		class ParallelCompare;
+		typedef std::shared_ptr<ParallelCompare> ParallelComparePtr;
+		
+		// Forwards everything to the real Hermit except the skip notifications for directories that
+		// were handed off to their own task; those get compared (and reported) separately. Matched
+		// by full path, since an item deeper down may have the same name as a split directory.
+		class SplitHermit : public hermit::Hermit {
+		public:
+			//
+			SplitHermit(const hermit::HermitPtr& h_) : mH_(h_) {
+			}
+			
+			//
+			virtual bool ShouldAbort() override {
+				return mH_->ShouldAbort();
+			}
+			
+			//
+			virtual void Notify(const char* notificationName, const void* param) override {
+				if (strcmp(notificationName, hermit::file::kFileSkippedNotification) == 0) {
+					auto params = (const hermit::file::FileNotificationParams*)param;
+					if (params->mPath1 != nullptr) {
+						std::string path1UTF8;
+						hermit::file::GetFilePathUTF8String(mH_, params->mPath1, path1UTF8);
+						std::lock_guard<std::mutex> guard(mMutex);
+						if (mSplitPaths.find(path1UTF8) != mSplitPaths.end()) {
+							return;
+						}
+					}
+				}
+				NOTIFY(mH_, notificationName, param);
+			}
+			
+			//
+			void AddSplitPath(const std::string& path1UTF8) {
+				std::lock_guard<std::mutex> guard(mMutex);
+				mSplitPaths.insert(path1UTF8);
+			}
+			
+		private:
+			//
+			hermit::HermitPtr mH_;
+			std::mutex mMutex;
+			StringSet mSplitPaths;
+		};
+		typedef std::shared_ptr<SplitHermit> SplitHermitPtr;
+		
+		// Preprocessor for one directory pair that is being split. Defers to the caller's
+		// preprocessor first, then skips (and schedules separately) subdirectories common to both sides.
+		// CompareFiles calls it for items at every depth, so only the pair's own children are split.
+		class SplitPreprocessor : public hermit::file::PreprocessFileFunction {
+		public:
+			//
+			SplitPreprocessor(const ParallelComparePtr& comparer,
+							  const SplitHermitPtr& splitHermit,
+							  const hermit::file::FilePathPtr& path1,
+							  const hermit::file::FilePathPtr& path2,
+							  const std::string& path1UTF8,
+							  const StringSet& commonSubdirectories) :
+			mComparer(comparer),
+			mSplitHermit(splitHermit),
+			mPath1(path1),
+			mPath2(path2),
+			mPath1UTF8(path1UTF8),
+			mCommonSubdirectories(commonSubdirectories) {
+			}
+			
+			//
+			virtual hermit::file::PreprocessFileInstruction Preprocess(const hermit::HermitPtr& h_,
+																	   const hermit::file::FilePathPtr& parent,
+																	   const std::string& itemName) override;
+			
+		private:
+			//
+			ParallelComparePtr mComparer;
+			SplitHermitPtr mSplitHermit;
+			hermit::file::FilePathPtr mPath1;
+			hermit::file::FilePathPtr mPath2;
+			std::string mPath1UTF8;
+			StringSet mCommonSubdirectories;
+		};
+		
+		//
+		class ParallelCompare : public std::enable_shared_from_this<ParallelCompare> {
+		public:
+			//
+			ParallelCompare(const hermit::HermitPtr& h_,
+							const hermit::file::HardLinkMapPtr& hardLinkMap1,
+							const hermit::file::HardLinkMapPtr& hardLinkMap2,
+							const hermit::file::IgnoreDates& ignoreDates,
+							const hermit::file::IgnoreFinderInfo& ignoreFinderInfo,
+							const hermit::file::PreprocessFileFunctionPtr& preprocessor,
+							size_t workerCount) :
+			mH_(h_),
+			mHardLinkMap1(hardLinkMap1),
+			mHardLinkMap2(hardLinkMap2),
+			mIgnoreDates(ignoreDates),
+			mIgnoreFinderInfo(ignoreFinderInfo),
+			mPreprocessor(preprocessor),
+			mPool(workerCount),
+			mStatus(hermit::file::CompareFilesStatus::kSuccess) {
+			}
+			
+			//
+			void Schedule(const hermit::file::FilePathPtr& path1, const hermit::file::FilePathPtr& path2) {
+				auto self = shared_from_this();
+				mPool.Submit([self, path1, path2]() {
+					self->CompareDirectories(path1, path2);
+				});
+			}
+			
+			//
+			hermit::file::CompareFilesStatus Wait() {
+				mPool.Wait();
+				return mStatus;
+			}
+			
+			//
+			const hermit::file::PreprocessFileFunctionPtr& GetPreprocessor() const {
+				return mPreprocessor;
+			}
+			
+		private:
+			//
+			bool ShouldSplit() const {
+				return (mPool.QueuedTaskCount() < (mPool.WorkerCount() * kQueuedTasksPerWorker));
+			}
+			
+			//
+			void CompareDirectories(const hermit::file::FilePathPtr& path1, const hermit::file::FilePathPtr& path2) {
+				if (mH_->ShouldAbort()) {
+					return;
+				}
+				
+				hermit::HermitPtr h_ = mH_;
+				hermit::file::PreprocessFileFunctionPtr preprocessor = mPreprocessor;
+				if (ShouldSplit()) {
+					std::string path1UTF8;
+					hermit::file::GetFilePathUTF8String(mH_, path1, path1UTF8);
+					std::string path2UTF8;
+					hermit::file::GetFilePathUTF8String(mH_, path2, path2UTF8);
+					
+					StringSet commonSubdirectories;
+					GetCommonSubdirectories(path1UTF8, path2UTF8, commonSubdirectories);
+					if (!commonSubdirectories.empty()) {
+						auto splitHermit = std::make_shared<SplitHermit>(mH_);
+						h_ = splitHermit;
+						preprocessor = std::make_shared<SplitPreprocessor>(shared_from_this(),
+																		   splitHermit,
+																		   path1,
+																		   path2,
+																		   path1UTF8,
+																		   commonSubdirectories);
+					}
+				}
+				
+				auto completion = std::make_shared<common::CompareCompletion>();
+				hermit::file::CompareFiles(h_,
+										   path1,
+										   path2,
+										   mHardLinkMap1,
+										   mHardLinkMap2,
+										   mIgnoreDates,
+										   mIgnoreFinderInfo,
+										   preprocessor,
+										   completion);
+				auto status = completion->Wait();
+				if (status != hermit::file::CompareFilesStatus::kSuccess) {
+					std::lock_guard<std::mutex> guard(mMutex);
+					mStatus = status;
+				}
+			}
+			
+			//
+			hermit::HermitPtr mH_;
+			hermit::file::HardLinkMapPtr mHardLinkMap1;
+			hermit::file::HardLinkMapPtr mHardLinkMap2;
+			hermit::file::IgnoreDates mIgnoreDates;
+			hermit::file::IgnoreFinderInfo mIgnoreFinderInfo;
+			hermit::file::PreprocessFileFunctionPtr mPreprocessor;
+			common::WorkStealingPool mPool;
+			std::mutex mMutex;
+			hermit::file::CompareFilesStatus mStatus;
+		};
+		
+		//
+		hermit::file::PreprocessFileInstruction SplitPreprocessor::Preprocess(const hermit::HermitPtr& h_,
+																			  const hermit::file::FilePathPtr& parent,
+																			  const std::string& itemName) {
+			auto instruction = mComparer->GetPreprocessor()->Preprocess(h_, parent, itemName);
+			if (instruction != hermit::file::PreprocessFileInstruction::kContinue) {
+				return instruction;
+			}
+			if (mCommonSubdirectories.find(itemName) == mCommonSubdirectories.end()) {
+				return instruction;
+			}
+			std::string parentUTF8;
+			hermit::file::GetFilePathUTF8String(h_, parent, parentUTF8);
+			if (parentUTF8 != mPath1UTF8) {
+				return instruction;
+			}
+			
+			hermit::file::FilePathPtr child1;
+			hermit::file::AppendToFilePath(h_, mPath1, itemName, child1);
+			hermit::file::FilePathPtr child2;
+			hermit::file::AppendToFilePath(h_, mPath2, itemName, child2);
+			if ((child1 == nullptr) || (child2 == nullptr)) {
+				return instruction;
+			}
+			std::string child1UTF8;
+			hermit::file::GetFilePathUTF8String(h_, child1, child1UTF8);
+			mSplitHermit->AddSplitPath(child1UTF8);
+			mComparer->Schedule(child1, child2);
+			return hermit::file::PreprocessFileInstruction::kSkip;
+		}
+		
+	} // namespace ParallelCompare_Impl
+	using namespace ParallelCompare_Impl;
+	
+	//
+	hermit::file::CompareFilesStatus ParallelCompareFiles(const hermit::HermitPtr& h_,
+														  const hermit::file::FilePathPtr& path1,
+														  const hermit::file::FilePathPtr& path2,
+														  const hermit::file::HardLinkMapPtr& hardLinkMap1,
+														  const hermit::file::HardLinkMapPtr& hardLinkMap2,
+														  const hermit::file::IgnoreDates& ignoreDates,
+														  const hermit::file::IgnoreFinderInfo& ignoreFinderInfo,
+														  const hermit::file::PreprocessFileFunctionPtr& preprocessor,
+														  size_t workerCount) {
+		auto comparer = std::make_shared<ParallelCompare>(h_,
+														  hardLinkMap1,
+														  hardLinkMap2,
+														  ignoreDates,
+														  ignoreFinderInfo,
+														  preprocessor,
+														  workerCount);
+		comparer->Schedule(path1, path2);
+		return comparer->Wait();
+	}
+	
+} // namespace compare_Impl
@@ -0,0 +1,45 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef ParallelCompare_h
+#define ParallelCompare_h
+
+#include "Hermit/File/CompareFiles.h"
+
+namespace compare_Impl {
+	
+	// Compares path1 and path2 using workerCount threads. Directory pairs present on both sides are
+	// split off into separate CompareFiles calls on a work-stealing pool while workers are starved
+	// for work; everything else (files, only-in items, the directories' own metadata) is still
+	// compared by CompareFiles and reported through h_ exactly as a single call would. The one
+	// exception is a directory whose subdirectories were split off: no single call sees both it and
+	// what differs inside them, so its kFolderContentsDiffer is left to the caller to fill in, from
+	// the differences h_ was sent (see FolderDifferences).
+	hermit::file::CompareFilesStatus ParallelCompareFiles(const hermit::HermitPtr& h_,
+														  const hermit::file::FilePathPtr& path1,
+														  const hermit::file::FilePathPtr& path2,
+														  const hermit::file::HardLinkMapPtr& hardLinkMap1,
+														  const hermit::file::HardLinkMapPtr& hardLinkMap2,
+														  const hermit::file::IgnoreDates& ignoreDates,
+														  const hermit::file::IgnoreFinderInfo& ignoreFinderInfo,
+														  const hermit::file::PreprocessFileFunctionPtr& preprocessor,
+														  size_t workerCount);
+	
+} // namespace compare_Impl
+
+#endif /* ParallelCompare_h */
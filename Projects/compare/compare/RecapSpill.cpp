@@ -0,0 +1,173 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include "RecapSpill.h"
+
+namespace compare_Impl {
+	namespace RecapSpill_Impl {
+		
+		//
+		static const size_t kFileBufferSize = 1024 * 1024;
+		
+		//
+		void AppendUInt32(std::string& buffer, uint32_t value) {
+			buffer.append((const char*)&value, sizeof(value));
+		}
+		
+		//
+		void AppendUInt64(std::string& buffer, uint64_t value) {
+			buffer.append((const char*)&value, sizeof(value));
+		}
+		
+		//
+		void AppendString(std::string& buffer, const std::string& value) {
+			AppendUInt32(buffer, (uint32_t)value.size());
+			buffer.append(value);
+		}
+		
+		//
+		class RecordReader {
+		public:
+			//
+			RecordReader(const std::vector<char>& data) : mData(data), mOffset(0), mFailed(false) {
+			}
+			
+			//
+			template <class T>
+			T Read() {
+				T value = 0;
+				if ((mOffset + sizeof(T)) > mData.size()) {
+					mFailed = true;
+					return value;
+				}
+				memcpy(&value, mData.data() + mOffset, sizeof(T));
+				mOffset += sizeof(T);
+				return value;
+			}
+			
+			//
+			std::string ReadString() {
+				uint32_t size = Read<uint32_t>();
+				if (mFailed || ((mOffset + size) > mData.size())) {
+					mFailed = true;
+					return std::string();
+				}
+				std::string value(mData.data() + mOffset, size);
+				mOffset += size;
+				return value;
+			}
+			
+			//
+			const std::vector<char>& mData;
+			size_t mOffset;
+			bool mFailed;
+		};
+		
+	} // namespace RecapSpill_Impl
+	using namespace RecapSpill_Impl;
+	
+	//
+	RecapSpill::RecapSpill(bool keepRecords) : mFile(nullptr), mCount(0), mFailed(false) {
+		if (keepRecords) {
+			// tmpfile() unlinks the file right away, so nothing is left behind if we crash.
+			mFile = tmpfile();
+			if (mFile != nullptr) {
+				setvbuf(mFile, nullptr, _IOFBF, kFileBufferSize);
+			}
+			else {
+				mFailed = true;
+			}
+		}
+	}
+	
+	//
+	RecapSpill::~RecapSpill() {
+		if (mFile != nullptr) {
+			fclose(mFile);
+		}
+	}
+	
+	//
+	void RecapSpill::Append(const DifferenceRecord& record) {
+		std::string buffer;
+		if (mFile != nullptr) {
+			AppendUInt32(buffer, 0);
+			AppendUInt32(buffer, (uint32_t)record.mType);
+			AppendUInt64(buffer, record.mInt1);
+			AppendUInt64(buffer, record.mInt2);
+			AppendString(buffer, record.mPath1UTF8);
+			AppendString(buffer, record.mPath2UTF8);
+			AppendString(buffer, record.mString1);
+			AppendString(buffer, record.mString2);
+			uint32_t size = (uint32_t)(buffer.size() - sizeof(uint32_t));
+			memcpy(&buffer[0], &size, sizeof(size));
+		}
+		
+		std::lock_guard<std::mutex> guard(mMutex);
+		++mCount;
+		if ((mFile != nullptr) && (fwrite(buffer.data(), 1, buffer.size(), mFile) != buffer.size())) {
+			mFailed = true;
+		}
+	}
+	
+	//
+	bool RecapSpill::ForEach(const RecordFunction& function) {
+		std::lock_guard<std::mutex> guard(mMutex);
+		if ((mFile == nullptr) || mFailed || (fflush(mFile) != 0)) {
+			return false;
+		}
+		rewind(mFile);
+		
+		std::vector<char> data;
+		bool success = true;
+		while (true) {
+			uint32_t size = 0;
+			size_t count = fread(&size, sizeof(size), 1, mFile);
+			if (count != 1) {
+				success = (feof(mFile) != 0);
+				break;
+			}
+			data.resize(size);
+			if ((size > 0) && (fread(data.data(), 1, size, mFile) != size)) {
+				success = false;
+				break;
+			}
+			
+			RecordReader reader(data);
+			DifferenceRecord record;
+			record.mType = (hermit::file::FileNotificationType)reader.Read<uint32_t>();
+			record.mInt1 = reader.Read<uint64_t>();
+			record.mInt2 = reader.Read<uint64_t>();
+			record.mPath1UTF8 = reader.ReadString();
+			record.mPath2UTF8 = reader.ReadString();
+			record.mString1 = reader.ReadString();
+			record.mString2 = reader.ReadString();
+			if (reader.mFailed) {
+				success = false;
+				break;
+			}
+			function(record);
+		}
+		fseek(mFile, 0, SEEK_END);
+		return success;
+	}
+	
+} // namespace compare_Impl
@@ -0,0 +1,73 @@
+//
+//    compare
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef RecapSpill_h
+#define RecapSpill_h
+
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include "DifferenceRecord.h"
+
+namespace compare_Impl {
+	
+	// Append-only temporary file of DifferenceRecords, each stored as a length-prefixed record, so
+	// the end-of-run recap costs the same memory whether there are ten differences or ten million.
+	class RecapSpill {
+	public:
+		//
+		typedef std::function<void(const DifferenceRecord&)> RecordFunction;
+		
+		// If keepRecords is false only the count is kept.
+		explicit RecapSpill(bool keepRecords);
+		
+		//
+		~RecapSpill();
+		
+		//
+		void Append(const DifferenceRecord& record);
+		
+		// Streams the records back in the order they were appended. Returns false if the spill
+		// file couldn't be created or read.
+		bool ForEach(const RecordFunction& function);
+		
+		//
+		uint64_t GetCount() const {
+			return mCount;
+		}
+		
+		// True if records were to be kept but the spill file couldn't be created or written, so
+		// some are missing.
+		bool HasFailed() {
+			std::lock_guard<std::mutex> guard(mMutex);
+			return mFailed;
+		}
+		
+	private:
+		//
+		std::mutex mMutex;
+		FILE* mFile;
+		uint64_t mCount;
+		bool mFailed;
+	};
+	typedef std::shared_ptr<RecapSpill> RecapSpillPtr;
+	
+} // namespace compare_Impl
+
+#endif /* RecapSpill_h */
@@ -17,11 +17,17 @@
 //
 
 #include <iomanip>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <list>
+#include <memory>
+#include <random>
 #include <set>
+#include <sstream>
 #include <string>
-#include <thread>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <vector>
 #include "Hermit/File/CompareFiles.h"
@@ -30,83 +36,63 @@
 #include "Hermit/File/FileNotification.h"
 #include "Hermit/File/GetFilePathUTF8String.h"
 #include "Hermit/Foundation/LoggingHermit.h"
+#include "Hermit/Foundation/Notification.h"
 #include "Hermit/String/SimplifyPath.h"
+#include "Common/CompareCompletion.h"
+#include "Common/ExclusionMatcher.h"
+#include "Common/NativeFileComparer.h"
+#include "Common/OutputSink.h"
+#include "Common/PhaseTimer.h"
+#include "Common/Progress.h"
+#include "CompareNotification.h"
+#include "DifferenceRecord.h"
+#include "DigestCache.h"
+#include "FolderDifferences.h"
+#include "ManifestCompare.h"
+#include "MoveDetector.h"
+#include "OutputFormat.h"
+#include "ParallelCompare.h"
+#include "RecapSpill.h"
 
 namespace compare_Impl {
 
 	//
-	typedef std::shared_ptr<hermit::file::FileNotificationParams> FileNotificationParamsPtr;
-	typedef std::vector<FileNotificationParamsPtr> FileNotificationParamsVector;
-	
-	//
-	void OutputDifference(const hermit::HermitPtr& h_,
-						  const std::string& path1UTF8,
-						  const std::string& path2UTF8,
-						  const hermit::file::FileNotificationParams& params,
-						  std::ostream& strm) {
-		if (params.mType == hermit::file::kItemInPath1Only) {
-			strm << "Only In 1: " << path1UTF8 << std::endl;
-		}
-		else if (params.mType == hermit::file::kItemInPath2Only) {
-			strm << "Only In 2: " << path2UTF8 << std::endl;
-		}
-		// kFolderContentsDiffer just means there was a difference somewhere under this directory.
-		// In practice it's a bit noisy to show these all the time.
-		else if (params.mType != hermit::file::kFolderContentsDiffer) {
-			strm << "Different: " << path1UTF8 << " (" << params.mType << ")" << std::endl;
-		}
-		if (params.mType == hermit::file::kCreationDatesDiffer) {
-			strm << "\t" << "Date 1: " << params.mString1 << std::endl;
-			strm << "\t" << "Date 2: " << params.mString2 << std::endl;
-		}
-		else if (params.mType == hermit::file::kModificationDatesDiffer) {
-			strm << "\t" << "Date 1: " << params.mString1 << std::endl;
-			strm << "\t" << "Date 2: " << params.mString2 << std::endl;
-		}
-		else if (params.mType == hermit::file::kLinkTargetsDiffer) {
-			strm << "\t" << "Target 1: " << params.mString1 << std::endl;
-			strm << "\t" << "Target 2: " << params.mString2 << std::endl;
-		}
-		else if (params.mType == hermit::file::kUserOwnersDiffer) {
-			strm << "\t" << "User Owner 1: " << params.mString1 << "\n";
-			strm << "\t" << "User Owner 2: " << params.mString2 << "\n";
-		}
-		else if (params.mType == hermit::file::kGroupOwnersDiffer) {
-			strm << "\t" << "Group Owner 1: " << params.mString1 << "\n";
-			strm << "\t" << "Group Owner 2: " << params.mString2 << "\n";
-		}
-		else if (params.mType == hermit::file::kBSDFlagsDiffer) {
-			strm << "\t" << "File 1 flags: 0x" << std::setfill('0') << std::setw(8) << std::hex << params.mInt1 << "\n";
-			strm << "\t" << "File 2 flags: 0x" << std::setfill('0') << std::setw(8) << std::hex << params.mInt2 << "\n";
-		}
-		else if (params.mType == hermit::file::kXAttrPresenceMismatch) {
-			if (!params.mString1.empty()) {
-				strm << "\t" << "Only in 1: " << params.mString1 << std::endl;
-			}
-			else {
-				strm << "\t" << "Only in 2: " << params.mString2 << std::endl;
-			}
-		}
-	}
-	
-	//
-	void OutputDifference(const hermit::HermitPtr& h_, const hermit::file::FileNotificationParams& params, std::ostream& strm) {
-		std::string path1UTF8;
-		if (params.mPath1 != nullptr) {
-			hermit::file::GetFilePathUTF8String(h_, params.mPath1, path1UTF8);
-		}
-		std::string path2UTF8;
-		if (params.mPath2 != nullptr) {
-			hermit::file::GetFilePathUTF8String(h_, params.mPath2, path2UTF8);
-		}
-		OutputDifference(h_, path1UTF8, path2UTF8, params, strm);
+	inline bool IsNotification(const char* notificationName, const char* expectedName) {
+		// Hermit passes its own constants through, so the pointer check almost always decides it.
+		return (notificationName == expectedName) || (strcmp(notificationName, expectedName) == 0);
 	}
 	
     //
-    class Hermit : public hermit::Hermit {
+    class Hermit : public hermit::Hermit, public ManifestCompareSink {
     public:
         //
-        Hermit(const hermit::HermitPtr& h_, bool showMatches) : mH_(h_), mShowMatches(showMatches) {
+        Hermit(const hermit::HermitPtr& h_,
+			   bool showMatches,
+			   const DigestCachePtr& digestCache,
+			   const common::OutputSinkPtr& output,
+			   const RecordFormatterPtr& formatter,
+			   bool countItems,
+			   common::ProgressCounters* progress,
+			   bool quiet,
+			   bool messagesToStderr) :
+		mH_(h_),
+		mShowMatches(showMatches),
+		mDigestCache(digestCache),
+		mOutput(output),
+		mFormatter(formatter),
+		mCountItems(countItems),
+		mProgress(progress),
+		mQuiet(quiet),
+		mMessagesToStderr(messagesToStderr),
+		mFileCount(0),
+		mByteCount(0),
+		mDirectoryCount(0),
+		mAssumedMatchCount(0),
+		mSkippedSubtreeCount(0),
+		mSkippedItemCount(0),
+		// The differences are only replayed in the recap that -m or --progress adds.
+		mDifferences(std::make_shared<RecapSpill>(showMatches || quiet)),
+		mErrors(std::make_shared<RecapSpill>(true)) {
         }
         
         //
@@ -116,13 +102,23 @@ namespace compare_Impl {
         
         //
         virtual void Notify(const char* notificationName, const void* param) override {
-            std::lock_guard<std::mutex> guard(mMutex);
-            
-            std::string name(notificationName);
-            if ((name == hermit::file::kFilesMatchNotification) ||
-                (name == hermit::file::kFilesDifferNotification) ||
-                (name == hermit::file::kFileSkippedNotification) ||
-                (name == hermit::file::kFileErrorNotification)) {
+			bool isMatch = IsNotification(notificationName, hermit::file::kFilesMatchNotification);
+			bool isDifference = !isMatch && IsNotification(notificationName, hermit::file::kFilesDifferNotification);
+			bool isSkipped = !isMatch && !isDifference && IsNotification(notificationName, hermit::file::kFileSkippedNotification);
+            if (isMatch ||
+				isDifference ||
+				isSkipped ||
+                IsNotification(notificationName, hermit::file::kFileErrorNotification)) {
+				if (mProgress != nullptr) {
+					mProgress->AddEntries(1);
+					if (isMatch || isDifference) {
+						mProgress->AddFiles(1);
+					}
+				}
+				if (isMatch && !mShowMatches && (mDigestCache == nullptr)) {
+					// Nothing to print or record.
+					return;
+				}
                 hermit::file::FileNotificationParams* params = (hermit::file::FileNotificationParams*)param;
                 
                 std::string path1UTF8;
@@ -133,121 +129,529 @@ namespace compare_Impl {
                 if (params->mPath2 != nullptr) {
                     hermit::file::GetFilePathUTF8String(mH_, params->mPath2, path2UTF8);
                 }
+				
+				// Done before taking mMutex since recording a match means reading the file.
+				if (mDigestCache != nullptr) {
+					if (isMatch) {
+						mDigestCache->OnFilesMatch(path1UTF8, nullptr);
+					}
+					else if (isDifference) {
+						mDigestCache->OnFilesDiffer(path1UTF8);
+					}
+				}
                 
-                if (name == hermit::file::kFilesMatchNotification) {
+                if (isMatch) {
 					if (mShowMatches) {
-                    	std::cout << "Match: " << path1UTF8 << std::endl;
+						mOutput->Write(mFormatter->Match(path1UTF8));
 					}
                 }
-                else if (name == hermit::file::kFilesDifferNotification) {
-					OutputDifference(mH_, path1UTF8, path2UTF8, *params, std::cout);
-					mDifferences.push_back(std::make_shared<hermit::file::FileNotificationParams>(*params));
+                else if (isDifference) {
+					DifferenceRecord record(*params, path1UTF8, path2UTF8);
+					if (mFolderDifferences != nullptr) {
+						if (record.mType == hermit::file::kFolderContentsDiffer) {
+							mFolderDifferences->AddReportedFolder(path1UTF8);
+						}
+						mFolderDifferences->AddDifference(path1UTF8, path2UTF8);
+					}
+					// Held back until the end, when it may turn out to be half of a move.
+					if ((mMoveDetector != nullptr) && mMoveDetector->Add(record)) {
+						return;
+					}
+					if (!mQuiet) {
+						mOutput->Write(mFormatter->Difference(record));
+					}
+					mDifferences->Append(record);
                 }
-                else if (name == hermit::file::kFileSkippedNotification) {
+                else if (isSkipped) {
 					if (mShowMatches) {
-                    	std::cout << "Skipped: " << path1UTF8 << std::endl;
+						bool assumedMatch = false;
+						{
+							std::lock_guard<std::mutex> guard(mMutex);
+							assumedMatch = (mSettledItems.erase(path1UTF8) != 0);
+						}
+						if (!assumedMatch) {
+							mOutput->Write(mFormatter->Skipped(path1UTF8));
+						}
 					}
                 }
                 else {
-                    std::cout << "ERROR: " << path1UTF8 << std::endl;
-					mErrors.push_back(std::make_shared<hermit::file::FileNotificationParams>(*params));
+					DifferenceRecord record(*params, path1UTF8, path2UTF8);
+					if (!mQuiet) {
+						mOutput->Write(mFormatter->Error(record));
+					}
+					mErrors->Append(record);
                 }
             }
+			else if (IsNotification(notificationName, kFilesAssumedMatchNotification)) {
+				AssumedMatchParams* params = (AssumedMatchParams*)param;
+				if (mProgress != nullptr) {
+					mProgress->AddEntries(1);
+					mProgress->AddFiles(1);
+				}
+				if (mShowMatches) {
+					mOutput->Write(mFormatter->AssumedMatch(*params));
+					// CompareFiles reports these as skipped, which they aren't really.
+					std::lock_guard<std::mutex> guard(mMutex);
+					mSettledItems.insert(params->mPath1UTF8);
+				}
+			}
+			else if (IsNotification(notificationName, common::kNativeCompareNotification)) {
+				common::NativeCompareParams* params = (common::NativeCompareParams*)param;
+				if (mProgress != nullptr) {
+					mProgress->AddEntries(1);
+					mProgress->AddFiles(1);
+				}
+				if (params->mMatch) {
+					if (mDigestCache != nullptr) {
+						mDigestCache->OnFilesMatch(params->mPath1UTF8, params->mDigest);
+					}
+					if (mShowMatches) {
+						mOutput->Write(mFormatter->Match(params->mPath1UTF8));
+					}
+				}
+				else {
+					if (mDigestCache != nullptr) {
+						mDigestCache->OnFilesDiffer(params->mPath1UTF8);
+					}
+					DifferenceRecord record;
+					record.mType = hermit::file::kFileContentsDiffer;
+					record.mPath1UTF8 = params->mPath1UTF8;
+					record.mPath2UTF8 = params->mPath2UTF8;
+					record.mInt1 = params->mOffset;
+					// CompareFiles was told to skip the pair, so it can't mark the folders above it.
+					if (mFolderDifferences != nullptr) {
+						mFolderDifferences->AddDifference(params->mPath1UTF8, params->mPath2UTF8);
+					}
+					if (!mQuiet) {
+						mOutput->Write(mFormatter->Difference(record));
+					}
+					mDifferences->Append(record);
+				}
+				if (mShowMatches) {
+					std::lock_guard<std::mutex> guard(mMutex);
+					mSettledItems.insert(params->mPath1UTF8);
+				}
+			}
+			else if (IsNotification(notificationName, hermit::kMessageNotification)) {
+				// The sink's writer thread owns stdout, so Hermit's messages go through it too, or
+				// to stderr to keep them out of machine-readable records.
+				const hermit::MessageParams* params = (const hermit::MessageParams*)param;
+				std::ostringstream strm;
+				if (params->severity == hermit::MessageSeverity::kWarning) {
+					strm << "WARNING: ";
+				}
+				else if (params->severity == hermit::MessageSeverity::kError) {
+					strm << "ERROR: ";
+				}
+				strm << params->message << "\n";
+				WriteMessage(strm.str());
+			}
             else {
                 NOTIFY(mH_, notificationName, param);
             }
         }
 		
+		// A diagnostic line, kept out of the way of the records.
+		void WriteMessage(const std::string& message) {
+			if (mMessagesToStderr) {
+				std::lock_guard<std::mutex> guard(mMutex);
+				std::cerr << message;
+			}
+			else {
+				mOutput->Write(std::string(message));
+			}
+		}
+		
+		//
+		virtual void OnItem(const ManifestEntry& entry1) override {
+			bool isDirectory = (entry1.mType == ManifestItemType::kDirectory);
+			if (mProgress != nullptr) {
+				mProgress->AddEntries(1);
+				if (!isDirectory) {
+					mProgress->AddFiles(1);
+				}
+			}
+			if (mCountItems) {
+				if (isDirectory) {
+					++mDirectoryCount;
+				}
+				else {
+					++mFileCount;
+					mByteCount += entry1.mSize;
+				}
+			}
+		}
+		
+		//
+		virtual void OnMatch(const std::string& path1UTF8, const std::string& path2UTF8, bool assumed) override {
+			if (assumed) {
+				++mAssumedMatchCount;
+			}
+			if (!mShowMatches) {
+				return;
+			}
+			if (assumed) {
+				mOutput->Write(mFormatter->AssumedMatch(AssumedMatchParams(AssumedMatchReason::kQuickCheck, path1UTF8, path2UTF8)));
+			}
+			else {
+				mOutput->Write(mFormatter->Match(path1UTF8));
+			}
+		}
+		
+		//
+		virtual void OnMatchingSubtree(const std::string& /*path1UTF8*/,
+									   const std::string& /*path2UTF8*/,
+									   const SubtreeDigest& subtree,
+									   bool assumed) override {
+			++mSkippedSubtreeCount;
+			mSkippedItemCount += subtree.mEntryCount;
+			if (assumed) {
+				mAssumedMatchCount += subtree.mFileCount;
+			}
+			if (mProgress != nullptr) {
+				mProgress->AddEntries(subtree.mEntryCount);
+				mProgress->AddFiles(subtree.mEntryCount - subtree.mDirectoryCount);
+			}
+			if (mCountItems) {
+				mDirectoryCount += subtree.mDirectoryCount;
+				mFileCount += subtree.mEntryCount - subtree.mDirectoryCount;
+				mByteCount += subtree.mByteCount;
+			}
+		}
+		
+		//
+		virtual void OnDifference(const DifferenceRecord& record) override {
+			if (!mQuiet) {
+				mOutput->Write(mFormatter->Difference(record));
+			}
+			mDifferences->Append(record);
+		}
+		
+		// The kFolderContentsDiffer records CompareFiles couldn't make itself; see FolderDifferences.
+		void ReportUnreportedFolders() {
+			std::vector<FolderDifferences::FolderPair> folders;
+			mFolderDifferences->GetUnreportedFolders(folders);
+			for (const auto& folder : folders) {
+				DifferenceRecord record;
+				record.mType = hermit::file::kFolderContentsDiffer;
+				record.mPath1UTF8 = folder.first;
+				record.mPath2UTF8 = folder.second;
+				OnDifference(record);
+			}
+		}
+		
+		//
+		void OnMove(const MoveDetector::Move& move) {
+			if (!mQuiet) {
+				mOutput->Write(mFormatter->Moved(move.mPath1UTF8, move.mPath2UTF8, move.mSize));
+			}
+			mMoves.push_back(move);
+		}
+		
+		//
+		virtual void OnError(const DifferenceRecord& record) override {
+			if (!mQuiet) {
+				mOutput->Write(mFormatter->Error(record));
+			}
+			mErrors->Append(record);
+		}
+		
+		// Tallies an item for the summary record, from metadata the caller already has. Only
+		// regular files add to the byte count.
+		void CountItem(uint32_t mode, uint64_t size) {
+			if (S_ISDIR(mode)) {
+				++mDirectoryCount;
+			}
+			else {
+				++mFileCount;
+				if (S_ISREG(mode)) {
+					mByteCount += size;
+				}
+			}
+		}
+		
 		//
 		void ShowDifferences() {
-			if (mDifferences.empty()) {
+			if ((mDifferences->GetCount() == 0) && mMoves.empty()) {
 				return;
 			}
 			std::cout << "\n" << "DIFFERENCES:" << "\n";
-			for (auto it = begin(mDifferences); it != end(mDifferences); ++it) {
-				OutputDifference(mH_, **it, std::cout);
+			bool success = mDifferences->ForEach([](const DifferenceRecord& record) {
+				std::ostringstream strm;
+				OutputDifference(record, strm);
+				std::cout << strm.str();
+			});
+			if (!success) {
+				std::cout << "WARNING: Couldn't read back the list of differences." << "\n";
+			}
+			for (const auto& move : mMoves) {
+				OutputMove(move.mPath1UTF8, move.mPath2UTF8, std::cout);
 			}
 		}
 		
 		//
 		void ShowErrors() {
-			if (mErrors.empty()) {
+			if (mErrors->GetCount() == 0) {
 				return;
 			}
 			std::cout << "\n" << "ERRORS:" << "\n";
-			for (auto it = begin(mErrors); it != end(mErrors); ++it) {
-				std::string path1UTF8;
-				if ((*it)->mPath1 != nullptr) {
-					hermit::file::GetFilePathUTF8String(mH_, (*it)->mPath1, path1UTF8);
-				}
-				std::cout << "ERROR: " << path1UTF8 << std::endl;
+			bool success = mErrors->ForEach([](const DifferenceRecord& record) {
+				std::cout << "ERROR: " << record.mPath1UTF8 << "\n";
+			});
+			if (!success) {
+				std::cout << "WARNING: Couldn't read back the list of errors." << "\n";
 			}
 		}
 		
         //
         hermit::HermitPtr mH_;
 		bool mShowMatches;
+		DigestCachePtr mDigestCache;
+		common::OutputSinkPtr mOutput;
+		RecordFormatterPtr mFormatter;
+		bool mCountItems;
+		common::ProgressCounters* mProgress;
+		// --progress: nothing per item, just the recap at the end.
+		bool mQuiet;
+		bool mMessagesToStderr;
+		std::atomic<uint64_t> mFileCount;
+		std::atomic<uint64_t> mByteCount;
+		std::atomic<uint64_t> mDirectoryCount;
+		// Manifest comparisons only; the Preprocessor keeps its own.
+		std::atomic<uint64_t> mAssumedMatchCount;
+		std::atomic<uint64_t> mSkippedSubtreeCount;
+		std::atomic<uint64_t> mSkippedItemCount;
         std::mutex mMutex;
-		FileNotificationParamsVector mDifferences;
-		FileNotificationParamsVector mErrors;
+		// Items the Preprocessor settled itself, which CompareFiles will report as skipped.
+		std::set<std::string> mSettledItems;
+		RecapSpillPtr mDifferences;
+		RecapSpillPtr mErrors;
+		// --detect-moves: set before the comparison starts, and only read during it.
+		std::shared_ptr<MoveDetector> mMoveDetector;
+		std::vector<MoveDetector::Move> mMoves;
+		// Tree comparisons only; set before the comparison starts, like mMoveDetector.
+		std::shared_ptr<FolderDifferences> mFolderDifferences;
     };
 
-    //
-    typedef std::set<std::string> StringSet;
-    
     //
     class Preprocessor : public hermit::file::PreprocessFileFunction {
     public:
         //
-        Preprocessor(const StringSet& exclusions) :
-        mExclusions(exclusions) {
+        Preprocessor(const common::ExclusionMatcherPtr& exclusions,
+					 const DigestCachePtr& digestCache,
+					 bool quickCheck,
+					 double samplePercent,
+					 const common::NativeFileComparerPtr& comparer,
+					 const std::shared_ptr<Hermit>& itemCounter) :
+        mExclusions(exclusions),
+		mDigestCache(digestCache),
+		mQuickCheck(quickCheck),
+		mSamplePercent(samplePercent),
+		mComparer(comparer),
+		mItemCounter(itemCounter),
+		mAssumedMatchCount(0),
+		mSampledCount(0) {
         }
         
         //
         virtual hermit::file::PreprocessFileInstruction Preprocess(const hermit::HermitPtr& h_,
                                                                    const hermit::file::FilePathPtr& parent,
                                                                    const std::string& itemName) override {
-            if (mExclusions.find(itemName) != mExclusions.end()) {
+            if (mComparer->IsExcluded(h_, parent, itemName, *mExclusions)) {
                 return hermit::file::PreprocessFileInstruction::kSkip;
             }
+			
+			std::string path1UTF8;
+			std::string path2UTF8;
+			common::SnapshotEntry entry1;
+			common::SnapshotEntry entry2;
+			bool found = mComparer->GetItemMetadata(h_, parent, itemName, path1UTF8, path2UTF8, entry1, entry2);
+			// Side 1 is looked up first, so it's there even if side 2 isn't.
+			if ((mItemCounter != nullptr) && entry1.HasStat()) {
+				mItemCounter->CountItem(entry1.GetMode(), entry1.GetSize());
+			}
+			if (!found || !entry1.IsRegularFile() || !entry2.IsRegularFile()) {
+				return hermit::file::PreprocessFileInstruction::kContinue;
+			}
+			
+			bool sampled = false;
+			if (mQuickCheck && QuickCheckMatches(entry1, entry2)) {
+				if (!ShouldSample()) {
+					++mAssumedMatchCount;
+					AssumedMatchParams params(AssumedMatchReason::kQuickCheck, path1UTF8, path2UTF8);
+					NOTIFY(h_, kFilesAssumedMatchNotification, &params);
+					return hermit::file::PreprocessFileInstruction::kSkip;
+				}
+				++mSampledCount;
+				sampled = true;
+			}
+			
+			// Read in full already under another path, which a sample would have done anyway.
+			if (mComparer->CompareLinkedPair(h_, path1UTF8, path2UTF8, entry1, entry2)) {
+				return hermit::file::PreprocessFileInstruction::kSkip;
+			}
+			if (mDigestCache != nullptr) {
+				DigestCacheKey key1 = MakeDigestCacheKey(entry1);
+				DigestCacheKey key2 = MakeDigestCacheKey(entry2);
+				// A sampled pair is there to be read, so it isn't allowed to hit; its result still
+				// gets recorded.
+				if (!sampled && mDigestCache->Lookup(key1, key2)) {
+					AssumedMatchParams params(AssumedMatchReason::kDigestCache, path1UTF8, path2UTF8);
+					NOTIFY(h_, kFilesAssumedMatchNotification, &params);
+					return hermit::file::PreprocessFileInstruction::kSkip;
+				}
+				mDigestCache->AddPending(path1UTF8, path2UTF8, key1, key2);
+			}
+			if (mComparer->Compare(h_, path1UTF8, path2UTF8, entry1, entry2, (mDigestCache != nullptr))) {
+				return hermit::file::PreprocessFileInstruction::kSkip;
+			}
             return hermit::file::PreprocessFileInstruction::kContinue;
-
-        }
-        
-        //
-        StringSet mExclusions;
-    };
-    
-    //
-    class CompareCompletion : public hermit::file::CompareFilesCompletion {
-    public:
-        //
-        CompareCompletion() : mStatus(hermit::file::CompareFilesStatus::kUnknown) {
-        }
-        
-        //
-        virtual void Call(const hermit::file::CompareFilesStatus& status) override {
-            mStatus = status;
-        }
-        
-        //
-        bool Done() {
-            return (mStatus != hermit::file::CompareFilesStatus::kUnknown);
         }
+		
+		// rsync-style quick check: the same size and modification time stand in for reading the
+		// contents. A skipped pair isn't looked at again, so everything else CompareFiles would
+		// check (xattrs, flags, birth time) has to match too; a pair that fails on any of it goes
+		// back to being compared in full, which reports the difference.
+		bool QuickCheckMatches(const common::SnapshotEntry& entry1, const common::SnapshotEntry& entry2) {
+			return (entry1.GetModificationTime() == entry2.GetModificationTime()) &&
+				   mComparer->MetadataMatches(entry1, entry2);
+		}
+		
+		//
+		bool ShouldSample() {
+			if (mSamplePercent <= 0) {
+				return false;
+			}
+			static thread_local std::mt19937_64 generator(std::random_device{}());
+			std::uniform_real_distribution<double> distribution(0, 100);
+			return (distribution(generator) < mSamplePercent);
+		}
         
         //
-        std::atomic<hermit::file::CompareFilesStatus> mStatus;
+        common::ExclusionMatcherPtr mExclusions;
+		DigestCachePtr mDigestCache;
+		bool mQuickCheck;
+		double mSamplePercent;
+		common::NativeFileComparerPtr mComparer;
+		// Only set if the summary record needs item counts.
+		std::shared_ptr<Hermit> mItemCounter;
+		std::atomic<uint64_t> mAssumedMatchCount;
+		std::atomic<uint64_t> mSampledCount;
     };
     
+	//
+	struct Options {
+		//
+		Options() :
+		ignoreDates(false),
+		ignoreFinderInfo(false),
+		showMatches(false),
+		workerCount(1),
+		quickCheck(false),
+		samplePercent(0),
+		format(OutputFormat::kText),
+		phaseTimes(false),
+		progress(false),
+		detectMoves(false),
+		snapshots(false) {
+		}
+		
+		//
+		bool ignoreDates;
+		bool ignoreFinderInfo;
+		bool showMatches;
+		size_t workerCount;
+		bool quickCheck;
+		double samplePercent;
+		// Empty if the digest cache is disabled.
+		std::string cachePath;
+		OutputFormat format;
+		common::ReadPipelineOptions readOptions;
+		bool phaseTimes;
+		bool progress;
+		bool detectMoves;
+		// Read metadata a directory at a time instead of an lstat per item.
+		bool snapshots;
+		// The default names, then --exclude, --include and --exclude-from in order.
+		common::ExclusionRules exclusions;
+		// --write-manifest: write this manifest of path 1 instead of comparing.
+		std::string writeManifestPath;
+	};
+	
+	// Byte count with an optional K, M or G suffix. Zero if it doesn't parse.
+	size_t ParseByteCount(const std::string& text) {
+		char* end = nullptr;
+		unsigned long long value = strtoull(text.c_str(), &end, 10);
+		if ((end == text.c_str()) || (value == 0)) {
+			return 0;
+		}
+		std::string suffix(end);
+		if ((suffix == "K") || (suffix == "k")) {
+			value *= 1024;
+		}
+		else if ((suffix == "M") || (suffix == "m")) {
+			value *= 1024 * 1024;
+		}
+		else if ((suffix == "G") || (suffix == "g")) {
+			value *= 1024 * 1024 * 1024;
+		}
+		else if (!suffix.empty()) {
+			return 0;
+		}
+		return (size_t)value;
+	}
+	
+	//
+	RunSummary MakeRunSummary(const Hermit& h, const std::chrono::steady_clock::time_point& startTime) {
+		RunSummary summary;
+		summary.mFiles = h.mFileCount;
+		summary.mBytes = h.mByteCount;
+		summary.mDirectories = h.mDirectoryCount;
+		summary.mDifferences = h.mDifferences->GetCount() + h.mMoves.size();
+		summary.mErrors = h.mErrors->GetCount();
+		summary.mElapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		return summary;
+	}
+	
     //
-    int compare(const std::string& path1, const std::string& path2, bool ignoreDates, bool ignoreFinderInfo, bool showMatches) {
-        auto h_ = std::make_shared<Hermit>(std::make_shared<hermit::LoggingHermit>(), showMatches);
+    int compare(const std::string& path1, const std::string& path2, const Options& options) {
+		bool ignoreDates = options.ignoreDates;
+		bool ignoreFinderInfo = options.ignoreFinderInfo;
+		bool showMatches = options.showMatches;
+		
+		DigestCachePtr digestCache;
+		if (!options.cachePath.empty()) {
+			uint32_t optionFlags = (ignoreDates ? 1 : 0) | (ignoreFinderInfo ? 2 : 0);
+			digestCache = std::make_shared<DigestCache>(options.cachePath, optionFlags);
+			digestCache->Load();
+		}
+		
+		auto startTime = std::chrono::steady_clock::now();
+		// The machine-readable formats replace the recap and status lines with a summary record.
+		bool textFormat = (options.format == OutputFormat::kText);
+		auto formatter = CreateRecordFormatter(options.format);
+		auto output = std::make_shared<common::OutputSink>(std::cout);
+		std::unique_ptr<common::ProgressCounters> progress;
+		common::ReadPipelineOptions readOptions(options.readOptions);
+		if (options.progress) {
+			progress.reset(new common::ProgressCounters);
+			readOptions.mProgress = progress.get();
+		}
+        auto h_ = std::make_shared<Hermit>(std::make_shared<hermit::LoggingHermit>(),
+										   showMatches,
+										   digestCache,
+										   output,
+										   formatter,
+										   !textFormat,
+										   progress.get(),
+										   options.progress && textFormat,
+										   !textFormat);
 
         std::vector<char> wdBuf(2048);
         std::string workingDir;
         const char* cwd = getcwd(&wdBuf.at(0), 2048);
         if (cwd == 0) {
-            std::cout << "WARNING: Current working directory appears invalid. (Was this directory deleted?)" << "\n";
+            h_->WriteMessage("WARNING: Current working directory appears invalid. (Was this directory deleted?)\n");
         }
         else {
             workingDir = cwd;
@@ -256,6 +660,7 @@ namespace compare_Impl {
         std::string simplifiedPath1;
         if (!hermit::string::SimplifyPath(h_, path1, workingDir, simplifiedPath1)) {
             NOTIFY_ERROR(h_, "SimplifyPath failed for:", path1);
+            output->Flush();
             return EXIT_FAILURE;
         }
         hermit::file::FilePathPtr filePath1;
@@ -264,6 +669,7 @@ namespace compare_Impl {
         std::string simplifiedPath2;
         if (!hermit::string::SimplifyPath(h_, path2, workingDir, simplifiedPath2)) {
             NOTIFY_ERROR(h_, "SimplifyPath failed for:", path2);
+            output->Flush();
             return EXIT_FAILURE;
         }
         hermit::file::FilePathPtr filePath2;
@@ -273,10 +679,12 @@ namespace compare_Impl {
         hermit::file::FileExists(h_, filePath1, exists1);
         if (!exists1.mSuccess) {
             NOTIFY_ERROR(h_, "FileExists failed for:", filePath1);
+            output->Flush();
             return EXIT_FAILURE;
         }
         if (!exists1.mExists) {
-            std::cout << "compare: Item 1 doesn't exist at path: <" << path1 << ">\n";
+            h_->WriteMessage("compare: Item 1 doesn't exist at path: <" + path1 + ">\n");
+            output->Flush();
             return EXIT_FAILURE;
         }
         
@@ -284,48 +692,350 @@ namespace compare_Impl {
         hermit::file::FileExists(h_, filePath2, exists2);
         if (!exists2.mSuccess) {
             NOTIFY_ERROR(h_, "FileExists failed for:", filePath2);
+            output->Flush();
             return EXIT_FAILURE;
         }
         if (!exists2.mExists) {
-            std::cout << "compare: Item 2 doesn't exist at path: <" << path2 << ">\n";
+            h_->WriteMessage("compare: Item 2 doesn't exist at path: <" + path2 + ">\n");
+            output->Flush();
             return EXIT_FAILURE;
         }
+		
+		// Only once the comparison is sure to run, so a failed start leaves no partial document.
+		std::string header(formatter->Header());
+		if (!header.empty()) {
+			output->Write(std::move(header));
+		}
         
-        StringSet filenamesToSkip;
-        filenamesToSkip.insert(".DS_Store");                // Finder view file which gets added/updated when you open a folder
-        filenamesToSkip.insert(".ipspot_update");           // Spotlight photo data file which the OS changes on its own
-        filenamesToSkip.insert("ehthumbs.db");              // Windows thumbnails file
-        filenamesToSkip.insert("ehthumbs_vista.db");        // Windows thumbnails file
-        filenamesToSkip.insert("Thumbs.db");                // Windows thumbnails file
+        auto exclusions = std::make_shared<const common::ExclusionMatcher>(options.exclusions);
 		
 		auto hardLinkMap1 = std::make_shared<hermit::file::HardLinkMap>(filePath1);
 		auto hardLinkMap2 = std::make_shared<hermit::file::HardLinkMap>(filePath2);
-        auto preprocessor = std::make_shared<Preprocessor>(filenamesToSkip);
-        auto completion = std::make_shared<CompareCompletion>();
-        hermit::file::CompareFiles(h_,
-                                   filePath1,
-                                   filePath2,
-								   hardLinkMap1,
-								   hardLinkMap2,
-								   ignoreDates ? hermit::file::IgnoreDates::kYes : hermit::file::IgnoreDates::kNo,
-								   ignoreFinderInfo ? hermit::file::IgnoreFinderInfo::kYes : hermit::file::IgnoreFinderInfo::kNo,
-                                   preprocessor,
-                                   completion);
-        while (!completion->Done()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        }
-		if (showMatches) {
-			// Recap all the differences since they may be hard to pick out from among the matches.
+		auto comparer = std::make_shared<common::NativeFileComparer>(simplifiedPath1,
+																	 simplifiedPath2,
+																	 ignoreDates,
+																	 options.snapshots,
+																	 readOptions);
+        auto preprocessor = std::make_shared<Preprocessor>(exclusions,
+														   digestCache,
+														   options.quickCheck,
+														   options.samplePercent,
+														   comparer,
+														   textFormat ? nullptr : h_);
+		// Nothing below a pair of files goes through the Preprocessor, so the pair is counted here.
+		struct stat rootStat;
+		if (!textFormat && (lstat(simplifiedPath1.c_str(), &rootStat) == 0) && !S_ISDIR(rootStat.st_mode)) {
+			h_->CountItem((uint32_t)rootStat.st_mode, (uint64_t)rootStat.st_size);
+		}
+		std::unique_ptr<common::ProgressReporter> progressReporter;
+		if (progress != nullptr) {
+			// With -q most files aren't read, so the count of entries is the better guide.
+			progressReporter.reset(new common::ProgressReporter(*progress,
+																std::cerr,
+																isatty(STDERR_FILENO) != 0,
+																simplifiedPath1,
+																!options.quickCheck));
+		}
+		if (options.detectMoves) {
+			h_->mMoveDetector = std::make_shared<MoveDetector>(simplifiedPath1, simplifiedPath2, exclusions);
+		}
+		h_->mFolderDifferences = std::make_shared<FolderDifferences>(simplifiedPath1, simplifiedPath2);
+		if (options.workerCount > 1) {
+			ParallelCompareFiles(h_,
+								 filePath1,
+								 filePath2,
+								 hardLinkMap1,
+								 hardLinkMap2,
+								 ignoreDates ? hermit::file::IgnoreDates::kYes : hermit::file::IgnoreDates::kNo,
+								 ignoreFinderInfo ? hermit::file::IgnoreFinderInfo::kYes : hermit::file::IgnoreFinderInfo::kNo,
+								 preprocessor,
+								 options.workerCount);
+		}
+		else {
+			auto completion = std::make_shared<common::CompareCompletion>();
+			hermit::file::CompareFiles(h_,
+									   filePath1,
+									   filePath2,
+									   hardLinkMap1,
+									   hardLinkMap2,
+									   ignoreDates ? hermit::file::IgnoreDates::kYes : hermit::file::IgnoreDates::kNo,
+									   ignoreFinderInfo ? hermit::file::IgnoreFinderInfo::kYes : hermit::file::IgnoreFinderInfo::kNo,
+									   preprocessor,
+									   completion);
+			completion->Wait();
+		}
+		if (progressReporter != nullptr) {
+			progressReporter->Stop();
+		}
+		h_->ReportUnreportedFolders();
+		if (h_->mMoveDetector != nullptr) {
+			std::vector<MoveDetector::Move> moves;
+			bool success = h_->mMoveDetector->Finish(moves, [&h_](const DifferenceRecord& record) {
+				h_->OnDifference(record);
+			});
+			if (!success) {
+				std::cerr << "WARNING: Couldn't read back the differences held for --detect-moves; some are missing." << "\n";
+			}
+			for (const auto& move : moves) {
+				h_->OnMove(move);
+			}
+		}
+		if (!textFormat) {
+			output->Write(formatter->Summary(MakeRunSummary(*h_, startTime)));
+			output->Flush();
+			if (digestCache != nullptr) {
+				digestCache->Save();
+			}
+			if (options.phaseTimes) {
+				// Not part of the record stream.
+				common::PhaseTimes::Report(std::cerr);
+			}
+			return 0;
+		}
+		output->Flush();
+		if (showMatches || options.progress) {
+			// Recap all the differences since they may be hard to pick out from among the matches,
+			// or weren't shown at all.
 			h_->ShowDifferences();
 		}
 		h_->ShowErrors();
 		
-		if (!showMatches && h_->mDifferences.empty() && h_->mErrors.empty()) {
+		if (!showMatches && (h_->mDifferences->GetCount() == 0) && h_->mMoves.empty() && (h_->mErrors->GetCount() == 0)) {
 			std::cout << "Items match." << "\n";
 		}
+		
+		if (h_->mMoveDetector != nullptr) {
+			const MoveDetector& detector = *h_->mMoveDetector;
+			std::cout << "Move detection: " << h_->mMoves.size() << " moves among " << detector.GetCandidateCount()
+					  << " files only on one side; " << detector.GetPartialHashCount() << " partial hashes, "
+					  << detector.GetFullHashCount() << " full hashes, " << detector.GetBytesRead() << " bytes read." << "\n";
+		}
+		if (options.quickCheck) {
+			std::cout << "Quick check: " << preprocessor->mAssumedMatchCount << " assumed matches, "
+					  << preprocessor->mSampledCount << " sampled." << "\n";
+		}
+		if (digestCache != nullptr) {
+			if (!digestCache->Save()) {
+				std::cout << "WARNING: Couldn't write digest cache at path: <" << options.cachePath << ">\n";
+			}
+			std::cout << "Digest cache: " << digestCache->GetHitCount() << " hits, "
+					  << digestCache->GetMissCount() << " misses." << "\n";
+		}
+		const common::HardLinkIndex& hardLinks = comparer->GetHardLinks();
+		if (hardLinks.GetSkippedFileCount() > 0) {
+			std::cout << "Hard links: " << hardLinks.GetSkippedFileCount() << " files already compared through another link, "
+					  << hardLinks.GetSkippedByteCount() << " bytes not read again." << "\n";
+		}
+		const common::ReadThroughput& throughput = comparer->GetThroughput();
+		if ((throughput.GetBytes(0) + throughput.GetBytes(1)) > 0) {
+			// Formatted on the side so std::cout's own settings are left alone.
+			std::ostringstream strm;
+			strm << "Read throughput (" << throughput.GetMechanism() << "): "
+				 << std::fixed << std::setprecision(1)
+				 << "1: " << throughput.GetMBPerSecond(0) << " MB/s, "
+				 << "2: " << throughput.GetMBPerSecond(1) << " MB/s." << "\n";
+			std::cout << strm.str();
+		}
+		if (options.phaseTimes) {
+			common::PhaseTimes::Report(std::cout);
+		}
         
         return 0;
     }
+	
+	//
+	bool GetSimplifiedPath(const hermit::HermitPtr& h_, const std::string& path, std::string& outPath) {
+		std::vector<char> wdBuf(2048);
+		const char* cwd = getcwd(&wdBuf.at(0), 2048);
+		std::string workingDir((cwd != nullptr) ? cwd : "");
+		if (!hermit::string::SimplifyPath(h_, path, workingDir, outPath)) {
+			NOTIFY_ERROR(h_, "SimplifyPath failed for:", path);
+			return false;
+		}
+		return true;
+	}
+	
+	// Either side may be a manifest written by --write-manifest; the other may be a live tree. The
+	// two are merged in path order in one pass, so -j doesn't apply and memory stays flat however
+	// big the manifests are.
+	int compareWithManifest(const std::string& path1, const std::string& path2, const Options& options) {
+		auto startTime = std::chrono::steady_clock::now();
+		bool textFormat = (options.format == OutputFormat::kText);
+		auto formatter = CreateRecordFormatter(options.format);
+		auto output = std::make_shared<common::OutputSink>(std::cout);
+		std::unique_ptr<common::ProgressCounters> progress;
+		if (options.progress) {
+			progress.reset(new common::ProgressCounters);
+		}
+		auto h_ = std::make_shared<Hermit>(std::make_shared<hermit::LoggingHermit>(),
+										   options.showMatches,
+										   nullptr,
+										   output,
+										   formatter,
+										   !textFormat,
+										   progress.get(),
+										   options.progress && textFormat,
+										   !textFormat);
+		
+		ManifestErrorFunction onError = [&h_](const std::string& pathUTF8, int error) {
+			DifferenceRecord record;
+			record.mPath1UTF8 = pathUTF8;
+			record.mInt1 = (uint64_t)error;
+			h_->OnError(record);
+		};
+		
+		// The tree side (if any) is what the progress estimate walks.
+		std::string treeRoot;
+		auto exclusions = std::make_shared<const common::ExclusionMatcher>(options.exclusions);
+		auto openSource = [&](const std::string& path, int index, std::unique_ptr<ManifestSource>& outSource) {
+			if (IsManifestFile(path)) {
+				std::unique_ptr<ManifestReader> reader(new ManifestReader);
+				if (!reader->Open(path)) {
+					h_->WriteMessage("compare: couldn't read manifest " + std::to_string(index) + " at path: <" + path + ">\n");
+					return false;
+				}
+				reader->SetExclusions(exclusions);
+				if (!reader->HasDigests() && textFormat) {
+					h_->WriteMessage("NOTE: Manifest " + std::to_string(index) + " has no digests; files of the same size are assumed to match.\n");
+				}
+				outSource = std::move(reader);
+				return true;
+			}
+			std::string simplifiedPath;
+			if (!GetSimplifiedPath(h_, path, simplifiedPath)) {
+				return false;
+			}
+			struct stat s;
+			if (lstat(simplifiedPath.c_str(), &s) != 0) {
+				h_->WriteMessage("compare: Item " + std::to_string(index) + " doesn't exist at path: <" + path + ">\n");
+				return false;
+			}
+			treeRoot = simplifiedPath;
+			outSource.reset(new TreeManifestSource(simplifiedPath, exclusions, onError, progress.get()));
+			return true;
+		};
+		std::unique_ptr<ManifestSource> source1;
+		std::unique_ptr<ManifestSource> source2;
+		if (!openSource(path1, 1, source1) || !openSource(path2, 2, source2)) {
+			output->Flush();
+			return EXIT_FAILURE;
+		}
+		
+		std::string header(formatter->Header());
+		if (!header.empty()) {
+			output->Write(std::move(header));
+		}
+		
+		std::unique_ptr<common::ProgressReporter> progressReporter;
+		if (progress != nullptr) {
+			progressReporter.reset(new common::ProgressReporter(*progress,
+																std::cerr,
+																isatty(STDERR_FILENO) != 0,
+																treeRoot,
+																!options.quickCheck));
+		}
+		ManifestCompareOptions compareOptions;
+		compareOptions.mIgnoreDates = options.ignoreDates;
+		compareOptions.mQuickCheck = options.quickCheck;
+		// -m lists every match, so it has to see every item.
+		compareOptions.mSkipMatchingSubtrees = !options.showMatches;
+		CompareManifests(*source1, *source2, compareOptions, *h_);
+		if (progressReporter != nullptr) {
+			progressReporter->Stop();
+		}
+		
+		for (ManifestSource* source : { source1.get(), source2.get() }) {
+			ManifestReader* reader = dynamic_cast<ManifestReader*>(source);
+			if ((reader != nullptr) && !reader->IsIntact()) {
+				std::string path((source == source1.get()) ? path1 : path2);
+				onError(path, EILSEQ);
+				std::cerr << "compare: manifest is damaged; the comparison stopped partway: <" << path << ">\n";
+			}
+		}
+		
+		if (!textFormat) {
+			output->Write(formatter->Summary(MakeRunSummary(*h_, startTime)));
+			output->Flush();
+			if (options.phaseTimes) {
+				common::PhaseTimes::Report(std::cerr);
+			}
+			return 0;
+		}
+		output->Flush();
+		if (options.showMatches || options.progress) {
+			h_->ShowDifferences();
+		}
+		h_->ShowErrors();
+		
+		if (!options.showMatches && (h_->mDifferences->GetCount() == 0) && (h_->mErrors->GetCount() == 0)) {
+			std::cout << "Items match." << "\n";
+		}
+		if (h_->mAssumedMatchCount > 0) {
+			std::cout << "Assumed matches (contents not compared): " << h_->mAssumedMatchCount << "." << "\n";
+		}
+		if (h_->mSkippedSubtreeCount > 0) {
+			std::cout << "Directory digests: " << h_->mSkippedSubtreeCount << " matching directories skipped ("
+					  << h_->mSkippedItemCount << " items)." << "\n";
+		}
+		if (options.phaseTimes) {
+			common::PhaseTimes::Report(std::cout);
+		}
+		return 0;
+	}
+	
+	// --write-manifest: records path's tree so later runs can compare against it without it being
+	// there. With -q only metadata is recorded, which is fast but leaves same-sized files to be
+	// assumed to match.
+	int writeManifest(const std::string& manifestPath, const std::string& path, const Options& options) {
+		auto h_ = std::make_shared<hermit::LoggingHermit>();
+		std::string simplifiedPath;
+		if (!GetSimplifiedPath(h_, path, simplifiedPath)) {
+			return EXIT_FAILURE;
+		}
+		struct stat s;
+		if ((stat(simplifiedPath.c_str(), &s) != 0) || !S_ISDIR(s.st_mode)) {
+			std::cout << "compare: --write-manifest needs a directory: <" << path << ">\n";
+			return EXIT_FAILURE;
+		}
+		
+		std::unique_ptr<common::ProgressCounters> progress;
+		std::unique_ptr<common::ProgressReporter> progressReporter;
+		if (options.progress) {
+			progress.reset(new common::ProgressCounters);
+			progressReporter.reset(new common::ProgressReporter(*progress,
+																std::cerr,
+																isatty(STDERR_FILENO) != 0,
+																simplifiedPath,
+																!options.quickCheck));
+		}
+		uint64_t errorCount = 0;
+		uint64_t entryCount = 0;
+		bool success = WriteTreeManifest(simplifiedPath,
+										 manifestPath,
+										 !options.quickCheck,
+										 std::make_shared<const common::ExclusionMatcher>(options.exclusions),
+										 [&errorCount](const std::string& pathUTF8, int error) {
+											 ++errorCount;
+											 std::cout << "ERROR: " << pathUTF8 << " (" << strerror(error) << ")" << "\n";
+										 },
+										 progress.get(),
+										 entryCount);
+		if (progressReporter != nullptr) {
+			progressReporter->Stop();
+		}
+		if (!success) {
+			std::cout << "compare: couldn't write manifest at path: <" << manifestPath << ">\n";
+			return EXIT_FAILURE;
+		}
+		std::cout << "Wrote manifest of " << entryCount << " items to " << manifestPath << "." << "\n";
+		if (errorCount > 0) {
+			std::cout << errorCount << " unreadable items were left out." << "\n";
+		}
+		if (options.phaseTimes) {
+			common::PhaseTimes::Report(std::cout);
+		}
+		return (errorCount > 0) ? EXIT_FAILURE : 0;
+	}
 
 } // namespace compare_Impl
 using namespace compare_Impl;
@@ -339,29 +1049,172 @@ int main(int argc, const char * argv[]) {
     
     if (args.size() < 2) {
         std::cout << "usage: compare [options] <path_1> <path_2>\n";
+        std::cout << "       compare [options] --write-manifest <file> <path>\n";
+        std::cout << "either path may be a manifest written by --write-manifest\n";
         std::cout << "[options]:" << "\n";
         std::cout << "\t-d ignore creation/modification dates when comparing items" << "\n";
         std::cout << "\t-f ignore finder info when comparing items" << "\n";
         std::cout << "\t-m show matches and skipped items" << "\n";
+        std::cout << "\t-q quick check: assume files with the same size and modification date match" << "\n";
+        std::cout << "\t--sample <percent> with -q, still fully compare this percentage of files" << "\n";
+        std::cout << "\t-j <n> compare subdirectories in parallel using n worker threads" << "\n";
+        std::cout << "\t--cache <path> remember the digests of matching files in this cache and skip" << "\n";
+        std::cout << "\t\treading pairs that haven't changed since (off by default)" << "\n";
+        std::cout << "\t--no-cache don't use a digest cache, even if --cache was given" << "\n";
+        std::cout << "\t--format=<text|ndjson|bin> output format (default text)" << "\n";
+        std::cout << "\t--io-depth <n> reads to keep in flight per file (default 4)" << "\n";
+        std::cout << "\t--block-size <bytes[K|M]> size of each read (default 1M)" << "\n";
+        std::cout << "\t--progress show a status line with throughput and ETA instead of a line per item;" << "\n";
+        std::cout << "\t\tdifferences are listed at the end" << "\n";
+        std::cout << "\t--write-manifest <file> record path's tree in a manifest (with -q, without digests)" << "\n";
+        std::cout << "\t\tand its directory digests in <file>.dirs, which lets manifest comparisons skip" << "\n";
+        std::cout << "\t\tdirectories that haven't changed" << "\n";
+        std::cout << "\t--detect-moves report files only in 1 with the same contents as files only in 2 as moved" << "\n";
+        std::cout << "\t\t(matched by size, then the first and last 64K, then a full hash)" << "\n";
+        std::cout << "\t--exclude <pattern> skip items matching a gitignore-style pattern: a name (*.o), a path" << "\n";
+        std::cout << "\t\tfrom the top (/build, src/**/gen), or a directory (tmp/); may be repeated" << "\n";
+        std::cout << "\t--include <pattern> don't skip items matching the pattern after all (like !pattern)" << "\n";
+        std::cout << "\t--exclude-from <file> read patterns from a file, one per line, as in .gitignore" << "\n";
+        std::cout << "\t\t(later rules win; .DS_Store, Thumbs.db and the like are always excluded first)" << "\n";
+        std::cout << "\t--phase-times when done, show where the time went (listing, stat, reading, comparing)" << "\n";
+        std::cout << "\t--snapshots read each directory's metadata in one batch instead of item by item (can help" << "\n";
+        std::cout << "\t\ton high-latency file systems; usually slower on local disks)" << "\n";
         return EXIT_FAILURE;
     }
     
-    bool ignoreDates = false;
-    bool ignoreFinderInfo = false;
-    bool showMatches = false;
+    Options options;
+    options.exclusions.AddDefaults();
     std::string path1;
     std::string path2;
     while (!args.empty()) {
         std::string arg(args.front());
         args.pop_front();
         if (arg == "-d") {
-            ignoreDates = true;
+            options.ignoreDates = true;
         }
         else if (arg == "-f") {
-            ignoreFinderInfo = true;
+            options.ignoreFinderInfo = true;
         }
         else if (arg == "-m") {
-            showMatches = true;
+            options.showMatches = true;
+        }
+        else if (arg == "-q") {
+            options.quickCheck = true;
+        }
+        else if (arg == "--sample") {
+            if (args.empty()) {
+                std::cout << "compare: --sample requires a percentage\n";
+                return EXIT_FAILURE;
+            }
+            double percent = atof(args.front().c_str());
+            args.pop_front();
+            if ((percent < 0) || (percent > 100)) {
+                std::cout << "compare: --sample percentage must be between 0 and 100\n";
+                return EXIT_FAILURE;
+            }
+            options.samplePercent = percent;
+        }
+        else if (arg == "-j") {
+            if (args.empty()) {
+                std::cout << "compare: -j requires a worker count\n";
+                return EXIT_FAILURE;
+            }
+            int count = atoi(args.front().c_str());
+            args.pop_front();
+            if (count < 1) {
+                std::cout << "compare: invalid worker count for -j\n";
+                return EXIT_FAILURE;
+            }
+            options.workerCount = (size_t)count;
+        }
+        else if (arg == "--cache") {
+            if (args.empty()) {
+                std::cout << "compare: --cache requires a path\n";
+                return EXIT_FAILURE;
+            }
+            options.cachePath = args.front();
+            args.pop_front();
+        }
+        else if (arg == "--no-cache") {
+            options.cachePath.clear();
+        }
+        else if (arg == "--io-depth") {
+            if (args.empty()) {
+                std::cout << "compare: --io-depth requires a count\n";
+                return EXIT_FAILURE;
+            }
+            int depth = atoi(args.front().c_str());
+            args.pop_front();
+            if ((depth < 1) || (depth > 256)) {
+                std::cout << "compare: --io-depth must be between 1 and 256\n";
+                return EXIT_FAILURE;
+            }
+            options.readOptions.mDepth = (size_t)depth;
+        }
+        else if (arg == "--block-size") {
+            if (args.empty()) {
+                std::cout << "compare: --block-size requires a size\n";
+                return EXIT_FAILURE;
+            }
+            size_t blockSize = ParseByteCount(args.front());
+            args.pop_front();
+            if ((blockSize < 4096) || (blockSize > (64 * 1024 * 1024))) {
+                std::cout << "compare: --block-size must be between 4K and 64M\n";
+                return EXIT_FAILURE;
+            }
+            options.readOptions.mBlockSize = blockSize;
+        }
+        else if (arg == "--progress") {
+            options.progress = true;
+        }
+        else if (arg == "--write-manifest") {
+            if (args.empty()) {
+                std::cout << "compare: --write-manifest requires a file\n";
+                return EXIT_FAILURE;
+            }
+            options.writeManifestPath = args.front();
+            args.pop_front();
+        }
+        else if ((arg == "--exclude") || (arg == "--include") || (arg == "--exclude-from")) {
+            if (args.empty()) {
+                std::cout << "compare: " << arg << ((arg == "--exclude-from") ? " requires a file\n" : " requires a pattern\n");
+                return EXIT_FAILURE;
+            }
+            std::string value(args.front());
+            args.pop_front();
+            std::string error;
+            bool added = (arg == "--exclude-from") ?
+                options.exclusions.AddFromFile(value, error) :
+                options.exclusions.Add(value, (arg == "--include"), error);
+            if (!added) {
+                std::cout << "compare: " << arg << " " << value << ": " << error << "\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if (arg == "--detect-moves") {
+            options.detectMoves = true;
+        }
+        else if (arg == "--phase-times") {
+            options.phaseTimes = true;
+        }
+        else if (arg == "--snapshots") {
+            options.snapshots = true;
+        }
+        else if (arg.compare(0, 9, "--format=") == 0) {
+            std::string format(arg, 9);
+            if (format == "text") {
+                options.format = OutputFormat::kText;
+            }
+            else if (format == "ndjson") {
+                options.format = OutputFormat::kNDJSON;
+            }
+            else if (format == "bin") {
+                options.format = OutputFormat::kBinary;
+            }
+            else {
+                std::cout << "compare: unknown output format: " << format << "\n";
+                return EXIT_FAILURE;
+            }
         }
         else if (path1.empty()) {
             path1 = arg;
@@ -370,5 +1223,30 @@ int main(int argc, const char * argv[]) {
             path2 = arg;
         }
     }
-    return compare(path1, path2, ignoreDates, ignoreFinderInfo, showMatches);
+    if (options.progress && options.showMatches) {
+        std::cout << "compare: --progress can't be combined with -m\n";
+        return EXIT_FAILURE;
+    }
+    if (options.phaseTimes) {
+        common::PhaseTimes::Enable();
+    }
+    if (!options.writeManifestPath.empty()) {
+        if (path1.empty() || !path2.empty()) {
+            std::cout << "compare: --write-manifest takes one path\n";
+            return EXIT_FAILURE;
+        }
+        if (options.detectMoves) {
+            std::cout << "compare: --detect-moves can't be combined with --write-manifest\n";
+            return EXIT_FAILURE;
+        }
+        return writeManifest(options.writeManifestPath, path1, options);
+    }
+    if (IsManifestFile(path1) || IsManifestFile(path2)) {
+        if (options.detectMoves) {
+            std::cout << "compare: --detect-moves needs two directories, not manifests\n";
+            return EXIT_FAILURE;
+        }
+        return compareWithManifest(path1, path2, options);
+    }
+    return compare(path1, path2, options);
 }
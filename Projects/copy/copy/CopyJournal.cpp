@@ -0,0 +1,411 @@
+//
+//    copy
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Common/Sha256.h"
+#include "CopyJournal.h"
+
+namespace copy_Impl {
+	namespace CopyJournal_Impl {
+		
+		//
+		// Version 1 keyed files by a 64-bit hash of the path alone.
+		static const char kMagic[8] = { 'C', 'P', 'Y', 'J', 'R', 'N', 'L', '2' };
+		static const char kVersion1Magic[8] = { 'C', 'P', 'Y', 'J', 'R', 'N', 'L', '1' };
+		
+		//
+		static const uint8_t kFileDoneRecord = 1;
+		static const uint8_t kRangeDoneRecord = 2;
+		static const size_t kFileDoneRecordSize = 1 + 8 + 8 + 4 + 8 + 8 + 4;
+		static const size_t kRangeDoneRecordSize = kFileDoneRecordSize + 8 + 8;
+		
+		// A batch is committed when it reaches either limit, so a crash loses at most a second or
+		// so of finished work.
+		static const size_t kCommitRecordCount = 16384;
+		static const std::chrono::seconds kCommitInterval(1);
+		
+		//
+		uint32_t Checksum(const char* data, size_t size) {
+			// FNV-1a; only has to catch a torn or half-written record.
+			uint32_t hash = 2166136261U;
+			for (size_t n = 0; n < size; ++n) {
+				hash ^= (uint8_t)data[n];
+				hash *= 16777619U;
+			}
+			return hash;
+		}
+		
+		//
+		template <class T>
+		void AppendValue(std::string& buffer, const T& value) {
+			buffer.append((const char*)&value, sizeof(value));
+		}
+		
+		//
+		template <class T>
+		T ReadValue(const char*& p) {
+			T value;
+			memcpy(&value, p, sizeof(value));
+			p += sizeof(value);
+			return value;
+		}
+		
+		//
+		bool WriteAll(int fd, const char* data, size_t size) {
+			while (size > 0) {
+				ssize_t result = write(fd, data, size);
+				if (result < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+				data += result;
+				size -= (size_t)result;
+			}
+			return true;
+		}
+		
+		//
+		bool ReadAll(int fd, off_t offset, char* data, size_t size) {
+			while (size > 0) {
+				ssize_t result = pread(fd, data, size, offset);
+				if (result < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+				if (result == 0) {
+					return false;
+				}
+				data += result;
+				size -= (size_t)result;
+				offset += result;
+			}
+			return true;
+		}
+		
+		//
+		std::string MakeHeader(const std::string& sourceRootUTF8, const std::string& destRootUTF8) {
+			std::string header(kMagic, sizeof(kMagic));
+			AppendValue(header, (uint32_t)sourceRootUTF8.size());
+			header += sourceRootUTF8;
+			AppendValue(header, (uint32_t)destRootUTF8.size());
+			header += destRootUTF8;
+			return header;
+		}
+		
+		//
+		bool ReadHeader(int fd, std::string& outSourceRootUTF8, std::string& outDestRootUTF8, size_t& outHeaderSize) {
+			char magic[sizeof(kMagic)];
+			if (!ReadAll(fd, 0, magic, sizeof(magic)) || (memcmp(magic, kMagic, sizeof(kMagic)) != 0)) {
+				return false;
+			}
+			off_t offset = sizeof(kMagic);
+			std::string* roots[] = { &outSourceRootUTF8, &outDestRootUTF8 };
+			for (std::string* root : roots) {
+				uint32_t size = 0;
+				if (!ReadAll(fd, offset, (char*)&size, sizeof(size)) || (size > 64 * 1024)) {
+					return false;
+				}
+				offset += sizeof(size);
+				root->resize(size);
+				if ((size > 0) && !ReadAll(fd, offset, &(*root)[0], size)) {
+					return false;
+				}
+				offset += size;
+			}
+			outHeaderSize = (size_t)offset;
+			return true;
+		}
+		
+		//
+		bool SyncFileSystem(int fd) {
+#if defined(__linux__)
+			return (syncfs(fd) == 0);
+#else
+			sync();
+			return true;
+#endif
+		}
+		
+	} // namespace CopyJournal_Impl
+	using namespace CopyJournal_Impl;
+	
+	//
+	CopyJournal::CopyJournal(const std::string& pathUTF8) :
+	mPathUTF8(pathUTF8),
+	mFd(-1),
+	mDestFileSystemFd(-1),
+	mReplayedRecordCount(0),
+	mBufferedRecordCount(0),
+	mLastCommitTime(std::chrono::steady_clock::now()),
+	mFailed(false) {
+	}
+	
+	//
+	CopyJournal::~CopyJournal() {
+		if (mFd >= 0) {
+			close(mFd);
+		}
+		if (mDestFileSystemFd >= 0) {
+			close(mDestFileSystemFd);
+		}
+	}
+	
+	//
+	bool CopyJournal::Open(const std::string& sourceRootUTF8, const std::string& destRootUTF8, std::string& outError) {
+		// syncfs needs something open on the destination file system; the root itself may not
+		// exist yet, but its parent must.
+		std::string::size_type slash = destRootUTF8.rfind('/');
+		std::string destParentUTF8((slash == std::string::npos) ? "." : (slash == 0) ? "/" : destRootUTF8.substr(0, slash));
+		mDestFileSystemFd = open(destParentUTF8.c_str(), O_RDONLY | O_DIRECTORY);
+		if (mDestFileSystemFd < 0) {
+			outError = "can't open destination parent: " + std::string(strerror(errno));
+			return false;
+		}
+		
+		mFd = open(mPathUTF8.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		struct stat s;
+		if ((mFd < 0) || (fstat(mFd, &s) != 0)) {
+			outError = strerror(errno);
+			return false;
+		}
+		if (s.st_size == 0) {
+			std::string header(MakeHeader(sourceRootUTF8, destRootUTF8));
+			if (!WriteAll(mFd, header.data(), header.size()) || (fdatasync(mFd) != 0)) {
+				outError = strerror(errno);
+				return false;
+			}
+			return true;
+		}
+		
+		std::string journalSourceRootUTF8;
+		std::string journalDestRootUTF8;
+		size_t headerSize = 0;
+		if (!ReadHeader(mFd, journalSourceRootUTF8, journalDestRootUTF8, headerSize)) {
+			char magic[sizeof(kVersion1Magic)];
+			if (ReadAll(mFd, 0, magic, sizeof(magic)) && (memcmp(magic, kVersion1Magic, sizeof(magic)) == 0)) {
+				outError = "journal was written by an older version of copy; delete it to start over";
+			}
+			else {
+				outError = "not a copy journal";
+			}
+			return false;
+		}
+		if ((journalSourceRootUTF8 != sourceRootUTF8) || (journalDestRootUTF8 != destRootUTF8)) {
+			outError = "journal is for copying <" + journalSourceRootUTF8 + "> to <" + journalDestRootUTF8 + ">";
+			return false;
+		}
+		if (!Replay(mFd, headerSize)) {
+			outError = strerror(errno);
+			return false;
+		}
+		return true;
+	}
+	
+	//
+	bool CopyJournal::ReadRoots(const std::string& pathUTF8, std::string& outSourceRootUTF8, std::string& outDestRootUTF8) {
+		int fd = open(pathUTF8.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		size_t headerSize = 0;
+		bool success = ReadHeader(fd, outSourceRootUTF8, outDestRootUTF8, headerSize);
+		close(fd);
+		return success;
+	}
+	
+	//
+	JournalKey CopyJournal::MakeKey(const std::string& relativePathUTF8) {
+		common::Sha256 hasher;
+		hasher.Update(relativePathUTF8.data(), relativePathUTF8.size());
+		common::Sha256Digest digest = hasher.Finish();
+		JournalKey key;
+		memcpy(&key.mHigh, digest.mBytes, sizeof(key.mHigh));
+		memcpy(&key.mLow, digest.mBytes + sizeof(key.mHigh), sizeof(key.mLow));
+		key.mLength = (uint32_t)relativePathUTF8.size();
+		return key;
+	}
+	
+	//
+	bool CopyJournal::Replay(int fd, size_t headerSize) {
+		struct stat s;
+		if (fstat(fd, &s) != 0) {
+			return false;
+		}
+		size_t fileSize = (size_t)s.st_size;
+		size_t validSize = headerSize;
+		if (fileSize > headerSize) {
+			void* data = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data == MAP_FAILED) {
+				return false;
+			}
+			const char* begin = (const char*)data;
+			const char* p = begin + headerSize;
+			const char* end = begin + fileSize;
+			mDoneRecords.reserve((fileSize - headerSize) / kFileDoneRecordSize);
+			while (p < end) {
+				uint8_t kind = (uint8_t)*p;
+				size_t recordSize = (kind == kRangeDoneRecord) ? kRangeDoneRecordSize : kFileDoneRecordSize;
+				if (((kind != kFileDoneRecord) && (kind != kRangeDoneRecord)) ||
+					((size_t)(end - p) < recordSize)) {
+					break;
+				}
+				uint32_t checksum = 0;
+				memcpy(&checksum, p + recordSize - sizeof(checksum), sizeof(checksum));
+				if (checksum != Checksum(p, recordSize - sizeof(checksum))) {
+					break;
+				}
+				const char* record = p + 1;
+				JournalKey key;
+				key.mHigh = ReadValue<uint64_t>(record);
+				key.mLow = ReadValue<uint64_t>(record);
+				key.mLength = ReadValue<uint32_t>(record);
+				FileStamp stamp;
+				stamp.mSize = ReadValue<uint64_t>(record);
+				stamp.mModificationTime = ReadValue<int64_t>(record);
+				if (kind == kFileDoneRecord) {
+					DoneRecord done;
+					done.mKey = key;
+					done.mStamp = stamp;
+					mDoneRecords.push_back(done);
+				}
+				else {
+					RangeRecord range;
+					range.mStamp = stamp;
+					range.mRange.first = ReadValue<uint64_t>(record);
+					range.mRange.second = ReadValue<uint64_t>(record);
+					mRangeRecords[key].push_back(range);
+				}
+				++mReplayedRecordCount;
+				p += recordSize;
+			}
+			validSize = (size_t)(p - begin);
+			munmap(data, fileSize);
+			std::sort(mDoneRecords.begin(), mDoneRecords.end());
+		}
+		
+		// Whatever follows the last good record is a batch the crash interrupted.
+		if ((validSize < fileSize) && (ftruncate(fd, (off_t)validSize) != 0)) {
+			return false;
+		}
+		return (lseek(fd, (off_t)validSize, SEEK_SET) >= 0);
+	}
+	
+	//
+	bool CopyJournal::IsFileDone(const JournalKey& key, const FileStamp& stamp) const {
+		DoneRecord probe;
+		probe.mKey = key;
+		auto range = std::equal_range(mDoneRecords.begin(), mDoneRecords.end(), probe);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (it->mStamp == stamp) {
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	//
+	void CopyJournal::GetDoneRanges(const JournalKey& key, const FileStamp& stamp, ByteRangeVector& outRanges) const {
+		auto it = mRangeRecords.find(key);
+		if (it == mRangeRecords.end()) {
+			return;
+		}
+		for (const auto& record : it->second) {
+			if (record.mStamp == stamp) {
+				outRanges.push_back(record.mRange);
+			}
+		}
+	}
+	
+	//
+	void CopyJournal::RecordFileDone(const JournalKey& key, const FileStamp& stamp) {
+		Append(kFileDoneRecord, key, stamp, nullptr);
+	}
+	
+	//
+	void CopyJournal::RecordRangeDone(const JournalKey& key, const FileStamp& stamp, uint64_t offset, uint64_t length) {
+		ByteRange range(offset, length);
+		Append(kRangeDoneRecord, key, stamp, &range);
+	}
+	
+	//
+	void CopyJournal::Append(uint8_t kind, const JournalKey& key, const FileStamp& stamp, const ByteRange* range) {
+		std::string record;
+		AppendValue(record, kind);
+		AppendValue(record, key.mHigh);
+		AppendValue(record, key.mLow);
+		AppendValue(record, key.mLength);
+		AppendValue(record, stamp.mSize);
+		AppendValue(record, stamp.mModificationTime);
+		if (range != nullptr) {
+			AppendValue(record, range->first);
+			AppendValue(record, range->second);
+		}
+		AppendValue(record, Checksum(record.data(), record.size()));
+		
+		bool commit = false;
+		{
+			std::lock_guard<std::mutex> guard(mBufferMutex);
+			mBuffer += record;
+			++mBufferedRecordCount;
+			commit = ((mBufferedRecordCount >= kCommitRecordCount) ||
+					  ((std::chrono::steady_clock::now() - mLastCommitTime) >= kCommitInterval));
+		}
+		if (commit) {
+			Commit();
+		}
+	}
+	
+	//
+	bool CopyJournal::Commit() {
+		std::lock_guard<std::mutex> commitGuard(mCommitMutex);
+		std::string batch;
+		{
+			std::lock_guard<std::mutex> guard(mBufferMutex);
+			batch.swap(mBuffer);
+			mBufferedRecordCount = 0;
+			mLastCommitTime = std::chrono::steady_clock::now();
+		}
+		if (mFailed || (mFd < 0)) {
+			return false;
+		}
+		if (batch.empty()) {
+			return true;
+		}
+		// Every record in the batch was appended after its data was written, so once this sync
+		// returns they're all safe to commit.
+		if (!SyncFileSystem(mDestFileSystemFd) ||
+			!WriteAll(mFd, batch.data(), batch.size()) ||
+			(fdatasync(mFd) != 0)) {
+			mFailed = true;
+			return false;
+		}
+		return true;
+	}
+	
+} // namespace copy_Impl
@@ -0,0 +1,176 @@
+//
+//    copy
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef CopyJournal_h
+#define CopyJournal_h
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace copy_Impl {
+	
+	// Identifies the version of a source file a journal record is about, so a file that changed
+	// since the interrupted run is copied again.
+	struct FileStamp {
+		//
+		FileStamp() : mSize(0), mModificationTime(0) {
+		}
+		
+		//
+		FileStamp(uint64_t size, int64_t modificationTime) : mSize(size), mModificationTime(modificationTime) {
+		}
+		
+		//
+		bool operator==(const FileStamp& other) const {
+			return (mSize == other.mSize) && (mModificationTime == other.mModificationTime);
+		}
+		
+		//
+		uint64_t mSize;
+		int64_t mModificationTime;
+	};
+	
+	// Identifies a file by its path relative to the source root: the first 128 bits of the path's
+	// SHA-256 and its length. Two paths only share a key if they collide in all of that, which
+	// across a 10M-file tree is about 1 in 10^23, so a record can't be applied to the wrong file.
+	struct JournalKey {
+		//
+		JournalKey() : mHigh(0), mLow(0), mLength(0) {
+		}
+		
+		//
+		bool operator==(const JournalKey& other) const {
+			return (mHigh == other.mHigh) && (mLow == other.mLow) && (mLength == other.mLength);
+		}
+		
+		//
+		bool operator<(const JournalKey& other) const {
+			if (mHigh != other.mHigh) {
+				return mHigh < other.mHigh;
+			}
+			if (mLow != other.mLow) {
+				return mLow < other.mLow;
+			}
+			return mLength < other.mLength;
+		}
+		
+		//
+		uint64_t mHigh;
+		uint64_t mLow;
+		uint32_t mLength;
+	};
+	
+	//
+	typedef std::pair<uint64_t, uint64_t> ByteRange;
+	typedef std::vector<ByteRange> ByteRangeVector;
+	
+	// Append-only record of finished files and finished ranges of huge files, for resuming an
+	// interrupted copy. Files are keyed by a JournalKey made from their path relative to the
+	// source root, so a record is 41 bytes (57 for a range) whatever the path, and replaying 10M
+	// of them is one sequential read and a sort. Records are written in batches: one syncfs on the
+	// destination makes the data of every file in the batch durable before the records that
+	// claim it are written and synced, instead of an fsync per file. Each record carries a
+	// checksum, and a torn tail left by a crash is cut off at the next open.
+	class CopyJournal {
+	public:
+		//
+		explicit CopyJournal(const std::string& pathUTF8);
+		
+		//
+		~CopyJournal();
+		
+		// Replays an existing journal for the same roots, or starts a new one.
+		bool Open(const std::string& sourceRootUTF8, const std::string& destRootUTF8, std::string& outError);
+		
+		// The roots an existing journal was written for, so a rerun copies to the same place.
+		static bool ReadRoots(const std::string& pathUTF8, std::string& outSourceRootUTF8, std::string& outDestRootUTF8);
+		
+		//
+		static JournalKey MakeKey(const std::string& relativePathUTF8);
+		
+		//
+		bool IsFileDone(const JournalKey& key, const FileStamp& stamp) const;
+		
+		// Ranges of the file already committed, in no particular order.
+		void GetDoneRanges(const JournalKey& key, const FileStamp& stamp, ByteRangeVector& outRanges) const;
+		
+		// Call only once the file's data and metadata are written.
+		void RecordFileDone(const JournalKey& key, const FileStamp& stamp);
+		
+		// Call only once the range's data is written.
+		void RecordRangeDone(const JournalKey& key, const FileStamp& stamp, uint64_t offset, uint64_t length);
+		
+		// Makes everything recorded so far durable. False if the journal couldn't be written, in
+		// which case later records are dropped too.
+		bool Commit();
+		
+		//
+		uint64_t GetReplayedRecordCount() const {
+			return mReplayedRecordCount;
+		}
+		
+	private:
+		//
+		struct DoneRecord {
+			JournalKey mKey;
+			FileStamp mStamp;
+			
+			bool operator<(const DoneRecord& other) const {
+				return mKey < other.mKey;
+			}
+		};
+		
+		//
+		struct RangeRecord {
+			FileStamp mStamp;
+			ByteRange mRange;
+		};
+		
+		//
+		bool Replay(int fd, size_t headerSize);
+		
+		//
+		void Append(uint8_t kind, const JournalKey& key, const FileStamp& stamp, const ByteRange* range);
+		
+		//
+		std::string mPathUTF8;
+		int mFd;
+		int mDestFileSystemFd;
+		std::vector<DoneRecord> mDoneRecords;
+		// Only huge files have ranges, so there are few of these.
+		std::map<JournalKey, std::vector<RangeRecord>> mRangeRecords;
+		uint64_t mReplayedRecordCount;
+		
+		//
+		std::mutex mBufferMutex;
+		std::string mBuffer;
+		size_t mBufferedRecordCount;
+		std::chrono::steady_clock::time_point mLastCommitTime;
+		std::mutex mCommitMutex;
+		bool mFailed;
+	};
+	
+} // namespace copy_Impl
+
+#endif /* CopyJournal_h */
@@ -0,0 +1,79 @@
+//
+//    copy
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef CopyOptions_h
+#define CopyOptions_h
+
+#include <cstddef>
+#include <string>
+#include "Common/Checksum.h"
+#include "Common/ExclusionMatcher.h"
+#include "DeltaCopy.h"
+#include "FileDataCopy.h"
+
+namespace copy_Impl {
+	
+	// Everything the command line can change about a copy.
+	struct CopyOptions {
+		//
+		CopyOptions() :
+		mVerify(false),
+		mVerbose(false),
+		mReflinkMode(ReflinkMode::kAuto),
+		mJobs(1),
+		mSync(false),
+		mDeleteOnlyInDest(false),
+		mInlineVerify(false),
+		mChecksumAlgorithm(common::ChecksumAlgorithm::kCRC32C),
+		mDeltaMode(DeltaMode::kOff),
+		mPhaseTimes(false),
+		mProgress(false),
+		mSnapshots(false) {
+		}
+		
+		//
+		bool mVerify;
+		bool mVerbose;
+		ReflinkMode mReflinkMode;
+		// Files (or chunks of huge files) copied at once.
+		size_t mJobs;
+		// Resume journal; empty for none.
+		std::string mJournalPathUTF8;
+		// Copy only what a metadata comparison against an existing destination finds changed.
+		bool mSync;
+		bool mDeleteOnlyInDest;
+		// Checksum each file's data on the way through and again as read back from the destination.
+		bool mInlineVerify;
+		common::ChecksumAlgorithm mChecksumAlgorithm;
+		// How files a sync finds changed are brought up to date.
+		DeltaMode mDeltaMode;
+		// Report a breakdown of time spent by phase at the end.
+		bool mPhaseTimes;
+		// A status line instead of a line per item.
+		bool mProgress;
+		// Verify and the sync scan read metadata a directory at a time instead of an lstat per item.
+		bool mSnapshots;
+		// --exclude, --include and --exclude-from, in order. Verify and the sync scan also leave
+		// out the default names (.DS_Store and the like), which are still copied.
+		common::ExclusionRules mExclusions;
+	};
+	
+} // namespace copy_Impl
+
+#endif /* CopyOptions_h */
@@ -0,0 +1,97 @@
+//
+//    copy
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "CopyScheduler.h"
+
+namespace copy_Impl {
+	
+	//
+	CopyScheduler::CopyScheduler(size_t workerCount, size_t capacity) :
+	mCapacity((capacity > 0) ? capacity : 1),
+	mNextSequence(0),
+	mRunningCount(0),
+	mShutdown(false) {
+		if (workerCount == 0) {
+			workerCount = 1;
+		}
+		for (size_t n = 0; n < workerCount; ++n) {
+			mThreads.push_back(std::thread(&CopyScheduler::Run, this));
+		}
+	}
+	
+	//
+	CopyScheduler::~CopyScheduler() {
+		Wait();
+		{
+			std::lock_guard<std::mutex> guard(mMutex);
+			mShutdown = true;
+		}
+		mWorkAvailable.notify_all();
+		for (auto& thread : mThreads) {
+			thread.join();
+		}
+	}
+	
+	//
+	void CopyScheduler::Submit(uint64_t byteCount, const Task& task) {
+		std::unique_lock<std::mutex> lock(mMutex);
+		mSpaceAvailable.wait(lock, [this]() { return mTasks.size() < mCapacity; });
+		QueuedTask queued;
+		queued.mByteCount = byteCount;
+		queued.mSequence = mNextSequence++;
+		queued.mTask = task;
+		mTasks.push(std::move(queued));
+		lock.unlock();
+		mWorkAvailable.notify_one();
+	}
+	
+	//
+	void CopyScheduler::Wait() {
+		std::unique_lock<std::mutex> lock(mMutex);
+		mAllDone.wait(lock, [this]() { return mTasks.empty() && (mRunningCount == 0); });
+	}
+	
+	//
+	void CopyScheduler::Run() {
+		while (true) {
+			Task task;
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				mWorkAvailable.wait(lock, [this]() { return mShutdown || !mTasks.empty(); });
+				if (mTasks.empty()) {
+					return;
+				}
+				task = std::move(const_cast<QueuedTask&>(mTasks.top()).mTask);
+				mTasks.pop();
+				++mRunningCount;
+			}
+			mSpaceAvailable.notify_one();
+			task();
+			{
+				std::lock_guard<std::mutex> guard(mMutex);
+				--mRunningCount;
+				if (!mTasks.empty() || (mRunningCount != 0)) {
+					continue;
+				}
+			}
+			mAllDone.notify_all();
+		}
+	}
+	
+} // namespace copy_Impl
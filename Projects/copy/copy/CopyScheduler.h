@@ -0,0 +1,88 @@
+//
+//    copy
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef CopyScheduler_h
+#define CopyScheduler_h
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace copy_Impl {
+	
+	// Runs copy tasks on a fixed set of workers, largest first. The queue is bounded so the tree
+	// walk feeding it never gets far ahead of the copying, however many files there are; with a
+	// full queue, big files and chunks of huge ones keep the bandwidth busy while small files
+	// fill in the gaps.
+	class CopyScheduler {
+	public:
+		//
+		typedef std::function<void()> Task;
+		
+		//
+		CopyScheduler(size_t workerCount, size_t capacity);
+		
+		//
+		~CopyScheduler();
+		
+		// Blocks while the queue is full.
+		void Submit(uint64_t byteCount, const Task& task);
+		
+		// Blocks until every submitted task has run.
+		void Wait();
+		
+	private:
+		//
+		struct QueuedTask {
+			uint64_t mByteCount;
+			uint64_t mSequence;
+			Task mTask;
+			
+			// Largest first, then first come first served.
+			bool operator<(const QueuedTask& other) const {
+				if (mByteCount != other.mByteCount) {
+					return mByteCount < other.mByteCount;
+				}
+				return mSequence > other.mSequence;
+			}
+		};
+		
+		//
+		void Run();
+		
+		//
+		size_t mCapacity;
+		uint64_t mNextSequence;
+		size_t mRunningCount;
+		bool mShutdown;
+		std::priority_queue<QueuedTask> mTasks;
+		std::vector<std::thread> mThreads;
+		std::mutex mMutex;
+		std::condition_variable mWorkAvailable;
+		std::condition_variable mSpaceAvailable;
+		std::condition_variable mAllDone;
+	};
+	
+} // namespace copy_Impl
+
+#endif /* CopyScheduler_h */
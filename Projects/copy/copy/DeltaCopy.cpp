@@ -0,0 +1,323 @@
+//
+//    copy
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include "Common/Checksum.h"
+#include "Common/PhaseTimer.h"
+#include "DeltaCopy.h"
+
+namespace copy_Impl {
+	namespace DeltaCopy_Impl {
+		
+		//
+		static const size_t kMinChunkSize = 16 * 1024;
+		static const size_t kMaxChunkSize = 256 * 1024;
+		// A cut is made where the top kBoundaryBits of the hash are all zero: one byte in 64 K.
+		static const int kBoundaryBits = 16;
+		
+		//
+		static const size_t kReadSize = 4 * 1024 * 1024;
+		
+		// 256 random values, the same in every run and on every machine since the chunks of the
+		// source and the destination have to line up.
+		struct GearTable {
+			//
+			GearTable() {
+				uint64_t state = 0x636f7079ULL;
+				for (auto& value : mValues) {
+					// splitmix64
+					uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+					z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+					z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+					value = z ^ (z >> 31);
+				}
+			}
+			
+			//
+			uint64_t mValues[256];
+		};
+		
+		//
+		const uint64_t* GetGearTable() {
+			static const GearTable table;
+			return table.mValues;
+		}
+		
+		// Length of the chunk starting at data. Fewer than kMaxChunkSize bytes only at the end of
+		// the file. The first kMinChunkSize bytes can't hold a cut, so they aren't hashed at all.
+		size_t FindChunkLength(const uint8_t* data, size_t size, const uint64_t* gear) {
+			size_t limit = std::min(size, kMaxChunkSize);
+			uint64_t hash = 0;
+			for (size_t n = kMinChunkSize; n < limit; ++n) {
+				hash = (hash << 1) + gear[data[n]];
+				if ((hash >> (64 - kBoundaryBits)) == 0) {
+					return n + 1;
+				}
+			}
+			return limit;
+		}
+		
+		//
+		uint64_t HashChunk(const uint8_t* data, size_t size) {
+			common::XXHash64 hash;
+			hash.Update(data, size);
+			return hash.Finish();
+		}
+		
+		//
+		std::string MakeTempPath(const std::string& destUTF8) {
+			std::string::size_type slash = destUTF8.rfind('/');
+			if (slash == std::string::npos) {
+				return "." + destUTF8 + ".XXXXXX";
+			}
+			return destUTF8.substr(0, slash + 1) + "." + destUTF8.substr(slash + 1) + ".XXXXXX";
+		}
+		
+		// Source chunks the destination has at the same offset are left alone; everything else is
+		// rewritten. Chunks that moved aren't worth chasing here, since moving them within the file
+		// could overwrite others still to be moved.
+		bool UpdateInPlace(int sourceFd,
+						   uint64_t sourceSize,
+						   int destFd,
+						   uint64_t destSize,
+						   const ContentChunkVector& sourceChunks,
+						   const ContentChunkVector& destChunks,
+						   bool sameFileSystem,
+						   const ReflinkMode& reflinkMode,
+						   DeltaResult& outResult) {
+			uint64_t runOffset = 0;
+			uint64_t runLength = 0;
+			auto flush = [&]() {
+				if (runLength == 0) {
+					return true;
+				}
+				common::PhaseScope scope(common::Phase::kWrite);
+				CopyMechanism mechanism;
+				outResult.mDestinationChanged = true;
+				if (!CopyFileData(sourceFd, destFd, runOffset, runLength, sameFileSystem, reflinkMode, mechanism)) {
+					return false;
+				}
+				outResult.mWrittenBytes += runLength;
+				runLength = 0;
+				return true;
+			};
+			
+			size_t destIndex = 0;
+			for (const auto& chunk : sourceChunks) {
+				while ((destIndex < destChunks.size()) && (destChunks[destIndex].mOffset < chunk.mOffset)) {
+					++destIndex;
+				}
+				if ((destIndex < destChunks.size()) &&
+					(destChunks[destIndex].mOffset == chunk.mOffset) &&
+					(destChunks[destIndex].mLength == chunk.mLength) &&
+					(destChunks[destIndex].mHash == chunk.mHash)) {
+					if (!flush()) {
+						return false;
+					}
+					outResult.mReusedBytes += chunk.mLength;
+				}
+				else {
+					if (runLength == 0) {
+						runOffset = chunk.mOffset;
+					}
+					runLength += chunk.mLength;
+				}
+			}
+			if (!flush()) {
+				return false;
+			}
+			if (destSize == sourceSize) {
+				return true;
+			}
+			outResult.mDestinationChanged = true;
+			return (ftruncate(destFd, (off_t)sourceSize) == 0);
+		}
+		
+		// Builds the new version in tempFd from runs of chunks found anywhere in the destination and
+		// runs of chunks only the source has.
+		bool BuildNewVersion(int sourceFd,
+							 int destFd,
+							 int tempFd,
+							 const ContentChunkVector& sourceChunks,
+							 const ContentChunkVector& destChunks,
+							 bool sameFileSystem,
+							 const ReflinkMode& reflinkMode,
+							 DeltaResult& outResult) {
+			std::unordered_map<uint64_t, const ContentChunk*> destIndex;
+			destIndex.reserve(destChunks.size());
+			for (const auto& chunk : destChunks) {
+				destIndex.emplace(chunk.mHash, &chunk);
+			}
+			
+			// A run is either all from the source or all from the destination, and contiguous in both.
+			bool runFromDest = false;
+			uint64_t runOffset = 0;
+			uint64_t runDestOffset = 0;
+			uint64_t runLength = 0;
+			auto flush = [&]() {
+				if (runLength == 0) {
+					return true;
+				}
+				common::PhaseScope scope(common::Phase::kWrite);
+				CopyMechanism mechanism;
+				if (runFromDest) {
+					if (!CopyFileDataAt(destFd, runDestOffset, tempFd, runOffset, runLength, true, reflinkMode, mechanism)) {
+						return false;
+					}
+					outResult.mReusedBytes += runLength;
+				}
+				else {
+					if (!CopyFileData(sourceFd, tempFd, runOffset, runLength, sameFileSystem, reflinkMode, mechanism)) {
+						return false;
+					}
+					outResult.mWrittenBytes += runLength;
+				}
+				runLength = 0;
+				return true;
+			};
+			
+			for (const auto& chunk : sourceChunks) {
+				auto it = destIndex.find(chunk.mHash);
+				bool fromDest = (it != destIndex.end()) && (it->second->mLength == chunk.mLength);
+				uint64_t destOffset = fromDest ? it->second->mOffset : 0;
+				bool extends = (runLength != 0) &&
+							   (fromDest == runFromDest) &&
+							   (!fromDest || (destOffset == runDestOffset + runLength));
+				if (!extends) {
+					if (!flush()) {
+						return false;
+					}
+					runFromDest = fromDest;
+					runOffset = chunk.mOffset;
+					runDestOffset = destOffset;
+				}
+				runLength += chunk.mLength;
+			}
+			return flush();
+		}
+		
+	} // namespace DeltaCopy_Impl
+	using namespace DeltaCopy_Impl;
+	
+	//
+	bool ChunkFileContent(int fd, uint64_t size, ContentChunkVector& outChunks) {
+		common::PhaseScope scope(common::Phase::kRead);
+		const uint64_t* gear = GetGearTable();
+		std::vector<uint8_t> buffer(kReadSize + kMaxChunkSize);
+		// File offset of buffer[0].
+		uint64_t bufferOffset = 0;
+		size_t start = 0;
+		size_t end = 0;
+		uint64_t readOffset = 0;
+		while (true) {
+			if ((end - start < kMaxChunkSize) && (readOffset < size)) {
+				memmove(buffer.data(), buffer.data() + start, end - start);
+				bufferOffset += start;
+				end -= start;
+				start = 0;
+				size_t request = (size_t)std::min<uint64_t>(buffer.size() - end, size - readOffset);
+				ssize_t result = pread(fd, buffer.data() + end, request, (off_t)readOffset);
+				if (result < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+				if (result == 0) {
+					// Shorter than it was a moment ago.
+					errno = EIO;
+					return false;
+				}
+				end += (size_t)result;
+				readOffset += (uint64_t)result;
+				continue;
+			}
+			if (start == end) {
+				return true;
+			}
+			size_t length = FindChunkLength(buffer.data() + start, end - start, gear);
+			ContentChunk chunk;
+			chunk.mOffset = bufferOffset + start;
+			chunk.mLength = (uint32_t)length;
+			chunk.mHash = HashChunk(buffer.data() + start, length);
+			outChunks.push_back(chunk);
+			start += length;
+		}
+	}
+	
+	//
+	bool DeltaCopyFileData(int sourceFd,
+						   uint64_t sourceSize,
+						   int destFd,
+						   uint64_t destSize,
+						   const std::string& destUTF8,
+						   const DeltaMode& mode,
+						   bool sameFileSystem,
+						   const ReflinkMode& reflinkMode,
+						   int& outTempFd,
+						   std::string& outTempUTF8,
+						   DeltaResult& outResult) {
+		outTempFd = -1;
+		outTempUTF8.clear();
+		
+		// Both files have to be read in full, so read them at the same time.
+		ContentChunkVector sourceChunks;
+		ContentChunkVector destChunks;
+		bool destChunked = false;
+		int destError = 0;
+		std::thread destThread([&]() {
+			destChunked = ChunkFileContent(destFd, destSize, destChunks);
+			destError = errno;
+		});
+		bool sourceChunked = ChunkFileContent(sourceFd, sourceSize, sourceChunks);
+		int sourceError = errno;
+		destThread.join();
+		if (!sourceChunked || !destChunked) {
+			errno = !sourceChunked ? sourceError : destError;
+			return false;
+		}
+		
+		if (mode == DeltaMode::kInPlace) {
+			return UpdateInPlace(sourceFd, sourceSize, destFd, destSize, sourceChunks, destChunks, sameFileSystem, reflinkMode, outResult);
+		}
+		
+		std::string tempUTF8(MakeTempPath(destUTF8));
+		int tempFd = mkstemp(&tempUTF8[0]);
+		if (tempFd < 0) {
+			return false;
+		}
+		if (!BuildNewVersion(sourceFd, destFd, tempFd, sourceChunks, destChunks, sameFileSystem, reflinkMode, outResult)) {
+			int error = errno;
+			close(tempFd);
+			unlink(tempUTF8.c_str());
+			errno = error;
+			return false;
+		}
+		outTempFd = tempFd;
+		outTempUTF8 = tempUTF8;
+		return true;
+	}
+	
+} // namespace copy_Impl
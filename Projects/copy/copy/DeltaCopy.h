@@ -0,0 +1,92 @@
+//
+//    copy
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef DeltaCopy_h
+#define DeltaCopy_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "FileDataCopy.h"
+
+namespace copy_Impl {
+	
+	// One piece of a file cut where a rolling hash of the bytes just before says to, so the cuts
+	// move with the content: an insert or delete only changes the chunks around it.
+	struct ContentChunk {
+		uint64_t mOffset;
+		uint32_t mLength;
+		// XXH64 of the chunk's bytes.
+		uint64_t mHash;
+	};
+	typedef std::vector<ContentChunk> ContentChunkVector;
+	
+	// Cuts the first size bytes of fd into chunks of 16 KB to 256 KB, 80 KB on average, using a
+	// gear hash. False with errno set if it couldn't all be read.
+	bool ChunkFileContent(int fd, uint64_t size, ContentChunkVector& outChunks);
+	
+	//
+	enum class DeltaMode {
+		// Files are always copied whole.
+		kOff,
+		// Only the chunks that changed are written, straight into the existing file.
+		kInPlace,
+		// The new version is put together next to the old one, from the old one's unchanged chunks
+		// and the source's changed ones, then renamed over it; nothing ever sees it half done.
+		kAtomic
+	};
+	
+	//
+	struct DeltaResult {
+		//
+		DeltaResult() :
+		mWrittenBytes(0),
+		mReusedBytes(0),
+		mDestinationChanged(false) {
+		}
+		
+		// Bytes copied from the source.
+		uint64_t mWrittenBytes;
+		// Bytes the existing destination already had: left alone in place, or copied within the
+		// destination file system.
+		uint64_t mReusedBytes;
+		// In place, set once the first write to the destination has been tried: from then on a
+		// failure leaves it neither the old version nor the new one.
+		bool mDestinationChanged;
+	};
+	
+	// Brings the existing file open as destFd (for reading and writing, in place) up to date with
+	// sourceFd by chunking both and comparing chunk hashes. Atomic, the new version is left open as
+	// outTempFd at outTempUTF8, beside destUTF8, for the caller to finish off and rename over it;
+	// on failure it's already gone. False with errno set.
+	bool DeltaCopyFileData(int sourceFd,
+						   uint64_t sourceSize,
+						   int destFd,
+						   uint64_t destSize,
+						   const std::string& destUTF8,
+						   const DeltaMode& mode,
+						   bool sameFileSystem,
+						   const ReflinkMode& reflinkMode,
+						   int& outTempFd,
+						   std::string& outTempUTF8,
+						   DeltaResult& outResult);
+	
+} // namespace copy_Impl
+
+#endif /* DeltaCopy_h */
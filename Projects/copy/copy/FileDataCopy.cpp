@@ -0,0 +1,379 @@
+//
+//    copy
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "FileDataCopy.h"
+
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+namespace copy_Impl {
+	namespace FileDataCopy_Impl {
+		
+		//
+		static const size_t kBufferSize = 1024 * 1024;
+		static const size_t kDirectAlignment = 4096;
+		
+		// Largest single request to the kernel; keeps each call interruptible in reasonable time.
+		static const uint64_t kMaxKernelCopy = 1024 * 1024 * 1024;
+		
+		// Errors that mean "this mechanism can't do it here", as opposed to a real I/O failure.
+		inline bool IsUnsupported(int error) {
+			return (error == ENOSYS) || (error == EXDEV) || (error == EINVAL) || (error == EOPNOTSUPP) ||
+				   (error == ENOTTY) || (error == EBADF) || (error == ETXTBSY);
+		}
+		
+#if defined(__linux__)
+		//
+		bool Clone(int sourceFd, uint64_t sourceOffset, int destFd, uint64_t destOffset, uint64_t length) {
+			struct stat s;
+			if ((sourceOffset == 0) && (destOffset == 0) && (fstat(sourceFd, &s) == 0) && ((uint64_t)s.st_size == length)) {
+				return (ioctl(destFd, FICLONE, sourceFd) == 0);
+			}
+			struct file_clone_range range;
+			range.src_fd = sourceFd;
+			range.src_offset = sourceOffset;
+			range.src_length = length;
+			range.dest_offset = destOffset;
+			return (ioctl(destFd, FICLONERANGE, &range) == 0);
+		}
+		
+		// Advances copied as far as it gets. False with errno set if it stopped short.
+		bool CopyWithCopyFileRange(int sourceFd,
+								   uint64_t sourceOffset,
+								   int destFd,
+								   uint64_t destOffset,
+								   uint64_t length,
+								   uint64_t& copied) {
+			while (copied < length) {
+				loff_t fromOffset = (loff_t)(sourceOffset + copied);
+				loff_t toOffset = (loff_t)(destOffset + copied);
+				uint64_t chunk = std::min(length - copied, kMaxKernelCopy);
+				ssize_t result = (ssize_t)syscall(__NR_copy_file_range, sourceFd, &fromOffset, destFd, &toOffset, (size_t)chunk, 0);
+				if (result < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+				if (result == 0) {
+					// Source is shorter than it was when we started.
+					errno = EIO;
+					return false;
+				}
+				copied += (uint64_t)result;
+			}
+			return true;
+		}
+		
+		//
+		bool CopyWithSendfile(int sourceFd,
+							  uint64_t sourceOffset,
+							  int destFd,
+							  uint64_t destOffset,
+							  uint64_t length,
+							  uint64_t& copied) {
+			if (lseek(destFd, (off_t)(destOffset + copied), SEEK_SET) < 0) {
+				return false;
+			}
+			while (copied < length) {
+				off_t fromOffset = (off_t)(sourceOffset + copied);
+				uint64_t chunk = std::min(length - copied, kMaxKernelCopy);
+				ssize_t result = sendfile(destFd, sourceFd, &fromOffset, (size_t)chunk);
+				if (result < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+				if (result == 0) {
+					errno = EIO;
+					return false;
+				}
+				copied += (uint64_t)result;
+			}
+			return true;
+		}
+#endif
+		
+		//
+		bool CopyBuffered(int sourceFd,
+						  uint64_t sourceOffset,
+						  int destFd,
+						  uint64_t destOffset,
+						  uint64_t length,
+						  uint64_t& copied,
+						  common::StreamingChecksum* sourceChecksum) {
+			static thread_local std::vector<char> buffer(kBufferSize);
+			while (copied < length) {
+				size_t chunk = (size_t)std::min<uint64_t>(length - copied, buffer.size());
+				ssize_t bytesRead = pread(sourceFd, buffer.data(), chunk, (off_t)(sourceOffset + copied));
+				if (bytesRead < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+				if (bytesRead == 0) {
+					errno = EIO;
+					return false;
+				}
+				if (sourceChecksum != nullptr) {
+					sourceChecksum->Update(buffer.data(), (size_t)bytesRead);
+				}
+				size_t written = 0;
+				while (written < (size_t)bytesRead) {
+					ssize_t result = pwrite(destFd, buffer.data() + written, (size_t)bytesRead - written, (off_t)(destOffset + copied + written));
+					if (result < 0) {
+						if (errno == EINTR) {
+							continue;
+						}
+						return false;
+					}
+					written += (size_t)result;
+				}
+				copied += written;
+			}
+			return true;
+		}
+		
+		//
+		struct FreeDeleter {
+			void operator()(void* p) const {
+				free(p);
+			}
+		};
+		
+		// Block-aligned, as O_DIRECT wants.
+		char* GetDirectBuffer() {
+			static thread_local std::unique_ptr<char, FreeDeleter> buffer;
+			if (buffer == nullptr) {
+				void* p = nullptr;
+				if (posix_memalign(&p, kDirectAlignment, kBufferSize) != 0) {
+					return nullptr;
+				}
+				buffer.reset((char*)p);
+			}
+			return buffer.get();
+		}
+		
+		// Returns false with errno EINVAL if the file system won't do direct I/O for this range.
+		bool ChecksumDirect(const std::string& pathUTF8,
+							uint64_t offset,
+							uint64_t length,
+							common::StreamingChecksum& checksum) {
+#if defined(O_DIRECT)
+			char* buffer = GetDirectBuffer();
+			if ((buffer == nullptr) || ((offset % kDirectAlignment) != 0)) {
+				errno = EINVAL;
+				return false;
+			}
+			int fd = open(pathUTF8.c_str(), O_RDONLY | O_DIRECT | O_NOFOLLOW);
+			if (fd < 0) {
+				return false;
+			}
+			uint64_t done = 0;
+			while (done < length) {
+				// Direct reads come in whole blocks; the last one stops short at end of file.
+				size_t request = (size_t)std::min<uint64_t>(length - done, kBufferSize);
+				request = (request + kDirectAlignment - 1) & ~(kDirectAlignment - 1);
+				ssize_t result = pread(fd, buffer, request, (off_t)(offset + done));
+				if (result < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					int error = errno;
+					close(fd);
+					errno = error;
+					return false;
+				}
+				if (result == 0) {
+					close(fd);
+					errno = EIO;
+					return false;
+				}
+				size_t useful = (size_t)std::min<uint64_t>((uint64_t)result, length - done);
+				checksum.Update(buffer, useful);
+				done += useful;
+			}
+			close(fd);
+			return true;
+#else
+			errno = EINVAL;
+			return false;
+#endif
+		}
+		
+		//
+		bool ChecksumUncached(int writtenFd, uint64_t offset, uint64_t length, common::StreamingChecksum& checksum) {
+			if (fdatasync(writtenFd) != 0) {
+				return false;
+			}
+#if defined(POSIX_FADV_DONTNEED)
+			posix_fadvise(writtenFd, (off_t)offset, (off_t)length, POSIX_FADV_DONTNEED);
+#elif defined(F_NOCACHE)
+			fcntl(writtenFd, F_NOCACHE, 1);
+#endif
+			static thread_local std::vector<char> buffer(kBufferSize);
+			uint64_t done = 0;
+			while (done < length) {
+				size_t request = (size_t)std::min<uint64_t>(length - done, buffer.size());
+				ssize_t result = pread(writtenFd, buffer.data(), request, (off_t)(offset + done));
+				if (result < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+				if (result == 0) {
+					errno = EIO;
+					return false;
+				}
+				checksum.Update(buffer.data(), (size_t)result);
+				done += (uint64_t)result;
+			}
+			return true;
+		}
+		
+	} // namespace FileDataCopy_Impl
+	using namespace FileDataCopy_Impl;
+	
+	//
+	const char* GetCopyMechanismName(const CopyMechanism& mechanism) {
+		switch (mechanism) {
+			case CopyMechanism::kReflink: return "reflink";
+			case CopyMechanism::kCopyFileRange: return "copy_file_range";
+			case CopyMechanism::kSendfile: return "sendfile";
+			case CopyMechanism::kDelta: return "delta";
+			default: return "buffered";
+		}
+	}
+	
+	//
+	bool CopyFileData(int sourceFd,
+					  int destFd,
+					  uint64_t offset,
+					  uint64_t length,
+					  bool sameFileSystem,
+					  const ReflinkMode& reflinkMode,
+					  CopyMechanism& outMechanism) {
+		return CopyFileDataAt(sourceFd, offset, destFd, offset, length, sameFileSystem, reflinkMode, outMechanism);
+	}
+	
+	//
+	bool CopyFileDataAt(int sourceFd,
+						uint64_t sourceOffset,
+						int destFd,
+						uint64_t destOffset,
+						uint64_t length,
+						bool sameFileSystem,
+						const ReflinkMode& reflinkMode,
+						CopyMechanism& outMechanism) {
+		uint64_t copied = 0;
+#if defined(__linux__)
+		if (reflinkMode != ReflinkMode::kNever) {
+			if (sameFileSystem && Clone(sourceFd, sourceOffset, destFd, destOffset, length)) {
+				outMechanism = CopyMechanism::kReflink;
+				return true;
+			}
+			if (reflinkMode == ReflinkMode::kAlways) {
+				if (!sameFileSystem) {
+					errno = EXDEV;
+				}
+				return false;
+			}
+		}
+		// Within one file system copy_file_range is free to share extents, which --reflink=never
+		// rules out.
+		if (!sameFileSystem || (reflinkMode != ReflinkMode::kNever)) {
+			if (CopyWithCopyFileRange(sourceFd, sourceOffset, destFd, destOffset, length, copied)) {
+				outMechanism = CopyMechanism::kCopyFileRange;
+				return true;
+			}
+			if (!IsUnsupported(errno)) {
+				return false;
+			}
+		}
+		if (CopyWithSendfile(sourceFd, sourceOffset, destFd, destOffset, length, copied)) {
+			outMechanism = CopyMechanism::kSendfile;
+			return true;
+		}
+		if (!IsUnsupported(errno)) {
+			return false;
+		}
+#else
+		if (reflinkMode == ReflinkMode::kAlways) {
+			errno = ENOTSUP;
+			return false;
+		}
+#endif
+		if (CopyBuffered(sourceFd, sourceOffset, destFd, destOffset, length, copied, nullptr)) {
+			outMechanism = CopyMechanism::kBuffered;
+			return true;
+		}
+		return false;
+	}
+	
+	//
+	bool CopyFileDataWithChecksum(int sourceFd,
+								  int destFd,
+								  uint64_t offset,
+								  uint64_t length,
+								  common::StreamingChecksum& sourceChecksum) {
+		uint64_t copied = 0;
+		return CopyBuffered(sourceFd, offset, destFd, offset, length, copied, &sourceChecksum);
+	}
+	
+	//
+	bool ChecksumWrittenData(const std::string& pathUTF8,
+							 int writtenFd,
+							 uint64_t offset,
+							 uint64_t length,
+							 const common::ChecksumAlgorithm& algorithm,
+							 uint64_t& outChecksum,
+							 bool& outDirect) {
+		common::StreamingChecksum checksum(algorithm);
+		outDirect = true;
+		if (!ChecksumDirect(pathUTF8, offset, length, checksum)) {
+			if (errno != EINVAL) {
+				return false;
+			}
+			// tmpfs and some FUSE file systems refuse O_DIRECT.
+			checksum = common::StreamingChecksum(algorithm);
+			outDirect = false;
+			if (!ChecksumUncached(writtenFd, offset, length, checksum)) {
+				return false;
+			}
+		}
+		outChecksum = checksum.Finish();
+		return true;
+	}
+	
+} // namespace copy_Impl
@@ -0,0 +1,97 @@
+//
+//    copy
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef FileDataCopy_h
+#define FileDataCopy_h
+
+#include <cstdint>
+#include <string>
+#include "Common/Checksum.h"
+
+namespace copy_Impl {
+	
+	//
+	enum class ReflinkMode {
+		// Clone when source and destination share a file system that supports it.
+		kAuto,
+		// Clone or fail.
+		kAlways,
+		// Always write a real copy of the data.
+		kNever
+	};
+	
+	// How a file's data was copied, fastest first.
+	enum class CopyMechanism {
+		kReflink,
+		kCopyFileRange,
+		kSendfile,
+		kBuffered,
+		// Only the parts of an existing destination that changed, by DeltaCopyFileData.
+		kDelta,
+		kCount
+	};
+	
+	//
+	const char* GetCopyMechanismName(const CopyMechanism& mechanism);
+	
+	// Copies length bytes at offset in sourceFd to the same offset in destFd, trying each
+	// mechanism in turn (reflink only if sameFileSystem) and carrying on from wherever the
+	// previous one stopped. outMechanism is the one that finished the job. On failure errno
+	// says why. The sendfile path moves destFd's file offset, so ranges of one file copied in
+	// parallel need a descriptor each.
+	bool CopyFileData(int sourceFd,
+					  int destFd,
+					  uint64_t offset,
+					  uint64_t length,
+					  bool sameFileSystem,
+					  const ReflinkMode& reflinkMode,
+					  CopyMechanism& outMechanism);
+	
+	// CopyFileData from one offset to another, e.g. to move data around within a file system.
+	bool CopyFileDataAt(int sourceFd,
+						uint64_t sourceOffset,
+						int destFd,
+						uint64_t destOffset,
+						uint64_t length,
+						bool sameFileSystem,
+						const ReflinkMode& reflinkMode,
+						CopyMechanism& outMechanism);
+	
+	// Copies through a user space buffer so every byte read from the source also goes into
+	// sourceChecksum on its way past.
+	bool CopyFileDataWithChecksum(int sourceFd,
+								  int destFd,
+								  uint64_t offset,
+								  uint64_t length,
+								  common::StreamingChecksum& sourceChecksum);
+	
+	// Checksums a range of a file just written through writtenFd as the device has it rather than
+	// as the page cache does: read with O_DIRECT where the file system allows, otherwise after
+	// syncing the file and dropping the range from the cache. outDirect says which.
+	bool ChecksumWrittenData(const std::string& pathUTF8,
+							 int writtenFd,
+							 uint64_t offset,
+							 uint64_t length,
+							 const common::ChecksumAlgorithm& algorithm,
+							 uint64_t& outChecksum,
+							 bool& outDirect);
+	
+} // namespace copy_Impl
+
+#endif /* FileDataCopy_h */
@@ -0,0 +1,1025 @@
+//
+//    copy
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include "Common/MetadataSnapshot.h"
+#include "Common/PhaseTimer.h"
+#include "Common/StatUtilities.h"
+#include "NativeCopy.h"
+
+namespace copy_Impl {
+	namespace NativeCopy_Impl {
+		
+		// Files at least this big are split into kChunkSize ranges copied in parallel.
+		static const uint64_t kChunkThreshold = 64 * 1024 * 1024;
+		static const uint64_t kChunkSize = 16 * 1024 * 1024;
+		
+		// Smaller files are replaced whole even with a delta mode; reading both sides to find
+		// what changed would cost more than it saves.
+		static const uint64_t kDeltaThreshold = 8 * 1024 * 1024;
+		
+		// Enough queued work per worker to pick the biggest from without running far ahead of the
+		// walk.
+		static const size_t kQueuedTasksPerJob = 64;
+		
+		//
+		int SetXAttr(int fd, const std::string& pathUTF8, const char* name, const void* value, size_t size) {
+#if defined(__APPLE__)
+			if (fd >= 0) {
+				return fsetxattr(fd, name, value, size, 0, 0);
+			}
+			return setxattr(pathUTF8.c_str(), name, value, size, 0, XATTR_NOFOLLOW);
+#else
+			if (fd >= 0) {
+				return fsetxattr(fd, name, value, size, 0);
+			}
+			return lsetxattr(pathUTF8.c_str(), name, value, size, 0);
+#endif
+		}
+		
+		// Attributes the destination file system doesn't support, or that only a privileged user may
+		// set (security.*, trusted.*), are left behind rather than failing the item; copy -y will
+		// still point them out.
+		bool CopyXAttrs(int fd, const std::string& sourceUTF8, const std::string& destUTF8) {
+			std::string xattrs;
+			if (!common::ReadXAttrs(sourceUTF8, xattrs)) {
+				return false;
+			}
+			const char* p = xattrs.data();
+			const char* end = p + xattrs.size();
+			while (p < end) {
+				const char* name = p;
+				p += strlen(name) + 1;
+				uint32_t size = 0;
+				memcpy(&size, p, sizeof(size));
+				p += sizeof(size);
+				if ((SetXAttr(fd, destUTF8, name, p, size) != 0) &&
+					(errno != ENOTSUP) && (errno != EPERM)) {
+					return false;
+				}
+				p += size;
+			}
+			return true;
+		}
+		
+		// A file updated in place may have xattrs the source no longer does.
+		bool RemoveXAttrs(int fd) {
+#if defined(__APPLE__)
+			ssize_t size = flistxattr(fd, nullptr, 0, 0);
+#else
+			ssize_t size = flistxattr(fd, nullptr, 0);
+#endif
+			if (size <= 0) {
+				return (size == 0) || (errno == ENOTSUP);
+			}
+			std::vector<char> names((size_t)size);
+#if defined(__APPLE__)
+			size = flistxattr(fd, names.data(), names.size(), 0);
+#else
+			size = flistxattr(fd, names.data(), names.size());
+#endif
+			if (size < 0) {
+				return false;
+			}
+			for (const char* name = names.data(); name < names.data() + size; name += strlen(name) + 1) {
+#if defined(__APPLE__)
+				int result = fremovexattr(fd, name, 0);
+				bool gone = (result != 0) && (errno == ENOATTR);
+#else
+				int result = fremovexattr(fd, name);
+				bool gone = (result != 0) && (errno == ENODATA);
+#endif
+				if ((result != 0) && !gone && (errno != EPERM)) {
+					return false;
+				}
+			}
+			return true;
+		}
+		
+		//
+		void GetTimes(const struct stat& s, struct timespec times[2]) {
+#if defined(__APPLE__)
+			times[0] = s.st_atimespec;
+			times[1] = s.st_mtimespec;
+#else
+			times[0] = s.st_atim;
+			times[1] = s.st_mtim;
+#endif
+		}
+		
+		//
+		int RemoveEntry(const char* path, const struct stat* /*s*/, int type, struct FTW* /*ftw*/) {
+			return (type == FTW_DP) ? rmdir(path) : unlink(path);
+		}
+		
+		// lstat, timed.
+		int StatItem(const std::string& pathUTF8, struct stat& outStat) {
+			common::PhaseScope scope(common::Phase::kStat);
+			return lstat(pathUTF8.c_str(), &outStat);
+		}
+		
+		//
+		FileStamp MakeFileStamp(const struct stat& s) {
+			return FileStamp((uint64_t)s.st_size, common::GetModificationTimeNs(s));
+		}
+		
+		//
+		double GetSeconds(const std::chrono::steady_clock::duration& duration) {
+			return std::chrono::duration<double>(duration).count();
+		}
+		
+		// Lets the owner write pathUTF8. outMode is only set, to its permissions before, if they
+		// were changed.
+		bool MakeWritable(const std::string& pathUTF8, mode_t& outMode) {
+			struct stat s;
+			if ((lstat(pathUTF8.c_str(), &s) != 0) || (chmod(pathUTF8.c_str(), S_IRUSR | S_IWUSR) != 0)) {
+				return false;
+			}
+			outMode = (s.st_mode & 07777);
+			return true;
+		}
+		
+	} // namespace NativeCopy_Impl
+	using namespace NativeCopy_Impl;
+	
+	//
+	bool RemoveTree(const std::string& pathUTF8) {
+		struct stat s;
+		if (lstat(pathUTF8.c_str(), &s) != 0) {
+			return (errno == ENOENT);
+		}
+		if (!S_ISDIR(s.st_mode)) {
+			return (unlink(pathUTF8.c_str()) == 0);
+		}
+		return (nftw(pathUTF8.c_str(), RemoveEntry, 64, FTW_DEPTH | FTW_PHYS) == 0);
+	}
+	
+	//
+	bool ApplyMetadata(int fd, const std::string& sourceUTF8, const std::string& destUTF8, const struct stat& s) {
+		bool isLink = S_ISLNK(s.st_mode);
+		// Only root can give files away; anyone else keeps the files they create, as cp -p does.
+		int result = (fd >= 0) ? fchown(fd, s.st_uid, s.st_gid) : lchown(destUTF8.c_str(), s.st_uid, s.st_gid);
+		if ((result != 0) && (errno != EPERM)) {
+			return false;
+		}
+		// Setting user xattrs needs write permission, which the source's mode may not give.
+		if (!CopyXAttrs(fd, sourceUTF8, destUTF8)) {
+			return false;
+		}
+		if (!isLink) {
+			mode_t mode = s.st_mode & 07777;
+			result = (fd >= 0) ? fchmod(fd, mode) : chmod(destUTF8.c_str(), mode);
+			if (result != 0) {
+				return false;
+			}
+		}
+		struct timespec times[2];
+		GetTimes(s, times);
+		if (fd >= 0) {
+			return (futimens(fd, times) == 0);
+		}
+		return (utimensat(AT_FDCWD, destUTF8.c_str(), times, AT_SYMLINK_NOFOLLOW) == 0);
+	}
+	
+	//
+	CopyStatistics::CopyStatistics() {
+		for (size_t n = 0; n < kMechanismCount; ++n) {
+			mFiles[n] = 0;
+			mBytes[n] = 0;
+		}
+		mResumedFiles = 0;
+		mResumedBytes = 0;
+		mVerifiedDirectBytes = 0;
+		mVerifiedUncachedBytes = 0;
+		mDeltaWrittenBytes = 0;
+		mDeltaReusedBytes = 0;
+		mChecksumAlgorithm = common::ChecksumAlgorithm::kCRC32C;
+	}
+	
+	//
+	void CopyStatistics::AddFile(const CopyMechanism& mechanism, uint64_t bytes) {
+		mFiles[(size_t)mechanism] += 1;
+		mBytes[(size_t)mechanism] += bytes;
+	}
+	
+	//
+	void CopyStatistics::AddResumed(uint64_t files, uint64_t bytes) {
+		mResumedFiles += files;
+		mResumedBytes += bytes;
+	}
+	
+	//
+	void CopyStatistics::AddVerified(uint64_t bytes, bool direct) {
+		if (direct) {
+			mVerifiedDirectBytes += bytes;
+		}
+		else {
+			mVerifiedUncachedBytes += bytes;
+		}
+	}
+	
+	//
+	void CopyStatistics::AddDelta(const DeltaResult& result) {
+		mDeltaWrittenBytes += result.mWrittenBytes;
+		mDeltaReusedBytes += result.mReusedBytes;
+	}
+	
+	//
+	void CopyStatistics::SetChecksumAlgorithm(const common::ChecksumAlgorithm& algorithm) {
+		mChecksumAlgorithm = algorithm;
+	}
+	
+	//
+	void CopyStatistics::Start() {
+		mStartTime = std::chrono::steady_clock::now();
+		mStopTime = mStartTime;
+	}
+	
+	//
+	void CopyStatistics::Stop() {
+		mStopTime = std::chrono::steady_clock::now();
+	}
+	
+	//
+	void CopyStatistics::Report(std::ostream& strm) const {
+		uint64_t totalBytes = 0;
+		strm << "Copy mechanisms:\n";
+		for (size_t n = 0; n < kMechanismCount; ++n) {
+			if (mFiles[n] != 0) {
+				strm << "\t" << GetCopyMechanismName((CopyMechanism)n) << ": " << mFiles[n] << " files, "
+					 << mBytes[n] << " bytes\n";
+			}
+			totalBytes += mBytes[n];
+		}
+		if ((mResumedFiles != 0) || (mResumedBytes != 0)) {
+			strm << "Resumed: " << mResumedFiles << " files and " << mResumedBytes << " bytes were already copied.\n";
+		}
+		if ((mVerifiedDirectBytes != 0) || (mVerifiedUncachedBytes != 0)) {
+			strm << "Verified: " << (mVerifiedDirectBytes + mVerifiedUncachedBytes) << " bytes by "
+				 << common::GetChecksumAlgorithmName(mChecksumAlgorithm);
+			if ((mChecksumAlgorithm == common::ChecksumAlgorithm::kCRC32C) && common::Crc32c::IsHardwareAccelerated()) {
+				strm << " (hardware)";
+			}
+			strm << "; read back " << mVerifiedDirectBytes << " bytes with O_DIRECT, "
+				 << mVerifiedUncachedBytes << " bytes after dropping them from the cache.\n";
+		}
+		if ((mDeltaWrittenBytes != 0) || (mDeltaReusedBytes != 0)) {
+			strm << "Delta: " << mDeltaWrittenBytes << " bytes had changed; " << mDeltaReusedBytes
+				 << " bytes were already in the destination.\n";
+		}
+		double seconds = GetSeconds(mStopTime - mStartTime);
+		double megabytesPerSecond = (seconds > 0) ? (totalBytes / seconds / (1024 * 1024)) : 0;
+		// Built apart from strm so its precision and float format stay as the caller left them.
+		std::ostringstream line;
+		line << "Throughput: " << std::fixed << std::setprecision(1) << megabytesPerSecond << " MB/s ("
+			 << totalBytes << " bytes in " << std::setprecision(3) << seconds << " seconds).\n";
+		strm << line.str();
+	}
+	
+	//
+	NativeCopier::NativeCopier(const CopyOptions& options, std::ostream& output) :
+	mOptions(options),
+	mExclusions(options.mExclusions),
+	mOutput(output),
+	mDestDevice(0),
+	mSourceRootLength(0),
+	mReplaceExisting(false),
+	mProgress(nullptr) {
+		mStatistics.SetChecksumAlgorithm(options.mChecksumAlgorithm);
+	}
+	
+	//
+	bool NativeCopier::CopyTree(const std::string& sourceUTF8, const std::string& destUTF8) {
+		struct stat s;
+		if (lstat(sourceUTF8.c_str(), &s) != 0) {
+			ReportError(sourceUTF8, "lstat", errno);
+			return false;
+		}
+		if (!Begin(sourceUTF8, destUTF8)) {
+			return false;
+		}
+		Walk(sourceUTF8, destUTF8, s);
+		return Finish();
+	}
+	
+	//
+	bool NativeCopier::SyncTree(const SyncPlan& plan, bool deleteOnlyInDest) {
+		const std::string& sourceRootUTF8 = plan.GetSourceRoot();
+		const std::string& destRootUTF8 = plan.GetDestRoot();
+		mReplaceExisting = true;
+		if (!Begin(sourceRootUTF8, destRootUTF8)) {
+			return false;
+		}
+		
+		// Directories whose contents change get their dates (and anything else that differs) put
+		// back afterwards, deepest first.
+		std::set<std::string, std::greater<std::string>> refreshDirectories;
+		if (deleteOnlyInDest) {
+			for (const auto& relativePathUTF8 : plan.GetOnlyInDest()) {
+				std::string destUTF8(destRootUTF8 + relativePathUTF8);
+				if (!RemoveTree(destUTF8)) {
+					ReportError(destUTF8, "delete", errno);
+				}
+				else {
+					std::lock_guard<std::mutex> guard(mMutex);
+					mOutput << "Deleted " << destUTF8 << "\n";
+				}
+				refreshDirectories.insert(relativePathUTF8.substr(0, relativePathUTF8.rfind('/')));
+			}
+		}
+		
+		std::set<std::string> copiedWhole;
+		for (const auto& relativePathUTF8 : plan.GetChanged()) {
+			// Anything under an item copied whole has already been taken care of.
+			bool covered = false;
+			for (std::string::size_type slash = relativePathUTF8.rfind('/');
+				 !covered && (slash != std::string::npos) && (slash > 0);
+				 slash = relativePathUTF8.rfind('/', slash - 1)) {
+				covered = (copiedWhole.find(relativePathUTF8.substr(0, slash)) != copiedWhole.end());
+			}
+			if (covered) {
+				continue;
+			}
+			
+			std::string sourceUTF8(sourceRootUTF8 + relativePathUTF8);
+			std::string destUTF8(destRootUTF8 + relativePathUTF8);
+			struct stat s;
+			if (lstat(sourceUTF8.c_str(), &s) != 0) {
+				ReportError(sourceUTF8, "lstat", errno);
+				continue;
+			}
+			if (!relativePathUTF8.empty()) {
+				refreshDirectories.insert(relativePathUTF8.substr(0, relativePathUTF8.rfind('/')));
+			}
+			struct stat destStat;
+			if (lstat(destUTF8.c_str(), &destStat) == 0) {
+				if (S_ISDIR(s.st_mode) && S_ISDIR(destStat.st_mode)) {
+					// Only the directory itself differs; its contents were compared one by one.
+					refreshDirectories.insert(relativePathUTF8);
+					continue;
+				}
+				// Files are replaced as they're copied, but something of another type has to go
+				// first.
+				if (((s.st_mode & S_IFMT) != (destStat.st_mode & S_IFMT)) && !RemoveTree(destUTF8)) {
+					ReportError(sourceUTF8, "remove item in the way", errno);
+					continue;
+				}
+			}
+			copiedWhole.insert(relativePathUTF8);
+			Walk(sourceUTF8, destUTF8, s);
+		}
+		mScheduler->Wait();
+		
+		for (const auto& relativePathUTF8 : refreshDirectories) {
+			if (copiedWhole.find(relativePathUTF8) != copiedWhole.end()) {
+				continue;
+			}
+			std::string sourceUTF8(sourceRootUTF8 + relativePathUTF8);
+			struct stat s;
+			if ((lstat(sourceUTF8.c_str(), &s) == 0) && S_ISDIR(s.st_mode)) {
+				DeferredItem item;
+				item.mSourceUTF8 = sourceUTF8;
+				item.mDestUTF8 = destRootUTF8 + relativePathUTF8;
+				item.mStat = s;
+				mRefreshDirectories.push_back(item);
+			}
+		}
+		return Finish();
+	}
+	
+	//
+	bool NativeCopier::Begin(const std::string& sourceUTF8, const std::string& destUTF8) {
+		std::string::size_type slash = destUTF8.rfind('/');
+		std::string destParentUTF8((slash == std::string::npos) ? "." : (slash == 0) ? "/" : destUTF8.substr(0, slash));
+		struct stat parentStat;
+		if (stat(destParentUTF8.c_str(), &parentStat) != 0) {
+			ReportError(sourceUTF8, "stat destination parent", errno);
+			return false;
+		}
+		// Everything is created under the destination root, so it all lands on one file system.
+		mDestDevice = (uint64_t)parentStat.st_dev;
+		
+		mSourceRootLength = sourceUTF8.size();
+		if (!mOptions.mJournalPathUTF8.empty()) {
+			mJournal.reset(new CopyJournal(mOptions.mJournalPathUTF8));
+			std::string error;
+			if (!mJournal->Open(sourceUTF8, destUTF8, error)) {
+				mOutput << "copy: Can't use journal <" << mOptions.mJournalPathUTF8 << ">: " << error << "\n";
+				return false;
+			}
+			if (mJournal->GetReplayedRecordCount() > 0) {
+				mOutput << "Resuming from journal (" << mJournal->GetReplayedRecordCount() << " records).\n";
+			}
+			mReplaceExisting = true;
+		}
+		
+		mStatistics.Start();
+		mScheduler.reset(new CopyScheduler(mOptions.mJobs, mOptions.mJobs * kQueuedTasksPerJob));
+		return true;
+	}
+	
+	//
+	bool NativeCopier::Finish() {
+		mScheduler->Wait();
+		mScheduler.reset();
+		FinishHardLinks();
+		FinishDirectories();
+		if ((mJournal != nullptr) && !mJournal->Commit()) {
+			ReportError(mOptions.mJournalPathUTF8, "write journal", errno);
+		}
+		mStatistics.Stop();
+		return mErrors.empty();
+	}
+	
+	//
+	void NativeCopier::Walk(const std::string& sourceUTF8, const std::string& destUTF8, const struct stat& s) {
+		AddProgress(1, 0, 0);
+		if (S_ISDIR(s.st_mode)) {
+			WalkDirectory(sourceUTF8, destUTF8, s);
+		}
+		else if (S_ISLNK(s.st_mode)) {
+			mScheduler->Submit(0, [this, sourceUTF8, destUTF8, s]() {
+				CopySymbolicLink(sourceUTF8, destUTF8, s);
+			});
+		}
+		else if (!S_ISREG(s.st_mode)) {
+			mScheduler->Submit(0, [this, sourceUTF8, destUTF8, s]() {
+				CopySpecialFile(sourceUTF8, destUTF8, s);
+			});
+		}
+		else if (s.st_nlink > 1) {
+			DeviceInode key((uint64_t)s.st_dev, (uint64_t)s.st_ino);
+			auto it = mHardLinkTargets.find(key);
+			if (it != mHardLinkTargets.end()) {
+				// The first copy may still be in flight; link to it once everything is in.
+				DeferredItem item;
+				item.mSourceUTF8 = sourceUTF8;
+				item.mDestUTF8 = destUTF8;
+				item.mStat = s;
+				item.mLinkTargetUTF8 = it->second;
+				mHardLinks.push_back(item);
+			}
+			else {
+				mHardLinkTargets[key] = destUTF8;
+				QueueRegularFile(sourceUTF8, destUTF8, s);
+			}
+		}
+		else {
+			QueueRegularFile(sourceUTF8, destUTF8, s);
+		}
+	}
+	
+	//
+	void NativeCopier::WalkDirectory(const std::string& sourceUTF8, const std::string& destUTF8, const struct stat& s) {
+		// Owner-writable until its contents are in; the real permissions go on afterwards.
+		if (mkdir(destUTF8.c_str(), (s.st_mode & 07777) | S_IRWXU) != 0) {
+			struct stat destStat;
+			if ((errno != EEXIST) || !mReplaceExisting ||
+				(lstat(destUTF8.c_str(), &destStat) != 0) || !S_ISDIR(destStat.st_mode) ||
+				(chmod(destUTF8.c_str(), destStat.st_mode | S_IRWXU) != 0)) {
+				ReportError(sourceUTF8, "mkdir", errno);
+				return;
+			}
+		}
+		DeferredItem item;
+		item.mSourceUTF8 = sourceUTF8;
+		item.mDestUTF8 = destUTF8;
+		item.mStat = s;
+		mDirectories.push_back(item);
+		// Reported now, ahead of its contents, though its metadata only goes on at the end.
+		ReportCopied(sourceUTF8, nullptr);
+		
+		std::vector<std::string> names;
+		{
+			common::PhaseScope scope(common::Phase::kTraverse);
+			DIR* dir = opendir(sourceUTF8.c_str());
+			if (dir == nullptr) {
+				ReportError(sourceUTF8, "opendir", errno);
+				return;
+			}
+			while (struct dirent* entry = readdir(dir)) {
+				if ((strcmp(entry->d_name, ".") != 0) && (strcmp(entry->d_name, "..") != 0)) {
+					names.push_back(entry->d_name);
+				}
+			}
+			closedir(dir);
+		}
+		
+		for (const auto& name : names) {
+			std::string childSourceUTF8(sourceUTF8 + "/" + name);
+			struct stat childStat;
+			if (StatItem(childSourceUTF8, childStat) != 0) {
+				ReportError(childSourceUTF8, "lstat", errno);
+			}
+			else if (!IsExcluded(childSourceUTF8, childStat)) {
+				Walk(childSourceUTF8, destUTF8 + "/" + name, childStat);
+			}
+		}
+	}
+	
+	//
+	bool NativeCopier::IsExcluded(const std::string& sourceUTF8, const struct stat& s) const {
+		if (mExclusions.IsEmpty()) {
+			return false;
+		}
+		size_t start = mExclusions.NeedsPath() ? (mSourceRootLength + 1) : (sourceUTF8.rfind('/') + 1);
+		return mExclusions.Match(sourceUTF8.data() + start, sourceUTF8.size() - start).IsExcluded(S_ISDIR(s.st_mode));
+	}
+	
+	//
+	void NativeCopier::QueueRegularFile(const std::string& sourceUTF8, const std::string& destUTF8, const struct stat& s) {
+		uint64_t size = (uint64_t)s.st_size;
+		JournalKey journalKey;
+		if (mJournal != nullptr) {
+			journalKey = CopyJournal::MakeKey(sourceUTF8.substr(mSourceRootLength));
+			if (IsFileDone(destUTF8, s, journalKey)) {
+				mStatistics.AddResumed(1, size);
+				AddProgress(0, 1, size);
+				return;
+			}
+		}
+		if (ShouldDeltaCopy(destUTF8, s)) {
+			auto job = std::make_shared<FileJob>(sourceUTF8, destUTF8, s, journalKey, 1);
+			mScheduler->Submit(size, [this, job]() {
+				DeltaCopyFile(job);
+			});
+			return;
+		}
+		if (size < kChunkThreshold) {
+			auto job = std::make_shared<FileJob>(sourceUTF8, destUTF8, s, journalKey, 1);
+			mScheduler->Submit(size, [this, job, size]() {
+				CopyRange(job, 0, size, true);
+			});
+			return;
+		}
+		
+		// Every range writes into the same file, so it has to exist before any of them start. An
+		// earlier run's partial copy is picked up from whatever ranges its journal committed.
+		std::set<ByteRange> doneRanges;
+		struct stat destStat;
+		if ((mJournal != nullptr) &&
+			(lstat(destUTF8.c_str(), &destStat) == 0) &&
+			S_ISREG(destStat.st_mode) &&
+			(destStat.st_size == s.st_size) &&
+			(chmod(destUTF8.c_str(), S_IRUSR | S_IWUSR) == 0)) {
+			ByteRangeVector ranges;
+			mJournal->GetDoneRanges(journalKey, MakeFileStamp(s), ranges);
+			doneRanges.insert(ranges.begin(), ranges.end());
+		}
+		if (doneRanges.empty()) {
+			int destFd = CreateFile(destUTF8);
+			if (destFd < 0) {
+				ReportError(sourceUTF8, "create", errno);
+				return;
+			}
+			if (ftruncate(destFd, (off_t)size) != 0) {
+				ReportError(sourceUTF8, "truncate", errno);
+				close(destFd);
+				unlink(destUTF8.c_str());
+				return;
+			}
+			close(destFd);
+		}
+		
+		ByteRangeVector ranges;
+		uint64_t resumedBytes = 0;
+		for (uint64_t offset = 0; offset < size; offset += kChunkSize) {
+			ByteRange range(offset, std::min<uint64_t>(kChunkSize, size - offset));
+			if (doneRanges.find(range) != doneRanges.end()) {
+				resumedBytes += range.second;
+			}
+			else {
+				ranges.push_back(range);
+			}
+		}
+		auto job = std::make_shared<FileJob>(sourceUTF8, destUTF8, s, journalKey, ranges.size());
+		job->mResumedBytes = resumedBytes;
+		AddProgress(0, 0, resumedBytes);
+		if (ranges.empty()) {
+			// The data was all in; the earlier run stopped before finishing the file off.
+			FinishFile(job, open(destUTF8.c_str(), O_WRONLY | O_NOFOLLOW));
+			return;
+		}
+		for (const auto& range : ranges) {
+			uint64_t offset = range.first;
+			uint64_t length = range.second;
+			mScheduler->Submit(length, [this, job, offset, length]() {
+				CopyRange(job, offset, length, false);
+			});
+		}
+	}
+	
+	//
+	bool NativeCopier::IsFileDone(const std::string& destUTF8, const struct stat& s, const JournalKey& journalKey) {
+		struct stat destStat;
+		return mJournal->IsFileDone(journalKey, MakeFileStamp(s)) &&
+			   (lstat(destUTF8.c_str(), &destStat) == 0) &&
+			   S_ISREG(destStat.st_mode) &&
+			   (destStat.st_size == s.st_size);
+	}
+	
+	//
+	bool NativeCopier::ShouldDeltaCopy(const std::string& destUTF8, const struct stat& s) {
+		struct stat destStat;
+		// Updated in place, a file with other links would change under them too.
+		return (mOptions.mDeltaMode != DeltaMode::kOff) &&
+			   mReplaceExisting &&
+			   ((uint64_t)s.st_size >= kDeltaThreshold) &&
+			   (lstat(destUTF8.c_str(), &destStat) == 0) &&
+			   S_ISREG(destStat.st_mode) &&
+			   (destStat.st_size != 0) &&
+			   ((destStat.st_nlink == 1) || (mOptions.mDeltaMode == DeltaMode::kAtomic));
+	}
+	
+	//
+	void NativeCopier::DeltaCopyFile(const FileJobPtr& job) {
+		bool inPlace = (mOptions.mDeltaMode == DeltaMode::kInPlace);
+		const char* operation = nullptr;
+		int error = 0;
+		int destFd = -1;
+		int tempFd = -1;
+		struct stat destStat;
+		// Changed only if the destination's permissions were.
+		mode_t originalMode = (mode_t)-1;
+		DeltaResult result;
+		int sourceFd = open(job->mSourceUTF8.c_str(), O_RDONLY | O_NOFOLLOW);
+		if (sourceFd < 0) {
+			operation = "open";
+		}
+		// Its permissions may not allow writing; they're put back with the rest of its metadata.
+		else if (inPlace && !MakeWritable(job->mDestUTF8, originalMode)) {
+			operation = "open destination";
+		}
+		else if ((destFd = open(job->mDestUTF8.c_str(), (inPlace ? O_RDWR : O_RDONLY) | O_NOFOLLOW)) < 0) {
+			operation = "open destination";
+		}
+		else if (fstat(destFd, &destStat) != 0) {
+			operation = "fstat destination";
+		}
+		else if (!DeltaCopyFileData(sourceFd,
+									(uint64_t)job->mStat.st_size,
+									destFd,
+									(uint64_t)destStat.st_size,
+									job->mDestUTF8,
+									mOptions.mDeltaMode,
+									((uint64_t)job->mStat.st_dev == mDestDevice),
+									mOptions.mReflinkMode,
+									tempFd,
+									job->mTempUTF8,
+									result)) {
+			operation = "delta copy";
+		}
+		else if (inPlace && !RemoveXAttrs(destFd)) {
+			operation = "remove xattrs";
+		}
+		if (operation != nullptr) {
+			error = errno;
+		}
+		if (sourceFd >= 0) {
+			close(sourceFd);
+		}
+		if (operation != nullptr) {
+			ReportError(job->mSourceUTF8, operation, error);
+			if (destFd >= 0) {
+				close(destFd);
+			}
+			// What's left of an update in place that had started writing can't be trusted. Until
+			// then, like an atomic one, the old version is still intact and is left as it was.
+			if (result.mDestinationChanged) {
+				unlink(job->mDestUTF8.c_str());
+			}
+			else if (originalMode != (mode_t)-1) {
+				chmod(job->mDestUTF8.c_str(), originalMode);
+			}
+			return;
+		}
+		if (!inPlace) {
+			close(destFd);
+			destFd = tempFd;
+		}
+		job->mMechanism = CopyMechanism::kDelta;
+		mStatistics.AddDelta(result);
+		AddProgress(0, 0, (uint64_t)job->mStat.st_size);
+		FinishFile(job, destFd);
+	}
+	
+	//
+	int NativeCopier::CreateFile(const std::string& destUTF8) {
+		int flags = O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW;
+		int fd = open(destUTF8.c_str(), flags, S_IRUSR | S_IWUSR);
+		if ((fd >= 0) || (errno != EEXIST) || !mReplaceExisting) {
+			return fd;
+		}
+		
+		struct stat destStat;
+		if ((lstat(destUTF8.c_str(), &destStat) == 0) && S_ISREG(destStat.st_mode)) {
+			bool firstPath = true;
+			if (destStat.st_nlink > 1) {
+				std::lock_guard<std::mutex> guard(mMutex);
+				firstPath = mRewrittenFiles.insert(DeviceInode((uint64_t)destStat.st_dev, (uint64_t)destStat.st_ino)).second;
+			}
+			// Its permissions may not allow writing; they're put back with the rest of its metadata.
+			if (firstPath && (chmod(destUTF8.c_str(), S_IRUSR | S_IWUSR) == 0)) {
+				fd = open(destUTF8.c_str(), O_WRONLY | O_TRUNC | O_NOFOLLOW);
+				if ((fd >= 0) && RemoveXAttrs(fd)) {
+					return fd;
+				}
+				if (fd >= 0) {
+					close(fd);
+				}
+			}
+		}
+		// Not a regular file, or not one we can write to: make a new one in its place.
+		if (unlink(destUTF8.c_str()) == 0) {
+			fd = open(destUTF8.c_str(), flags, S_IRUSR | S_IWUSR);
+		}
+		return fd;
+	}
+	
+	//
+	bool NativeCopier::CopyRangeData(const FileJobPtr& job,
+									 int sourceFd,
+									 int destFd,
+									 uint64_t offset,
+									 uint64_t length,
+									 CopyMechanism& outMechanism,
+									 const char*& outOperation) {
+		if (!mOptions.mInlineVerify) {
+			common::PhaseScope scope(common::Phase::kWrite);
+			if (!CopyFileData(sourceFd,
+							  destFd,
+							  offset,
+							  length,
+							  ((uint64_t)job->mStat.st_dev == mDestDevice),
+							  mOptions.mReflinkMode,
+							  outMechanism)) {
+				outOperation = "copy data";
+				return false;
+			}
+			return true;
+		}
+		
+		// The checksum needs the bytes in hand, so kernel-side copies are out.
+		outMechanism = CopyMechanism::kBuffered;
+		common::StreamingChecksum sourceChecksum(mOptions.mChecksumAlgorithm);
+		{
+			common::PhaseScope scope(common::Phase::kWrite);
+			if (!CopyFileDataWithChecksum(sourceFd, destFd, offset, length, sourceChecksum)) {
+				outOperation = "copy data";
+				return false;
+			}
+		}
+		uint64_t destChecksum = 0;
+		bool direct = false;
+		common::PhaseScope scope(common::Phase::kVerify);
+		if (!ChecksumWrittenData(job->mDestUTF8, destFd, offset, length, mOptions.mChecksumAlgorithm, destChecksum, direct)) {
+			outOperation = "read back";
+			return false;
+		}
+		if (destChecksum != sourceChecksum.Finish()) {
+			outOperation = "verify checksum";
+			errno = EIO;
+			return false;
+		}
+		mStatistics.AddVerified(length, direct);
+		return true;
+	}
+	
+	//
+	void NativeCopier::CopyRange(const FileJobPtr& job, uint64_t offset, uint64_t length, bool create) {
+		const char* operation = nullptr;
+		int error = 0;
+		CopyMechanism mechanism = CopyMechanism::kBuffered;
+		int destFd = -1;
+		int sourceFd = open(job->mSourceUTF8.c_str(), O_RDONLY | O_NOFOLLOW);
+		if (sourceFd < 0) {
+			operation = "open";
+			error = errno;
+		}
+		else {
+			destFd = create ? CreateFile(job->mDestUTF8) : open(job->mDestUTF8.c_str(), O_WRONLY | O_NOFOLLOW);
+			if (destFd < 0) {
+				operation = create ? "create" : "open destination";
+				error = errno;
+			}
+			else if (!CopyRangeData(job, sourceFd, destFd, offset, length, mechanism, operation)) {
+				error = errno;
+			}
+			else {
+				AddProgress(0, 0, length);
+				if (!create && (mJournal != nullptr)) {
+					mJournal->RecordRangeDone(job->mJournalKey, MakeFileStamp(job->mStat), offset, length);
+				}
+			}
+			close(sourceFd);
+		}
+		
+		{
+			std::lock_guard<std::mutex> guard(job->mMutex);
+			if ((operation != nullptr) && (job->mOperation == nullptr)) {
+				job->mOperation = operation;
+				job->mError = error;
+			}
+			if (mechanism > job->mMechanism) {
+				job->mMechanism = mechanism;
+			}
+		}
+		if (--job->mRemainingRanges == 0) {
+			FinishFile(job, destFd);
+		}
+		else if (destFd >= 0) {
+			close(destFd);
+		}
+	}
+	
+	//
+	void NativeCopier::FinishFile(const FileJobPtr& job, int destFd) {
+		const char* operation = job->mOperation;
+		int error = job->mError;
+		const std::string& writtenUTF8 = job->mTempUTF8.empty() ? job->mDestUTF8 : job->mTempUTF8;
+		if ((operation == nullptr) && !ApplyMetadata(destFd, job->mSourceUTF8, writtenUTF8, job->mStat)) {
+			operation = "set metadata";
+			error = errno;
+		}
+		if ((destFd >= 0) && (close(destFd) != 0) && (operation == nullptr)) {
+			operation = "close";
+			error = errno;
+		}
+		if ((operation == nullptr) && !job->mTempUTF8.empty() && (rename(writtenUTF8.c_str(), job->mDestUTF8.c_str()) != 0)) {
+			operation = "rename";
+			error = errno;
+		}
+		if (operation != nullptr) {
+			ReportError(job->mSourceUTF8, operation, error);
+			unlink(writtenUTF8.c_str());
+			return;
+		}
+		if (mJournal != nullptr) {
+			mJournal->RecordFileDone(job->mJournalKey, MakeFileStamp(job->mStat));
+		}
+		mStatistics.AddFile(job->mMechanism, (uint64_t)job->mStat.st_size - job->mResumedBytes);
+		if (job->mResumedBytes != 0) {
+			mStatistics.AddResumed(0, job->mResumedBytes);
+		}
+		AddProgress(0, 1, 0);
+		ReportCopied(job->mSourceUTF8, &job->mMechanism);
+	}
+	
+	//
+	void NativeCopier::CopySymbolicLink(const std::string& sourceUTF8, const std::string& destUTF8, const struct stat& s) {
+		std::vector<char> target((size_t)s.st_size + 1);
+		ssize_t size = readlink(sourceUTF8.c_str(), target.data(), target.size());
+		if ((size < 0) || ((size_t)size >= target.size())) {
+			ReportError(sourceUTF8, "readlink", (size < 0) ? errno : ENAMETOOLONG);
+			return;
+		}
+		target[(size_t)size] = 0;
+		int result = symlink(target.data(), destUTF8.c_str());
+		if ((result != 0) && (errno == EEXIST) && mReplaceExisting && (unlink(destUTF8.c_str()) == 0)) {
+			result = symlink(target.data(), destUTF8.c_str());
+		}
+		if (result != 0) {
+			ReportError(sourceUTF8, "symlink", errno);
+			return;
+		}
+		if (!ApplyMetadata(-1, sourceUTF8, destUTF8, s)) {
+			ReportError(sourceUTF8, "set metadata", errno);
+			return;
+		}
+		AddProgress(0, 1, 0);
+		ReportCopied(sourceUTF8, nullptr);
+	}
+	
+	//
+	void NativeCopier::CopySpecialFile(const std::string& sourceUTF8, const std::string& destUTF8, const struct stat& s) {
+		// Fifos, sockets and devices: recreated with the same type (and device number), since
+		// there's no data to copy. Making devices needs root, as it would with cp -a.
+		mode_t mode = (s.st_mode & (S_IFMT | 07777));
+		int result = mknod(destUTF8.c_str(), mode, s.st_rdev);
+		if ((result != 0) && (errno == EEXIST) && mReplaceExisting && (unlink(destUTF8.c_str()) == 0)) {
+			result = mknod(destUTF8.c_str(), mode, s.st_rdev);
+		}
+		if (result != 0) {
+			ReportError(sourceUTF8, "mknod", errno);
+			return;
+		}
+		if (!ApplyMetadata(-1, sourceUTF8, destUTF8, s)) {
+			ReportError(sourceUTF8, "set metadata", errno);
+			return;
+		}
+		AddProgress(0, 1, 0);
+		ReportCopied(sourceUTF8, nullptr);
+	}
+	
+	//
+	void NativeCopier::FinishHardLinks() {
+		for (const auto& item : mHardLinks) {
+			const char* target = item.mLinkTargetUTF8.c_str();
+			const char* path = item.mDestUTF8.c_str();
+			int result = link(target, path);
+			if ((result != 0) && (errno == EEXIST) && mReplaceExisting && (unlink(path) == 0)) {
+				result = link(target, path);
+			}
+			if (result != 0) {
+				ReportError(item.mSourceUTF8, "link", errno);
+			}
+			else {
+				AddProgress(0, 1, 0);
+				ReportCopied(item.mSourceUTF8, nullptr);
+			}
+		}
+		mHardLinks.clear();
+	}
+	
+	//
+	void NativeCopier::FinishDirectories() {
+		// Walked parents first, so backwards puts every directory after everything inside it;
+		// creating those would otherwise bump its dates, and its permissions might not allow it.
+		// They were reported as copied when they were made.
+		for (auto it = mDirectories.rbegin(); it != mDirectories.rend(); ++it) {
+			if (!ApplyMetadata(-1, it->mSourceUTF8, it->mDestUTF8, it->mStat)) {
+				ReportError(it->mSourceUTF8, "set metadata", errno);
+			}
+		}
+		mDirectories.clear();
+		
+		// Existing directories a sync changed things in; already deepest first. Their dates were
+		// all that changed, so they aren't reported.
+		for (const auto& item : mRefreshDirectories) {
+			if (!ApplyMetadata(-1, item.mSourceUTF8, item.mDestUTF8, item.mStat)) {
+				ReportError(item.mSourceUTF8, "set metadata", errno);
+			}
+		}
+		mRefreshDirectories.clear();
+	}
+	
+	//
+	void NativeCopier::AddProgress(uint64_t entries, uint64_t files, uint64_t bytes) {
+		if (mProgress == nullptr) {
+			return;
+		}
+		if (entries != 0) {
+			mProgress->AddEntries(entries);
+		}
+		if (files != 0) {
+			mProgress->AddFiles(files);
+		}
+		if (bytes != 0) {
+			mProgress->AddBytes(bytes);
+		}
+	}
+	
+	//
+	void NativeCopier::ReportCopied(const std::string& sourceUTF8, const CopyMechanism* mechanism) {
+		if (mOptions.mProgress) {
+			// The status line stands in for these.
+			return;
+		}
+		std::lock_guard<std::mutex> guard(mMutex);
+		mOutput << "Copied " << sourceUTF8;
+		if (mOptions.mVerbose && (mechanism != nullptr)) {
+			mOutput << " (" << GetCopyMechanismName(*mechanism) << ")";
+		}
+		mOutput << "\n";
+	}
+	
+	//
+	void NativeCopier::ReportError(const std::string& sourceUTF8, const char* operation, int error) {
+		std::lock_guard<std::mutex> guard(mMutex);
+		mOutput << "ERROR copying " << sourceUTF8;
+		if (mOptions.mVerbose) {
+			mOutput << " (" << operation << ": " << strerror(error) << ")";
+		}
+		mOutput << "\n";
+		mErrors.push_back(sourceUTF8);
+	}
+	
+} // namespace copy_Impl
@@ -0,0 +1,282 @@
+//
+//    copy
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef NativeCopy_h
+#define NativeCopy_h
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <utility>
+#include <vector>
+#include "Common/ExclusionMatcher.h"
+#include "Common/Progress.h"
+#include "CopyJournal.h"
+#include "CopyOptions.h"
+#include "CopyScheduler.h"
+#include "DeltaCopy.h"
+#include "SyncPlan.h"
+#include "FileDataCopy.h"
+
+namespace copy_Impl {
+	
+	// Per-mechanism file and byte counts for the report at the end of a copy.
+	class CopyStatistics {
+	public:
+		//
+		CopyStatistics();
+		
+		//
+		void AddFile(const CopyMechanism& mechanism, uint64_t bytes);
+		
+		// Work a journal showed was already done by an earlier run.
+		void AddResumed(uint64_t files, uint64_t bytes);
+		
+		// Bytes checked by an inline verify, read back with O_DIRECT or not.
+		void AddVerified(uint64_t bytes, bool direct);
+		
+		// A file brought up to date by a delta copy.
+		void AddDelta(const DeltaResult& result);
+		
+		//
+		void SetChecksumAlgorithm(const common::ChecksumAlgorithm& algorithm);
+		
+		//
+		void Start();
+		
+		//
+		void Stop();
+		
+		//
+		void Report(std::ostream& strm) const;
+		
+	private:
+		//
+		static const size_t kMechanismCount = (size_t)CopyMechanism::kCount;
+		
+		//
+		std::atomic<uint64_t> mFiles[kMechanismCount];
+		std::atomic<uint64_t> mBytes[kMechanismCount];
+		std::atomic<uint64_t> mResumedFiles;
+		std::atomic<uint64_t> mResumedBytes;
+		std::atomic<uint64_t> mVerifiedDirectBytes;
+		std::atomic<uint64_t> mVerifiedUncachedBytes;
+		std::atomic<uint64_t> mDeltaWrittenBytes;
+		std::atomic<uint64_t> mDeltaReusedBytes;
+		common::ChecksumAlgorithm mChecksumAlgorithm;
+		std::chrono::steady_clock::time_point mStartTime;
+		std::chrono::steady_clock::time_point mStopTime;
+	};
+	
+	// Copies a tree with plain system calls so file data can move inside the kernel (or not at all,
+	// for a reflink) instead of passing through a user space buffer. The calling thread walks the
+	// source and creates directories while a CopyScheduler copies files, splitting huge ones into
+	// ranges copied in parallel. Hard links follow once every file is in, then directory metadata,
+	// deepest first. Reports each item the way FileSystemCopy's update callback does. With a
+	// journal, files and ranges an earlier run finished are skipped, and items it left behind
+	// are replaced. With a delta mode, big files that are already there are updated instead.
+	class NativeCopier {
+	public:
+		//
+		NativeCopier(const CopyOptions& options, std::ostream& output);
+		
+		// destUTF8 must not exist yet, unless resuming from a journal.
+		bool CopyTree(const std::string& sourceUTF8, const std::string& destUTF8);
+		
+		// Copies just the items a --sync scan found new or changed, replacing what's in the way,
+		// and optionally deletes what exists only in the destination.
+		bool SyncTree(const SyncPlan& plan, bool deleteOnlyInDest);
+		
+		// Counted into as items are walked and copied, for --progress.
+		void SetProgress(common::ProgressCounters* progress) {
+			mProgress = progress;
+		}
+		
+		//
+		const CopyStatistics& GetStatistics() const {
+			return mStatistics;
+		}
+		
+		//
+		const std::vector<std::string>& GetErrors() const {
+			return mErrors;
+		}
+		
+	private:
+		//
+		struct FileJob {
+			//
+			FileJob(const std::string& sourceUTF8,
+					const std::string& destUTF8,
+					const struct stat& s,
+					const JournalKey& journalKey,
+					size_t rangeCount) :
+			mSourceUTF8(sourceUTF8),
+			mDestUTF8(destUTF8),
+			mStat(s),
+			mJournalKey(journalKey),
+			mRemainingRanges(rangeCount),
+			mResumedBytes(0),
+			mMechanism(CopyMechanism::kReflink),
+			mOperation(nullptr),
+			mError(0) {
+			}
+			
+			//
+			std::string mSourceUTF8;
+			std::string mDestUTF8;
+			struct stat mStat;
+			JournalKey mJournalKey;
+			std::atomic<size_t> mRemainingRanges;
+			uint64_t mResumedBytes;
+			std::mutex mMutex;
+			// The slowest mechanism any range needed.
+			CopyMechanism mMechanism;
+			// First failure, if any.
+			const char* mOperation;
+			int mError;
+			// Atomic delta copies: the new version, renamed over mDestUTF8 once it's finished off.
+			std::string mTempUTF8;
+		};
+		typedef std::shared_ptr<FileJob> FileJobPtr;
+		
+		//
+		struct DeferredItem {
+			std::string mSourceUTF8;
+			std::string mDestUTF8;
+			// Directories: the source's metadata. Hard links: unused.
+			struct stat mStat;
+			// Hard links: the copy to link to.
+			std::string mLinkTargetUTF8;
+		};
+		
+		//
+		typedef std::pair<uint64_t, uint64_t> DeviceInode;
+		typedef std::map<DeviceInode, std::string> HardLinkMap;
+		
+		//
+		bool Begin(const std::string& sourceUTF8, const std::string& destUTF8);
+		
+		//
+		bool Finish();
+		
+		//
+		void Walk(const std::string& sourceUTF8, const std::string& destUTF8, const struct stat& s);
+		
+		//
+		void WalkDirectory(const std::string& sourceUTF8, const std::string& destUTF8, const struct stat& s);
+		
+		// By its path relative to the source root.
+		bool IsExcluded(const std::string& sourceUTF8, const struct stat& s) const;
+		
+		//
+		void QueueRegularFile(const std::string& sourceUTF8, const std::string& destUTF8, const struct stat& s);
+		
+		// True if the journal says an earlier run finished the file and it's still there.
+		bool IsFileDone(const std::string& destUTF8, const struct stat& s, const JournalKey& journalKey);
+		
+		// True if the destination is a file worth updating with a delta copy rather than replacing.
+		bool ShouldDeltaCopy(const std::string& destUTF8, const struct stat& s);
+		
+		//
+		void DeltaCopyFile(const FileJobPtr& job);
+		
+		// O_EXCL, except that with a journal (or --sync) whatever is there already is replaced. A
+		// regular file is truncated and rewritten in place, as cp does, so hard links to it elsewhere
+		// see the new contents rather than being left on the old ones.
+		int CreateFile(const std::string& destUTF8);
+		
+		// CopyFileData, or with an inline verify the buffered copy, read back and checksum
+		// comparison. On failure outOperation says which step failed, and errno why.
+		bool CopyRangeData(const FileJobPtr& job,
+						   int sourceFd,
+						   int destFd,
+						   uint64_t offset,
+						   uint64_t length,
+						   CopyMechanism& outMechanism,
+						   const char*& outOperation);
+		
+		//
+		void CopyRange(const FileJobPtr& job, uint64_t offset, uint64_t length, bool create);
+		
+		// Called by whichever range finishes last.
+		void FinishFile(const FileJobPtr& job, int destFd);
+		
+		//
+		void CopySymbolicLink(const std::string& sourceUTF8, const std::string& destUTF8, const struct stat& s);
+		
+		//
+		void CopySpecialFile(const std::string& sourceUTF8, const std::string& destUTF8, const struct stat& s);
+		
+		//
+		void FinishHardLinks();
+		
+		//
+		void FinishDirectories();
+		
+		//
+		void AddProgress(uint64_t entries, uint64_t files, uint64_t bytes);
+		
+		//
+		void ReportCopied(const std::string& sourceUTF8, const CopyMechanism* mechanism);
+		
+		//
+		void ReportError(const std::string& sourceUTF8, const char* operation, int error);
+		
+		//
+		CopyOptions mOptions;
+		common::ExclusionMatcher mExclusions;
+		std::ostream& mOutput;
+		uint64_t mDestDevice;
+		size_t mSourceRootLength;
+		std::unique_ptr<CopyJournal> mJournal;
+		// Items already at the destination (left by an interrupted run, or out of date) are
+		// replaced instead of being errors.
+		bool mReplaceExisting;
+		std::unique_ptr<CopyScheduler> mScheduler;
+		HardLinkMap mHardLinkTargets;
+		std::vector<DeferredItem> mHardLinks;
+		std::vector<DeferredItem> mDirectories;
+		std::vector<DeferredItem> mRefreshDirectories;
+		CopyStatistics mStatistics;
+		common::ProgressCounters* mProgress;
+		std::mutex mMutex;
+		std::vector<std::string> mErrors;
+		// Destination files CreateFile rewrote in place. A second path to the same one is a link
+		// the source no longer has, so it gets a file of its own instead. Guarded by mMutex.
+		std::set<DeviceInode> mRewrittenFiles;
+	};
+	
+	// Deletes the item, and everything in it if it's a directory. True if it's gone.
+	bool RemoveTree(const std::string& pathUTF8);
+	
+	// Owner, xattrs, permissions and dates, in that order so the dates stick. fd may be -1 to work
+	// by path (symbolic links, directories being finished off after their contents).
+	bool ApplyMetadata(int fd, const std::string& sourceUTF8, const std::string& destUTF8, const struct stat& s);
+	
+} // namespace copy_Impl
+
+#endif /* NativeCopy_h */
@@ -0,0 +1,82 @@
+//
+//    copy
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "SyncPlan.h"
+
+namespace copy_Impl {
+	
+	//
+	SyncPlan::SyncPlan(const std::string& sourceRootUTF8, const std::string& destRootUTF8) :
+	mSourceRootUTF8(sourceRootUTF8),
+	mDestRootUTF8(destRootUTF8) {
+	}
+	
+	//
+	bool SyncPlan::GetRelativePath(const std::string& rootUTF8, const std::string& pathUTF8, std::string& outRelativePathUTF8) {
+		if ((pathUTF8.compare(0, rootUTF8.size(), rootUTF8) != 0) ||
+			((pathUTF8.size() > rootUTF8.size()) && (pathUTF8[rootUTF8.size()] != '/'))) {
+			return false;
+		}
+		outRelativePathUTF8 = pathUTF8.substr(rootUTF8.size());
+		return true;
+	}
+	
+	//
+	void SyncPlan::AddChanged(const std::string& sourcePathUTF8) {
+		std::string relativePathUTF8;
+		if (GetRelativePath(mSourceRootUTF8, sourcePathUTF8, relativePathUTF8)) {
+			std::lock_guard<std::mutex> guard(mMutex);
+			mChanged.insert(relativePathUTF8);
+		}
+	}
+	
+	//
+	void SyncPlan::AddOnlyInDest(const std::string& destPathUTF8) {
+		std::string relativePathUTF8;
+		if (GetRelativePath(mDestRootUTF8, destPathUTF8, relativePathUTF8)) {
+			std::lock_guard<std::mutex> guard(mMutex);
+			mOnlyInDest.insert(relativePathUTF8);
+		}
+	}
+	
+	//
+	void SyncPlan::AddError(const std::string& pathUTF8) {
+		std::lock_guard<std::mutex> guard(mMutex);
+		mErrors.push_back(pathUTF8);
+	}
+	
+	//
+	std::vector<std::string> SyncPlan::GetChanged() const {
+		std::lock_guard<std::mutex> guard(mMutex);
+		return std::vector<std::string>(mChanged.begin(), mChanged.end());
+	}
+	
+	//
+	std::vector<std::string> SyncPlan::GetOnlyInDest() const {
+		std::lock_guard<std::mutex> guard(mMutex);
+		return std::vector<std::string>(mOnlyInDest.begin(), mOnlyInDest.end());
+	}
+	
+	//
+	std::vector<std::string> SyncPlan::GetErrors() const {
+		std::lock_guard<std::mutex> guard(mMutex);
+		return mErrors;
+	}
+	
+} // namespace copy_Impl
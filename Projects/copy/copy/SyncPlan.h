@@ -0,0 +1,80 @@
+//
+//    copy
+//    Copyright (C) 2018 Paul Young (aka peymojo)
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef SyncPlan_h
+#define SyncPlan_h
+
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace copy_Impl {
+	
+	// What a --sync scan found, as paths relative to the two roots ("" for a root itself, otherwise
+	// starting with "/"). Filled in from CompareFiles' threads.
+	class SyncPlan {
+	public:
+		//
+		SyncPlan(const std::string& sourceRootUTF8, const std::string& destRootUTF8);
+		
+		// New or changed in the source, by full source path.
+		void AddChanged(const std::string& sourcePathUTF8);
+		
+		// Present only in the destination, by full destination path.
+		void AddOnlyInDest(const std::string& destPathUTF8);
+		
+		//
+		void AddError(const std::string& pathUTF8);
+		
+		// Sorted, so an item always comes after its ancestors.
+		std::vector<std::string> GetChanged() const;
+		
+		//
+		std::vector<std::string> GetOnlyInDest() const;
+		
+		//
+		std::vector<std::string> GetErrors() const;
+		
+		//
+		const std::string& GetSourceRoot() const {
+			return mSourceRootUTF8;
+		}
+		
+		//
+		const std::string& GetDestRoot() const {
+			return mDestRootUTF8;
+		}
+		
+	private:
+		//
+		static bool GetRelativePath(const std::string& rootUTF8, const std::string& pathUTF8, std::string& outRelativePathUTF8);
+		
+		//
+		std::string mSourceRootUTF8;
+		std::string mDestRootUTF8;
+		mutable std::mutex mMutex;
+		std::set<std::string> mChanged;
+		std::set<std::string> mOnlyInDest;
+		std::vector<std::string> mErrors;
+	};
+	
+} // namespace copy_Impl
+
+#endif /* SyncPlan_h */
@@ -19,9 +19,11 @@
 #include <iomanip>
 #include <iostream>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <sstream>
-#include <thread>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <vector>
 
@@ -47,7 +49,15 @@
 #include "Hermit/String/SInt32ToString.h"
 #include "Hermit/String/UInt32ToString.h"
 #include "Hermit/String/UInt64ToString.h"
-#include "Hermit/Utility/OperationTimer.h"
+#include "Common/CompareCompletion.h"
+#include "Common/Completion.h"
+#include "Common/ExclusionMatcher.h"
+#include "Common/NativeFileComparer.h"
+#include "Common/PhaseTimer.h"
+#include "CopyJournal.h"
+#include "CopyOptions.h"
+#include "NativeCopy.h"
+#include "SyncPlan.h"
 
 namespace copy_Impl {
 	
@@ -55,15 +65,19 @@ namespace copy_Impl {
 	class CoutReporter {
 	public:
 		//
-		void Report(const std::string& inTag, const time_t& inTime) {
+		void Report(const std::string& inTag, double inSeconds) {
 			static const time_t oneMinute = 60;
 			static const time_t oneHour = 60 * oneMinute;
 			static const time_t oneDay = oneHour * 24;
 			static const time_t oneYear = oneDay * 365;
 			
-			time_t t = inTime;
-			if (inTime < 60) {
-				std::cout << inTag << ": " << inTime << " seconds." << "\n";
+			// Formatted on the side so std::cout's own settings are left alone.
+			std::ostringstream secondsStream;
+			secondsStream << std::fixed << std::setprecision(3) << inSeconds;
+			
+			time_t t = (time_t)inSeconds;
+			if (inSeconds < 60) {
+				std::cout << inTag << ": " << secondsStream.str() << " seconds." << "\n";
 			}
 			else {
 				std::ostringstream formattedTimeStream;
@@ -115,19 +129,39 @@ namespace copy_Impl {
 					formattedTimeStream << " ";
 				}
 				
-				std::cout << inTag << ": " << formattedTimeStream.str() << "(" << inTime << " seconds).\n";
+				std::cout << inTag << ": " << formattedTimeStream.str() << "(" << secondsStream.str() << " seconds).\n";
 			}
 		}
 	};
 	
 	//
-	typedef hermit::utility::OperationTimer<CoutReporter> Timer;
+	typedef common::ScopedTimer<CoutReporter> Timer;
 	
 	//
 	void usage() {
 		std::cout << "usage: copy <source> <destination>\n";
 		std::cout << "\t-y verify results after copy\n";
-		//        std::cout << "\t-v verbose\n";
+		std::cout << "\t-v verbose (show how each file's data was copied, and why items failed)\n";
+		std::cout << "\t--reflink=auto|always|never share data blocks with the source where the file system allows\n";
+		std::cout << "\t\t(default auto: clone when possible, otherwise copy)\n";
+		std::cout << "\t-j <n> copy up to n files, or ranges of huge files, at once (default 1)\n";
+		std::cout << "\t--sync copy only items that are new or changed (by type, size, date, owner, permissions or xattrs)\n";
+		std::cout << "\t\tcompared to an existing destination\n";
+		std::cout << "\t--delete with --sync, delete items found only in the destination\n";
+		std::cout << "\t--delta[=inplace|atomic] with --sync, rewrite only the changed parts of big files, either in place\n";
+		std::cout << "\t\t(the default) or in a new copy renamed over the old one once it's complete\n";
+		std::cout << "\t--journal <file> record progress in file; rerunning with the same journal resumes an interrupted copy\n";
+		std::cout << "\t--progress show a status line with throughput and ETA instead of a line per item\n";
+		std::cout << "\t--phase-times when done, show where the time went (listing, stat, writing, verifying)\n";
+		std::cout << "\t--snapshots with -y or --sync, read each directory's metadata in one batch instead of item by item\n";
+		std::cout << "\t\t(can help on high-latency file systems; usually slower on local disks)\n";
+		std::cout << "\t--checksum=crc32c|xxhash checksum data as it's copied, then read it back from the destination\n";
+		std::cout << "\t\tbypassing the page cache and check that it matches\n";
+		std::cout << "\t--exclude <pattern> don't copy items matching a gitignore-style pattern: a name (*.o), a path\n";
+		std::cout << "\t\tfrom the top (/build, src/**/gen), or a directory (tmp/); may be repeated. With --sync\n";
+		std::cout << "\t\t--delete, excluded items in the destination are left alone\n";
+		std::cout << "\t--include <pattern> copy items matching the pattern after all (like !pattern)\n";
+		std::cout << "\t--exclude-from <file> read patterns from a file, one per line, as in .gitignore\n";
 	}
 	
 	//
@@ -164,24 +198,18 @@ namespace copy_Impl {
 	};
 	
 	//
-	class CopyCompletion : public hermit::file::FileSystemCopyCompletion {
+	class CopyCompletion :
+	public hermit::file::FileSystemCopyCompletion,
+	public common::Completion<hermit::file::FileSystemCopyResult> {
 	public:
 		//
-		CopyCompletion() : mResult(hermit::file::FileSystemCopyResult::kUnknown) {
+		CopyCompletion() : Completion(hermit::file::FileSystemCopyResult::kUnknown) {
 		}
 		
 		//
 		virtual void Call(const hermit::HermitPtr& h_, const hermit::file::FileSystemCopyResult& result) override {
-			mResult = result;
+			Signal(result);
 		}
-		
-		//
-		bool Done() {
-			return (mResult != hermit::file::FileSystemCopyResult::kUnknown);
-		}
-		
-		//
-		std::atomic<hermit::file::FileSystemCopyResult> mResult;
 	};
 	
 #if 000
@@ -302,7 +330,10 @@ namespace copy_Impl {
 				}
 			
 				if (name == hermit::file::kFileSkippedNotification) {
-					std::cout << "Skipped: <" << path1UTF8 << ">.\n";
+					// Pairs the Preprocessor compared itself come back from CompareFiles as skipped.
+					if (mSettledItems.erase(path1UTF8) == 0) {
+						std::cout << "Skipped: <" << path1UTF8 << ">.\n";
+					}
 				}
 				else if (name == hermit::file::kFileErrorNotification) {
 					std::cout << "* Error: CompareFiles() failed for <" << path1UTF8 << "> and <" << path2UTF8 << ">.\n";
@@ -407,6 +438,21 @@ namespace copy_Impl {
 #endif
 				}
 			}
+			else if (name == common::kNativeCompareNotification) {
+				common::NativeCompareParams* params = (common::NativeCompareParams*)param;
+				std::string path1UTF8 = SanitizeStringForOutput(params->mPath1UTF8);
+				std::string path2UTF8 = SanitizeStringForOutput(params->mPath2UTF8);
+				if (params->mMatch) {
+					std::cout << "Match: " << path1UTF8 << "\n";
+				}
+				else {
+					std::cout << "* Files <" << path1UTF8 << "> and <" << path2UTF8 << "> differ.\n";
+					if (!mSummarize) {
+						std::cout << "--(offset to first difference: " << params->mOffset << ")" << "\n";
+					}
+				}
+				mSettledItems.insert(path1UTF8);
+			}
 			NOTIFY(mH_, notificationName, param);
 		}
 		
@@ -430,68 +476,227 @@ namespace copy_Impl {
 		std::mutex mMutex;
 		StringVector mErrors;
 		uint64_t mFirstDifferentByte;
+		std::set<std::string> mSettledItems;
 	};
 		
-	//
-	typedef std::set<std::string> StringSet;
+	// What verify and the sync scan leave out: the default names, then the user's rules.
+	common::ExclusionMatcherPtr GetExclusions(const CopyOptions& options) {
+		common::ExclusionRules rules;
+		rules.AddDefaults();
+		rules.Add(options.mExclusions);
+		return std::make_shared<const common::ExclusionMatcher>(rules);
+	}
+	
+	// The --sync "quick check": items are taken to be the same if these all match, without
+	// reading their contents.
+	bool SyncMetadataMatches(const common::SnapshotEntry& sourceEntry, const common::SnapshotEntry& destEntry) {
+		if (!sourceEntry.HasStat() || !destEntry.HasStat() ||
+			(sourceEntry.GetMode() != destEntry.GetMode()) ||
+			(sourceEntry.GetUserID() != destEntry.GetUserID()) ||
+			(sourceEntry.GetGroupID() != destEntry.GetGroupID()) ||
+			(sourceEntry.GetModificationTime() != destEntry.GetModificationTime())) {
+			return false;
+		}
+		if (!S_ISDIR(sourceEntry.GetMode()) && (sourceEntry.GetSize() != destEntry.GetSize())) {
+			return false;
+		}
+		return !sourceEntry.HasXAttrs() || !destEntry.HasXAttrs() || (sourceEntry.GetXAttrs() == destEntry.GetXAttrs());
+	}
 	
 	//
 	class Preprocessor : public hermit::file::PreprocessFileFunction {
 	public:
-		//
-		Preprocessor(const StringSet& exclusions) :
-		mExclusions(exclusions) {
+		// With a sync plan, only metadata is compared, and what differs goes into the plan
+		// instead of being compared any further.
+		Preprocessor(const common::ExclusionMatcherPtr& exclusions,
+					 const common::NativeFileComparerPtr& comparer,
+					 const std::shared_ptr<SyncPlan>& syncPlan = nullptr) :
+		mExclusions(exclusions),
+		mComparer(comparer),
+		mSyncPlan(syncPlan) {
 		}
 		
 		//
 		virtual hermit::file::PreprocessFileInstruction Preprocess(const hermit::HermitPtr& h_,
 																   const hermit::file::FilePathPtr& parent,
 																   const std::string& itemName) override {
-			if (mExclusions.find(itemName) != mExclusions.end()) {
+			if (mComparer->IsExcluded(h_, parent, itemName, *mExclusions)) {
 				return hermit::file::PreprocessFileInstruction::kSkip;
 			}
-			return hermit::file::PreprocessFileInstruction::kContinue;
+			if (mSyncPlan != nullptr) {
+				return PreprocessForSync(h_, parent, itemName);
+			}
 			
+			std::string sourcePathUTF8;
+			std::string destPathUTF8;
+			common::SnapshotEntry sourceEntry;
+			common::SnapshotEntry destEntry;
+			if (mComparer->GetItemMetadata(h_, parent, itemName, sourcePathUTF8, destPathUTF8, sourceEntry, destEntry) &&
+				(mComparer->CompareLinkedPair(h_, sourcePathUTF8, destPathUTF8, sourceEntry, destEntry) ||
+				 mComparer->Compare(h_, sourcePathUTF8, destPathUTF8, sourceEntry, destEntry, false))) {
+				return hermit::file::PreprocessFileInstruction::kSkip;
+			}
+			return hermit::file::PreprocessFileInstruction::kContinue;
 		}
 		
 		//
-		StringSet mExclusions;
+		hermit::file::PreprocessFileInstruction PreprocessForSync(const hermit::HermitPtr& h_,
+																  const hermit::file::FilePathPtr& parent,
+																  const std::string& itemName) {
+			std::string sourcePathUTF8;
+			std::string destPathUTF8;
+			common::SnapshotEntry sourceEntry;
+			common::SnapshotEntry destEntry;
+			if (!mComparer->GetItemMetadata(h_, parent, itemName, sourcePathUTF8, destPathUTF8, sourceEntry, destEntry)) {
+				if (sourcePathUTF8.empty()) {
+					// Couldn't even work out the paths; leave it to CompareFiles to report.
+					return hermit::file::PreprocessFileInstruction::kContinue;
+				}
+				// Only on one side (rare enough that a plain lstat to find out which is fine).
+				struct stat s;
+				if (lstat(sourcePathUTF8.c_str(), &s) == 0) {
+					mSyncPlan->AddChanged(sourcePathUTF8);
+				}
+				else if (lstat(destPathUTF8.c_str(), &s) == 0) {
+					mSyncPlan->AddOnlyInDest(destPathUTF8);
+				}
+				return hermit::file::PreprocessFileInstruction::kSkip;
+			}
+			bool bothDirectories = S_ISDIR(sourceEntry.GetMode()) && S_ISDIR(destEntry.GetMode());
+			if (!SyncMetadataMatches(sourceEntry, destEntry)) {
+				mSyncPlan->AddChanged(sourcePathUTF8);
+			}
+			// Directories on both sides are descended into whether or not they themselves differ.
+			return bothDirectories ? hermit::file::PreprocessFileInstruction::kContinue : hermit::file::PreprocessFileInstruction::kSkip;
+		}
+		
+		//
+		common::ExclusionMatcherPtr mExclusions;
+		common::NativeFileComparerPtr mComparer;
+		std::shared_ptr<SyncPlan> mSyncPlan;
 	};
 	
-	//
-	class CompareCompletion : public hermit::file::CompareFilesCompletion {
+	// Collects the differences CompareFiles finds during a --sync scan into the plan, instead of
+	// printing them.
+	class SyncScanHermit : public hermit::Hermit {
 	public:
 		//
-		CompareCompletion() : mStatus(hermit::file::CompareFilesStatus::kUnknown) {
+		SyncScanHermit(const hermit::HermitPtr& h_, const std::shared_ptr<SyncPlan>& plan, const common::ExclusionMatcherPtr& exclusions) :
+		mH_(h_),
+		mPlan(plan),
+		mExclusions(exclusions) {
 		}
 		
 		//
-		virtual void Call(const hermit::file::CompareFilesStatus& status) override {
-			mStatus = status;
+		virtual bool ShouldAbort() override {
+			return mH_->ShouldAbort();
 		}
 		
 		//
-		bool Done() {
-			return (mStatus != hermit::file::CompareFilesStatus::kUnknown);
+		virtual void Notify(const char* notificationName, const void* param) override {
+			std::string name(notificationName);
+			if ((name == hermit::file::kFilesMatchNotification) || (name == hermit::file::kFileSkippedNotification)) {
+				return;
+			}
+			if ((name != hermit::file::kFilesDifferNotification) && (name != hermit::file::kFileErrorNotification)) {
+				NOTIFY(mH_, notificationName, param);
+				return;
+			}
+			
+			hermit::file::FileNotificationParams* params = (hermit::file::FileNotificationParams*)param;
+			std::string path1UTF8;
+			if (params->mPath1 != nullptr) {
+				hermit::file::GetFilePathUTF8String(mH_, params->mPath1, path1UTF8);
+			}
+			std::string path2UTF8;
+			if (params->mPath2 != nullptr) {
+				hermit::file::GetFilePathUTF8String(mH_, params->mPath2, path2UTF8);
+			}
+			if (name == hermit::file::kFileErrorNotification) {
+				std::lock_guard<std::mutex> guard(mMutex);
+				std::cout << "* Error: CompareFiles() failed for <" << SanitizeStringForOutput(path1UTF8)
+						  << "> and <" << SanitizeStringForOutput(path2UTF8) << ">.\n";
+				mPlan->AddError(path1UTF8);
+			}
+			else if (params->mType == hermit::file::kItemInPath2Only) {
+				if (!IsExcluded(path2UTF8)) {
+					mPlan->AddOnlyInDest(path2UTF8);
+				}
+			}
+			else if (params->mType != hermit::file::kFolderContentsDiffer) {
+				mPlan->AddChanged(path1UTF8);
+			}
+		}
+		
+		// Only the destination has it, so that's where to look if it matters whether it's a
+		// directory.
+		bool IsExcluded(const std::string& destPathUTF8) const {
+			const std::string& rootUTF8 = mPlan->GetDestRoot();
+			if (mExclusions->IsEmpty() || (destPathUTF8.size() <= rootUTF8.size())) {
+				return false;
+			}
+			size_t start = mExclusions->NeedsPath() ? (rootUTF8.size() + 1) : (destPathUTF8.rfind('/') + 1);
+			common::ExclusionMatch match = mExclusions->Match(destPathUTF8.data() + start, destPathUTF8.size() - start);
+			struct stat s;
+			return match.IsExcluded(match.DependsOnType() && (lstat(destPathUTF8.c_str(), &s) == 0) && S_ISDIR(s.st_mode));
 		}
 		
 		//
-		std::atomic<hermit::file::CompareFilesStatus> mStatus;
+		hermit::HermitPtr mH_;
+		std::shared_ptr<SyncPlan> mPlan;
+		common::ExclusionMatcherPtr mExclusions;
+		std::mutex mMutex;
 	};
 	
+	// Metadata-only CompareFiles pass filling in plan.
+	bool ScanForSync(const hermit::HermitPtr& h_,
+					 hermit::file::FilePathPtr sourcePath,
+					 hermit::file::FilePathPtr destPath,
+					 const std::shared_ptr<SyncPlan>& plan,
+					 const common::ExclusionMatcherPtr& exclusions,
+					 bool useSnapshots) {
+		auto scanH_ = std::make_shared<SyncScanHermit>(h_, plan, exclusions);
+		auto hardLinkMap1 = std::make_shared<hermit::file::HardLinkMap>(sourcePath);
+		auto hardLinkMap2 = std::make_shared<hermit::file::HardLinkMap>(destPath);
+		auto comparer = std::make_shared<common::NativeFileComparer>(plan->GetSourceRoot(),
+																	 plan->GetDestRoot(),
+																	 false,
+																	 useSnapshots,
+																	 common::ReadPipelineOptions());
+		auto preprocessor = std::make_shared<Preprocessor>(exclusions, comparer, plan);
+		auto completion = std::make_shared<common::CompareCompletion>();
+		hermit::file::CompareFiles(scanH_,
+								   sourcePath,
+								   destPath,
+								   hardLinkMap1,
+								   hardLinkMap2,
+								   hermit::file::IgnoreDates::kNo,
+								   hermit::file::IgnoreFinderInfo::kNo,
+								   preprocessor,
+								   completion);
+		// Differences are what a scan is for, so only giving up part-way counts as failure.
+		return (completion->Wait() != hermit::file::CompareFilesStatus::kCancel);
+	}
+	
 	//
-	bool VerifyCopy(const hermit::HermitPtr& h_, hermit::file::FilePathPtr sourcePath, hermit::file::FilePathPtr destPath) {
-		StringSet filenamesToSkip;
-		filenamesToSkip.insert(".DS_Store");            // Finder view file which gets added/updated when you open a folder
-		filenamesToSkip.insert(".ipspot_update");       // Spotlight photo data file which the OS changes on its own
-		filenamesToSkip.insert("ehthumbs.db");          // Windows thumbnails file
-		filenamesToSkip.insert("ehthumbs_vista.db");    // Windows thumbnails file
-		filenamesToSkip.insert("Thumbs.db");            // Windows thumbnails file
-		
+	bool VerifyCopy(const hermit::HermitPtr& h_,
+					hermit::file::FilePathPtr sourcePath,
+					hermit::file::FilePathPtr destPath,
+					const common::ExclusionMatcherPtr& exclusions,
+					bool useSnapshots) {
 		auto hardLinkMap1 = std::make_shared<hermit::file::HardLinkMap>(sourcePath);
 		auto hardLinkMap2 = std::make_shared<hermit::file::HardLinkMap>(destPath);
-		auto preprocessor = std::make_shared<Preprocessor>(filenamesToSkip);
-		auto completion = std::make_shared<CompareCompletion>();
+		std::string sourcePathUTF8;
+		hermit::file::GetFilePathUTF8String(h_, sourcePath, sourcePathUTF8);
+		std::string destPathUTF8;
+		hermit::file::GetFilePathUTF8String(h_, destPath, destPathUTF8);
+		auto comparer = std::make_shared<common::NativeFileComparer>(sourcePathUTF8,
+																	 destPathUTF8,
+																	 false,
+																	 useSnapshots,
+																	 common::ReadPipelineOptions());
+		auto preprocessor = std::make_shared<Preprocessor>(exclusions, comparer);
+		auto completion = std::make_shared<common::CompareCompletion>();
 		hermit::file::CompareFiles(h_,
 								   sourcePath,
 								   destPath,
@@ -501,8 +706,11 @@ namespace copy_Impl {
 								   hermit::file::IgnoreFinderInfo::kNo,
 								   preprocessor,
 								   completion);
-		while (!completion->Done()) {
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		auto status = completion->Wait();
+		const common::HardLinkIndex& hardLinks = comparer->GetHardLinks();
+		if (hardLinks.GetSkippedFileCount() > 0) {
+			std::cout << "Hard links: " << hardLinks.GetSkippedFileCount() << " files already verified through another link, "
+					  << hardLinks.GetSkippedByteCount() << " bytes not read again." << "\n";
 		}
 		
 		//        if (!compareCallback.mMismatches.empty())
@@ -525,23 +733,83 @@ namespace copy_Impl {
 		//            }
 		//        }
 		
-		return (completion->mStatus == hermit::file::CompareFilesStatus::kSuccess);
+		return (status == hermit::file::CompareFilesStatus::kSuccess);
 	}
 	
 	//
-	bool Copy(const hermit::HermitPtr& h_, hermit::file::FilePathPtr sourcePath, hermit::file::FilePathPtr destPath, bool verify) {
+	bool Copy(const hermit::HermitPtr& h_,
+			  hermit::file::FilePathPtr sourcePath,
+			  hermit::file::FilePathPtr destPath,
+			  const CopyOptions& options) {
+		bool success = false;
+		StringVector errors;
+#if defined(__linux__)
+		std::string sourcePathUTF8;
+		hermit::file::GetFilePathUTF8String(h_, sourcePath, sourcePathUTF8);
+		std::string destPathUTF8;
+		hermit::file::GetFilePathUTF8String(h_, destPath, destPathUTF8);
+		NativeCopier copier(options, std::cout);
+		std::unique_ptr<common::ProgressCounters> progress;
+		std::unique_ptr<common::ProgressReporter> progressReporter;
+		if (options.mProgress) {
+			progress.reset(new common::ProgressCounters);
+			copier.SetProgress(progress.get());
+		}
+		auto startProgress = [&](const std::string& estimateRootUTF8) {
+			if (progress != nullptr) {
+				progressReporter.reset(new common::ProgressReporter(*progress,
+																	std::cerr,
+																	isatty(STDERR_FILENO) != 0,
+																	estimateRootUTF8,
+																	true));
+			}
+		};
+		struct stat destStat;
+		if (options.mSync && (lstat(destPathUTF8.c_str(), &destStat) == 0)) {
+			std::cout << "Scanning <" << destPathUTF8 << "> for changes..." << "\n";
+			auto plan = std::make_shared<SyncPlan>(sourcePathUTF8, destPathUTF8);
+			if (!ScanForSync(h_, sourcePath, destPath, plan, GetExclusions(options), options.mSnapshots)) {
+				std::cout << "SYNC SCAN FAILED." << "\n";
+				return false;
+			}
+			std::cout << "Sync: " << plan->GetChanged().size() << " new or changed, "
+					  << plan->GetOnlyInDest().size() << " only in destination." << "\n";
+			// Only what changed gets copied, so the size of the source says nothing about how long
+			// that will take.
+			startProgress("");
+			success = copier.SyncTree(*plan, options.mDeleteOnlyInDest);
+			errors = plan->GetErrors();
+			errors.insert(errors.end(), copier.GetErrors().begin(), copier.GetErrors().end());
+		}
+		else {
+			startProgress(sourcePathUTF8);
+			success = copier.CopyTree(sourcePathUTF8, destPathUTF8);
+			errors = copier.GetErrors();
+		}
+		if (progressReporter != nullptr) {
+			progressReporter->Stop();
+		}
+		copier.GetStatistics().Report(std::cout);
+#else
+		if (options.mReflinkMode != ReflinkMode::kAuto) {
+			std::cout << "copy: --reflink=always|never is only supported on Linux." << "\n";
+			return false;
+		}
+		if (!options.mJournalPathUTF8.empty() || options.mSync || options.mInlineVerify || options.mProgress ||
+			!options.mExclusions.IsEmpty()) {
+			std::cout << "copy: --journal, --sync, --checksum, --progress and --exclude are only supported on Linux." << "\n";
+			return false;
+		}
 		auto updateCallback = std::make_shared<IntermediateUpdateCallback>();
 		auto completion = std::make_shared<CopyCompletion>();
 		hermit::file::FileSystemCopy(h_, sourcePath, destPath, updateCallback, completion);
-		while (!completion->Done()) {
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
-		}
-		
-		bool success = (completion->mResult == hermit::file::FileSystemCopyResult::kSuccess);
-		if (!updateCallback->mErrors.empty()) {
+		success = (completion->Wait() == hermit::file::FileSystemCopyResult::kSuccess);
+		errors = updateCallback->mErrors;
+#endif
+		if (!errors.empty()) {
 			std::cout << "\n-------\nThere were errors:\n";
-			auto end = std::end(updateCallback->mErrors);
-			for (auto it = std::begin(updateCallback->mErrors); it != end; ++it) {
+			auto end = std::end(errors);
+			for (auto it = std::begin(errors); it != end; ++it) {
 				std::cout << *it << "\n";
 			}
 			success = false;
@@ -551,9 +819,10 @@ namespace copy_Impl {
 			return false;
 		}
 		
-		if (verify) {
+		if (options.mVerify) {
 			std::cout << "Copy complete. Verifying..." << "\n";
-			success = VerifyCopy(h_, sourcePath, destPath);
+			common::PhaseScope scope(common::Phase::kVerify);
+			success = VerifyCopy(h_, sourcePath, destPath, GetExclusions(options), options.mSnapshots);
 			if (!success) {
 				std::cout << "VERIFY FAILED." << "\n";
 			}
@@ -562,7 +831,7 @@ namespace copy_Impl {
 	}
 	
 	//
-	static int Copy(const std::string& inPath1, const std::string& inPath2, bool inVerify) {
+	static int Copy(const std::string& inPath1, const std::string& inPath2, const CopyOptions& options) {
 		auto h_ = std::make_shared<Hermit>(std::make_shared<hermit::LoggingHermit>());
 
 		std::vector<char> wdBuf(2048);
@@ -614,6 +883,45 @@ namespace copy_Impl {
 			return EXIT_FAILURE;
 		}
 		
+		if (!options.mJournalPathUTF8.empty()) {
+			// A rerun carries on into the destination the interrupted run created, which by now
+			// exists and would otherwise be copied into. The destination given has to be the one
+			// the journal is for: either that path, or the directory it was created in.
+			std::string sourcePathUTF8;
+			hermit::file::GetFilePathUTF8String(h_, filePath1, sourcePathUTF8);
+			std::string journalSourceUTF8;
+			std::string journalDestUTF8;
+			if (CopyJournal::ReadRoots(options.mJournalPathUTF8, journalSourceUTF8, journalDestUTF8) &&
+				(journalSourceUTF8 == sourcePathUTF8)) {
+				std::string destPathUTF8;
+				hermit::file::GetFilePathUTF8String(h_, filePath2, destPathUTF8);
+				std::string leaf;
+				hermit::file::GetFilePathLeaf(h_, filePath1, leaf);
+				hermit::file::FilePathPtr destChildPath;
+				hermit::file::AppendToFilePath(h_, filePath2, leaf, destChildPath);
+				std::string destChildPathUTF8;
+				if (destChildPath != nullptr) {
+					hermit::file::GetFilePathUTF8String(h_, destChildPath, destChildPathUTF8);
+				}
+				if ((journalDestUTF8 != destPathUTF8) && (journalDestUTF8 != destChildPathUTF8)) {
+					std::cout << "copy: Journal <" << options.mJournalPathUTF8 << "> is for a copy to <"
+							  << journalDestUTF8 << ">, not <" << destPathUTF8 << ">; use that destination "
+							  << "or a different journal.\n";
+					return EXIT_FAILURE;
+				}
+				hermit::file::FilePathPtr destPath;
+				hermit::file::CreateFilePathFromUTF8String(h_, journalDestUTF8, destPath);
+				if (destPath == nullptr) {
+					NOTIFY_ERROR(h_, "CreateFilePathFromUTF8String failed for path:", journalDestUTF8);
+					return EXIT_FAILURE;
+				}
+				std::cout << "Resuming copy to <" << journalDestUTF8 << ">.\n";
+				int result = Copy(h_, filePath1, destPath, options);
+				h_->PrintErrors();
+				return result;
+			}
+		}
+		
 		int result = 0;
 		hermit::file::FileExists(h_, filePath2, existsStatus);
 		if (!existsStatus.mSuccess) {
@@ -642,7 +950,7 @@ namespace copy_Impl {
 				return EXIT_FAILURE;
 			}
 			
-			result = Copy(h_, filePath1, destPath, inVerify);
+			result = Copy(h_, filePath1, destPath, options);
 		}
 		else {
 			hermit::file::FilePathPtr destParent;
@@ -676,7 +984,7 @@ namespace copy_Impl {
 				return EXIT_FAILURE;
 			}
 			
-			result = Copy(h_, filePath1, filePath2, inVerify);
+			result = Copy(h_, filePath1, filePath2, options);
 		}
 		h_->PrintErrors();
 		return result;
@@ -697,15 +1005,100 @@ namespace copy_Impl {
 		std::string srcPath;
 		bool getDestPath = false;
 		std::string destPath;
-		bool verify = false;
-		bool verbose = false;
+		CopyOptions options;
 		while (!args.empty()) {
 			std::string arg(args.front());
 			if (arg == "-v") {
-				verbose = true;
+				options.mVerbose = true;
 			}
 			else if (arg == "-y") {
-				verify = true;
+				options.mVerify = true;
+			}
+			else if (arg == "-j") {
+				args.pop_front();
+				int jobs = args.empty() ? 0 : atoi(args.front().c_str());
+				if ((jobs < 1) || (jobs > 1024)) {
+					std::cout << "copy: -j needs a count from 1 to 1024.\n";
+					usage();
+					return EXIT_FAILURE;
+				}
+				options.mJobs = (size_t)jobs;
+			}
+			else if (arg == "--sync") {
+				options.mSync = true;
+			}
+			else if (arg == "--delete") {
+				options.mDeleteOnlyInDest = true;
+			}
+			else if (arg == "--journal") {
+				args.pop_front();
+				if (args.empty()) {
+					usage();
+					return EXIT_FAILURE;
+				}
+				options.mJournalPathUTF8 = args.front();
+			}
+			else if (arg.find("--reflink=") == 0) {
+				std::string mode(arg.substr(10));
+				if (mode == "auto") {
+					options.mReflinkMode = ReflinkMode::kAuto;
+				}
+				else if (mode == "always") {
+					options.mReflinkMode = ReflinkMode::kAlways;
+				}
+				else if (mode == "never") {
+					options.mReflinkMode = ReflinkMode::kNever;
+				}
+				else {
+					std::cout << "copy: Unknown --reflink mode: " << mode << "\n";
+					usage();
+					return EXIT_FAILURE;
+				}
+			}
+			else if (arg == "--progress") {
+				options.mProgress = true;
+			}
+			else if ((arg == "--exclude") || (arg == "--include") || (arg == "--exclude-from")) {
+				args.pop_front();
+				if (args.empty()) {
+					usage();
+					return EXIT_FAILURE;
+				}
+				std::string error;
+				bool added = (arg == "--exclude-from") ?
+					options.mExclusions.AddFromFile(args.front(), error) :
+					options.mExclusions.Add(args.front(), (arg == "--include"), error);
+				if (!added) {
+					std::cout << "copy: " << arg << " " << args.front() << ": " << error << "\n";
+					return EXIT_FAILURE;
+				}
+			}
+			else if (arg == "--phase-times") {
+				options.mPhaseTimes = true;
+			}
+			else if (arg == "--snapshots") {
+				options.mSnapshots = true;
+			}
+			else if ((arg == "--delta") || (arg == "--delta=inplace")) {
+				options.mDeltaMode = DeltaMode::kInPlace;
+			}
+			else if (arg == "--delta=atomic") {
+				options.mDeltaMode = DeltaMode::kAtomic;
+			}
+			else if (arg.find("--checksum=") == 0) {
+				std::string algorithm(arg.substr(11));
+				if (algorithm == "crc32c") {
+					options.mChecksumAlgorithm = common::ChecksumAlgorithm::kCRC32C;
+				}
+				else if ((algorithm == "xxhash") || (algorithm == "xxh64")) {
+					options.mChecksumAlgorithm = common::ChecksumAlgorithm::kXXH64;
+				}
+				else {
+					std::cout << "copy: Unknown --checksum algorithm: " << algorithm << "\n";
+					usage();
+					return EXIT_FAILURE;
+				}
+				options.mInlineVerify = true;
 			}
 			else if (!gotSrcPath) {
 				srcPath = arg;
@@ -722,13 +1115,44 @@ namespace copy_Impl {
 			args.pop_front();
 		}
 		
+		if (options.mDeleteOnlyInDest && !options.mSync) {
+			std::cout << "copy: --delete only makes sense with --sync.\n";
+			usage();
+			return EXIT_FAILURE;
+		}
+		if ((options.mDeltaMode != DeltaMode::kOff) && !options.mSync) {
+			std::cout << "copy: --delta only makes sense with --sync.\n";
+			usage();
+			return EXIT_FAILURE;
+		}
+		if ((options.mDeltaMode != DeltaMode::kOff) &&
+			(options.mInlineVerify || (options.mReflinkMode == ReflinkMode::kAlways))) {
+			// Delta copies rewrite only parts of files, and those parts never line up with blocks.
+			std::cout << "copy: --delta can't be combined with --checksum or --reflink=always.\n";
+			usage();
+			return EXIT_FAILURE;
+		}
+		if (options.mInlineVerify && (options.mReflinkMode == ReflinkMode::kAlways)) {
+			// A clone never reads the data, so there's nothing to checksum on the way through.
+			std::cout << "copy: --checksum can't be combined with --reflink=always.\n";
+			usage();
+			return EXIT_FAILURE;
+		}
+		
 		std::string caption("Copy took");
-		if (verify) {
+		if (options.mVerify) {
 			caption = "Copy & verify took";
 		}
+		if (options.mPhaseTimes) {
+			common::PhaseTimes::Enable();
+		}
 		CoutReporter reporter;
 		Timer t(reporter, caption);
-		return Copy(srcPath, destPath, verify);
+		int result = Copy(srcPath, destPath, options);
+		if (options.mPhaseTimes) {
+			common::PhaseTimes::Report(std::cout);
+		}
+		return result;
 	}
 	
 } // namespace copy_Impl
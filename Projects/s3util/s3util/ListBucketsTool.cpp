@@ -17,8 +17,8 @@
 //
 
 #include <iostream>
-#include <thread>
 #include "Hermit/S3/S3ListBuckets.h"
+#include "Common/Completion.h"
 #include "ListBucketsTool.h"
 #include "ReadKeyFile.h"
 
@@ -48,19 +48,16 @@ namespace s3util {
 		};
 		
 		//
-		class S3Completion : public hermit::s3::S3CompletionBlock {
+		class S3Completion : public hermit::s3::S3CompletionBlock, public common::Completion<hermit::s3::S3Result> {
 		public:
 			//
-			S3Completion() : mResult(hermit::s3::S3Result::kUnknown) {
+			S3Completion() : Completion(hermit::s3::S3Result::kUnknown) {
 			}
 			
 			//
 			virtual void Call(const hermit::HermitPtr& h_, const hermit::s3::S3Result& result) override {
-				mResult = result;
+				Signal(result);
 			}
-			
-			//
-			std::atomic<hermit::s3::S3Result> mResult;
 		};
 		
 		//
@@ -70,10 +67,7 @@ namespace s3util {
 				auto bucketNameReceiver = std::make_shared<BucketNameReceiver>();
 				auto completion = std::make_shared<S3Completion>();
 				hermit::s3::S3ListBuckets(h_, s3PublicKey, s3PrivateKey, bucketNameReceiver, completion);
-				while (completion->mResult == hermit::s3::S3Result::kUnknown) {
-					std::this_thread::sleep_for(std::chrono::milliseconds(10));
-				}
-				if (completion->mResult != hermit::s3::S3Result::kSuccess) {
+				if (completion->Wait() != hermit::s3::S3Result::kSuccess) {
 					std::cout << "list_buckets(): S3ListBuckets() failed.\n";
 					return EXIT_FAILURE;
 				}
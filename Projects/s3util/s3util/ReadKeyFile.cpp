@@ -17,31 +17,33 @@
 //
 
 #include <iostream>
-#include <thread>
 #include "Hermit/File/ReadFirstLineFromUTF8FilePath.h"
+#include "Common/Completion.h"
 #include "ReadKeyFile.h"
 
 namespace hermit {
 	namespace ReadKeyFile_Impl {
 		//
-		class Completion : public file::ReadFirstLineFromUTF8FilePathCompletion {
+		class Completion :
+		public file::ReadFirstLineFromUTF8FilePathCompletion,
+		public common::Completion<file::ReadFirstLineFromUTF8FilePathResult> {
 		public:
 			//
-			Completion() : mResult(file::ReadFirstLineFromUTF8FilePathResult::kUnknown) {
+			Completion() : common::Completion<file::ReadFirstLineFromUTF8FilePathResult>(file::ReadFirstLineFromUTF8FilePathResult::kUnknown) {
 			}
 			
 			//
 			virtual void Call(const HermitPtr& h_,
 							  const file::ReadFirstLineFromUTF8FilePathResult& result,
 							  const std::string& line) {
-				mResult = result;
 				if (result == file::ReadFirstLineFromUTF8FilePathResult::kSuccess) {
 					mLine = line;
 				}
+				// Signal last; it publishes mLine to the waiting thread.
+				Signal(result);
 			}
 			
 			//
-			std::atomic<file::ReadFirstLineFromUTF8FilePathResult> mResult;
 			std::string mLine;
 		};
 		
@@ -52,14 +54,12 @@ namespace hermit {
 	bool ReadKeyFile(const HermitPtr& h_, const char* pathToKeyFileUTF8, std::string& outKey) {
 		auto completion = std::make_shared<Completion>();
 		file::ReadFirstLineFromUTF8FilePath(h_, pathToKeyFileUTF8, completion);
-		while (completion->mResult == file::ReadFirstLineFromUTF8FilePathResult::kUnknown) {
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
-		}
-		if (completion->mResult == file::ReadFirstLineFromUTF8FilePathResult::kFileNotFound) {
+		auto result = completion->Wait();
+		if (result == file::ReadFirstLineFromUTF8FilePathResult::kFileNotFound) {
 			std::cout << "s3util: No key file found at path: " << pathToKeyFileUTF8 << "\n";
 			return false;
 		}
-		if (completion->mResult != file::ReadFirstLineFromUTF8FilePathResult::kSuccess) {
+		if (result != file::ReadFirstLineFromUTF8FilePathResult::kSuccess) {
 			std::cout << "s3util: Error reading key file at path: " << pathToKeyFileUTF8 << "\n";
 			return false;
 		}
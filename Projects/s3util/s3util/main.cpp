@@ -16,12 +16,14 @@
 //	along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+#include <iomanip>
 #include <iostream>
 #include <map>
+#include <sstream>
 #include <vector>
 #include "Hermit/Foundation/Notification.h"
 #include "Hermit/Utility/CommandLineTool.h"
-#include "Hermit/Utility/OperationTimer.h"
+#include "Common/PhaseTimer.h"
 #include "ListBucketsTool.h"
 
 namespace s3util {
@@ -113,21 +115,19 @@ namespace s3util {
 	class CoutReporter {
 	public:
 		//
-		void Report(const std::string& tag, const time_t& timeElapsed) {
+		void Report(const std::string& tag, double secondsElapsed) {
 			static const time_t oneMinute = 60;
 			static const time_t oneHour = 60 * oneMinute;
 			static const time_t oneDay = oneHour * 24;
 			static const time_t oneYear = oneDay * 365;
 			
-			time_t t = timeElapsed;
-			if (timeElapsed == 0) {
-				std::cout << tag << ": less than one second." << "\n";
-			}
-			else if (timeElapsed == 1) {
-				std::cout << tag << ": 1 second." << "\n";
-			}
-			else if (timeElapsed < 60) {
-				std::cout << tag << ": " << timeElapsed << " seconds." << "\n";
+			// Formatted on the side so std::cout's own settings are left alone.
+			std::ostringstream secondsStream;
+			secondsStream << std::fixed << std::setprecision(3) << secondsElapsed;
+			
+			time_t t = (time_t)secondsElapsed;
+			if (secondsElapsed < 60) {
+				std::cout << tag << ": " << secondsStream.str() << " seconds." << "\n";
 			}
 			else {
 				std::ostringstream formattedTimeStream;
@@ -179,13 +179,13 @@ namespace s3util {
 					formattedTimeStream << " ";
 				}
 				
-				std::cout << tag << ": " << formattedTimeStream.str() << "(" << timeElapsed << " seconds).\n";
+				std::cout << tag << ": " << formattedTimeStream.str() << "(" << secondsStream.str() << " seconds).\n";
 			}
 		}
 	};
 
 	//
-    typedef hermit::utility::OperationTimer<CoutReporter> Timer;
+    typedef common::ScopedTimer<CoutReporter> Timer;
 
 	//
 	int main(std::list<std::string> args) {